@@ -0,0 +1,161 @@
+//! Round trip benchmarks for the UDS diagnostic server, using the simulation channel
+//! so that only the time spent in the server thread and the channel plumbing is measured.
+//!
+//! Run with `cargo bench --features simulation`.
+//!
+//! Before handing over to criterion, this prints the p50/p99/p999 latency of single requests
+//! along with how many heap allocations each request makes.
+
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    sync::atomic::{AtomicUsize, Ordering},
+    time::{Duration, Instant},
+};
+
+use criterion::{black_box, criterion_group, BenchmarkId, Criterion, Throughput};
+use ecu_diagnostics::{
+    channel::IsoTPSettings,
+    hardware::simulation::SimulationIsoTpChannel,
+    uds::{UDSCommand, UdsCmd, UdsDiagnosticServer, UdsServerOptions, UdsVoidHandler},
+    DiagnosticServer,
+};
+
+/// Allocator that counts every allocation made by the process
+struct CountingAlloc;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for CountingAlloc {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAlloc = CountingAlloc;
+
+/// Read VIN request, and the simulated ECU's response to it
+const REQUEST: [u8; 3] = [0x22, 0xF1, 0x90];
+const RESPONSE: [u8; 20] = [
+    0x62, 0xF1, 0x90, b'W', b'D', b'B', b'2', b'1', b'1', b'0', b'2', b'2', b'1', b'A', b'1',
+    b'2', b'3', b'4', b'5', b'6',
+];
+
+/// Number of requests timed when reporting latency percentiles
+const LATENCY_SAMPLES: usize = 20_000;
+
+fn new_server() -> UdsDiagnosticServer {
+    let mut channel = SimulationIsoTpChannel::new();
+    channel.add_response(&REQUEST, &RESPONSE);
+
+    let server_options = UdsServerOptions {
+        send_id: 0x07E0,
+        recv_id: 0x07E8,
+        read_timeout_ms: 100,
+        write_timeout_ms: 100,
+        global_tp_id: 0x00,
+        tester_present_interval_ms: 2000,
+        tester_present_require_response: true,
+        p2_star_timeout_ms: 5000,
+        busy_repeat_delay_ms: 500,
+    };
+
+    let isotp_settings = IsoTPSettings {
+        block_size: 8,
+        st_min: 20,
+        extended_addressing: false,
+        pad_frame: true,
+        can_speed: 500_000,
+        can_use_ext_addr: false,
+        can_fd: false,
+        can_fd_brs: false,
+    };
+
+    UdsDiagnosticServer::new_over_iso_tp(server_options, channel, isotp_settings, UdsVoidHandler)
+        .expect("Could not start UDS server")
+}
+
+fn percentile(sorted: &[Duration], pct: f64) -> Duration {
+    let idx = ((sorted.len() as f64 * pct) as usize).min(sorted.len() - 1);
+    sorted[idx]
+}
+
+/// Prints a latency and allocation summary of single requests
+fn report_latency() {
+    let mut server = new_server();
+    let mut samples = Vec::with_capacity(LATENCY_SAMPLES);
+
+    // Warm up the server thread and channel
+    for _ in 0..1000 {
+        server.send_byte_array_with_response(&REQUEST).unwrap();
+    }
+
+    let allocs_before = ALLOCATIONS.load(Ordering::Relaxed);
+    let start = Instant::now();
+    for _ in 0..LATENCY_SAMPLES {
+        let t = Instant::now();
+        black_box(server.send_byte_array_with_response(&REQUEST).unwrap());
+        samples.push(t.elapsed());
+    }
+    let total = start.elapsed();
+    let allocs = ALLOCATIONS.load(Ordering::Relaxed) - allocs_before;
+
+    samples.sort_unstable();
+    println!("UDS round trip ({} requests)", LATENCY_SAMPLES);
+    println!("  p50:  {:?}", percentile(&samples, 0.50));
+    println!("  p99:  {:?}", percentile(&samples, 0.99));
+    println!("  p999: {:?}", percentile(&samples, 0.999));
+    println!(
+        "  requests/s: {:.0}",
+        LATENCY_SAMPLES as f64 / total.as_secs_f64()
+    );
+    println!(
+        "  allocations/request: {:.2}",
+        allocs as f64 / LATENCY_SAMPLES as f64
+    );
+}
+
+fn bench_single(c: &mut Criterion) {
+    let mut server = new_server();
+    let mut group = c.benchmark_group("uds_single");
+    group.throughput(Throughput::Elements(1));
+    group.bench_function("read_data_by_identifier", |b| {
+        b.iter(|| black_box(server.send_byte_array_with_response(&REQUEST).unwrap()))
+    });
+    group.finish();
+}
+
+fn bench_batch(c: &mut Criterion) {
+    let mut server = new_server();
+    let mut group = c.benchmark_group("uds_batch");
+    for size in [4usize, 16, 64] {
+        group.throughput(Throughput::Elements(size as u64));
+        group.bench_with_input(BenchmarkId::from_parameter(size), &size, |b, &size| {
+            b.iter(|| {
+                let cmds = (0..size)
+                    .map(|_| UdsCmd::new(UDSCommand::ReadDataByIdentifier, &REQUEST[1..], true))
+                    .collect();
+                black_box(server.execute_batch(cmds, true).unwrap())
+            })
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_single, bench_batch);
+
+fn main() {
+    report_latency();
+    benches();
+    Criterion::default().configure_from_args().final_summary();
+}
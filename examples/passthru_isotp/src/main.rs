@@ -53,6 +53,8 @@ fn main() {
         global_tp_id: 0,
         tester_present_interval_ms: 2000,
         tester_present_require_response: true,
+        p2_star_timeout_ms: 5000,
+        busy_repeat_delay_ms: 500,
     };
 
     let iso_tp_settings = IsoTPSettings {
@@ -62,6 +64,8 @@ fn main() {
         pad_frame: true,
         can_speed: 500000,
         can_use_ext_addr: false,
+        can_fd: false,
+        can_fd_brs: false,
     };
 
     let mut uds_server = match UdsDiagnosticServer::new_over_iso_tp(
@@ -41,6 +41,8 @@ fn main() {
         pad_frame: true,
         can_speed: 500000,
         can_use_ext_addr: false,
+        can_fd: false,
+        can_fd_brs: false,
     };
 
     let mut kwp_server: Kwp2000DiagnosticServer = match Kwp2000DiagnosticServer::new_over_iso_tp(
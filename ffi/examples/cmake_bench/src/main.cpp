@@ -0,0 +1,254 @@
+// Latency benchmark for the UDS FFI round trip.
+//
+// The UDS server talks to a loopback ISO-TP callback handler, which answers every
+// request with a positive response immediately. This means only the time spent in the
+// FFI layer, the callbacks and the server thread is measured.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "ecu_diagnostics_ffi.hpp"
+
+using namespace ecu_diagnostics;
+using bench_clock = std::chrono::steady_clock;
+
+static const uint32_t WARMUP_REQUESTS = 1000;
+static const uint32_t BENCH_REQUESTS = 20000;
+
+// Heap allocation counting. On glibc, malloc and friends can be replaced by the
+// executable, which catches allocations made by the Rust library as well as our own.
+static std::atomic<uint64_t> alloc_count(0);
+
+#if defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+#define ALLOC_COUNTING_SUPPORTED 1
+#else
+#define ALLOC_COUNTING_SUPPORTED 0
+#endif
+
+// Loopback channel state. Callbacks are only ever called from the server thread
+struct LoopbackChannel {
+    uint8_t pending[4096];
+    uint32_t pending_len;
+    bool has_pending;
+};
+
+CallbackHandlerResult loopback_ok(void *ctx) {
+    return CallbackHandlerResult::OK;
+}
+
+CallbackHandlerResult loopback_clear_rx(void *ctx) {
+    static_cast<LoopbackChannel *>(ctx)->has_pending = false;
+    return CallbackHandlerResult::OK;
+}
+
+CallbackHandlerResult loopback_set_ids(void *ctx, uint32_t send, uint32_t recv) {
+    return CallbackHandlerResult::OK;
+}
+
+CallbackHandlerResult loopback_set_cfg(void *ctx, IsoTPSettings cfg) {
+    return CallbackHandlerResult::OK;
+}
+
+// Answers every request with a positive response, echoing the request's arguments
+CallbackHandlerResult loopback_write(void *ctx, CallbackPayload tx, uint32_t timeout) {
+    LoopbackChannel *ch = static_cast<LoopbackChannel *>(ctx);
+    if (tx.data_len == 0 || tx.data_len > sizeof(ch->pending)) {
+        return CallbackHandlerResult::APIError;
+    }
+    memcpy(ch->pending, tx.data, tx.data_len);
+    ch->pending[0] += 0x40;
+    ch->pending_len = tx.data_len;
+    ch->has_pending = true;
+    return CallbackHandlerResult::OK;
+}
+
+// The library takes ownership of read data, so it must be allocated with malloc
+CallbackHandlerResult loopback_read(void *ctx, CallbackPayload *rx, uint32_t timeout) {
+    LoopbackChannel *ch = static_cast<LoopbackChannel *>(ctx);
+    if (!ch->has_pending) {
+        return CallbackHandlerResult::ReadTimeout;
+    }
+    uint8_t *data = static_cast<uint8_t *>(malloc(ch->pending_len));
+    memcpy(data, ch->pending, ch->pending_len);
+    rx->data = data;
+    rx->data_len = ch->pending_len;
+    ch->has_pending = false;
+    return CallbackHandlerResult::OK;
+}
+
+IsoTpChannelCallbackHandler loopback_handler(LoopbackChannel *ch) {
+    IsoTpChannelCallbackHandler handler = {};
+    handler.base.user_ctx = ch;
+    handler.base.open_callback = loopback_ok;
+    handler.base.close_callback = loopback_ok;
+    handler.base.clear_tx_callback = loopback_ok;
+    handler.base.clear_rx_callback = loopback_clear_rx;
+    handler.base.read_bytes_callback = loopback_read;
+    handler.base.write_bytes_callback = loopback_write;
+    handler.base.set_ids_callback = loopback_set_ids;
+    handler.set_iso_tp_cfg_callback = loopback_set_cfg;
+    return handler;
+}
+
+struct BenchResult {
+    std::vector<double> latencies_us;
+    double total_s;
+    uint64_t allocs;
+    uint32_t failures;
+};
+
+void print_result(const char *name, BenchResult &res) {
+    std::vector<double> &l = res.latencies_us;
+    std::sort(l.begin(), l.end());
+    auto pct = [&l](double p) {
+        size_t idx = std::min(l.size() - 1, (size_t)(l.size() * p));
+        return l[idx];
+    };
+    printf("%s (%u requests)\n", name, (unsigned)l.size());
+    printf("  p50:  %.2f us\n", pct(0.50));
+    printf("  p99:  %.2f us\n", pct(0.99));
+    printf("  p999: %.2f us\n", pct(0.999));
+    printf("  requests/s: %.0f\n", l.size() / res.total_s);
+    if (ALLOC_COUNTING_SUPPORTED) {
+        printf("  allocations/request: %.2f\n", (double)res.allocs / l.size());
+    } else {
+        printf("  allocations/request: n/a on this platform\n");
+    }
+    if (res.failures != 0) {
+        printf("  FAILED requests: %u\n", res.failures);
+    }
+}
+
+// Prints the server's own view of where time was spent
+void print_metrics(const ServerMetricsSnapshot &m) {
+    if (m.requests == 0) {
+        return;
+    }
+    printf("  server metrics: %llu requests, avg queue wait %.2f us, avg write %.2f us, avg first response %.2f us (max %llu us)\n",
+           (unsigned long long)m.requests,
+           (double)m.queue_wait_us / m.requests,
+           (double)m.write_time_us / m.requests,
+           m.responses == 0 ? 0.0 : (double)m.first_response_us / m.responses,
+           (unsigned long long)m.max_first_response_us);
+    printf("  server metrics: %llu response pending, %llu busy repeat, %llu timeouts\n",
+           (unsigned long long)m.response_pending,
+           (unsigned long long)m.busy_repeat,
+           (unsigned long long)m.timeouts);
+}
+
+// Runs `request` (Which returns true on success) the configured number of times
+template <typename F>
+BenchResult run_bench(F request) {
+    for (uint32_t i = 0; i < WARMUP_REQUESTS; i++) {
+        request();
+    }
+    BenchResult res = {};
+    res.latencies_us.reserve(BENCH_REQUESTS);
+    uint64_t allocs_before = alloc_count.load();
+    auto start = bench_clock::now();
+    for (uint32_t i = 0; i < BENCH_REQUESTS; i++) {
+        auto t = bench_clock::now();
+        if (!request()) {
+            res.failures++;
+        }
+        res.latencies_us.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - t).count());
+    }
+    res.total_s = std::chrono::duration<double>(bench_clock::now() - start).count();
+    // Don't count the allocations made by pushing latencies (reserved above)
+    res.allocs = alloc_count.load() - allocs_before;
+    return res;
+}
+
+int main() {
+    IsoTPSettings opts = {};
+    opts.block_size = 8;
+    opts.can_speed = 500000;
+    opts.pad_frame = true;
+    opts.st_min = 20;
+
+    UdsServerOptions server_opts = {};
+    server_opts.send_id = 0x07E0;
+    server_opts.recv_id = 0x07E8;
+    server_opts.read_timeout_ms = 100;
+    server_opts.write_timeout_ms = 100;
+    server_opts.tester_present_interval_ms = 2000;
+    server_opts.tester_present_require_response = true;
+    server_opts.p2_star_timeout_ms = 5000;
+    server_opts.busy_repeat_delay_ms = 500;
+
+    uint8_t did[2] = {0xF1, 0x90};
+
+    // Legacy single server API, where the library allocates every response
+    LoopbackChannel legacy_ch = {};
+    register_isotp_callback(loopback_handler(&legacy_ch));
+    if (create_uds_server_over_isotp(server_opts, opts) != DiagServerResult::OK) {
+        printf("Could not start legacy UDS server\n");
+        return 1;
+    }
+    BenchResult legacy = run_bench([&did]() {
+        UdsPayload p = {};
+        p.sid.tag = UDSCommand::Tag::ReadDataByIdentifier;
+        p.args_len = sizeof(did);
+        p.args_ptr = did;
+        bool ok = send_payload_uds(&p, true) == DiagServerResult::OK;
+        if (ok) {
+            free_uds_payload_response(&p);
+        }
+        return ok;
+    });
+    destroy_uds_server();
+    destroy_isotp_callback();
+    print_result("send_payload_uds", legacy);
+
+    // Handle based API, writing responses into a caller owned buffer
+    LoopbackChannel handle_ch = {};
+    UdsServerHandle *handle = nullptr;
+    if (create_uds_server_handle_over_isotp(server_opts, opts, loopback_handler(&handle_ch), &handle) != DiagServerResult::OK) {
+        printf("Could not start UDS server handle\n");
+        return 1;
+    }
+    uint8_t resp_buf[64];
+    BenchResult into = run_bench([&did, &resp_buf, handle]() {
+        UdsPayload p = {};
+        p.sid.tag = UDSCommand::Tag::ReadDataByIdentifier;
+        p.args_len = sizeof(did);
+        p.args_ptr = did;
+        uint32_t resp_len = 0;
+        return send_payload_uds_handle_into(handle, &p, true, resp_buf, sizeof(resp_buf), &resp_len) == DiagServerResult::OK;
+    });
+    UdsMetricsHandle *metrics_handle = create_uds_metrics_handle(handle);
+    destroy_uds_server_handle(handle);
+    // The metrics outlive the server
+    ServerMetricsSnapshot metrics = {};
+    read_uds_metrics(metrics_handle, &metrics);
+    destroy_uds_metrics_handle(metrics_handle);
+    print_result("send_payload_uds_handle_into", into);
+    print_metrics(metrics);
+
+    return (legacy.failures == 0 && into.failures == 0) ? 0 : 1;
+}
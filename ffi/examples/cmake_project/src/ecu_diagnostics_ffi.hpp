@@ -9,6 +9,22 @@
 
 namespace ecu_diagnostics {
 
+/// Longest name a [DTC] can have (A u32 in decimal)
+constexpr static const uintptr_t DTC_NAME_MAX_LEN = 10;
+
+/// Maximum length of an [ObdPidValue] name, including the NUL terminator
+constexpr static const uintptr_t OBD_VALUE_NAME_MAX_LEN = 64;
+
+/// Maximum length of a [PassthruDeviceInfo] string, including the NUL terminator
+/// (Requires the `passthru` feature)
+constexpr static const uintptr_t PASSTHRU_INFO_STR_MAX_LEN = 260;
+
+/// Maximum number of data bytes stored per periodic sample (Not including the periodic identifier)
+constexpr static const uintptr_t PERIODIC_SAMPLE_MAX_LEN = 62;
+
+/// Maximum number of values a single PID decodes to with [DataPid::decode_scaled]
+constexpr static const uintptr_t SCALED_PID_MAX_VALUES = 4;
+
 /// Callback handler result
 enum class CallbackHandlerResult {
   /// Everything OK
@@ -23,7 +39,56 @@ enum class CallbackHandlerResult {
   CallbackAlreadyExists = 5,
 };
 
+/// Unit type of an [ObdPidValue]
+enum class ObdValueUnit {
+  /// Raw number
+  Raw,
+  /// Speed. Metric is km/h, imperial is mph
+  Speed,
+  /// Percentage
+  Percent,
+  /// Temperature. Metric is celsius, imperial is fahrenheit
+  Temperature,
+  /// RPM
+  Rpm,
+  /// Volts
+  Volts,
+  /// Time in seconds
+  Time,
+  /// Distance. Metric is km, imperial is miles
+  Distance,
+  /// Pressure. Metric is kPa, imperial is psi
+  Pressure,
+  /// Encoded enumeration value. The value is the raw enumeration value
+  Encoded,
+  /// Bit encoded byte array. The value is always 0
+  ByteArray,
+};
+
 /// FFI Diagnostic server response codes
+/// Rate at which the ECU sends periodic data identifiers. The actual rates are defined by the ECU
+enum class PeriodicTransmissionMode {
+  /// Send at the ECU's slow rate
+  SendAtSlowRate,
+  /// Send at the ECU's medium rate
+  SendAtMediumRate,
+  /// Send at the ECU's fast rate
+  SendAtFastRate,
+  /// Stop sending
+  StopSending,
+};
+
+/// Distribution the response times of a simulated ECU are drawn from, see [SimulatedResponseTime]
+enum class SimulatedResponseTimeKind {
+  /// Always respond after `min_us`
+  Fixed,
+  /// Respond after a time evenly distributed between `min_us` and `max_us`
+  Uniform,
+  /// Respond after at least `min_us`, plus an exponentially distributed extra time with
+  /// an average of `mean_extra_us`. This gives the long tail real ECUs have under load
+  LongTail,
+};
+
 enum class DiagServerResult {
   /// Operation OK
   OK = 0,
@@ -43,6 +108,15 @@ enum class DiagServerResult {
   ServerAlreadyRunning = 7,
   /// No diagnostic server to register the request. Call
   NoDiagnosticServer = 8,
+  /// Parameter provided to a subfunction was invalid
+  ParameterInvalid = 9,
+  HardwareError = 10,
+  /// Response buffer provided by the caller is too small to hold the ECU's response.
+  /// The required length is written back to the caller
+  BufferTooSmall = 11,
+  /// The request carrying this and other parameters failed. The result of the first
+  /// parameter of the request holds its error
+  BatchedRequestFailed = 12,
   /// ECU responded with an error, call [get_ecu_error_code]
   /// to retrieve the NRC from the ECU
   ECUError = 98,
@@ -52,41 +126,56 @@ enum class DiagServerResult {
   Todo = 100,
 };
 
-/// UDS Command Service IDs
-enum class UDSCommand : uint8_t {
-  /// Diagnostic session control. See [diagnostic_session_control]
-  DiagnosticSessionControl = 16,
-  /// ECU Reset. See [ecu_reset]
-  ECUReset = 17,
-  /// Security access. See [security_access]
-  SecurityAccess = 39,
-  /// Controls communication functionality of the ECU
-  CommunicationControl = 40,
-  /// Tester present command.
-  TesterPresent = 62,
-  AccessTimingParameters = 131,
-  SecuredDataTransmission = 132,
-  ControlDTCSettings = 133,
-  ResponseOnEvent = 134,
-  LinkControl = 135,
-  ReadDataByIdentifier = 34,
-  ReadMemoryByAddress = 35,
-  ReadScalingDataByIdentifier = 36,
-  ReadDataByPeriodicIdentifier = 42,
-  DynamicallyDefineDataIdentifier = 44,
-  WriteDataByIdentifier = 46,
-  WriteMemoryByAddress = 61,
-  ClearDiagnosticInformation = 20,
-  /// Reading and querying diagnostic trouble codes
-  /// stored on the ECU. See [read_dtc_information]
-  ReadDTCInformation = 25,
-  InputOutputControlByIdentifier = 47,
-  RoutineControl = 49,
-  RequestDownload = 52,
-  RequestUpload = 53,
-  TransferData = 54,
-  RequestTransferExit = 55,
-};
+/// Keep-alive scheduler shared by every diagnostic server on one bus, created with
+/// [create_keep_alive_scheduler]
+struct KeepAliveScheduler;
+
+/// Opaque handle to a functional OBD2 client, which talks to every ECU at once over a raw CAN channel
+struct Obd2FunctionalHandle;
+
+/// Opaque handle to a running OBD2 diagnostic server
+struct Obd2ServerHandle;
+
+/// Simulated ECU, which answers requests by prefix matching rules, and models how long
+/// a real ECU and the ISO-TP transfers to and from it take.
+///
+/// Only available when the library is built with the `simulation` feature
+struct SimulatedEcu;
+
+/// Opaque handle to the metrics of a UDS server, created with [create_uds_metrics_handle].
+///
+/// Unlike the server's own handle, this can be used from any thread whilst requests are in progress.
+/// It stays valid (But stops updating) once the server is destroyed
+struct UdsMetricsHandle;
+
+/// Opaque handle to a running UDS diagnostic server
+struct UdsServerHandle;
+
+/// Consumer of an active periodic data stream, created by [start_periodic_stream_uds_handle]
+struct PeriodicDataStream;
+
+/// Converter for the live values of one data identifier, compiled once from its
+/// ReadScalingDataByIdentifier response.
+///
+/// Unlike [ScalingData], the scaling bytes are only parsed once, so whole buffers of
+/// raw samples can be converted in one call
+struct ScalingConverter;
+
+/// Callback for requests submitted with [submit_payload_uds_handle]
+///
+/// ## Parameters
+/// * user_ctx - Context pointer given to [register_uds_completion_callback]
+/// * request_id - ID of the completed request, as returned by [submit_payload_uds_handle]
+/// * result - Result of the request
+/// * ecu_error - The ECUs negative response code if `result` is [DiagServerResult::ECUError]
+/// * resp - The ECUs response, beginning with SID + 0x40. This is only valid until the callback returns
+/// * resp_len - Length of `resp`
+using UdsCompletionCallback = void(*)(void *user_ctx,
+                                      uint32_t request_id,
+                                      DiagServerResult result,
+                                      uint8_t ecu_error,
+                                      const uint8_t *resp,
+                                      uint32_t resp_len);
 
 /// Callback handler payload
 struct CallbackPayload {
@@ -99,37 +188,66 @@ struct CallbackPayload {
 };
 
 /// Callback handler for base channel to allow access via FFI
+///
+/// Every callback is given `user_ctx` as its first argument, so one set of
+/// callbacks can serve multiple channels (For example, one per ECU).
 struct BaseChannelCallbackHandler {
+  /// User context pointer passed to every callback. The library never dereferences this.
+  void *user_ctx;
   /// Callback when [BaseChannel::open] is called
-  CallbackHandlerResult (*open_callback)();
+  CallbackHandlerResult (*open_callback)(void *user_ctx);
   /// Callback when [BaseChannel::close] is called
-  CallbackHandlerResult (*close_callback)();
+  CallbackHandlerResult (*close_callback)(void *user_ctx);
   /// Callback when [BaseChannel::write_bytes] is called
-  CallbackHandlerResult (*write_bytes_callback)(CallbackPayload write_payload, uint32_t write_timeout_ms);
+  CallbackHandlerResult (*write_bytes_callback)(void *user_ctx,
+                                                CallbackPayload write_payload,
+                                                uint32_t write_timeout_ms);
   /// Callback when [BaseChannel::read_bytes] is called
-  CallbackHandlerResult (*read_bytes_callback)(CallbackPayload *read_payload, uint32_t read_timeout_ms);
+  CallbackHandlerResult (*read_bytes_callback)(void *user_ctx,
+                                               CallbackPayload *read_payload,
+                                               uint32_t read_timeout_ms);
   /// Callback when [BaseChannel::clear_tx_buffer] is called
-  CallbackHandlerResult (*clear_tx_callback)();
+  CallbackHandlerResult (*clear_tx_callback)(void *user_ctx);
   /// Callback when [BaseChannel::clear_rx_buffer] is called
-  CallbackHandlerResult (*clear_rx_callback)();
+  CallbackHandlerResult (*clear_rx_callback)(void *user_ctx);
   /// Callback when [BaseChannel::set_ids] is called
-  CallbackHandlerResult (*set_ids_callback)(uint32_t send, uint32_t recv);
+  CallbackHandlerResult (*set_ids_callback)(void *user_ctx, uint32_t send, uint32_t recv);
 };
 
-/// ISO-TP configuration options
+/// ISO-TP configuration options (ISO15765-2)
 struct IsoTPSettings {
-  /// Block size
+  /// ISO-TP Block size
+  ///
+  /// This value indicates the number of CAN Frames to send in multi-frame messages,
+  /// before sending or receiving a flow control message.
+  ///
+  /// A value of 0 indicates send everything without flow control messages.
+  ///
+  /// NOTE: This value might be overridden by the device's implementation of ISO-TP
   uint8_t block_size;
-  /// Minimum separation time between CAN Frames (In milliseconds)
+  /// Minimum separation time between Tx/Rx CAN Frames.
+  ///
+  /// 3 ranges are accepted for this value:
+  /// * 0x00 - Send without delay (ECU/Adapter will send frames as fast as the physical bus allows).
+  /// * 0x01-0x7F - Send with delay of 1-127 milliseconds between can frames
+  /// * 0xF1-0xF9 - Send with delay of 100-900 microseconds between can frames
+  ///
+  /// NOTE: This value might be overridden by the device's implementation of ISO-TP
   uint8_t st_min;
   /// Use extended ISO-TP addressing
   bool extended_addressing;
-  /// Pad frames over ISO-TP if data size < 8
+  /// Pad frames over ISO-TP if data size is less than 8.
   bool pad_frame;
   /// Baud rate of the CAN Network
   uint32_t can_speed;
   /// Does the CAN Network support extended addressing (29bit) or standard addressing (11bit)
   bool can_use_ext_addr;
+  /// Send and receive ISO-TP frames as CAN-FD frames of up to 64 bytes, rather than
+  /// classic 8 byte CAN frames. Both the ECU and the adapter must support CAN-FD
+  bool can_fd;
+  /// Send the data phase of CAN-FD frames at the data bit rate (Bit rate switch).
+  /// Only used if `can_fd` is set
+  bool can_fd_brs;
 };
 
 /// Callback handler for [IsoTPChannel]
@@ -137,7 +255,163 @@ struct IsoTpChannelCallbackHandler {
   /// Base handler
   BaseChannelCallbackHandler base;
   /// Callback when [IsoTPChannel::set_iso_tp_cfg] is called
-  CallbackHandlerResult (*set_iso_tp_cfg_callback)(IsoTPSettings cfg);
+  CallbackHandlerResult (*set_iso_tp_cfg_callback)(void *user_ctx, IsoTPSettings cfg);
+};
+
+/// CAN Frame
+struct CanFrame {
+  /// CAN ID
+  uint32_t id;
+  /// Number of valid bytes in `data`
+  uint8_t dlc;
+  /// Frame data
+  uint8_t data[8];
+  /// Non zero if the frame uses extended (29bit) addressing
+  uint8_t ext;
+};
+
+/// Callback handler for [CanChannel], for sending and receiving raw CAN frames
+///
+/// Frames are passed in batches, so that a single callback can move a whole
+/// batch to or from the hardware at once.
+struct CanChannelCallbackHandler {
+  /// User context pointer passed to every callback. The library never dereferences this.
+  void *user_ctx;
+  /// Callback when [PacketChannel::open] is called
+  CallbackHandlerResult (*open_callback)(void *user_ctx);
+  /// Callback when [PacketChannel::close] is called
+  CallbackHandlerResult (*close_callback)(void *user_ctx);
+  /// Callback when [PacketChannel::write_packets] is called. All `frame_count` frames
+  /// should be written before returning. `frames` is only valid until the callback returns
+  CallbackHandlerResult (*write_frames_callback)(void *user_ctx,
+                                                 const CanFrame *frames,
+                                                 uint32_t frame_count,
+                                                 uint32_t write_timeout_ms);
+  /// Callback when [PacketChannel::read_packets_into] is called. Up to `capacity` frames
+  /// should be written into `frames`, and `read_count` set to the number of frames written
+  CallbackHandlerResult (*read_frames_callback)(void *user_ctx,
+                                                CanFrame *frames,
+                                                uint32_t capacity,
+                                                uint32_t *read_count,
+                                                uint32_t read_timeout_ms);
+  /// Callback when [PacketChannel::clear_tx_buffer] is called
+  CallbackHandlerResult (*clear_tx_callback)(void *user_ctx);
+  /// Callback when [PacketChannel::clear_rx_buffer] is called
+  CallbackHandlerResult (*clear_rx_callback)(void *user_ctx);
+  /// Callback when [CanChannel::set_can_cfg] is called
+  CallbackHandlerResult (*set_can_cfg_callback)(void *user_ctx, uint32_t baud, bool use_extended);
+};
+
+/// Settings for [Obd2FunctionalClient]
+struct Obd2FunctionalOptions {
+  /// Functional request ID. 0x7DF for 11bit CAN, 0x18DB33F1 for 29bit CAN
+  uint32_t request_id;
+  /// Lowest ID an ECU can respond with. 0x7E8 for 11bit CAN, 0x18DAF100 for 29bit CAN
+  uint32_t response_id_min;
+  /// Highest ID an ECU can respond with. 0x7EF for 11bit CAN, 0x18DAF1FF for 29bit CAN
+  uint32_t response_id_max;
+  /// Time in ms to collect responses for after sending the request. ISO 15765-4 allows
+  /// ECUs 50ms (P2) to respond
+  uint32_t window_ms;
+  /// Time in ms to keep waiting for an ECU that responded with response pending (P2*)
+  uint32_t pending_timeout_ms;
+  /// Write timeout in ms
+  uint32_t write_timeout_ms;
+  /// Baud rate of the CAN Network
+  uint32_t can_speed;
+  /// Pad frames to 8 bytes
+  bool pad_frame;
+};
+
+/// Response of one ECU to [send_functional_obd2_handle]
+struct ObdFunctionalResponse {
+  /// Set to the CAN ID the ECU responded with
+  uint32_t responder_id;
+  /// Set to the result of the ECU's response
+  DiagServerResult result;
+  /// Set to the ECUs negative response code if `result` is [DiagServerResult::ECUError]
+  uint8_t ecu_error;
+  /// Caller owned buffer to write the ECUs response into.
+  /// The response will begin with SID + 0x40
+  uint8_t *resp_buf;
+  /// Capacity of `resp_buf` in bytes
+  uint32_t resp_buf_len;
+  /// Set to the length of the ECUs response
+  uint32_t resp_len;
+};
+
+/// OBD2 server options
+struct Obd2ServerOptions {
+  /// ECU Send ID
+  uint32_t send_id;
+  /// ECU Receive ID
+  uint32_t recv_id;
+  /// Read timeout in ms
+  uint32_t read_timeout_ms;
+  /// Write timeout in ms
+  uint32_t write_timeout_ms;
+};
+
+/// One decoded value of a PID read with [query_pids_obd2_handle].
+/// Some PIDs return more than one value
+struct ObdPidValue {
+  /// PID the value belongs to
+  uint8_t pid;
+  /// Unit type of the value
+  ObdValueUnit unit;
+  /// Value in metric form
+  float metric_value;
+  /// Value in imperial form
+  float imperial_value;
+  /// NUL terminated name of the value. Names longer than the buffer are truncated
+  char name[OBD_VALUE_NAME_MAX_LEN];
+};
+
+/// Values of one PID read with [query_pids_scaled_obd2_handle], in metric units.
+/// The name and unit of each value are looked up separately with [get_obd_scaled_value_info]
+struct ObdScaledPidValues {
+  /// PID the values belong to
+  uint8_t pid;
+  /// Number of values set in `values`
+  uint8_t value_count;
+  /// Decoded values of the PID
+  float values[SCALED_PID_MAX_VALUES];
+};
+
+/// Installed Passthru adapter, found by [get_passthru_devices]
+/// (Requires the `passthru` feature)
+struct PassthruDeviceInfo {
+  /// NUL terminated name of the adapter
+  char name[PASSTHRU_INFO_STR_MAX_LEN];
+  /// NUL terminated vendor of the adapter
+  char vendor[PASSTHRU_INFO_STR_MAX_LEN];
+  /// NUL terminated path of the adapter's function library
+  char library_location[PASSTHRU_INFO_STR_MAX_LEN];
+  /// Adapter supports ISO-TP
+  bool iso_tp;
+  /// Adapter supports raw CAN
+  bool can;
+  /// Adapter supports ISO9141 (K-Line)
+  bool kline;
+  /// Adapter supports ISO14230 (KWP2000 over K-Line)
+  bool kline_kwp;
+  /// Adapter supports SAE J1850
+  bool sae_j1850;
+  /// Adapter supports SCI
+  bool sci;
+};
+
+/// Response time of a simulated ECU. This is the time the ECU takes to process a request,
+/// not including ISO-TP transfer times. Fields which `kind` does not use are ignored
+struct SimulatedResponseTime {
+  /// Distribution of the response times
+  SimulatedResponseTimeKind kind;
+  /// Shortest response time in microseconds
+  uint32_t min_us;
+  /// Longest response time in microseconds. Only used by [SimulatedResponseTimeKind::Uniform]
+  uint32_t max_us;
+  /// Average time added to `min_us` in microseconds. Only used by [SimulatedResponseTimeKind::LongTail]
+  uint32_t mean_extra_us;
 };
 
 /// UDS server options
@@ -146,7 +420,8 @@ struct UdsServerOptions {
   uint32_t send_id;
   /// ECU Receive ID
   uint32_t recv_id;
-  /// Read timeout in ms
+  /// Read timeout in ms. This is how long the server waits for the ECU's first
+  /// response to a request (P2)
   uint32_t read_timeout_ms;
   /// Write timeout in ms
   uint32_t write_timeout_ms;
@@ -157,6 +432,61 @@ struct UdsServerOptions {
   uint32_t tester_present_interval_ms;
   /// Configures if the diagnostic server will poll for a response from tester present.
   bool tester_present_require_response;
+  /// Maximum time in ms to wait for the ECU's next response, after it has responded with
+  /// [UDSError::RequestCorrectlyReceivedResponsePending] (P2*). The UDS default is 5000ms
+  uint32_t p2_star_timeout_ms;
+  /// Time in ms to wait before repeating a request that the ECU rejected with
+  /// [UDSError::BusyRepeatRequest]
+  uint32_t busy_repeat_delay_ms;
+};
+
+/// UDS Command Service IDs
+union UDSCommand {
+  enum class Tag : uint8_t {
+    /// Diagnostic session control. See [diagnostic_session_control]
+    DiagnosticSessionControl,
+    /// ECU Reset. See [ecu_reset]
+    ECUReset,
+    /// Security access. See [security_access]
+    SecurityAccess,
+    /// Controls communication functionality of the ECU
+    CommunicationControl,
+    /// Tester present command.
+    TesterPresent,
+    AccessTimingParameters,
+    SecuredDataTransmission,
+    ControlDTCSettings,
+    ResponseOnEvent,
+    LinkControl,
+    ReadDataByIdentifier,
+    ReadMemoryByAddress,
+    ReadScalingDataByIdentifier,
+    ReadDataByPeriodicIdentifier,
+    DynamicallyDefineDataIdentifier,
+    WriteDataByIdentifier,
+    WriteMemoryByAddress,
+    ClearDiagnosticInformation,
+    /// Reading and querying diagnostic trouble codes
+    /// stored on the ECU. See [read_dtc_information]
+    ReadDTCInformation,
+    InputOutputControlByIdentifier,
+    RoutineControl,
+    RequestDownload,
+    RequestUpload,
+    TransferData,
+    RequestTransferExit,
+    Other,
+  };
+
+  struct Other_Body {
+    Tag tag;
+    uint8_t _0;
+  };
+
+  struct {
+    Tag tag;
+  };
+  Other_Body other;
 };
 
 /// Payload to send to the UDS server
@@ -169,18 +499,704 @@ struct UdsPayload {
   uint8_t *args_ptr;
 };
 
+/// One request of a batch sent with [send_batch_uds_handle]
+struct UdsBatchItem {
+  /// Payload to send to the ECU. This is never modified
+  UdsPayload payload;
+  /// If set to false, no response will be read from the ECU for this request
+  bool response_require;
+  /// Caller owned buffer to write the ECUs response into.
+  /// The response will begin with SID + 0x40
+  uint8_t *resp_buf;
+  /// Capacity of `resp_buf` in bytes
+  uint32_t resp_buf_len;
+  /// Set to the length of the ECUs response
+  uint32_t resp_len;
+  /// Set to the result of this request
+  DiagServerResult result;
+  /// Set to the ECUs negative response code if `result` is [DiagServerResult::ECUError]
+  uint8_t ecu_error;
+};
+
+/// One ECU to read DTCs from with [sweep_dtcs_uds_handles]
+struct UdsDtcSweepTarget {
+  /// Server for the ECU. A handle can only be used by one target of a sweep
+  UdsServerHandle *handle;
+  /// Adapter the server communicates through. Targets with the same adapter share
+  /// its concurrency limit. This is only used to group targets, so can be any value
+  uint32_t adapter;
+  /// Set to the result of reading this ECU's DTCs
+  DiagServerResult result;
+  /// Set to the ECUs negative response code if `result` is [DiagServerResult::ECUError]
+  uint8_t ecu_error;
+  /// Set to the number of DTCs the ECU reported
+  uint32_t dtc_count;
+};
+
+/// Diagnostic trouble code, as read from a UDS ECU
+struct UdsDtc {
+  /// The raw value of the DTC according to the ECU
+  uint32_t raw;
+  /// Status byte of the DTC according to the ECU
+  uint8_t status;
+  /// Indication if the DTC turns on the MIL lamp
+  bool mil_on;
+  /// DTC format identifier reported by the ECU (0x00 ISO15031-6, 0x01 ISO14229-1,
+  /// 0x02 SAE J1939-73, 0x03 ISO11992-4). 0xFE if the ECU did not report it, and
+  /// 0xFF marks a 2 byte KWP2000 DTC. Both are reserved in ISO14229 so never reported by an ECU
+  uint8_t format;
+};
+
+/// DTC read by [sweep_dtcs_uds_handles], along with the ECU it came from
+struct UdsSweepDtc {
+  /// Send ID of the ECU's server
+  uint32_t send_id;
+  /// Receive ID of the ECU's server
+  uint32_t recv_id;
+  /// The DTC
+  UdsDtc dtc;
+};
+
+/// Copy of [ServerMetrics] at a point in time.
+///
+/// All times are totals over every request since the server started (or
+/// since the last [ServerMetrics::reset]), divide by the matching count to get averages.
+struct ServerMetricsSnapshot {
+  /// Number of requests executed by the server
+  uint64_t requests;
+  /// Total time in microseconds requests spent queued, before the server started executing them
+  uint64_t queue_wait_us;
+  /// Total time in microseconds spent writing requests to the channel
+  uint64_t write_time_us;
+  /// Total time in microseconds between a request being written, and the ECU's first
+  /// response to it (Including response pending replies)
+  uint64_t first_response_us;
+  /// Longest time in microseconds the ECU took to give its first response to a request
+  uint64_t max_first_response_us;
+  /// Number of requests that received a first response. This is the count for `first_response_us`
+  uint64_t responses;
+  /// Number of response pending (0x78) replies received
+  uint64_t response_pending;
+  /// Number of busy repeat request (0x21) replies received, each of which caused the request to be sent again
+  uint64_t busy_repeat;
+  /// Number of requests the ECU did not respond to in time
+  uint64_t timeouts;
+};
+
+/// One periodic data identifier sent by the ECU
+struct PeriodicSample {
+  /// Time the sample was received, in microseconds since the stream was started
+  uint64_t timestamp_us;
+  /// Periodic data identifier (The low byte of data identifier 0xF2xx)
+  uint8_t periodic_id;
+  /// Number of valid bytes in `data`
+  uint8_t len;
+  /// Sample data. Data longer than [PERIODIC_SAMPLE_MAX_LEN] is truncated
+  uint8_t data[PERIODIC_SAMPLE_MAX_LEN];
+};
+
+/// Settings for [UdsDiagnosticServer::download]
+struct DownloadOptions {
+  /// ECU memory address to download the image to
+  uint64_t memory_address;
+  /// Number of bytes to encode the memory address with (1-8)
+  uint8_t address_len;
+  /// Number of bytes to encode the image size with (1-8)
+  uint8_t size_len;
+  /// Data format identifier. The high nibble is the compression method, and the
+  /// low nibble is the encryption method. 0x00 is neither compressed nor encrypted
+  uint8_t data_format;
+  /// Longest TransferData request to send, including the SID and block sequence counter.
+  /// If 0, the ECU's maximum is used, otherwise the smaller of the two is used
+  uint32_t max_block_len;
+};
+
+/// Progress of a download
+struct TransferProgress {
+  /// Number of image bytes the ECU has acknowledged
+  uint64_t bytes_sent;
+  /// Size of the image in bytes
+  uint64_t total_bytes;
+  /// Time since the first block was sent, in microseconds
+  uint64_t elapsed_us;
+  /// Number of TransferData blocks the ECU has acknowledged
+  uint32_t blocks_sent;
+};
+
+/// Callback for the progress of [download_uds_handle]. This is called on the thread
+/// that called [download_uds_handle]
+///
+/// ## Parameters
+/// * user_ctx - Context pointer given to [download_uds_handle]
+/// * progress - Progress of the download. The throughput in bytes per second is
+/// `bytes_sent * 1000000 / elapsed_us`
+using UdsTransferProgressCallback = void(*)(void *user_ctx, const TransferProgress *progress);
+
 extern "C" {
 
+/// Gets the last ECU negative response code
+///
+/// When using server handles, prefer [uds::get_ecu_error_code_handle], as this value
+/// is shared between all servers
+uint8_t get_ecu_error_code();
+
+/// Creates a new OBD2 diagnostic server using an ISO-TP callback handler, and returns a handle to it
+///
+/// ## Parameters
+/// * settings - OBD2 Server settings
+/// * iso_tp_opts - ISO-TP settings to configure the channel with
+/// * callbacks - Callback handler for the servers channel
+/// * handle - Set to the new server handle if creation was successful
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the server was created. The handle must be freed with [destroy_obd2_server_handle]
+DiagServerResult create_obd2_server_handle_over_isotp(Obd2ServerOptions settings,
+                                                      IsoTPSettings iso_tp_opts,
+                                                      IsoTpChannelCallbackHandler callbacks,
+                                                      Obd2ServerHandle **handle);
+
+/// Reads many Service 01 PIDs from the ECU behind `handle`, packing up to 6 PIDs into each request
+///
+/// Every value is decoded along with its name. To sample scaled PIDs at a high rate,
+/// use [query_pids_scaled_obd2_handle] instead.
+///
+/// ## Parameters
+/// * pids - PIDs to read
+/// * pid_count - Number of PIDs in `pids`
+/// * results - Array of `pid_count` results, set to the result of each PID
+/// * values - Buffer to write the decoded values of every successful PID into, in the order of `pids`
+/// * value_capacity - Number of values `values` can hold
+/// * value_count - Set to the number of decoded values. If [DiagServerResult::BufferTooSmall]
+/// is returned, this is the capacity required
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the results were written, even if individual PIDs failed
+DiagServerResult query_pids_obd2_handle(Obd2ServerHandle *handle,
+                                        const uint8_t *pids,
+                                        uint32_t pid_count,
+                                        DiagServerResult *results,
+                                        ObdPidValue *values,
+                                        uint32_t value_capacity,
+                                        uint32_t *value_count);
+
+/// Reads many scaled Service 01 PIDs from the ECU behind `handle`, packing up to 6 PIDs into each request.
+///
+/// Unlike [query_pids_obd2_handle], no names are decoded or copied, so this is the one to use
+/// for sampling PIDs at a high rate.
+///
+/// ## Parameters
+/// * pids - PIDs to read. PIDs which are not scaled numbers are not requested, and return [DiagServerResult::ParameterInvalid]
+/// * pid_count - Number of PIDs in `pids`
+/// * results - Array of `pid_count` results, set to the result of each PID
+/// * values - Array of `pid_count` values, set to the values of each successful PID
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the results were written, even if individual PIDs failed
+DiagServerResult query_pids_scaled_obd2_handle(Obd2ServerHandle *handle,
+                                               const uint8_t *pids,
+                                               uint32_t pid_count,
+                                               DiagServerResult *results,
+                                               ObdScaledPidValues *values);
+
+/// Looks up the name and unit of a value read with [query_pids_scaled_obd2_handle]
+///
+/// ## Parameters
+/// * pid - PID the value belongs to
+/// * idx - Index of the value in [ObdScaledPidValues::values]
+/// * unit - Set to the unit of the value
+/// * name - Buffer to write the NUL terminated name of the value into, or null. Names longer than the buffer are truncated
+/// * name_len - Capacity of `name`
+///
+/// ## Returns
+/// [DiagServerResult::ParameterInvalid] if the PID is not a scaled number, or has no value `idx`
+DiagServerResult get_obd_scaled_value_info(uint8_t pid,
+                                           uint32_t idx,
+                                           ObdValueUnit *unit,
+                                           char *name,
+                                           uint32_t name_len);
+
+/// Creates a new functional OBD2 client over a raw CAN channel, and returns a handle to it.
+/// This configures and opens the channel
+///
+/// ## Parameters
+/// * options - Functional client settings
+/// * callbacks - Callback handler for the client's CAN channel
+/// * handle - Set to the new client handle if creation was successful
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the client was created. The handle must be freed with [destroy_obd2_functional_handle]
+DiagServerResult create_obd2_functional_handle(Obd2FunctionalOptions options,
+                                               CanChannelCallbackHandler callbacks,
+                                               Obd2FunctionalHandle **handle);
+
+/// Sends a functional request, and collects the response of every ECU that answers
+///
+/// ## Parameters
+/// * handle - Client to send the request with
+/// * payload - Request to send, starting with the service ID. At most 7 bytes
+/// * payload_len - Length of `payload`
+/// * responses - Array of `response_capacity` responses, each with its own response buffer.
+/// These are written in order of responder ID
+/// * response_capacity - Number of responses `responses` can hold
+/// * response_count - Set to the number of ECUs that responded
+///
+/// ## Returns
+/// [DiagServerResult::BufferTooSmall] if more ECUs responded than `responses` can hold.
+/// Otherwise, [DiagServerResult::OK] if the request was sent, even if individual ECUs failed
+DiagServerResult send_functional_obd2_handle(Obd2FunctionalHandle *handle,
+                                             const uint8_t *payload,
+                                             uint32_t payload_len,
+                                             ObdFunctionalResponse *responses,
+                                             uint32_t response_capacity,
+                                             uint32_t *response_count);
+
+/// Destroys a functional client created with [create_obd2_functional_handle].
+/// The handle must not be used after this call
+void destroy_obd2_functional_handle(Obd2FunctionalHandle *handle);
+
+/// Gets the last negative response code the ECU behind `handle` responded with
+uint8_t get_ecu_error_code_obd2_handle(const Obd2ServerHandle *handle);
+
+/// Destroys an OBD2 server created with [create_obd2_server_handle_over_isotp].
+/// The handle must not be used after this call
+void destroy_obd2_server_handle(Obd2ServerHandle *handle);
+
+/// Lists the installed Passthru adapters (Requires the `passthru` feature).
+///
+/// Registry keys (Windows) or JSON files (Unix) which have not changed since the last scan
+/// in this process are not read again, so calling this repeatedly is cheap.
+///
+/// ## Parameters
+/// * devices - Buffer to write the adapters into
+/// * capacity - Capacity of `devices`
+/// * count - Set to the number of installed adapters
+///
+/// ## Returns
+/// [DiagServerResult::BufferTooSmall] if there are more than `capacity` adapters. The first
+/// `capacity` adapters are still written into `devices`
+DiagServerResult get_passthru_devices(PassthruDeviceInfo *devices, uint32_t capacity, uint32_t *count);
+
+/// Creates a new simulated ECU with no rules, whose response times are evenly
+/// distributed between `min_response_us` and `max_response_us`
+///
+/// ## Parameters
+/// * seed - Seed for the response time distribution
+///
+/// ## Returns
+/// The ECU, which must be freed with [destroy_simulated_ecu]
+SimulatedEcu *create_simulated_ecu(uint32_t min_response_us, uint32_t max_response_us, uint64_t seed);
+
+/// Creates a new simulated ECU with no rules
+///
+/// ## Parameters
+/// * timing - Response time of the ECU, unless a rule overrides it with [set_simulated_ecu_rule_timing]
+/// * seed - Seed for the response time distribution
+///
+/// ## Returns
+/// The ECU, which must be freed with [destroy_simulated_ecu]
+SimulatedEcu *create_simulated_ecu_with_timing(SimulatedResponseTime timing, uint64_t seed);
+
+/// Adds a rule to a simulated ECU. When several rules match a request,
+/// the one with the longest prefix is used
+///
+/// ## Parameters
+/// * prefix - Requests starting with these bytes match the rule
+/// * resp - Response to matching requests, beginning with SID + 0x40. If empty, the ECU does not respond
+/// * pending_count - Number of response pending (0x78) responses to send before the response
+/// * pending_interval_us - Time between response pending responses
+DiagServerResult add_simulated_ecu_rule(SimulatedEcu *ecu,
+                                        const uint8_t *prefix,
+                                        uint32_t prefix_len,
+                                        const uint8_t *resp,
+                                        uint32_t resp_len,
+                                        uint32_t pending_count,
+                                        uint32_t pending_interval_us);
+
+/// Sets the response time of the rule of a simulated ECU whose prefix is exactly `prefix`,
+/// instead of the ECU's response time
+///
+/// ## Parameters
+/// * prefix - Prefix the rule was added with
+/// * timing - Response time of the rule. If null, the rule uses the ECU's response time again
+///
+/// ## Returns
+/// [DiagServerResult::ParameterInvalid] if the ECU has no rule with this prefix
+DiagServerResult set_simulated_ecu_rule_timing(SimulatedEcu *ecu,
+                                               const uint8_t *prefix,
+                                               uint32_t prefix_len,
+                                               const SimulatedResponseTime *timing);
+
+/// Sets the negative response code a simulated ECU responds with to requests that match
+/// no rule. If `nrc` is 0, the ECU does not respond to them
+void set_simulated_ecu_unsupported_nrc(SimulatedEcu *ecu, uint8_t nrc);
+
+/// Returns the number of requests a simulated ECU has received
+uint64_t get_simulated_ecu_request_count(const SimulatedEcu *ecu);
+
+/// Creates a new UDS diagnostic server which talks to a simulated ECU, and returns a handle to it.
+/// The ECU can still be changed and must still be freed by the caller. The server keeps
+/// its own reference to it
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the server was created. The handle must be freed with [crate::uds::destroy_uds_server_handle]
+DiagServerResult create_uds_server_handle_over_simulation(UdsServerOptions settings,
+                                                          IsoTPSettings iso_tp_opts,
+                                                          const SimulatedEcu *ecu,
+                                                          UdsServerHandle **handle);
+
+/// Frees a simulated ECU. Servers created over it keep working until they are destroyed
+void destroy_simulated_ecu(SimulatedEcu *ecu);
+
+/// Creates a new UDS diagnostic server using an ISO-TP callback handler, and returns a handle to it
+///
+/// ## Parameters
+/// * settings - UDS Server settings
+/// * iso_tp_opts - ISO-TP settings to configure the channel with
+/// * callbacks - Callback handler for the servers channel. The same callbacks can be used
+/// for multiple servers, with a different `user_ctx` per server
+/// * handle - Set to the new server handle if creation was successful
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the server was created. The handle must be freed with [destroy_uds_server_handle]
+DiagServerResult create_uds_server_handle_over_isotp(UdsServerOptions settings,
+                                                     IsoTPSettings iso_tp_opts,
+                                                     IsoTpChannelCallbackHandler callbacks,
+                                                     UdsServerHandle **handle);
+
+/// Sends a payload to the UDS server behind `handle`. See [send_payload_uds] for how the
+/// response is returned, and [free_uds_payload_response] for how to free it
+DiagServerResult send_payload_uds_handle(UdsServerHandle *handle,
+                                         UdsPayload *payload,
+                                         bool response_require);
+
+/// Sends a payload to the UDS server behind `handle`, writing the response into a
+/// caller provided buffer. See [send_payload_uds_into]
+DiagServerResult send_payload_uds_handle_into(UdsServerHandle *handle,
+                                              const UdsPayload *payload,
+                                              bool response_require,
+                                              uint8_t *resp_buf,
+                                              uint32_t resp_buf_len,
+                                              uint32_t *resp_len);
+
+/// Sends a batch of payloads to the UDS server behind `handle`.
+///
+/// The whole batch is executed by the server thread in one go, in order, and the
+/// calling thread is only woken up once every request has completed. Failed requests
+/// are not retried.
+///
+/// ## Parameters
+/// * handle - Server to run the batch on
+/// * items - Array of requests. The result, response and NRC of each request is written back into its item
+/// * item_count - Number of items in `items`
+/// * defer_tester_present - If true, tester present is only sent between batches, and never
+/// in between requests of this batch. Only use this if the batch completes within the ECUs session timeout.
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the batch was executed. Each item then holds its own result.
+/// Any other value means the batch could not be run at all.
+DiagServerResult send_batch_uds_handle(UdsServerHandle *handle,
+                                       UdsBatchItem *items,
+                                       uint32_t item_count,
+                                       bool defer_tester_present);
+
+/// Registers the callback that requests submitted with [submit_payload_uds_handle] complete to.
+///
+/// The callback is called on the server's background thread, so it should return quickly
+/// (For example, by posting the result to the caller's event loop). Requests that have already
+/// been submitted will still complete to the previously registered callback.
+DiagServerResult register_uds_completion_callback(UdsServerHandle *handle,
+                                                  UdsCompletionCallback callback,
+                                                  void *user_ctx);
+
+/// Submits a payload to the UDS server behind `handle`, without waiting for the ECU to respond.
+///
+/// Submitted requests are executed in order by the server thread, and their results are
+/// delivered to the callback registered with [register_uds_completion_callback]. Any number of
+/// requests can be in flight at once. Failed requests are not retried.
+///
+/// ## Parameters
+/// * handle - Server to submit the request to
+/// * payload - Payload to send to the ECU. The arguments are copied, so the payload can be reused straight away
+/// * response_require - If set to false, no response will be read from the ECU
+/// * request_id - Set to the ID the completion callback will be called with
+///
+/// ## Returns
+/// [DiagServerResult::NoHandler] if no completion callback has been registered
+DiagServerResult submit_payload_uds_handle(UdsServerHandle *handle,
+                                           const UdsPayload *payload,
+                                           bool response_require,
+                                           uint32_t *request_id);
+
+/// Gets the last negative response code the ECU behind `handle` responded with
+uint8_t get_ecu_error_code_handle(const UdsServerHandle *handle);
+
+/// Creates a handle to the metrics of the UDS server behind `handle`. Returns null if `handle` is null.
+///
+/// Like every other call taking the server's handle, this must not be called whilst another
+/// thread is using the server. The returned handle has no such restriction.
+/// Destroy it with [destroy_uds_metrics_handle]
+UdsMetricsHandle *create_uds_metrics_handle(const UdsServerHandle *handle);
+
+/// Copies the metrics behind `handle` into `metrics`.
+///
+/// Reading metrics never blocks, and can be done from any thread
+/// whilst requests are in progress.
+DiagServerResult read_uds_metrics(const UdsMetricsHandle *handle, ServerMetricsSnapshot *metrics);
+
+/// Resets the metrics behind `handle` back to 0. Like [read_uds_metrics], this can be done from any thread
+DiagServerResult reset_uds_metrics(const UdsMetricsHandle *handle);
+
+/// Destroys a handle created with [create_uds_metrics_handle]
+void destroy_uds_metrics_handle(UdsMetricsHandle *handle);
+
+/// Enables or disables the response cache of the UDS server behind `handle`.
+///
+/// Once enabled, reads of identification data identifiers (0xF180-0xF19F) are answered from
+/// the cache after the first read, until the session changes or the ECU is reset.
+/// Disabling the cache also clears it
+DiagServerResult set_uds_response_cache_enabled_handle(UdsServerHandle *handle, bool enabled);
+
+/// Removes every cached response from the response cache of the UDS server behind `handle`
+DiagServerResult clear_uds_response_cache_handle(UdsServerHandle *handle);
+
+/// Copies the cached response to a request into a caller provided buffer, without
+/// sending anything to the ECU.
+///
+/// ## Parameters
+/// * handle - Server to query
+/// * request - Full request (SID + arguments)
+/// * request_len - Length of `request`
+/// * resp_buf - Buffer to copy the response into
+/// * resp_buf_len - Capacity of `resp_buf`
+/// * resp_len - Set to the length of the cached response, or 0 if there is no cached response
+DiagServerResult get_uds_cached_response_handle(const UdsServerHandle *handle,
+                                                const uint8_t *request,
+                                                uint32_t request_len,
+                                                uint8_t *resp_buf,
+                                                uint32_t resp_buf_len,
+                                                uint32_t *resp_len);
+
+/// Gets the number of requests the UDS server behind `handle` answered from its response cache,
+/// and the number of cacheable requests it had to send to the ECU
+DiagServerResult get_uds_response_cache_stats_handle(const UdsServerHandle *handle,
+                                                     uint64_t *hits,
+                                                     uint64_t *misses);
+
+/// Creates a keep-alive scheduler for one bus. Servers joined to it with
+/// [set_keep_alive_scheduler_uds_handle] share one functional tester present (0x3E 0x80)
+/// per interval, rather than each sending their own
+///
+/// ## Parameters
+/// * functional_id - Functional address every ECU on the bus listens to
+/// * interval_ms - Longest time a session may go without traffic
+KeepAliveScheduler *create_keep_alive_scheduler(uint32_t functional_id, uint32_t interval_ms);
+
+/// Joins the UDS server behind `handle` to `scheduler`, or if `scheduler` is null, goes back
+/// to the server sending its own tester present messages
+DiagServerResult set_keep_alive_scheduler_uds_handle(UdsServerHandle *handle,
+                                                     const KeepAliveScheduler *scheduler);
+
+/// Returns the number of keep-alives sent on the bus of `scheduler`, or 0 if `scheduler` is null
+uint64_t get_keep_alives_sent(const KeepAliveScheduler *scheduler);
+
+/// Destroys a scheduler created with [create_keep_alive_scheduler]. Servers which
+/// are still joined to it keep sharing keep-alives
+void destroy_keep_alive_scheduler(KeepAliveScheduler *scheduler);
+
+/// Asks the ECU behind `handle` to start sending periodic data identifiers
+/// (ReadDataByPeriodicIdentifier), and starts capturing them.
+///
+/// ## Parameters
+/// * handle - Server to start the stream on
+/// * mode - Rate at which the ECU should send the identifiers. Must not be [PeriodicTransmissionMode::StopSending]
+/// * periodic_ids - Periodic data identifiers to stream (The low byte of data identifier 0xF2xx)
+/// * periodic_ids_len - Number of identifiers in `periodic_ids`
+/// * capacity - Minimum number of samples to buffer before new samples are dropped
+/// * stream - Set to the new stream if it was started
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the stream was started. The stream must be freed with [destroy_periodic_stream]
+DiagServerResult start_periodic_stream_uds_handle(UdsServerHandle *handle,
+                                                  PeriodicTransmissionMode mode,
+                                                  const uint8_t *periodic_ids,
+                                                  uint32_t periodic_ids_len,
+                                                  uint32_t capacity,
+                                                  PeriodicDataStream **stream);
+
+/// Asks the ECU behind `handle` to stop sending periodic data identifiers, and stops capturing them.
+/// Samples already captured can still be read from the stream
+///
+/// ## Parameters
+/// * handle - Server to stop the stream on
+/// * periodic_ids - Periodic data identifiers to stop. If `periodic_ids_len` is 0, all identifiers are stopped
+/// * periodic_ids_len - Number of identifiers in `periodic_ids`
+DiagServerResult stop_periodic_stream_uds_handle(UdsServerHandle *handle,
+                                                 const uint8_t *periodic_ids,
+                                                 uint32_t periodic_ids_len);
+
+/// Moves up to `max_samples` captured samples into `samples`, oldest first. This never blocks.
+///
+/// ## Returns
+/// The number of samples written into `samples`
+uint32_t read_periodic_stream(PeriodicDataStream *stream,
+                              PeriodicSample *samples,
+                              uint32_t max_samples);
+
+/// Returns the number of samples `stream` discarded because it was full
+uint64_t get_periodic_stream_dropped(const PeriodicDataStream *stream);
+
+/// Destroys a stream created with [start_periodic_stream_uds_handle].
+/// This does not stop the ECU from sending, use [stop_periodic_stream_uds_handle] first
+void destroy_periodic_stream(PeriodicDataStream *stream);
+
+/// Reads the scaling data of a data identifier from the ECU behind `handle`
+/// (ReadScalingDataByIdentifier), and compiles it into a converter for the identifier's live values.
+///
+/// ## Parameters
+/// * handle - Server to read the scaling data with
+/// * did - Data identifier to read the scaling data of
+/// * converter - Set to the new converter if the scaling data could be compiled
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the converter was created. The converter must be freed with [destroy_scaling_converter].
+/// [DiagServerResult::Todo] if the identifier is not numeric, or uses a
+/// vehicle manufacturer specific formula
+DiagServerResult read_scaling_converter_uds_handle(UdsServerHandle *handle,
+                                                   uint16_t did,
+                                                   ScalingConverter **converter);
+
+/// Compiles a ReadScalingDataByIdentifier response which has already been read
+/// (Beginning with 0x64 and the data identifier) into a converter. See [read_scaling_converter_uds_handle]
+DiagServerResult create_scaling_converter(const uint8_t *resp,
+                                          uint32_t resp_len,
+                                          ScalingConverter **converter);
+
+/// Returns the number of bytes of one raw value of `converter`, or 0 if `converter` is null
+uint32_t get_scaling_converter_sample_len(const ScalingConverter *converter);
+
+/// Converts `count` raw values which have already been decoded. `raw` and `out` may be the same buffer
+DiagServerResult convert_scaling_values(const ScalingConverter *converter,
+                                        const float *raw,
+                                        float *out,
+                                        uint32_t count);
+
+/// Decodes back to back raw samples (EG: The data of a [PeriodicSample]), and converts them.
+///
+/// ## Parameters
+/// * converter - Converter to use
+/// * data - Raw samples of [get_scaling_converter_sample_len] bytes each
+/// * data_len - Length of `data` in bytes. Trailing bytes which do not make up a whole sample are ignored
+/// * out - Buffer to write the converted values into
+/// * out_len - Capacity of `out` in values
+/// * out_count - Set to the number of values written into `out`
+DiagServerResult decode_scaling_values(const ScalingConverter *converter,
+                                       const uint8_t *data,
+                                       uint32_t data_len,
+                                       float *out,
+                                       uint32_t out_len,
+                                       uint32_t *out_count);
+
+/// Destroys a converter created with [read_scaling_converter_uds_handle] or [create_scaling_converter]
+void destroy_scaling_converter(ScalingConverter *converter);
+
+/// Downloads an image to the ECU behind `handle` (RequestDownload, TransferData and RequestTransferExit).
+///
+/// The TransferData blocks are sent one at a time by the server's background thread, each waiting
+/// for the ECU to acknowledge the previous one, using the largest block size the ECU accepts. The image is read in place, and is not copied as a whole.
+/// Blocks that fail are not retried. The ECU must already be in a session which allows downloads.
+///
+/// ## Parameters
+/// * handle - Server to download with
+/// * image - Image to download. This must stay valid until the function returns
+/// * image_len - Length of `image` in bytes
+/// * options - Settings for the download
+/// * progress_cb - Optional callback for the progress of the download. If it falls behind,
+/// some blocks are skipped, but it is always called once every block has been acknowledged
+/// * user_ctx - Context pointer to hand back to `progress_cb`
+/// * progress - Set to the progress of the download, even if it failed part way through
+DiagServerResult download_uds_handle(UdsServerHandle *handle,
+                                     const uint8_t *image,
+                                     uint32_t image_len,
+                                     DownloadOptions options,
+                                     UdsTransferProgressCallback progress_cb,
+                                     void *user_ctx,
+                                     TransferProgress *progress);
+
+/// Writes the name of `dtc` (EG: P0301) into `name` as a null terminated string, without allocating.
+///
+/// ## Parameters
+/// * dtc - DTC to name
+/// * name - Caller owned buffer to write the name into. A buffer of `DTC_NAME_MAX_LEN + 1` bytes can hold any name
+/// * name_len - Capacity of `name`
+/// * written - Set to the length of the name, not including the null terminator
+///
+/// ## Returns
+/// [DiagServerResult::BufferTooSmall] if `name` cannot hold the name and its null terminator
+DiagServerResult get_uds_dtc_name(const UdsDtc *dtc,
+                                  char *name,
+                                  uint32_t name_len,
+                                  uint32_t *written);
+
+/// Reads the DTCs stored on the ECU behind `handle` which match `status_mask`,
+/// decoding them straight into a caller owned array.
+///
+/// ## Parameters
+/// * handle - Server to read the DTCs from
+/// * status_mask - DTC status mask to read DTCs by. 0xFF reads all DTCs
+/// * dtcs - Caller owned array to write the DTCs into
+/// * dtc_capacity - Capacity of `dtcs`
+/// * dtc_count - Set to the number of DTCs the ECU reported
+///
+/// ## Returns
+/// [DiagServerResult::BufferTooSmall] if `dtcs` could only hold the first `dtc_capacity` DTCs
+DiagServerResult get_dtcs_by_status_mask_uds_handle(UdsServerHandle *handle,
+                                                    uint8_t status_mask,
+                                                    UdsDtc *dtcs,
+                                                    uint32_t dtc_capacity,
+                                                    uint32_t *dtc_count);
+
+/// Reads the DTCs of many ECUs at once, each through its own server handle.
+///
+/// Up to `max_in_flight_per_adapter` ECUs on each adapter are queried at the same time.
+/// Failed requests are not retried, and a failing ECU does not stop the sweep. Instead, its
+/// error is written back into its target. The callbacks of each handle are called
+/// from that server's background thread, as usual.
+///
+/// ## Parameters
+/// * targets - ECUs to read. The result and DTC count of each ECU is written back into its target
+/// * target_count - Number of targets in `targets`
+/// * status_mask - DTC status mask to read DTCs by. 0xFF reads all DTCs
+/// * max_in_flight_per_adapter - Maximum number of ECUs to query at the same time on each adapter
+/// * dtcs - Caller owned array to write the DTCs of every ECU into, grouped by ECU
+/// * dtc_capacity - Capacity of `dtcs`
+/// * dtc_count - Set to the total number of DTCs read
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the sweep was run. Each target then holds its own result.
+/// [DiagServerResult::BufferTooSmall] if `dtcs` could only hold the first `dtc_capacity` DTCs.
+DiagServerResult sweep_dtcs_uds_handles(UdsDtcSweepTarget *targets,
+                                        uint32_t target_count,
+                                        uint8_t status_mask,
+                                        uint32_t max_in_flight_per_adapter,
+                                        UdsSweepDtc *dtcs,
+                                        uint32_t dtc_capacity,
+                                        uint32_t *dtc_count);
+
+/// Destroys a UDS server created with [create_uds_server_handle_over_isotp].
+/// The handle must not be used after this call
+void destroy_uds_server_handle(UdsServerHandle *handle);
+
 /// Register an ISO-TP callback
 void register_isotp_callback(IsoTpChannelCallbackHandler cb);
 
 /// Delete an ISO-TP callback
 void destroy_isotp_callback();
 
-/// Gets the last ECU negative response code
-uint8_t get_ecu_error_code();
-
 /// Creates a new UDS diagnostic server using an ISO-TP callback handler
+/// registered with [register_isotp_callback]
+///
+/// Only one server can be created this way. To use multiple servers,
+/// use [create_uds_server_handle_over_isotp]
 DiagServerResult create_uds_server_over_isotp(UdsServerOptions settings, IsoTPSettings iso_tp_opts);
 
 /// Sends a payload to the UDS server, attempts to get the ECUs response
@@ -198,11 +1214,48 @@ DiagServerResult create_uds_server_over_isotp(UdsServerOptions settings, IsoTPSe
 ///
 /// ## Returns
 /// If a response is required, and it completes successfully, then the returned value
-/// will have a new pointer set for args_ptr. **IMPORTANT**. It is up to the caller
-/// of this function to deallocate this pointer after using it. The rust library will
-/// have nothing to do with it once it is returned
+/// will have a new pointer set for args_ptr. **IMPORTANT**. This pointer is owned by the
+/// rust library, and MUST be released with [free_uds_payload_response] once the caller
+/// is done with it. To poll without having to free anything, use [send_payload_uds_into] instead.
 DiagServerResult send_payload_uds(UdsPayload *payload, bool response_require);
 
+/// Frees a response that was returned by [send_payload_uds].
+///
+/// After this call, args_ptr is set to null and args_len is set to 0.
+///
+/// ## Safety
+/// Only call this on payloads whose args_ptr was set by [send_payload_uds]. Calling it
+/// on a payload that points to a caller owned argument buffer is undefined behaviour.
+void free_uds_payload_response(UdsPayload *payload);
+
+/// Sends a payload to the UDS server, writing the ECUs response into a caller provided buffer.
+///
+/// Unlike [send_payload_uds], the request payload is never modified, and nothing is
+/// handed back to the caller that has to be deallocated, so the same request and
+/// response buffer can be reused in a polling loop.
+///
+/// This is not allocation free. The server still reads the response into its own buffer,
+/// which is copied into `resp_buf` and freed before this returns.
+///
+/// ## Parameters
+/// * payload - Payload to send to the ECU
+/// * response_require - If set to false, no response will be read from the ECU, and `resp_len` is set to 0.
+/// * resp_buf - Buffer to write the ECUs response into. The response will begin with SID + 0x40
+/// * resp_buf_len - Capacity of `resp_buf` in bytes
+/// * resp_len - Set to the length of the ECUs response
+///
+/// ## Returns
+/// [DiagServerResult::BufferTooSmall] if the response does not fit in `resp_buf`. In this case,
+/// `resp_len` is set to the length of the response, and nothing is written to `resp_buf`.
+DiagServerResult send_payload_uds_into(const UdsPayload *payload,
+                                       bool response_require,
+                                       uint8_t *resp_buf,
+                                       uint32_t resp_buf_len,
+                                       uint32_t *resp_len);
+
+/// Copies the metrics of the UDS server into `metrics`. See [read_uds_metrics]
+DiagServerResult get_uds_metrics(ServerMetricsSnapshot *metrics);
+
 /// Destroys an existing UDS server
 void destroy_uds_server();
 
@@ -15,7 +15,7 @@ std::string print_array_pretty(const uint8_t *arr, uint32_t size) {
     return ret;
 }
 
-CallbackHandlerResult handle_isotp_config(IsoTPSettings cfg) {
+CallbackHandlerResult handle_isotp_config(void* ctx, IsoTPSettings cfg) {
     printf("\nSet ISO-TP config called! Configuration:\n");
     printf("Min separation time: %d\n", cfg.st_min);
     printf("Block size: %d\n", cfg.block_size);
@@ -30,36 +30,36 @@ CallbackHandlerResult handle_isotp_config(IsoTPSettings cfg) {
     return CallbackHandlerResult::OK;
 }
 
-CallbackHandlerResult handle_open(){
+CallbackHandlerResult handle_open(void* ctx){
     printf("\nOpen called!\n");
     return CallbackHandlerResult::OK;
 }
-CallbackHandlerResult handle_close(){
+CallbackHandlerResult handle_close(void* ctx){
     printf("\nClose called!\n");
     return CallbackHandlerResult::OK;
 }
 
-CallbackHandlerResult handle_clear_tx(){
+CallbackHandlerResult handle_clear_tx(void* ctx){
     printf("\nClear Tx buffers called!\n");
     return CallbackHandlerResult::OK;
 }
 
-CallbackHandlerResult handle_clear_rx(){
+CallbackHandlerResult handle_clear_rx(void* ctx){
     printf("\nClear Rx buffers called!\n");
     return CallbackHandlerResult::OK;
 }
 
-CallbackHandlerResult handle_write(CallbackPayload tx, uint32_t timeout){
+CallbackHandlerResult handle_write(void* ctx, CallbackPayload tx, uint32_t timeout){
     printf("\nWrite called! Data: { Dest-Addr: 0x%04X, data: [%s], timeout_ms: %d }\n", tx.addr, print_array_pretty(tx.data, tx.data_len).c_str(), timeout);
     return CallbackHandlerResult::OK;
 }
 
-CallbackHandlerResult handle_read(CallbackPayload *rx, uint32_t timeout){
+CallbackHandlerResult handle_read(void* ctx, CallbackPayload *rx, uint32_t timeout){
     printf("\nRead called!\n");
     return CallbackHandlerResult::OK;
 }
 
-CallbackHandlerResult handle_set_ids(uint32_t send, uint32_t recv){
+CallbackHandlerResult handle_set_ids(void* ctx, uint32_t send, uint32_t recv){
     printf("\nSet IDs called. Send: 0x%04x, Recv: 0x%04X\n", send, recv);
     return CallbackHandlerResult::OK;
 }
@@ -67,6 +67,7 @@ CallbackHandlerResult handle_set_ids(uint32_t send, uint32_t recv){
 int main() {
     // Base handler
     BaseChannelCallbackHandler base_handle = {};
+    base_handle.user_ctx = nullptr;
     base_handle.open_callback = handle_open;
     base_handle.close_callback = handle_close;
     base_handle.clear_rx_callback = handle_clear_rx;
@@ -99,6 +100,8 @@ int main() {
     server_opts.send_id = 0x07E0;
     server_opts.tester_present_interval_ms = 2500;
     server_opts.tester_present_require_response = true;
+    server_opts.p2_star_timeout_ms = 5000;
+    server_opts.busy_repeat_delay_ms = 500;
 
     // Register ISO-TP data handler
     register_isotp_callback(iso_tp);
@@ -112,7 +115,7 @@ int main() {
 
         UdsPayload start_diag_req = UdsPayload{};
         uint8_t args[0x03]; // Extended session mode
-        start_diag_req.sid = UDSCommand::DiagnosticSessionControl;
+        start_diag_req.sid.tag = UDSCommand::Tag::DiagnosticSessionControl;
         start_diag_req.args_len = 0x01;
         start_diag_req.args_ptr = args;
 
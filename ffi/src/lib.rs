@@ -1,20 +1,39 @@
 //! FFI bindings for ECU_Diagnostics
 //!
-//! IMPORTANT. Access to the FFI bindings should be done on one thread! No multi-thread support
+//! Diagnostic servers are created as opaque handles, so multiple servers can run at once
+//! (One per ECU). Each server runs its own background thread, which calls into the
+//! callback handler it was created with. Callback handlers shared between servers
+//! must therefore be thread safe.
+//!
+//! IMPORTANT. The legacy single server API ([uds::create_uds_server_over_isotp],
+//! [uds::send_payload_uds], [uds::destroy_uds_server]) should only be used from one thread!
 #![no_std]
 
 extern crate alloc;
 extern crate ecu_diagnostics;
 
 use alloc::vec::Vec;
+use core::{
+    ffi::c_void,
+    sync::atomic::{AtomicU8, Ordering},
+};
 
-use ecu_diagnostics::{DiagnosticServer, hardware::HardwareError};
+use ecu_diagnostics::hardware::HardwareError;
 pub use ecu_diagnostics::{
-    channel::{ChannelError, ChannelResult, IsoTPChannel, IsoTPSettings, PayloadChannel},
-    uds::{UDSCommand, UdsDiagnosticServer, UdsServerOptions, UdsVoidHandler},
+    channel::{
+        CanChannel, CanFrame, ChannelError, ChannelResult, IsoTPChannel, IsoTPSettings,
+        PacketChannel, PayloadChannel,
+    },
     DiagError,
 };
 
+pub mod obd2;
+#[cfg(feature = "passthru")]
+pub mod passthru;
+#[cfg(feature = "simulation")]
+pub mod simulation;
+pub mod uds;
+
 #[repr(C)]
 #[derive(Debug)]
 /// Callback handler payload
@@ -81,46 +100,59 @@ impl From<CallbackHandlerResult> for ChannelError {
 #[derive(Clone)]
 #[allow(missing_debug_implementations)]
 /// Callback handler for base channel to allow access via FFI
+///
+/// Every callback is given `user_ctx` as its first argument, so one set of
+/// callbacks can serve multiple channels (For example, one per ECU).
 pub struct BaseChannelCallbackHandler {
+    /// User context pointer passed to every callback. The library never dereferences this.
+    pub user_ctx: *mut c_void,
     /// Callback when [BaseChannel::open] is called
-    pub open_callback: extern "C" fn() -> CallbackHandlerResult,
+    pub open_callback: extern "C" fn(user_ctx: *mut c_void) -> CallbackHandlerResult,
     /// Callback when [BaseChannel::close] is called
-    pub close_callback: extern "C" fn() -> CallbackHandlerResult,
+    pub close_callback: extern "C" fn(user_ctx: *mut c_void) -> CallbackHandlerResult,
     /// Callback when [BaseChannel::write_bytes] is called
     pub write_bytes_callback: extern "C" fn(
+        user_ctx: *mut c_void,
         write_payload: CallbackPayload,
         write_timeout_ms: u32,
     ) -> CallbackHandlerResult,
     /// Callback when [BaseChannel::read_bytes] is called
     pub read_bytes_callback: extern "C" fn(
+        user_ctx: *mut c_void,
         read_payload: &mut CallbackPayload,
         read_timeout_ms: u32,
     ) -> CallbackHandlerResult,
     /// Callback when [BaseChannel::clear_tx_buffer] is called
-    pub clear_tx_callback: extern "C" fn() -> CallbackHandlerResult,
+    pub clear_tx_callback: extern "C" fn(user_ctx: *mut c_void) -> CallbackHandlerResult,
     /// Callback when [BaseChannel::clear_rx_buffer] is called
-    pub clear_rx_callback: extern "C" fn() -> CallbackHandlerResult,
+    pub clear_rx_callback: extern "C" fn(user_ctx: *mut c_void) -> CallbackHandlerResult,
     /// Callback when [BaseChannel::set_ids] is called
-    pub set_ids_callback: extern "C" fn(send: u32, recv: u32) -> CallbackHandlerResult,
+    pub set_ids_callback:
+        extern "C" fn(user_ctx: *mut c_void, send: u32, recv: u32) -> CallbackHandlerResult,
 }
 
+// The user context is opaque to the library, and is only ever handed back to the
+// callbacks. It is up to the caller to make sure it can be used from the server thread.
+unsafe impl Send for BaseChannelCallbackHandler {}
+unsafe impl Sync for BaseChannelCallbackHandler {}
+
 impl PayloadChannel for BaseChannelCallbackHandler {
     fn open(&mut self) -> ChannelResult<()> {
-        match (self.open_callback)() {
+        match (self.open_callback)(self.user_ctx) {
             CallbackHandlerResult::OK => Ok(()),
             x => Err(x.into()),
         }
     }
 
     fn close(&mut self) -> ChannelResult<()> {
-        match (self.close_callback)() {
+        match (self.close_callback)(self.user_ctx) {
             CallbackHandlerResult::OK => Ok(()),
             x => Err(x.into()),
         }
     }
 
     fn set_ids(&mut self, send: u32, recv: u32) -> ChannelResult<()> {
-        match (self.set_ids_callback)(send, recv) {
+        match (self.set_ids_callback)(self.user_ctx, send, recv) {
             CallbackHandlerResult::OK => Ok(()),
             x => Err(x.into()),
         }
@@ -128,7 +160,7 @@ impl PayloadChannel for BaseChannelCallbackHandler {
 
     fn read_bytes(&mut self, timeout_ms: u32) -> ChannelResult<Vec<u8>> {
         let mut p = CallbackPayload::default();
-        match (self.read_bytes_callback)(&mut p, timeout_ms) {
+        match (self.read_bytes_callback)(self.user_ctx, &mut p, timeout_ms) {
             CallbackHandlerResult::OK => Ok(unsafe {
                 Vec::from_raw_parts(p.data as *mut u8, p.data_len as usize, p.data_len as usize)
             }),
@@ -143,21 +175,21 @@ impl PayloadChannel for BaseChannelCallbackHandler {
             data: buffer.as_ptr(),
         };
 
-        match (self.write_bytes_callback)(p, timeout_ms) {
+        match (self.write_bytes_callback)(self.user_ctx, p, timeout_ms) {
             CallbackHandlerResult::OK => Ok(()),
             x => Err(x.into()),
         }
     }
 
     fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
-        match (self.clear_rx_callback)() {
+        match (self.clear_rx_callback)(self.user_ctx) {
             CallbackHandlerResult::OK => Ok(()),
             x => Err(x.into()),
         }
     }
 
     fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
-        match (self.clear_tx_callback)() {
+        match (self.clear_tx_callback)(self.user_ctx) {
             CallbackHandlerResult::OK => Ok(()),
             x => Err(x.into()),
         }
@@ -171,12 +203,13 @@ pub struct IsoTpChannelCallbackHandler {
     /// Base handler
     pub base: BaseChannelCallbackHandler,
     /// Callback when [IsoTPChannel::set_iso_tp_cfg] is called
-    pub set_iso_tp_cfg_callback: extern "C" fn(cfg: IsoTPSettings) -> CallbackHandlerResult,
+    pub set_iso_tp_cfg_callback:
+        extern "C" fn(user_ctx: *mut c_void, cfg: IsoTPSettings) -> CallbackHandlerResult,
 }
 
 impl IsoTPChannel for IsoTpChannelCallbackHandler {
     fn set_iso_tp_cfg(&mut self, cfg: IsoTPSettings) -> ChannelResult<()> {
-        match (self.set_iso_tp_cfg_callback)(cfg) {
+        match (self.set_iso_tp_cfg_callback)(self.base.user_ctx, cfg) {
             CallbackHandlerResult::OK => Ok(()),
             x => Err(x.into()),
         }
@@ -213,26 +246,141 @@ impl PayloadChannel for IsoTpChannelCallbackHandler {
     }
 }
 
-static mut ISO_TP_HANDLER: Option<IsoTpChannelCallbackHandler> = None;
-static mut UDS_SERVER: Option<UdsDiagnosticServer> = None;
+#[repr(C)]
+#[derive(Clone)]
+#[allow(missing_debug_implementations)]
+/// Callback handler for [CanChannel], for sending and receiving raw CAN frames
+///
+/// Frames are passed in batches, so that a single callback can move a whole
+/// batch to or from the hardware at once.
+pub struct CanChannelCallbackHandler {
+    /// User context pointer passed to every callback. The library never dereferences this.
+    pub user_ctx: *mut c_void,
+    /// Callback when [PacketChannel::open] is called
+    pub open_callback: extern "C" fn(user_ctx: *mut c_void) -> CallbackHandlerResult,
+    /// Callback when [PacketChannel::close] is called
+    pub close_callback: extern "C" fn(user_ctx: *mut c_void) -> CallbackHandlerResult,
+    /// Callback when [PacketChannel::write_packets] is called. All `frame_count` frames
+    /// should be written before returning. `frames` is only valid until the callback returns
+    pub write_frames_callback: extern "C" fn(
+        user_ctx: *mut c_void,
+        frames: *const CanFrame,
+        frame_count: u32,
+        write_timeout_ms: u32,
+    ) -> CallbackHandlerResult,
+    /// Callback when [PacketChannel::read_packets_into] is called. Up to `capacity` frames
+    /// should be written into `frames`, and `read_count` set to the number of frames written
+    pub read_frames_callback: extern "C" fn(
+        user_ctx: *mut c_void,
+        frames: *mut CanFrame,
+        capacity: u32,
+        read_count: &mut u32,
+        read_timeout_ms: u32,
+    ) -> CallbackHandlerResult,
+    /// Callback when [PacketChannel::clear_tx_buffer] is called
+    pub clear_tx_callback: extern "C" fn(user_ctx: *mut c_void) -> CallbackHandlerResult,
+    /// Callback when [PacketChannel::clear_rx_buffer] is called
+    pub clear_rx_callback: extern "C" fn(user_ctx: *mut c_void) -> CallbackHandlerResult,
+    /// Callback when [CanChannel::set_can_cfg] is called
+    pub set_can_cfg_callback: extern "C" fn(
+        user_ctx: *mut c_void,
+        baud: u32,
+        use_extended: bool,
+    ) -> CallbackHandlerResult,
+}
+
+// Same as BaseChannelCallbackHandler, the user context is only ever handed back to the callbacks
+unsafe impl Send for CanChannelCallbackHandler {}
+unsafe impl Sync for CanChannelCallbackHandler {}
 
-static mut ECU_ERROR: u8 = 0x00;
+impl PacketChannel<CanFrame> for CanChannelCallbackHandler {
+    fn open(&mut self) -> ChannelResult<()> {
+        match (self.open_callback)(self.user_ctx) {
+            CallbackHandlerResult::OK => Ok(()),
+            x => Err(x.into()),
+        }
+    }
 
-/// Register an ISO-TP callback
-#[no_mangle]
+    fn close(&mut self) -> ChannelResult<()> {
+        match (self.close_callback)(self.user_ctx) {
+            CallbackHandlerResult::OK => Ok(()),
+            x => Err(x.into()),
+        }
+    }
+
+    fn write_packets(&mut self, packets: &[CanFrame], timeout_ms: u32) -> ChannelResult<()> {
+        if packets.is_empty() {
+            return Ok(());
+        }
+        match (self.write_frames_callback)(
+            self.user_ctx,
+            packets.as_ptr(),
+            packets.len() as u32,
+            timeout_ms,
+        ) {
+            CallbackHandlerResult::OK => Ok(()),
+            x => Err(x.into()),
+        }
+    }
 
-pub extern "C" fn register_isotp_callback(cb: IsoTpChannelCallbackHandler) {
-    unsafe { ISO_TP_HANDLER = Some(cb) }
+    fn read_packets(&mut self, max: usize, timeout_ms: u32) -> ChannelResult<Vec<CanFrame>> {
+        let mut frames = alloc::vec![CanFrame::default(); max];
+        let count = self.read_packets_into(&mut frames, timeout_ms)?;
+        frames.truncate(count);
+        Ok(frames)
+    }
+
+    fn read_packets_into(
+        &mut self,
+        packets: &mut [CanFrame],
+        timeout_ms: u32,
+    ) -> ChannelResult<usize> {
+        if packets.is_empty() {
+            return Ok(0);
+        }
+        let mut count = 0u32;
+        match (self.read_frames_callback)(
+            self.user_ctx,
+            packets.as_mut_ptr(),
+            packets.len() as u32,
+            &mut count,
+            timeout_ms,
+        ) {
+            // Never trust the caller to stay in bounds
+            CallbackHandlerResult::OK => Ok((count as usize).min(packets.len())),
+            x => Err(x.into()),
+        }
+    }
+
+    fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
+        match (self.clear_rx_callback)(self.user_ctx) {
+            CallbackHandlerResult::OK => Ok(()),
+            x => Err(x.into()),
+        }
+    }
+
+    fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
+        match (self.clear_tx_callback)(self.user_ctx) {
+            CallbackHandlerResult::OK => Ok(()),
+            x => Err(x.into()),
+        }
+    }
 }
 
-/// Delete an ISO-TP callback
-#[no_mangle]
-pub extern "C" fn destroy_isotp_callback() {
-    unsafe { ISO_TP_HANDLER = None }
+impl CanChannel for CanChannelCallbackHandler {
+    fn set_can_cfg(&mut self, baud: u32, use_extended: bool) -> ChannelResult<()> {
+        match (self.set_can_cfg_callback)(self.user_ctx, baud, use_extended) {
+            CallbackHandlerResult::OK => Ok(()),
+            x => Err(x.into()),
+        }
+    }
 }
 
 // DIAG SERVERS
 
+/// Last NRC any server received. Servers each run on their own thread, so this is atomic
+static ECU_ERROR: AtomicU8 = AtomicU8::new(0x00);
+
 #[repr(C)]
 #[derive(Debug, Copy, Clone, PartialEq, Eq, PartialOrd, Ord)]
 /// FFI Diagnostic server response codes
@@ -258,6 +406,12 @@ pub enum DiagServerResult {
     /// Parameter provided to a subfunction was invalid
     ParameterInvalid = 9,
     HardwareError = 10,
+    /// Response buffer provided by the caller is too small to hold the ECU's response.
+    /// The required length is written back to the caller
+    BufferTooSmall = 11,
+    /// The request carrying this and other parameters failed. The result of the first
+    /// parameter of the request holds its error
+    BatchedRequestFailed = 12,
     /// ECU responded with an error, call [get_ecu_error_code]
     /// to retrieve the NRC from the ECU
     ECUError = 98,
@@ -271,8 +425,8 @@ impl From<DiagError> for DiagServerResult {
     fn from(x: DiagError) -> Self {
         match x {
             DiagError::NotSupported => DiagServerResult::NotSupported,
-            DiagError::ECUError {code, def} => {
-                unsafe { ECU_ERROR = code };
+            DiagError::ECUError { code, .. } => {
+                ECU_ERROR.store(code, Ordering::Relaxed);
                 DiagServerResult::ECUError
             }
             DiagError::EmptyResponse => DiagServerResult::EmptyResponse,
@@ -283,114 +437,35 @@ impl From<DiagError> for DiagServerResult {
             DiagError::ChannelError(_) => DiagServerResult::HandlerError,
             DiagError::ParameterInvalid => DiagServerResult::ParameterInvalid,
             DiagError::HardwareError(_) => DiagServerResult::HardwareError,
+            DiagError::MismatchedResponse(_) => DiagServerResult::WrongMessage,
+            DiagError::BatchedRequestFailed => DiagServerResult::BatchedRequestFailed,
         }
     }
 }
 
-#[repr(C)]
-#[derive(Debug)]
-/// Payload to send to the UDS server
-pub struct UdsPayload {
-    /// Service ID
-    pub sid: UDSCommand,
-    /// Argument length
-    pub args_len: u32,
-    /// Pointer to arguments array
-    pub args_ptr: *mut u8,
-}
-
 /// Gets the last ECU negative response code
-
+///
+/// When using server handles, prefer [uds::get_ecu_error_code_handle], as this value
+/// is shared between all servers
 #[no_mangle]
 pub extern "C" fn get_ecu_error_code() -> u8 {
-    unsafe { ECU_ERROR }
+    ECU_ERROR.load(Ordering::Relaxed)
 }
 
-/// Creates a new UDS diagnostic server using an ISO-TP callback handler
-#[no_mangle]
-pub extern "C" fn create_uds_server_over_isotp(
-    settings: UdsServerOptions,
-    iso_tp_opts: IsoTPSettings,
+/// Copies an ECU response into a caller owned buffer
+pub(crate) fn copy_response_to_buffer(
+    resp: &[u8],
+    resp_buf: *mut u8,
+    resp_buf_len: u32,
+    resp_len: &mut u32,
 ) -> DiagServerResult {
-    if unsafe { ISO_TP_HANDLER.is_none() } {
-        return DiagServerResult::NoHandler;
+    *resp_len = resp.len() as u32;
+    if resp.is_empty() {
+        return DiagServerResult::OK;
     }
-    if unsafe { UDS_SERVER.is_some() } {
-        return DiagServerResult::ServerAlreadyRunning;
+    if resp_buf.is_null() || resp.len() > resp_buf_len as usize {
+        return DiagServerResult::BufferTooSmall;
     }
-
-    let channel = unsafe { ISO_TP_HANDLER.clone().unwrap() };
-    let server =
-        UdsDiagnosticServer::new_over_iso_tp(settings, channel, iso_tp_opts, UdsVoidHandler);
-
-    match server {
-        Ok(s) => {
-            unsafe { UDS_SERVER = Some(s) }
-            DiagServerResult::OK
-        }
-        Err(e) => e.into(),
-    }
-}
-
-/// Sends a payload to the UDS server, attempts to get the ECUs response
-///
-/// ## Parameters
-/// * payload - Payload to send to the ECU. If the ECU responds OK, then this payload
-/// will be replaced by the ECUs response
-///
-/// * response_require - If set to false, no response will be read from the ECU.
-///
-/// ## Notes
-///
-/// Due to restrictions, the payload SID in the response message will match the original SID,
-/// rather than SID + 0x40.
-///
-/// ## Returns
-/// If a response is required, and it completes successfully, then the returned value
-/// will have a new pointer set for args_ptr. **IMPORTANT**. It is up to the caller
-/// of this function to deallocate this pointer after using it. The rust library will
-/// have nothing to do with it once it is returned
-#[no_mangle]
-pub extern "C" fn send_payload_uds(
-    payload: &mut UdsPayload,
-    response_require: bool,
-) -> DiagServerResult {
-    if unsafe { UDS_SERVER.is_none() } {
-        return DiagServerResult::NoDiagnosticServer;
-    }
-
-    match unsafe { UDS_SERVER.as_mut() } {
-        Some(server) => {
-            if response_require {
-                match server.execute_command_with_response(payload.sid, unsafe {
-                    &core::slice::from_raw_parts(payload.args_ptr, payload.args_len as usize)
-                }) {
-                    Ok(mut resp) => {
-                        payload.sid = (resp[0] - 0x40).into();
-                        let len = resp.len() as u32;
-                        let resp_ptr = resp.as_mut_ptr();
-                        core::mem::forget(resp); // Forget the response array, its up to the caller to deallocate this
-                        payload.args_len = len;
-                        payload.args_ptr = resp_ptr;
-                        DiagServerResult::OK
-                    }
-                    Err(e) => e.into(),
-                }
-            } else {
-                match server.execute_command(payload.sid, unsafe {
-                    &core::slice::from_raw_parts(payload.args_ptr, payload.args_len as usize)
-                }) {
-                    Ok(_) => DiagServerResult::OK,
-                    Err(e) => e.into(),
-                }
-            }
-        }
-        None => DiagServerResult::NoDiagnosticServer,
-    }
-}
-
-/// Destroys an existing UDS server
-#[no_mangle]
-pub extern "C" fn destroy_uds_server() {
-    unsafe { UDS_SERVER = None }
+    unsafe { core::ptr::copy_nonoverlapping(resp.as_ptr(), resp_buf, resp.len()) };
+    DiagServerResult::OK
 }
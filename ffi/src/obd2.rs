@@ -0,0 +1,487 @@
+//! FFI bindings for the OBD2 diagnostic server
+//!
+//! Servers are created as opaque [Obd2ServerHandle]s, one per ECU, in the same way as
+//! [crate::uds::UdsServerHandle].
+
+use alloc::{boxed::Box, vec::Vec};
+use core::ffi::c_char;
+
+use ecu_diagnostics::obd2::{DataPid, ObdUnitType, ObdValue, PidUnit};
+pub use ecu_diagnostics::obd2::{
+    OBD2DiagnosticServer, Obd2FunctionalClient, Obd2FunctionalOptions, Obd2ServerOptions,
+    SCALED_PID_MAX_VALUES,
+};
+
+use crate::{
+    copy_response_to_buffer, CanChannelCallbackHandler, DiagError, DiagServerResult, IsoTPSettings,
+    IsoTpChannelCallbackHandler,
+};
+
+/// Maximum length of an [ObdPidValue] name, including the NUL terminator
+pub const OBD_VALUE_NAME_MAX_LEN: usize = 64;
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+/// Unit type of an [ObdPidValue]
+pub enum ObdValueUnit {
+    /// Raw number
+    Raw,
+    /// Speed. Metric is km/h, imperial is mph
+    Speed,
+    /// Percentage
+    Percent,
+    /// Temperature. Metric is celsius, imperial is fahrenheit
+    Temperature,
+    /// RPM
+    Rpm,
+    /// Volts
+    Volts,
+    /// Time in seconds
+    Time,
+    /// Distance. Metric is km, imperial is miles
+    Distance,
+    /// Pressure. Metric is kPa, imperial is psi
+    Pressure,
+    /// Encoded enumeration value. The value is the raw enumeration value
+    Encoded,
+    /// Bit encoded byte array. The value is always 0
+    ByteArray,
+}
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+/// One decoded value of a PID read with [query_pids_obd2_handle].
+/// Some PIDs return more than one value
+pub struct ObdPidValue {
+    /// PID the value belongs to
+    pub pid: u8,
+    /// Unit type of the value
+    pub unit: ObdValueUnit,
+    /// Value in metric form
+    pub metric_value: f32,
+    /// Value in imperial form
+    pub imperial_value: f32,
+    /// NUL terminated name of the value. Names longer than the buffer are truncated
+    pub name: [c_char; OBD_VALUE_NAME_MAX_LEN],
+}
+
+impl ObdPidValue {
+    fn new(pid: u8, v: &ObdValue) -> Self {
+        let value = v.get_value();
+        let unit = match value {
+            ObdUnitType::Raw(_) => ObdValueUnit::Raw,
+            ObdUnitType::Speed(_) => ObdValueUnit::Speed,
+            ObdUnitType::Percent(_) => ObdValueUnit::Percent,
+            ObdUnitType::Temperature(_) => ObdValueUnit::Temperature,
+            ObdUnitType::Rpm(_) => ObdValueUnit::Rpm,
+            ObdUnitType::Volts(_) => ObdValueUnit::Volts,
+            ObdUnitType::Time(_) => ObdValueUnit::Time,
+            ObdUnitType::Distance(_) => ObdValueUnit::Distance,
+            ObdUnitType::Pressure(_) => ObdValueUnit::Pressure,
+            ObdUnitType::Encoded(_) => ObdValueUnit::Encoded,
+            ObdUnitType::ByteArray(_) => ObdValueUnit::ByteArray,
+        };
+        let mut name = [0 as c_char; OBD_VALUE_NAME_MAX_LEN];
+        copy_name(&v.get_name(), &mut name);
+        Self {
+            pid,
+            unit,
+            metric_value: v.get_metric_data(),
+            imperial_value: v.get_imperial_data(),
+            name,
+        }
+    }
+}
+
+/// Copies `src` into `dst` as a NUL terminated string, truncating it if `dst` is too short
+fn copy_name(src: &str, dst: &mut [c_char]) {
+    let len = src.len().min(dst.len().saturating_sub(1));
+    for (d, b) in dst.iter_mut().zip(&src.as_bytes()[..len]) {
+        *d = *b as c_char;
+    }
+    if let Some(d) = dst.get_mut(len) {
+        *d = 0;
+    }
+}
+
+impl From<PidUnit> for ObdValueUnit {
+    fn from(unit: PidUnit) -> Self {
+        match unit {
+            PidUnit::Raw => ObdValueUnit::Raw,
+            PidUnit::Speed => ObdValueUnit::Speed,
+            PidUnit::Percent => ObdValueUnit::Percent,
+            PidUnit::Temperature => ObdValueUnit::Temperature,
+            PidUnit::Rpm => ObdValueUnit::Rpm,
+            PidUnit::Volts => ObdValueUnit::Volts,
+            PidUnit::Time => ObdValueUnit::Time,
+            PidUnit::Distance => ObdValueUnit::Distance,
+            PidUnit::Pressure => ObdValueUnit::Pressure,
+        }
+    }
+}
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+/// Values of one PID read with [query_pids_scaled_obd2_handle], in metric units.
+/// The name and unit of each value are looked up separately with [get_obd_scaled_value_info]
+pub struct ObdScaledPidValues {
+    /// PID the values belong to
+    pub pid: u8,
+    /// Number of values set in `values`
+    pub value_count: u8,
+    /// Decoded values of the PID
+    pub values: [f32; SCALED_PID_MAX_VALUES],
+}
+
+#[repr(C)]
+#[derive(Debug)]
+/// Response of one ECU to [send_functional_obd2_handle]
+pub struct ObdFunctionalResponse {
+    /// Set to the CAN ID the ECU responded with
+    pub responder_id: u32,
+    /// Set to the result of the ECU's response
+    pub result: DiagServerResult,
+    /// Set to the ECUs negative response code if `result` is [DiagServerResult::ECUError]
+    pub ecu_error: u8,
+    /// Caller owned buffer to write the ECUs response into.
+    /// The response will begin with SID + 0x40
+    pub resp_buf: *mut u8,
+    /// Capacity of `resp_buf` in bytes
+    pub resp_buf_len: u32,
+    /// Set to the length of the ECUs response
+    pub resp_len: u32,
+}
+
+/// Opaque handle to a functional OBD2 client, which talks to every ECU at once over a raw CAN channel
+#[allow(missing_debug_implementations)]
+pub struct Obd2FunctionalHandle {
+    client: Obd2FunctionalClient<CanChannelCallbackHandler>,
+}
+
+/// Opaque handle to a running OBD2 diagnostic server
+#[derive(Debug)]
+pub struct Obd2ServerHandle {
+    server: OBD2DiagnosticServer,
+    ecu_error: u8,
+}
+
+impl Obd2ServerHandle {
+    /// Converts a server error into its FFI result, keeping track of the ECUs NRC
+    fn record_error(&mut self, e: DiagError) -> DiagServerResult {
+        if let DiagError::ECUError { code, .. } = e {
+            self.ecu_error = code;
+        }
+        e.into()
+    }
+}
+
+/// Creates a new OBD2 diagnostic server using an ISO-TP callback handler, and returns a handle to it
+///
+/// ## Parameters
+/// * settings - OBD2 Server settings
+/// * iso_tp_opts - ISO-TP settings to configure the channel with
+/// * callbacks - Callback handler for the servers channel
+/// * handle - Set to the new server handle if creation was successful
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the server was created. The handle must be freed with [destroy_obd2_server_handle]
+#[no_mangle]
+pub extern "C" fn create_obd2_server_handle_over_isotp(
+    settings: Obd2ServerOptions,
+    iso_tp_opts: IsoTPSettings,
+    callbacks: IsoTpChannelCallbackHandler,
+    handle: &mut *mut Obd2ServerHandle,
+) -> DiagServerResult {
+    *handle = core::ptr::null_mut();
+    match OBD2DiagnosticServer::new_over_iso_tp(settings, callbacks, iso_tp_opts) {
+        Ok(server) => {
+            *handle = Box::into_raw(Box::new(Obd2ServerHandle {
+                server,
+                ecu_error: 0x00,
+            }));
+            DiagServerResult::OK
+        }
+        Err(e) => e.into(),
+    }
+}
+
+/// Reads many Service 01 PIDs from the ECU behind `handle`, packing up to 6 PIDs into each request
+///
+/// Every value is decoded along with its name. To sample scaled PIDs at a high rate,
+/// use [query_pids_scaled_obd2_handle] instead.
+///
+/// ## Parameters
+/// * pids - PIDs to read
+/// * pid_count - Number of PIDs in `pids`
+/// * results - Array of `pid_count` results, set to the result of each PID
+/// * values - Buffer to write the decoded values of every successful PID into, in the order of `pids`
+/// * value_capacity - Number of values `values` can hold
+/// * value_count - Set to the number of decoded values. If [DiagServerResult::BufferTooSmall]
+/// is returned, this is the capacity required
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the results were written, even if individual PIDs failed
+#[no_mangle]
+pub extern "C" fn query_pids_obd2_handle(
+    handle: *mut Obd2ServerHandle,
+    pids: *const u8,
+    pid_count: u32,
+    results: *mut DiagServerResult,
+    values: *mut ObdPidValue,
+    value_capacity: u32,
+    value_count: &mut u32,
+) -> DiagServerResult {
+    *value_count = 0;
+    let h = match unsafe { handle.as_mut() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    if pid_count == 0 {
+        return DiagServerResult::OK;
+    }
+    if pids.is_null() || results.is_null() {
+        return DiagServerResult::ParameterInvalid;
+    }
+    let raw = unsafe { core::slice::from_raw_parts(pids, pid_count as usize) };
+    let results = unsafe { core::slice::from_raw_parts_mut(results, pid_count as usize) };
+    let out: &mut [ObdPidValue] = if values.is_null() || value_capacity == 0 {
+        &mut []
+    } else {
+        unsafe { core::slice::from_raw_parts_mut(values, value_capacity as usize) }
+    };
+
+    let query: Vec<DataPid> = raw.iter().map(|p| DataPid::from(*p)).collect();
+    let mut total = 0usize;
+    for ((pid, res), result) in raw.iter().zip(h.server.query_pids(&query)).zip(results) {
+        *result = match res {
+            Ok(decoded) => {
+                for v in decoded.iter() {
+                    if let Some(slot) = out.get_mut(total) {
+                        *slot = ObdPidValue::new(*pid, v);
+                    }
+                    total += 1;
+                }
+                DiagServerResult::OK
+            }
+            Err(e) => h.record_error(e),
+        };
+    }
+    *value_count = total as u32;
+    if total > out.len() {
+        DiagServerResult::BufferTooSmall
+    } else {
+        DiagServerResult::OK
+    }
+}
+
+/// Reads many scaled Service 01 PIDs from the ECU behind `handle`, packing up to 6 PIDs into each request.
+///
+/// Unlike [query_pids_obd2_handle], no names are decoded or copied, so this is the one to use
+/// for sampling PIDs at a high rate.
+///
+/// ## Parameters
+/// * pids - PIDs to read. PIDs which are not scaled numbers are not requested, and return [DiagServerResult::ParameterInvalid]
+/// * pid_count - Number of PIDs in `pids`
+/// * results - Array of `pid_count` results, set to the result of each PID
+/// * values - Array of `pid_count` values, set to the values of each successful PID
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the results were written, even if individual PIDs failed
+#[no_mangle]
+pub extern "C" fn query_pids_scaled_obd2_handle(
+    handle: *mut Obd2ServerHandle,
+    pids: *const u8,
+    pid_count: u32,
+    results: *mut DiagServerResult,
+    values: *mut ObdScaledPidValues,
+) -> DiagServerResult {
+    let h = match unsafe { handle.as_mut() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    if pid_count == 0 {
+        return DiagServerResult::OK;
+    }
+    if pids.is_null() || results.is_null() || values.is_null() {
+        return DiagServerResult::ParameterInvalid;
+    }
+    let raw = unsafe { core::slice::from_raw_parts(pids, pid_count as usize) };
+    let results = unsafe { core::slice::from_raw_parts_mut(results, pid_count as usize) };
+    let values = unsafe { core::slice::from_raw_parts_mut(values, pid_count as usize) };
+
+    let query: Vec<DataPid> = raw.iter().map(|p| DataPid::from(*p)).collect();
+    for ((res, result), value) in h
+        .server
+        .query_pids_scaled(&query)
+        .into_iter()
+        .zip(results)
+        .zip(values)
+    {
+        *result = match res {
+            Ok(decoded) => {
+                let v = decoded.get_values();
+                value.pid = u8::from(decoded.get_pid());
+                value.value_count = v.len() as u8;
+                value.values[..v.len()].copy_from_slice(v);
+                DiagServerResult::OK
+            }
+            Err(e) => h.record_error(e),
+        };
+    }
+    DiagServerResult::OK
+}
+
+/// Looks up the name and unit of a value read with [query_pids_scaled_obd2_handle]
+///
+/// ## Parameters
+/// * pid - PID the value belongs to
+/// * idx - Index of the value in [ObdScaledPidValues::values]
+/// * unit - Set to the unit of the value
+/// * name - Buffer to write the NUL terminated name of the value into, or null. Names longer than the buffer are truncated
+/// * name_len - Capacity of `name`
+///
+/// ## Returns
+/// [DiagServerResult::ParameterInvalid] if the PID is not a scaled number, or has no value `idx`
+#[no_mangle]
+pub extern "C" fn get_obd_scaled_value_info(
+    pid: u8,
+    idx: u32,
+    unit: &mut ObdValueUnit,
+    name: *mut c_char,
+    name_len: u32,
+) -> DiagServerResult {
+    let pid = DataPid::from(pid);
+    let (n, u) = match (
+        pid.get_scaled_name(idx as usize),
+        pid.get_scaled_unit(idx as usize),
+    ) {
+        (Some(n), Some(u)) => (n, u),
+        _ => return DiagServerResult::ParameterInvalid,
+    };
+    *unit = u.into();
+    if !name.is_null() && name_len != 0 {
+        copy_name(n, unsafe {
+            core::slice::from_raw_parts_mut(name, name_len as usize)
+        });
+    }
+    DiagServerResult::OK
+}
+
+/// Creates a new functional OBD2 client over a raw CAN channel, and returns a handle to it.
+/// This configures and opens the channel
+///
+/// ## Parameters
+/// * options - Functional client settings
+/// * callbacks - Callback handler for the client's CAN channel
+/// * handle - Set to the new client handle if creation was successful
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the client was created. The handle must be freed with [destroy_obd2_functional_handle]
+#[no_mangle]
+pub extern "C" fn create_obd2_functional_handle(
+    options: Obd2FunctionalOptions,
+    callbacks: CanChannelCallbackHandler,
+    handle: &mut *mut Obd2FunctionalHandle,
+) -> DiagServerResult {
+    *handle = core::ptr::null_mut();
+    match Obd2FunctionalClient::new(callbacks, options) {
+        Ok(client) => {
+            *handle = Box::into_raw(Box::new(Obd2FunctionalHandle { client }));
+            DiagServerResult::OK
+        }
+        Err(e) => e.into(),
+    }
+}
+
+/// Sends a functional request, and collects the response of every ECU that answers
+///
+/// ## Parameters
+/// * handle - Client to send the request with
+/// * payload - Request to send, starting with the service ID. At most 7 bytes
+/// * payload_len - Length of `payload`
+/// * responses - Array of `response_capacity` responses, each with its own response buffer.
+/// These are written in order of responder ID
+/// * response_capacity - Number of responses `responses` can hold
+/// * response_count - Set to the number of ECUs that responded
+///
+/// ## Returns
+/// [DiagServerResult::BufferTooSmall] if more ECUs responded than `responses` can hold.
+/// Otherwise, [DiagServerResult::OK] if the request was sent, even if individual ECUs failed
+#[no_mangle]
+pub extern "C" fn send_functional_obd2_handle(
+    handle: *mut Obd2FunctionalHandle,
+    payload: *const u8,
+    payload_len: u32,
+    responses: *mut ObdFunctionalResponse,
+    response_capacity: u32,
+    response_count: &mut u32,
+) -> DiagServerResult {
+    *response_count = 0;
+    let h = match unsafe { handle.as_mut() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    if payload.is_null() || payload_len == 0 {
+        return DiagServerResult::ParameterInvalid;
+    }
+    let payload = unsafe { core::slice::from_raw_parts(payload, payload_len as usize) };
+    let out: &mut [ObdFunctionalResponse] = if responses.is_null() || response_capacity == 0 {
+        &mut []
+    } else {
+        unsafe { core::slice::from_raw_parts_mut(responses, response_capacity as usize) }
+    };
+    let found = match h.client.send_functional(payload) {
+        Ok(r) => r,
+        Err(e) => return e.into(),
+    };
+    let count = found.len();
+    *response_count = count as u32;
+    for (item, res) in out.iter_mut().zip(found) {
+        item.responder_id = res.responder_id;
+        item.ecu_error = 0x00;
+        item.result = match res.response {
+            Ok(resp) => {
+                copy_response_to_buffer(&resp, item.resp_buf, item.resp_buf_len, &mut item.resp_len)
+            }
+            Err(e) => {
+                item.resp_len = 0;
+                if let DiagError::ECUError { code, .. } = e {
+                    item.ecu_error = code;
+                }
+                e.into()
+            }
+        };
+    }
+    if count > out.len() {
+        DiagServerResult::BufferTooSmall
+    } else {
+        DiagServerResult::OK
+    }
+}
+
+/// Destroys a functional client created with [create_obd2_functional_handle].
+/// The handle must not be used after this call
+#[no_mangle]
+pub extern "C" fn destroy_obd2_functional_handle(handle: *mut Obd2FunctionalHandle) {
+    if !handle.is_null() {
+        drop(unsafe { Box::from_raw(handle) })
+    }
+}
+
+/// Gets the last negative response code the ECU behind `handle` responded with
+#[no_mangle]
+pub extern "C" fn get_ecu_error_code_obd2_handle(handle: *const Obd2ServerHandle) -> u8 {
+    match unsafe { handle.as_ref() } {
+        Some(h) => h.ecu_error,
+        None => 0x00,
+    }
+}
+
+/// Destroys an OBD2 server created with [create_obd2_server_handle_over_isotp].
+/// The handle must not be used after this call
+#[no_mangle]
+pub extern "C" fn destroy_obd2_server_handle(handle: *mut Obd2ServerHandle) {
+    if !handle.is_null() {
+        drop(unsafe { Box::from_raw(handle) })
+    }
+}
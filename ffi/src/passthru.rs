@@ -0,0 +1,100 @@
+//! FFI bindings for enumerating installed Passthru (SAE J2534) adapters
+//!
+//! Only available when the library is built with the `passthru` feature
+
+use core::ffi::c_char;
+
+use ecu_diagnostics::hardware::{passthru::PassthruScanner, HardwareInfo, HardwareScanner};
+
+use crate::DiagServerResult;
+
+/// Maximum length of a [PassthruDeviceInfo] string, including the NUL terminator
+pub const PASSTHRU_INFO_STR_MAX_LEN: usize = 260;
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+/// Installed Passthru adapter, found by [get_passthru_devices]
+pub struct PassthruDeviceInfo {
+    /// NUL terminated name of the adapter
+    pub name: [c_char; PASSTHRU_INFO_STR_MAX_LEN],
+    /// NUL terminated vendor of the adapter
+    pub vendor: [c_char; PASSTHRU_INFO_STR_MAX_LEN],
+    /// NUL terminated path of the adapter's function library
+    pub library_location: [c_char; PASSTHRU_INFO_STR_MAX_LEN],
+    /// Adapter supports ISO-TP
+    pub iso_tp: bool,
+    /// Adapter supports raw CAN
+    pub can: bool,
+    /// Adapter supports ISO9141 (K-Line)
+    pub kline: bool,
+    /// Adapter supports ISO14230 (KWP2000 over K-Line)
+    pub kline_kwp: bool,
+    /// Adapter supports SAE J1850
+    pub sae_j1850: bool,
+    /// Adapter supports SCI
+    pub sci: bool,
+}
+
+/// Copies a string into a NUL terminated buffer, truncating it if it is too long
+fn copy_str(src: &str) -> [c_char; PASSTHRU_INFO_STR_MAX_LEN] {
+    let mut dst = [0 as c_char; PASSTHRU_INFO_STR_MAX_LEN];
+    let len = src.len().min(PASSTHRU_INFO_STR_MAX_LEN - 1);
+    for (d, b) in dst.iter_mut().zip(&src.as_bytes()[..len]) {
+        *d = *b as c_char;
+    }
+    dst
+}
+
+impl From<&HardwareInfo> for PassthruDeviceInfo {
+    fn from(info: &HardwareInfo) -> Self {
+        Self {
+            name: copy_str(&info.name),
+            vendor: copy_str(info.vendor.as_deref().unwrap_or_default()),
+            library_location: copy_str(info.library_location.as_deref().unwrap_or_default()),
+            iso_tp: info.capabilities.iso_tp,
+            can: info.capabilities.can,
+            kline: info.capabilities.kline,
+            kline_kwp: info.capabilities.kline_kwp,
+            sae_j1850: info.capabilities.sae_j1850,
+            sci: info.capabilities.sci,
+        }
+    }
+}
+
+/// Lists the installed Passthru adapters.
+///
+/// Registry keys (Windows) or JSON files (Unix) which have not changed since the last scan
+/// in this process are not read again, so calling this repeatedly is cheap.
+///
+/// ## Parameters
+/// * devices - Buffer to write the adapters into
+/// * capacity - Capacity of `devices`
+/// * count - Set to the number of installed adapters
+///
+/// ## Returns
+/// [DiagServerResult::BufferTooSmall] if there are more than `capacity` adapters. The first
+/// `capacity` adapters are still written into `devices`
+#[no_mangle]
+pub extern "C" fn get_passthru_devices(
+    devices: *mut PassthruDeviceInfo,
+    capacity: u32,
+    count: &mut u32,
+) -> DiagServerResult {
+    let found = PassthruScanner::new().list_devices();
+    *count = found.len() as u32;
+    if found.is_empty() {
+        return DiagServerResult::OK;
+    }
+    if devices.is_null() {
+        return DiagServerResult::BufferTooSmall;
+    }
+    let out = unsafe { core::slice::from_raw_parts_mut(devices, capacity as usize) };
+    for (dst, info) in out.iter_mut().zip(&found) {
+        *dst = info.into();
+    }
+    if found.len() > out.len() {
+        DiagServerResult::BufferTooSmall
+    } else {
+        DiagServerResult::OK
+    }
+}
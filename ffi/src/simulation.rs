@@ -0,0 +1,222 @@
+//! FFI bindings for simulated ECUs
+//!
+//! A [SimulatedEcu] can be used in place of an [crate::IsoTpChannelCallbackHandler]
+//! to load test servers without any hardware. This is only available with the
+//! `simulation` feature enabled.
+
+use alloc::boxed::Box;
+use core::time::Duration;
+
+pub use ecu_diagnostics::hardware::simulation::SimulatedEcu;
+use ecu_diagnostics::hardware::simulation::{ResponseTime, SimulatedRule};
+
+use crate::{
+    uds::{new_handle, UdsServerHandle, UdsServerOptions},
+    DiagServerResult, IsoTPSettings,
+};
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+/// Distribution the response times of a simulated ECU are drawn from, see [SimulatedResponseTime]
+pub enum SimulatedResponseTimeKind {
+    /// Always respond after `min_us`
+    Fixed,
+    /// Respond after a time evenly distributed between `min_us` and `max_us`
+    Uniform,
+    /// Respond after at least `min_us`, plus an exponentially distributed extra time with
+    /// an average of `mean_extra_us`. This gives the long tail real ECUs have under load
+    LongTail,
+}
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+/// Response time of a simulated ECU. This is the time the ECU takes to process a request,
+/// not including ISO-TP transfer times. Fields which `kind` does not use are ignored
+pub struct SimulatedResponseTime {
+    /// Distribution of the response times
+    pub kind: SimulatedResponseTimeKind,
+    /// Shortest response time in microseconds
+    pub min_us: u32,
+    /// Longest response time in microseconds. Only used by [SimulatedResponseTimeKind::Uniform]
+    pub max_us: u32,
+    /// Average time added to `min_us` in microseconds. Only used by [SimulatedResponseTimeKind::LongTail]
+    pub mean_extra_us: u32,
+}
+
+impl From<SimulatedResponseTime> for ResponseTime {
+    fn from(t: SimulatedResponseTime) -> Self {
+        let min = Duration::from_micros(t.min_us as u64);
+        match t.kind {
+            SimulatedResponseTimeKind::Fixed => ResponseTime::Fixed(min),
+            SimulatedResponseTimeKind::Uniform => ResponseTime::Uniform {
+                min,
+                max: Duration::from_micros(t.max_us as u64),
+            },
+            SimulatedResponseTimeKind::LongTail => ResponseTime::LongTail {
+                min,
+                mean_extra: Duration::from_micros(t.mean_extra_us as u64),
+            },
+        }
+    }
+}
+
+/// Creates a new simulated ECU with no rules, whose response times are evenly
+/// distributed between `min_response_us` and `max_response_us`
+///
+/// ## Parameters
+/// * seed - Seed for the response time distribution
+///
+/// ## Returns
+/// The ECU, which must be freed with [destroy_simulated_ecu]
+#[no_mangle]
+pub extern "C" fn create_simulated_ecu(
+    min_response_us: u32,
+    max_response_us: u32,
+    seed: u64,
+) -> *mut SimulatedEcu {
+    create_simulated_ecu_with_timing(
+        SimulatedResponseTime {
+            kind: SimulatedResponseTimeKind::Uniform,
+            min_us: min_response_us,
+            max_us: max_response_us,
+            mean_extra_us: 0,
+        },
+        seed,
+    )
+}
+
+/// Creates a new simulated ECU with no rules
+///
+/// ## Parameters
+/// * timing - Response time of the ECU, unless a rule overrides it with [set_simulated_ecu_rule_timing]
+/// * seed - Seed for the response time distribution
+///
+/// ## Returns
+/// The ECU, which must be freed with [destroy_simulated_ecu]
+#[no_mangle]
+pub extern "C" fn create_simulated_ecu_with_timing(
+    timing: SimulatedResponseTime,
+    seed: u64,
+) -> *mut SimulatedEcu {
+    Box::into_raw(Box::new(SimulatedEcu::new(timing.into(), seed)))
+}
+
+/// Adds a rule to a simulated ECU. When several rules match a request,
+/// the one with the longest prefix is used
+///
+/// ## Parameters
+/// * prefix - Requests starting with these bytes match the rule
+/// * resp - Response to matching requests, beginning with SID + 0x40. If empty, the ECU does not respond
+/// * pending_count - Number of response pending (0x78) responses to send before the response
+/// * pending_interval_us - Time between response pending responses
+#[no_mangle]
+pub extern "C" fn add_simulated_ecu_rule(
+    ecu: *mut SimulatedEcu,
+    prefix: *const u8,
+    prefix_len: u32,
+    resp: *const u8,
+    resp_len: u32,
+    pending_count: u32,
+    pending_interval_us: u32,
+) -> DiagServerResult {
+    let ecu = match unsafe { ecu.as_mut() } {
+        Some(e) => e,
+        None => return DiagServerResult::ParameterInvalid,
+    };
+    let prefix = unsafe { bytes(prefix, prefix_len) };
+    let resp = unsafe { bytes(resp, resp_len) };
+    ecu.add_rule(SimulatedRule::new(prefix, resp).with_pending(
+        pending_count,
+        Duration::from_micros(pending_interval_us as u64),
+    ));
+    DiagServerResult::OK
+}
+
+/// Sets the response time of the rule of a simulated ECU whose prefix is exactly `prefix`,
+/// instead of the ECU's response time
+///
+/// ## Parameters
+/// * prefix - Prefix the rule was added with
+/// * timing - Response time of the rule. If null, the rule uses the ECU's response time again
+///
+/// ## Returns
+/// [DiagServerResult::ParameterInvalid] if the ECU has no rule with this prefix
+#[no_mangle]
+pub extern "C" fn set_simulated_ecu_rule_timing(
+    ecu: *mut SimulatedEcu,
+    prefix: *const u8,
+    prefix_len: u32,
+    timing: *const SimulatedResponseTime,
+) -> DiagServerResult {
+    let ecu = match unsafe { ecu.as_mut() } {
+        Some(e) => e,
+        None => return DiagServerResult::ParameterInvalid,
+    };
+    let prefix = unsafe { bytes(prefix, prefix_len) };
+    let timing = unsafe { timing.as_ref() }.map(|t| (*t).into());
+    match ecu.set_rule_timing(prefix, timing) {
+        true => DiagServerResult::OK,
+        false => DiagServerResult::ParameterInvalid,
+    }
+}
+
+/// Sets the negative response code a simulated ECU responds with to requests that match
+/// no rule. If `nrc` is 0, the ECU does not respond to them
+#[no_mangle]
+pub extern "C" fn set_simulated_ecu_unsupported_nrc(ecu: *mut SimulatedEcu, nrc: u8) {
+    if let Some(e) = unsafe { ecu.as_mut() } {
+        e.set_unsupported_nrc(if nrc == 0 { None } else { Some(nrc) })
+    }
+}
+
+/// Returns the number of requests a simulated ECU has received
+#[no_mangle]
+pub extern "C" fn get_simulated_ecu_request_count(ecu: *const SimulatedEcu) -> u64 {
+    match unsafe { ecu.as_ref() } {
+        Some(e) => e.request_count(),
+        None => 0,
+    }
+}
+
+/// Creates a new UDS diagnostic server which talks to a simulated ECU, and returns a handle to it.
+/// The ECU can still be changed and must still be freed by the caller. The server keeps
+/// its own reference to it
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the server was created. The handle must be freed with [crate::uds::destroy_uds_server_handle]
+#[no_mangle]
+pub extern "C" fn create_uds_server_handle_over_simulation(
+    settings: UdsServerOptions,
+    iso_tp_opts: IsoTPSettings,
+    ecu: *const SimulatedEcu,
+    handle: &mut *mut UdsServerHandle,
+) -> DiagServerResult {
+    *handle = core::ptr::null_mut();
+    let ecu = match unsafe { ecu.as_ref() } {
+        Some(e) => e.clone(),
+        None => return DiagServerResult::ParameterInvalid,
+    };
+    match new_handle(settings, iso_tp_opts, ecu) {
+        Ok(h) => {
+            *handle = Box::into_raw(Box::new(h));
+            DiagServerResult::OK
+        }
+        Err(e) => e,
+    }
+}
+
+/// Frees a simulated ECU. Servers created over it keep working until they are destroyed
+#[no_mangle]
+pub extern "C" fn destroy_simulated_ecu(ecu: *mut SimulatedEcu) {
+    if !ecu.is_null() {
+        drop(unsafe { Box::from_raw(ecu) })
+    }
+}
+
+unsafe fn bytes<'a>(ptr: *const u8, len: u32) -> &'a [u8] {
+    if ptr.is_null() || len == 0 {
+        &[]
+    } else {
+        core::slice::from_raw_parts(ptr, len as usize)
+    }
+}
@@ -0,0 +1,1349 @@
+//! FFI bindings for the UDS diagnostic server
+//!
+//! Servers are created as opaque [UdsServerHandle]s, one per ECU. Each call that takes
+//! a handle only touches that server, so many servers can be used from one process.
+
+use alloc::{boxed::Box, sync::Arc, vec::Vec};
+use core::ffi::{c_char, c_void};
+
+pub use ecu_diagnostics::dtc::DTC_NAME_MAX_LEN;
+pub use ecu_diagnostics::keep_alive::KeepAliveScheduler;
+pub use ecu_diagnostics::metrics::{ServerMetrics, ServerMetricsSnapshot};
+pub use ecu_diagnostics::uds::{
+    sweep_dtcs, DownloadOptions, DtcSweepOptions, DtcSweepTarget, PeriodicDataStream,
+    PeriodicSample, PeriodicTransmissionMode, ScalingConverter, TransferProgress, UDSCommand,
+    UdsCmd, UdsDiagnosticServer, UdsServerOptions, UdsVoidHandler, PERIODIC_SAMPLE_MAX_LEN,
+};
+use ecu_diagnostics::{
+    dtc::{DTCFormatType, DTCStatus, DTC},
+    DiagnosticServer,
+};
+
+use crate::{
+    copy_response_to_buffer, DiagError, DiagServerResult, IsoTPChannel, IsoTPSettings,
+    IsoTpChannelCallbackHandler,
+};
+
+#[repr(C)]
+#[derive(Debug)]
+/// Payload to send to the UDS server
+pub struct UdsPayload {
+    /// Service ID
+    pub sid: UDSCommand,
+    /// Argument length
+    pub args_len: u32,
+    /// Pointer to arguments array
+    pub args_ptr: *mut u8,
+}
+
+#[repr(C)]
+#[derive(Debug)]
+/// One request of a batch sent with [send_batch_uds_handle]
+pub struct UdsBatchItem {
+    /// Payload to send to the ECU. This is never modified
+    pub payload: UdsPayload,
+    /// If set to false, no response will be read from the ECU for this request
+    pub response_require: bool,
+    /// Caller owned buffer to write the ECUs response into.
+    /// The response will begin with SID + 0x40
+    pub resp_buf: *mut u8,
+    /// Capacity of `resp_buf` in bytes
+    pub resp_buf_len: u32,
+    /// Set to the length of the ECUs response
+    pub resp_len: u32,
+    /// Set to the result of this request
+    pub result: DiagServerResult,
+    /// Set to the ECUs negative response code if `result` is [DiagServerResult::ECUError]
+    pub ecu_error: u8,
+}
+
+/// Callback for requests submitted with [submit_payload_uds_handle]
+///
+/// ## Parameters
+/// * user_ctx - Context pointer given to [register_uds_completion_callback]
+/// * request_id - ID of the completed request, as returned by [submit_payload_uds_handle]
+/// * result - Result of the request
+/// * ecu_error - The ECUs negative response code if `result` is [DiagServerResult::ECUError]
+/// * resp - The ECUs response, beginning with SID + 0x40. This is only valid until the callback returns
+/// * resp_len - Length of `resp`
+pub type UdsCompletionCallback = extern "C" fn(
+    user_ctx: *mut c_void,
+    request_id: u32,
+    result: DiagServerResult,
+    ecu_error: u8,
+    resp: *const u8,
+    resp_len: u32,
+);
+
+/// Callback for the progress of [download_uds_handle]. This is called on the thread
+/// that called [download_uds_handle]
+///
+/// ## Parameters
+/// * user_ctx - Context pointer given to [download_uds_handle]
+/// * progress - Progress of the download. The throughput in bytes per second is
+/// `bytes_sent * 1000000 / elapsed_us`
+pub type UdsTransferProgressCallback =
+    extern "C" fn(user_ctx: *mut c_void, progress: *const TransferProgress);
+
+/// Registered completion callback, and the context to hand back to it
+#[derive(Debug, Clone, Copy)]
+struct CompletionHandler {
+    callback: UdsCompletionCallback,
+    user_ctx: *mut c_void,
+}
+
+// The user context is opaque to the library, and is only ever handed back to the callback
+unsafe impl Send for CompletionHandler {}
+
+impl CompletionHandler {
+    fn complete(self, request_id: u32, res: Result<Vec<u8>, DiagError>) {
+        match res {
+            Ok(resp) => (self.callback)(
+                self.user_ctx,
+                request_id,
+                DiagServerResult::OK,
+                0x00,
+                resp.as_ptr(),
+                resp.len() as u32,
+            ),
+            Err(e) => {
+                let ecu_error = match e {
+                    DiagError::ECUError { code, .. } => code,
+                    _ => 0x00,
+                };
+                (self.callback)(
+                    self.user_ctx,
+                    request_id,
+                    e.into(),
+                    ecu_error,
+                    core::ptr::null(),
+                    0,
+                )
+            }
+        }
+    }
+}
+
+#[repr(C)]
+#[derive(Debug)]
+/// One ECU to read DTCs from with [sweep_dtcs_uds_handles]
+pub struct UdsDtcSweepTarget {
+    /// Server for the ECU. A handle can only be used by one target of a sweep
+    pub handle: *mut UdsServerHandle,
+    /// Adapter the server communicates through. Targets with the same adapter share
+    /// its concurrency limit. This is only used to group targets, so can be any value
+    pub adapter: u32,
+    /// Set to the result of reading this ECU's DTCs
+    pub result: DiagServerResult,
+    /// Set to the ECUs negative response code if `result` is [DiagServerResult::ECUError]
+    pub ecu_error: u8,
+    /// Set to the number of DTCs the ECU reported
+    pub dtc_count: u32,
+}
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone, Default)]
+/// Diagnostic trouble code, as read from a UDS ECU
+pub struct UdsDtc {
+    /// The raw value of the DTC according to the ECU
+    pub raw: u32,
+    /// Status byte of the DTC according to the ECU
+    pub status: u8,
+    /// Indication if the DTC turns on the MIL lamp
+    pub mil_on: bool,
+    /// DTC format identifier reported by the ECU (0x00 ISO15031-6, 0x01 ISO14229-1,
+    /// 0x02 SAE J1939-73, 0x03 ISO11992-4). 0xFE if the ECU did not report it, and
+    /// 0xFF marks a 2 byte KWP2000 DTC. Both are reserved in ISO14229 so never reported by an ECU
+    pub format: u8,
+}
+
+impl From<DTC> for UdsDtc {
+    fn from(dtc: DTC) -> Self {
+        Self {
+            raw: dtc.raw,
+            status: match dtc.status {
+                DTCStatus::Unknown(s) => s,
+                _ => 0,
+            },
+            mil_on: dtc.mil_on,
+            format: match dtc.format {
+                DTCFormatType::Iso15031_6 => 0x00,
+                DTCFormatType::Iso14229_1 => 0x01,
+                DTCFormatType::SaeJ1939_73 => 0x02,
+                DTCFormatType::Iso11992_4 => 0x03,
+                // Not reported by the ECU
+                DTCFormatType::Unknown(0) => 0xFE,
+                DTCFormatType::Unknown(x) => x,
+                DTCFormatType::TwoByteHexKwp => 0xFF,
+            },
+        }
+    }
+}
+
+impl From<UdsDtc> for DTC {
+    fn from(dtc: UdsDtc) -> Self {
+        Self {
+            format: match dtc.format {
+                0x00 => DTCFormatType::Iso15031_6,
+                0x01 => DTCFormatType::Iso14229_1,
+                0x02 => DTCFormatType::SaeJ1939_73,
+                0x03 => DTCFormatType::Iso11992_4,
+                0xFE => DTCFormatType::Unknown(0),
+                0xFF => DTCFormatType::TwoByteHexKwp,
+                x => DTCFormatType::Unknown(x),
+            },
+            raw: dtc.raw,
+            status: DTCStatus::Unknown(dtc.status),
+            mil_on: dtc.mil_on,
+            readiness_flag: false,
+        }
+    }
+}
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone, Default)]
+/// DTC read by [sweep_dtcs_uds_handles], along with the ECU it came from
+pub struct UdsSweepDtc {
+    /// Send ID of the ECU's server
+    pub send_id: u32,
+    /// Receive ID of the ECU's server
+    pub recv_id: u32,
+    /// The DTC
+    pub dtc: UdsDtc,
+}
+
+/// Opaque handle to a running UDS diagnostic server
+#[derive(Debug)]
+pub struct UdsServerHandle {
+    server: UdsDiagnosticServer,
+    ecu_error: u8,
+    completion: Option<CompletionHandler>,
+    next_request_id: u32,
+}
+
+impl UdsServerHandle {
+    /// Runs a UDS payload on the server, returning the ECUs full response
+    /// (Beginning with SID + 0x40). If no response is required, an empty response is returned
+    pub(crate) fn run_payload(
+        &mut self,
+        payload: &UdsPayload,
+        response_require: bool,
+    ) -> Result<Vec<u8>, DiagServerResult> {
+        let args = unsafe { payload_args(payload) };
+        let res = if response_require {
+            self.server.execute_command_with_response(payload.sid, args)
+        } else {
+            self.server
+                .execute_command(payload.sid, args)
+                .map(|_| Vec::new())
+        };
+        res.map_err(|e| self.record_error(e))
+    }
+
+    /// Converts a server error into its FFI result, keeping track of the ECUs NRC
+    pub(crate) fn record_error(&mut self, e: DiagError) -> DiagServerResult {
+        if let DiagError::ECUError { code, .. } = e {
+            self.ecu_error = code;
+        }
+        e.into()
+    }
+}
+
+/// Runs a batch of requests on the server behind `h`, writing each result into its item
+fn send_batch(
+    h: &mut UdsServerHandle,
+    items: &mut [UdsBatchItem],
+    defer_tester_present: bool,
+) -> DiagServerResult {
+    let cmds = items
+        .iter()
+        .map(|i| {
+            UdsCmd::new(
+                i.payload.sid,
+                unsafe { payload_args(&i.payload) },
+                i.response_require,
+            )
+        })
+        .collect();
+    let results = match h.server.execute_batch(cmds, defer_tester_present) {
+        Ok(r) => r,
+        Err(e) => return h.record_error(e),
+    };
+    for (item, res) in items.iter_mut().zip(results) {
+        item.ecu_error = 0x00;
+        item.result = match res {
+            Ok(resp) => {
+                copy_response_to_buffer(&resp, item.resp_buf, item.resp_buf_len, &mut item.resp_len)
+            }
+            Err(e) => {
+                item.resp_len = 0;
+                if let DiagError::ECUError { code, .. } = e {
+                    item.ecu_error = code;
+                }
+                h.record_error(e)
+            }
+        };
+    }
+    DiagServerResult::OK
+}
+
+/// Returns the argument slice of a payload
+pub(crate) unsafe fn payload_args(payload: &UdsPayload) -> &[u8] {
+    if payload.args_ptr.is_null() || payload.args_len == 0 {
+        &[]
+    } else {
+        core::slice::from_raw_parts(payload.args_ptr, payload.args_len as usize)
+    }
+}
+
+pub(crate) fn new_handle<C: IsoTPChannel + 'static>(
+    settings: UdsServerOptions,
+    iso_tp_opts: IsoTPSettings,
+    channel: C,
+) -> Result<UdsServerHandle, DiagServerResult> {
+    UdsDiagnosticServer::new_over_iso_tp(settings, channel, iso_tp_opts, UdsVoidHandler)
+        .map(|server| UdsServerHandle {
+            server,
+            ecu_error: 0x00,
+            completion: None,
+            next_request_id: 0,
+        })
+        .map_err(|e| e.into())
+}
+
+/// Creates a new UDS diagnostic server using an ISO-TP callback handler, and returns a handle to it
+///
+/// ## Parameters
+/// * settings - UDS Server settings
+/// * iso_tp_opts - ISO-TP settings to configure the channel with
+/// * callbacks - Callback handler for the servers channel. The same callbacks can be used
+/// for multiple servers, with a different `user_ctx` per server
+/// * handle - Set to the new server handle if creation was successful
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the server was created. The handle must be freed with [destroy_uds_server_handle]
+#[no_mangle]
+pub extern "C" fn create_uds_server_handle_over_isotp(
+    settings: UdsServerOptions,
+    iso_tp_opts: IsoTPSettings,
+    callbacks: IsoTpChannelCallbackHandler,
+    handle: &mut *mut UdsServerHandle,
+) -> DiagServerResult {
+    *handle = core::ptr::null_mut();
+    match new_handle(settings, iso_tp_opts, callbacks) {
+        Ok(h) => {
+            *handle = Box::into_raw(Box::new(h));
+            DiagServerResult::OK
+        }
+        Err(e) => e,
+    }
+}
+
+/// Sends a payload to the UDS server behind `handle`. See [send_payload_uds] for how the
+/// response is returned, and [free_uds_payload_response] for how to free it
+#[no_mangle]
+pub extern "C" fn send_payload_uds_handle(
+    handle: *mut UdsServerHandle,
+    payload: &mut UdsPayload,
+    response_require: bool,
+) -> DiagServerResult {
+    match unsafe { handle.as_mut() } {
+        Some(h) => send_payload(h, payload, response_require),
+        None => DiagServerResult::NoDiagnosticServer,
+    }
+}
+
+/// Sends a payload to the UDS server behind `handle`, writing the response into a
+/// caller provided buffer. See [send_payload_uds_into]
+#[no_mangle]
+pub extern "C" fn send_payload_uds_handle_into(
+    handle: *mut UdsServerHandle,
+    payload: &UdsPayload,
+    response_require: bool,
+    resp_buf: *mut u8,
+    resp_buf_len: u32,
+    resp_len: &mut u32,
+) -> DiagServerResult {
+    *resp_len = 0;
+    match unsafe { handle.as_mut() } {
+        Some(h) => match h.run_payload(payload, response_require) {
+            Ok(resp) => copy_response_to_buffer(&resp, resp_buf, resp_buf_len, resp_len),
+            Err(e) => e,
+        },
+        None => DiagServerResult::NoDiagnosticServer,
+    }
+}
+
+/// Sends a batch of payloads to the UDS server behind `handle`.
+///
+/// The whole batch is executed by the server thread in one go, in order, and the
+/// calling thread is only woken up once every request has completed. Failed requests
+/// are not retried.
+///
+/// ## Parameters
+/// * handle - Server to run the batch on
+/// * items - Array of requests. The result, response and NRC of each request is written back into its item
+/// * item_count - Number of items in `items`
+/// * defer_tester_present - If true, tester present is only sent between batches, and never
+/// in between requests of this batch. Only use this if the batch completes within the ECUs session timeout.
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the batch was executed. Each item then holds its own result.
+/// Any other value means the batch could not be run at all.
+#[no_mangle]
+pub extern "C" fn send_batch_uds_handle(
+    handle: *mut UdsServerHandle,
+    items: *mut UdsBatchItem,
+    item_count: u32,
+    defer_tester_present: bool,
+) -> DiagServerResult {
+    let h = match unsafe { handle.as_mut() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    if item_count == 0 {
+        return DiagServerResult::OK;
+    }
+    if items.is_null() {
+        return DiagServerResult::ParameterInvalid;
+    }
+    send_batch(
+        h,
+        unsafe { core::slice::from_raw_parts_mut(items, item_count as usize) },
+        defer_tester_present,
+    )
+}
+
+/// Registers the callback that requests submitted with [submit_payload_uds_handle] complete to.
+///
+/// The callback is called on the server's background thread, so it should return quickly
+/// (For example, by posting the result to the caller's event loop). Requests that have already
+/// been submitted will still complete to the previously registered callback.
+#[no_mangle]
+pub extern "C" fn register_uds_completion_callback(
+    handle: *mut UdsServerHandle,
+    callback: UdsCompletionCallback,
+    user_ctx: *mut c_void,
+) -> DiagServerResult {
+    match unsafe { handle.as_mut() } {
+        Some(h) => {
+            h.completion = Some(CompletionHandler { callback, user_ctx });
+            DiagServerResult::OK
+        }
+        None => DiagServerResult::NoDiagnosticServer,
+    }
+}
+
+/// Submits a payload to the UDS server behind `handle`, without waiting for the ECU to respond.
+///
+/// Submitted requests are executed in order by the server thread, and their results are
+/// delivered to the callback registered with [register_uds_completion_callback]. Any number of
+/// requests can be in flight at once. Failed requests are not retried.
+///
+/// ## Parameters
+/// * handle - Server to submit the request to
+/// * payload - Payload to send to the ECU. The arguments are copied, so the payload can be reused straight away
+/// * response_require - If set to false, no response will be read from the ECU
+/// * request_id - Set to the ID the completion callback will be called with
+///
+/// ## Returns
+/// [DiagServerResult::NoHandler] if no completion callback has been registered
+#[no_mangle]
+pub extern "C" fn submit_payload_uds_handle(
+    handle: *mut UdsServerHandle,
+    payload: &UdsPayload,
+    response_require: bool,
+    request_id: &mut u32,
+) -> DiagServerResult {
+    let h = match unsafe { handle.as_mut() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    let completion = match h.completion {
+        Some(c) => c,
+        None => return DiagServerResult::NoHandler,
+    };
+    let id = h.next_request_id;
+    let res = h.server.execute_command_async(
+        payload.sid,
+        unsafe { payload_args(payload) },
+        response_require,
+        move |res| completion.complete(id, res),
+    );
+    match res {
+        Ok(_) => {
+            h.next_request_id = h.next_request_id.wrapping_add(1);
+            *request_id = id;
+            DiagServerResult::OK
+        }
+        Err(e) => h.record_error(e),
+    }
+}
+
+/// Gets the last negative response code the ECU behind `handle` responded with
+#[no_mangle]
+pub extern "C" fn get_ecu_error_code_handle(handle: *const UdsServerHandle) -> u8 {
+    match unsafe { handle.as_ref() } {
+        Some(h) => h.ecu_error,
+        None => 0x00,
+    }
+}
+
+/// Opaque handle to the metrics of a UDS server, created with [create_uds_metrics_handle].
+///
+/// Unlike the server's own handle, this can be used from any thread whilst requests are in progress.
+/// It stays valid (But stops updating) once the server is destroyed
+#[derive(Debug)]
+pub struct UdsMetricsHandle {
+    metrics: Arc<ServerMetrics>,
+}
+
+/// Creates a handle to the metrics of the UDS server behind `handle`. Returns null if `handle` is null.
+///
+/// Like every other call taking the server's handle, this must not be called whilst another
+/// thread is using the server. The returned handle has no such restriction.
+/// Destroy it with [destroy_uds_metrics_handle]
+#[no_mangle]
+pub extern "C" fn create_uds_metrics_handle(
+    handle: *const UdsServerHandle,
+) -> *mut UdsMetricsHandle {
+    match unsafe { handle.as_ref() } {
+        Some(h) => Box::into_raw(Box::new(UdsMetricsHandle {
+            metrics: h.server.get_metrics(),
+        })),
+        None => core::ptr::null_mut(),
+    }
+}
+
+/// Copies the metrics behind `handle` into `metrics`.
+///
+/// Reading metrics never blocks, and can be done from any thread
+/// whilst requests are in progress.
+#[no_mangle]
+pub extern "C" fn read_uds_metrics(
+    handle: *const UdsMetricsHandle,
+    metrics: &mut ServerMetricsSnapshot,
+) -> DiagServerResult {
+    match unsafe { handle.as_ref() } {
+        Some(h) => {
+            *metrics = h.metrics.snapshot();
+            DiagServerResult::OK
+        }
+        None => DiagServerResult::NoDiagnosticServer,
+    }
+}
+
+/// Resets the metrics behind `handle` back to 0. Like [read_uds_metrics], this can be done from any thread
+#[no_mangle]
+pub extern "C" fn reset_uds_metrics(handle: *const UdsMetricsHandle) -> DiagServerResult {
+    match unsafe { handle.as_ref() } {
+        Some(h) => {
+            h.metrics.reset();
+            DiagServerResult::OK
+        }
+        None => DiagServerResult::NoDiagnosticServer,
+    }
+}
+
+/// Destroys a handle created with [create_uds_metrics_handle]
+#[no_mangle]
+pub extern "C" fn destroy_uds_metrics_handle(handle: *mut UdsMetricsHandle) {
+    if !handle.is_null() {
+        drop(unsafe { Box::from_raw(handle) })
+    }
+}
+
+/// Enables or disables the response cache of the UDS server behind `handle`.
+///
+/// Once enabled, reads of identification data identifiers (0xF180-0xF19F) are answered from
+/// the cache after the first read, until the session changes or the ECU is reset.
+/// Disabling the cache also clears it
+#[no_mangle]
+pub extern "C" fn set_uds_response_cache_enabled_handle(
+    handle: *mut UdsServerHandle,
+    enabled: bool,
+) -> DiagServerResult {
+    match unsafe { handle.as_mut() } {
+        Some(h) => {
+            h.server.response_cache_mut().set_enabled(enabled);
+            DiagServerResult::OK
+        }
+        None => DiagServerResult::NoDiagnosticServer,
+    }
+}
+
+/// Removes every cached response from the response cache of the UDS server behind `handle`
+#[no_mangle]
+pub extern "C" fn clear_uds_response_cache_handle(
+    handle: *mut UdsServerHandle,
+) -> DiagServerResult {
+    match unsafe { handle.as_mut() } {
+        Some(h) => {
+            h.server.response_cache_mut().clear();
+            DiagServerResult::OK
+        }
+        None => DiagServerResult::NoDiagnosticServer,
+    }
+}
+
+/// Copies the cached response to a request into a caller provided buffer, without
+/// sending anything to the ECU.
+///
+/// ## Parameters
+/// * handle - Server to query
+/// * request - Full request (SID + arguments)
+/// * request_len - Length of `request`
+/// * resp_buf - Buffer to copy the response into
+/// * resp_buf_len - Capacity of `resp_buf`
+/// * resp_len - Set to the length of the cached response, or 0 if there is no cached response
+#[no_mangle]
+pub extern "C" fn get_uds_cached_response_handle(
+    handle: *const UdsServerHandle,
+    request: *const u8,
+    request_len: u32,
+    resp_buf: *mut u8,
+    resp_buf_len: u32,
+    resp_len: &mut u32,
+) -> DiagServerResult {
+    *resp_len = 0;
+    let h = match unsafe { handle.as_ref() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    if request.is_null() || request_len == 0 {
+        return DiagServerResult::ParameterInvalid;
+    }
+    let request = unsafe { core::slice::from_raw_parts(request, request_len as usize) };
+    match h.server.response_cache().get(request) {
+        Some(resp) => copy_response_to_buffer(resp, resp_buf, resp_buf_len, resp_len),
+        None => DiagServerResult::OK,
+    }
+}
+
+/// Gets the number of requests the UDS server behind `handle` answered from its response cache,
+/// and the number of cacheable requests it had to send to the ECU
+#[no_mangle]
+pub extern "C" fn get_uds_response_cache_stats_handle(
+    handle: *const UdsServerHandle,
+    hits: &mut u64,
+    misses: &mut u64,
+) -> DiagServerResult {
+    match unsafe { handle.as_ref() } {
+        Some(h) => {
+            let stats = h.server.response_cache().stats();
+            *hits = stats.0;
+            *misses = stats.1;
+            DiagServerResult::OK
+        }
+        None => DiagServerResult::NoDiagnosticServer,
+    }
+}
+
+/// Creates a keep-alive scheduler for one bus. Servers joined to it with
+/// [set_keep_alive_scheduler_uds_handle] share one functional tester present (0x3E 0x80)
+/// per interval, rather than each sending their own
+///
+/// ## Parameters
+/// * functional_id - Functional address every ECU on the bus listens to
+/// * interval_ms - Longest time a session may go without traffic
+#[no_mangle]
+pub extern "C" fn create_keep_alive_scheduler(
+    functional_id: u32,
+    interval_ms: u32,
+) -> *mut KeepAliveScheduler {
+    Box::into_raw(Box::new(KeepAliveScheduler::new(
+        functional_id,
+        interval_ms,
+    )))
+}
+
+/// Joins the UDS server behind `handle` to `scheduler`, or if `scheduler` is null, goes back
+/// to the server sending its own tester present messages
+#[no_mangle]
+pub extern "C" fn set_keep_alive_scheduler_uds_handle(
+    handle: *mut UdsServerHandle,
+    scheduler: *const KeepAliveScheduler,
+) -> DiagServerResult {
+    let h = match unsafe { handle.as_mut() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    match h
+        .server
+        .set_keep_alive_scheduler(unsafe { scheduler.as_ref() })
+    {
+        Ok(_) => DiagServerResult::OK,
+        Err(e) => h.record_error(e),
+    }
+}
+
+/// Returns the number of keep-alives sent on the bus of `scheduler`, or 0 if `scheduler` is null
+#[no_mangle]
+pub extern "C" fn get_keep_alives_sent(scheduler: *const KeepAliveScheduler) -> u64 {
+    match unsafe { scheduler.as_ref() } {
+        Some(s) => s.keep_alives_sent(),
+        None => 0,
+    }
+}
+
+/// Destroys a scheduler created with [create_keep_alive_scheduler]. Servers which
+/// are still joined to it keep sharing keep-alives
+#[no_mangle]
+pub extern "C" fn destroy_keep_alive_scheduler(scheduler: *mut KeepAliveScheduler) {
+    if !scheduler.is_null() {
+        drop(unsafe { Box::from_raw(scheduler) })
+    }
+}
+
+/// Asks the ECU behind `handle` to start sending periodic data identifiers
+/// (ReadDataByPeriodicIdentifier), and starts capturing them.
+///
+/// ## Parameters
+/// * handle - Server to start the stream on
+/// * mode - Rate at which the ECU should send the identifiers. Must not be [PeriodicTransmissionMode::StopSending]
+/// * periodic_ids - Periodic data identifiers to stream (The low byte of data identifier 0xF2xx)
+/// * periodic_ids_len - Number of identifiers in `periodic_ids`
+/// * capacity - Minimum number of samples to buffer before new samples are dropped
+/// * stream - Set to the new stream if it was started
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the stream was started. The stream must be freed with [destroy_periodic_stream]
+#[no_mangle]
+pub extern "C" fn start_periodic_stream_uds_handle(
+    handle: *mut UdsServerHandle,
+    mode: PeriodicTransmissionMode,
+    periodic_ids: *const u8,
+    periodic_ids_len: u32,
+    capacity: u32,
+    stream: &mut *mut PeriodicDataStream,
+) -> DiagServerResult {
+    *stream = core::ptr::null_mut();
+    let h = match unsafe { handle.as_mut() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    if periodic_ids.is_null() || periodic_ids_len == 0 {
+        return DiagServerResult::ParameterInvalid;
+    }
+    let ids = unsafe { core::slice::from_raw_parts(periodic_ids, periodic_ids_len as usize) };
+    match h.server.start_periodic_stream(mode, ids, capacity as usize) {
+        Ok(s) => {
+            *stream = Box::into_raw(Box::new(s));
+            DiagServerResult::OK
+        }
+        Err(e) => h.record_error(e),
+    }
+}
+
+/// Asks the ECU behind `handle` to stop sending periodic data identifiers, and stops capturing them.
+/// Samples already captured can still be read from the stream
+///
+/// ## Parameters
+/// * handle - Server to stop the stream on
+/// * periodic_ids - Periodic data identifiers to stop. If `periodic_ids_len` is 0, all identifiers are stopped
+/// * periodic_ids_len - Number of identifiers in `periodic_ids`
+#[no_mangle]
+pub extern "C" fn stop_periodic_stream_uds_handle(
+    handle: *mut UdsServerHandle,
+    periodic_ids: *const u8,
+    periodic_ids_len: u32,
+) -> DiagServerResult {
+    let h = match unsafe { handle.as_mut() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    let ids: &[u8] = if periodic_ids.is_null() || periodic_ids_len == 0 {
+        &[]
+    } else {
+        unsafe { core::slice::from_raw_parts(periodic_ids, periodic_ids_len as usize) }
+    };
+    match h.server.stop_periodic_stream(ids) {
+        Ok(_) => DiagServerResult::OK,
+        Err(e) => h.record_error(e),
+    }
+}
+
+/// Moves up to `max_samples` captured samples into `samples`, oldest first. This never blocks.
+///
+/// ## Returns
+/// The number of samples written into `samples`
+#[no_mangle]
+pub extern "C" fn read_periodic_stream(
+    stream: *mut PeriodicDataStream,
+    samples: *mut PeriodicSample,
+    max_samples: u32,
+) -> u32 {
+    match unsafe { stream.as_mut() } {
+        Some(s) if !samples.is_null() => {
+            let out = unsafe { core::slice::from_raw_parts_mut(samples, max_samples as usize) };
+            s.read(out) as u32
+        }
+        _ => 0,
+    }
+}
+
+/// Returns the number of samples `stream` discarded because it was full
+#[no_mangle]
+pub extern "C" fn get_periodic_stream_dropped(stream: *const PeriodicDataStream) -> u64 {
+    match unsafe { stream.as_ref() } {
+        Some(s) => s.dropped(),
+        None => 0,
+    }
+}
+
+/// Destroys a stream created with [start_periodic_stream_uds_handle].
+/// This does not stop the ECU from sending, use [stop_periodic_stream_uds_handle] first
+#[no_mangle]
+pub extern "C" fn destroy_periodic_stream(stream: *mut PeriodicDataStream) {
+    if !stream.is_null() {
+        drop(unsafe { Box::from_raw(stream) })
+    }
+}
+
+/// Reads the scaling data of a data identifier from the ECU behind `handle`
+/// (ReadScalingDataByIdentifier), and compiles it into a converter for the identifier's live values.
+///
+/// ## Parameters
+/// * handle - Server to read the scaling data with
+/// * did - Data identifier to read the scaling data of
+/// * converter - Set to the new converter if the scaling data could be compiled
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the converter was created. The converter must be freed with [destroy_scaling_converter].
+/// [DiagServerResult::Todo] if the identifier is not numeric, or uses a
+/// vehicle manufacturer specific formula
+#[no_mangle]
+pub extern "C" fn read_scaling_converter_uds_handle(
+    handle: *mut UdsServerHandle,
+    did: u16,
+    converter: &mut *mut ScalingConverter,
+) -> DiagServerResult {
+    *converter = core::ptr::null_mut();
+    let h = match unsafe { handle.as_mut() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    match h.server.read_scaling_converter(did) {
+        Ok(c) => {
+            *converter = Box::into_raw(Box::new(c));
+            DiagServerResult::OK
+        }
+        Err(e) => h.record_error(e),
+    }
+}
+
+/// Compiles a ReadScalingDataByIdentifier response which has already been read
+/// (Beginning with 0x64 and the data identifier) into a converter. See [read_scaling_converter_uds_handle]
+#[no_mangle]
+pub extern "C" fn create_scaling_converter(
+    resp: *const u8,
+    resp_len: u32,
+    converter: &mut *mut ScalingConverter,
+) -> DiagServerResult {
+    *converter = core::ptr::null_mut();
+    if resp.is_null() {
+        return DiagServerResult::ParameterInvalid;
+    }
+    let resp = unsafe { core::slice::from_raw_parts(resp, resp_len as usize) };
+    match ScalingConverter::from_response(resp) {
+        Ok(c) => {
+            *converter = Box::into_raw(Box::new(c));
+            DiagServerResult::OK
+        }
+        Err(e) => e.into(),
+    }
+}
+
+/// Returns the number of bytes of one raw value of `converter`, or 0 if `converter` is null
+#[no_mangle]
+pub extern "C" fn get_scaling_converter_sample_len(converter: *const ScalingConverter) -> u32 {
+    match unsafe { converter.as_ref() } {
+        Some(c) => c.sample_len() as u32,
+        None => 0,
+    }
+}
+
+/// Converts `count` raw values which have already been decoded. `raw` and `out` may be the same buffer
+#[no_mangle]
+pub extern "C" fn convert_scaling_values(
+    converter: *const ScalingConverter,
+    raw: *const f32,
+    out: *mut f32,
+    count: u32,
+) -> DiagServerResult {
+    let c = match unsafe { converter.as_ref() } {
+        Some(c) => c,
+        None => return DiagServerResult::ParameterInvalid,
+    };
+    if raw.is_null() || out.is_null() {
+        return DiagServerResult::ParameterInvalid;
+    }
+    let out = unsafe {
+        core::ptr::copy(raw, out, count as usize);
+        core::slice::from_raw_parts_mut(out, count as usize)
+    };
+    c.formula().apply_in_place(out);
+    DiagServerResult::OK
+}
+
+/// Decodes back to back raw samples (EG: The data of a [PeriodicSample]), and converts them.
+///
+/// ## Parameters
+/// * converter - Converter to use
+/// * data - Raw samples of [get_scaling_converter_sample_len] bytes each
+/// * data_len - Length of `data` in bytes. Trailing bytes which do not make up a whole sample are ignored
+/// * out - Buffer to write the converted values into
+/// * out_len - Capacity of `out` in values
+/// * out_count - Set to the number of values written into `out`
+#[no_mangle]
+pub extern "C" fn decode_scaling_values(
+    converter: *const ScalingConverter,
+    data: *const u8,
+    data_len: u32,
+    out: *mut f32,
+    out_len: u32,
+    out_count: &mut u32,
+) -> DiagServerResult {
+    *out_count = 0;
+    let c = match unsafe { converter.as_ref() } {
+        Some(c) => c,
+        None => return DiagServerResult::ParameterInvalid,
+    };
+    if data.is_null() || out.is_null() {
+        return DiagServerResult::ParameterInvalid;
+    }
+    let data = unsafe { core::slice::from_raw_parts(data, data_len as usize) };
+    let out = unsafe { core::slice::from_raw_parts_mut(out, out_len as usize) };
+    *out_count = c.decode_batch(data, out) as u32;
+    DiagServerResult::OK
+}
+
+/// Destroys a converter created with [read_scaling_converter_uds_handle] or [create_scaling_converter]
+#[no_mangle]
+pub extern "C" fn destroy_scaling_converter(converter: *mut ScalingConverter) {
+    if !converter.is_null() {
+        drop(unsafe { Box::from_raw(converter) })
+    }
+}
+
+/// Image borrowed from the caller of [download_uds_handle]
+struct CallerImage {
+    ptr: *const u8,
+    len: usize,
+}
+
+// The server thread only reads the image, and download_uds_handle does not return
+// until the server thread is done with it
+unsafe impl Send for CallerImage {}
+unsafe impl Sync for CallerImage {}
+
+impl AsRef<[u8]> for CallerImage {
+    fn as_ref(&self) -> &[u8] {
+        unsafe { core::slice::from_raw_parts(self.ptr, self.len) }
+    }
+}
+
+/// Downloads an image to the ECU behind `handle` (RequestDownload, TransferData and RequestTransferExit).
+///
+/// The TransferData blocks are sent one at a time by the server's background thread, each waiting
+/// for the ECU to acknowledge the previous one, using the largest block size the ECU accepts. The image is read in place, and is not copied as a whole.
+/// Blocks that fail are not retried. The ECU must already be in a session which allows downloads.
+///
+/// ## Parameters
+/// * handle - Server to download with
+/// * image - Image to download. This must stay valid until the function returns
+/// * image_len - Length of `image` in bytes
+/// * options - Settings for the download
+/// * progress_cb - Optional callback for the progress of the download. If it falls behind,
+/// some blocks are skipped, but it is always called once every block has been acknowledged
+/// * user_ctx - Context pointer to hand back to `progress_cb`
+/// * progress - Set to the progress of the download, even if it failed part way through
+#[no_mangle]
+pub extern "C" fn download_uds_handle(
+    handle: *mut UdsServerHandle,
+    image: *const u8,
+    image_len: u32,
+    options: DownloadOptions,
+    progress_cb: Option<UdsTransferProgressCallback>,
+    user_ctx: *mut c_void,
+    progress: &mut TransferProgress,
+) -> DiagServerResult {
+    *progress = TransferProgress {
+        total_bytes: image_len as u64,
+        ..Default::default()
+    };
+    let h = match unsafe { handle.as_mut() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    if image.is_null() || image_len == 0 {
+        return DiagServerResult::ParameterInvalid;
+    }
+    let image = Arc::new(CallerImage {
+        ptr: image,
+        len: image_len as usize,
+    });
+    let res = h.server.download(image, options, |p| {
+        *progress = *p;
+        if let Some(cb) = progress_cb {
+            cb(user_ctx, p)
+        }
+    });
+    match res {
+        Ok(_) => DiagServerResult::OK,
+        Err(e) => h.record_error(e),
+    }
+}
+
+/// Writes the name of `dtc` (EG: P0301) into `name` as a null terminated string, without allocating.
+///
+/// ## Parameters
+/// * dtc - DTC to name
+/// * name - Caller owned buffer to write the name into. A buffer of `DTC_NAME_MAX_LEN + 1` bytes can hold any name
+/// * name_len - Capacity of `name`
+/// * written - Set to the length of the name, not including the null terminator
+///
+/// ## Returns
+/// [DiagServerResult::BufferTooSmall] if `name` cannot hold the name and its null terminator
+#[no_mangle]
+pub extern "C" fn get_uds_dtc_name(
+    dtc: &UdsDtc,
+    name: *mut c_char,
+    name_len: u32,
+    written: &mut u32,
+) -> DiagServerResult {
+    let dtc_name = DTC::from(*dtc).get_name();
+    let bytes = dtc_name.as_str().as_bytes();
+    *written = bytes.len() as u32;
+    if name.is_null() || bytes.len() >= name_len as usize {
+        return DiagServerResult::BufferTooSmall;
+    }
+    unsafe {
+        core::ptr::copy_nonoverlapping(bytes.as_ptr() as *const c_char, name, bytes.len());
+        *name.add(bytes.len()) = 0;
+    }
+    DiagServerResult::OK
+}
+
+/// Reads the DTCs stored on the ECU behind `handle` which match `status_mask`,
+/// decoding them straight into a caller owned array.
+///
+/// ## Parameters
+/// * handle - Server to read the DTCs from
+/// * status_mask - DTC status mask to read DTCs by. 0xFF reads all DTCs
+/// * dtcs - Caller owned array to write the DTCs into
+/// * dtc_capacity - Capacity of `dtcs`
+/// * dtc_count - Set to the number of DTCs the ECU reported
+///
+/// ## Returns
+/// [DiagServerResult::BufferTooSmall] if `dtcs` could only hold the first `dtc_capacity` DTCs
+#[no_mangle]
+pub extern "C" fn get_dtcs_by_status_mask_uds_handle(
+    handle: *mut UdsServerHandle,
+    status_mask: u8,
+    dtcs: *mut UdsDtc,
+    dtc_capacity: u32,
+    dtc_count: &mut u32,
+) -> DiagServerResult {
+    *dtc_count = 0;
+    let h = match unsafe { handle.as_mut() } {
+        Some(h) => h,
+        None => return DiagServerResult::NoDiagnosticServer,
+    };
+    let out: &mut [UdsDtc] = if dtcs.is_null() {
+        &mut []
+    } else {
+        unsafe { core::slice::from_raw_parts_mut(dtcs, dtc_capacity as usize) }
+    };
+    match h.server.get_dtcs_by_status_mask_into(status_mask, out) {
+        Ok(count) => {
+            *dtc_count = count as u32;
+            if count > out.len() {
+                DiagServerResult::BufferTooSmall
+            } else {
+                DiagServerResult::OK
+            }
+        }
+        Err(e) => h.record_error(e),
+    }
+}
+
+/// Reads the DTCs of many ECUs at once, each through its own server handle.
+///
+/// Up to `max_in_flight_per_adapter` ECUs on each adapter are queried at the same time.
+/// Failed requests are not retried, and a failing ECU does not stop the sweep. Instead, its
+/// error is written back into its target. The callbacks of each handle are called
+/// from that server's background thread, as usual.
+///
+/// ## Parameters
+/// * targets - ECUs to read. The result and DTC count of each ECU is written back into its target
+/// * target_count - Number of targets in `targets`
+/// * status_mask - DTC status mask to read DTCs by. 0xFF reads all DTCs
+/// * max_in_flight_per_adapter - Maximum number of ECUs to query at the same time on each adapter
+/// * dtcs - Caller owned array to write the DTCs of every ECU into, grouped by ECU
+/// * dtc_capacity - Capacity of `dtcs`
+/// * dtc_count - Set to the total number of DTCs read
+///
+/// ## Returns
+/// [DiagServerResult::OK] if the sweep was run. Each target then holds its own result.
+/// [DiagServerResult::BufferTooSmall] if `dtcs` could only hold the first `dtc_capacity` DTCs.
+#[no_mangle]
+pub extern "C" fn sweep_dtcs_uds_handles(
+    targets: *mut UdsDtcSweepTarget,
+    target_count: u32,
+    status_mask: u8,
+    max_in_flight_per_adapter: u32,
+    dtcs: *mut UdsSweepDtc,
+    dtc_capacity: u32,
+    dtc_count: &mut u32,
+) -> DiagServerResult {
+    *dtc_count = 0;
+    if target_count == 0 {
+        return DiagServerResult::OK;
+    }
+    if targets.is_null() {
+        return DiagServerResult::ParameterInvalid;
+    }
+    let targets = unsafe { core::slice::from_raw_parts_mut(targets, target_count as usize) };
+    // Every handle is borrowed mutably for the whole sweep
+    for (i, t) in targets.iter().enumerate() {
+        if t.handle.is_null() {
+            return DiagServerResult::NoDiagnosticServer;
+        }
+        if targets[..i].iter().any(|o| o.handle == t.handle) {
+            return DiagServerResult::ParameterInvalid;
+        }
+    }
+
+    let mut sweep_targets: Vec<DtcSweepTarget<'_>> = targets
+        .iter()
+        .map(|t| DtcSweepTarget {
+            adapter: t.adapter,
+            server: unsafe { &mut (*t.handle).server },
+        })
+        .collect();
+    let res = sweep_dtcs(
+        &mut sweep_targets,
+        DtcSweepOptions {
+            status_mask,
+            max_in_flight_per_adapter,
+        },
+    );
+    drop(sweep_targets);
+
+    for (t, ecu_res) in targets.iter_mut().zip(res.ecu_results) {
+        t.ecu_error = 0;
+        match ecu_res {
+            Ok(count) => {
+                t.result = DiagServerResult::OK;
+                t.dtc_count = count as u32;
+            }
+            Err(e) => {
+                t.dtc_count = 0;
+                t.result = unsafe { &mut *t.handle }.record_error(e);
+                if t.result == DiagServerResult::ECUError {
+                    t.ecu_error = unsafe { &*t.handle }.ecu_error;
+                }
+            }
+        }
+    }
+
+    *dtc_count = res.dtcs.len() as u32;
+    if res.dtcs.is_empty() {
+        return DiagServerResult::OK;
+    }
+    if dtcs.is_null() {
+        return DiagServerResult::BufferTooSmall;
+    }
+    let out = unsafe { core::slice::from_raw_parts_mut(dtcs, dtc_capacity as usize) };
+    for (o, d) in out.iter_mut().zip(res.dtcs.iter()) {
+        *o = UdsSweepDtc {
+            send_id: d.send_id,
+            recv_id: d.recv_id,
+            dtc: d.dtc.into(),
+        };
+    }
+    if res.dtcs.len() > dtc_capacity as usize {
+        DiagServerResult::BufferTooSmall
+    } else {
+        DiagServerResult::OK
+    }
+}
+
+/// Destroys a UDS server created with [create_uds_server_handle_over_isotp].
+/// The handle must not be used after this call
+#[no_mangle]
+pub extern "C" fn destroy_uds_server_handle(handle: *mut UdsServerHandle) {
+    if !handle.is_null() {
+        drop(unsafe { Box::from_raw(handle) })
+    }
+}
+
+fn send_payload(
+    h: &mut UdsServerHandle,
+    payload: &mut UdsPayload,
+    response_require: bool,
+) -> DiagServerResult {
+    match h.run_payload(payload, response_require) {
+        Ok(resp) => {
+            if response_require {
+                payload.sid = (resp[0] - 0x40).into();
+                payload.args_len = resp.len() as u32;
+                // Boxed slice so that capacity == length, and [free_uds_payload_response]
+                // can rebuild the allocation from just the pointer and length
+                payload.args_ptr = Box::into_raw(resp.into_boxed_slice()) as *mut u8;
+            }
+            DiagServerResult::OK
+        }
+        Err(e) => e,
+    }
+}
+
+// Legacy single server API
+
+static mut ISO_TP_HANDLER: Option<IsoTpChannelCallbackHandler> = None;
+static mut UDS_SERVER: Option<UdsServerHandle> = None;
+
+/// Register an ISO-TP callback
+#[no_mangle]
+pub extern "C" fn register_isotp_callback(cb: IsoTpChannelCallbackHandler) {
+    unsafe { ISO_TP_HANDLER = Some(cb) }
+}
+
+/// Delete an ISO-TP callback
+#[no_mangle]
+pub extern "C" fn destroy_isotp_callback() {
+    unsafe { ISO_TP_HANDLER = None }
+}
+
+/// Creates a new UDS diagnostic server using an ISO-TP callback handler
+/// registered with [register_isotp_callback]
+///
+/// Only one server can be created this way. To use multiple servers,
+/// use [create_uds_server_handle_over_isotp]
+#[no_mangle]
+pub extern "C" fn create_uds_server_over_isotp(
+    settings: UdsServerOptions,
+    iso_tp_opts: IsoTPSettings,
+) -> DiagServerResult {
+    if unsafe { ISO_TP_HANDLER.is_none() } {
+        return DiagServerResult::NoHandler;
+    }
+    if unsafe { UDS_SERVER.is_some() } {
+        return DiagServerResult::ServerAlreadyRunning;
+    }
+
+    let channel = unsafe { ISO_TP_HANDLER.clone().unwrap() };
+    match new_handle(settings, iso_tp_opts, channel) {
+        Ok(h) => {
+            unsafe { UDS_SERVER = Some(h) }
+            DiagServerResult::OK
+        }
+        Err(e) => e,
+    }
+}
+
+/// Sends a payload to the UDS server, attempts to get the ECUs response
+///
+/// ## Parameters
+/// * payload - Payload to send to the ECU. If the ECU responds OK, then this payload
+/// will be replaced by the ECUs response
+///
+/// * response_require - If set to false, no response will be read from the ECU.
+///
+/// ## Notes
+///
+/// Due to restrictions, the payload SID in the response message will match the original SID,
+/// rather than SID + 0x40.
+///
+/// ## Returns
+/// If a response is required, and it completes successfully, then the returned value
+/// will have a new pointer set for args_ptr. **IMPORTANT**. This pointer is owned by the
+/// rust library, and MUST be released with [free_uds_payload_response] once the caller
+/// is done with it. To poll without having to free anything, use [send_payload_uds_into] instead.
+#[no_mangle]
+pub extern "C" fn send_payload_uds(
+    payload: &mut UdsPayload,
+    response_require: bool,
+) -> DiagServerResult {
+    match unsafe { UDS_SERVER.as_mut() } {
+        Some(h) => send_payload(h, payload, response_require),
+        None => DiagServerResult::NoDiagnosticServer,
+    }
+}
+
+/// Frees a response that was returned by [send_payload_uds].
+///
+/// After this call, args_ptr is set to null and args_len is set to 0.
+///
+/// ## Safety
+/// Only call this on payloads whose args_ptr was set by [send_payload_uds]. Calling it
+/// on a payload that points to a caller owned argument buffer is undefined behaviour.
+#[no_mangle]
+pub extern "C" fn free_uds_payload_response(payload: &mut UdsPayload) {
+    if !payload.args_ptr.is_null() {
+        unsafe {
+            drop(Box::from_raw(core::ptr::slice_from_raw_parts_mut(
+                payload.args_ptr,
+                payload.args_len as usize,
+            )))
+        }
+    }
+    payload.args_ptr = core::ptr::null_mut();
+    payload.args_len = 0;
+}
+
+/// Sends a payload to the UDS server, writing the ECUs response into a caller provided buffer.
+///
+/// Unlike [send_payload_uds], the request payload is never modified, and nothing is
+/// handed back to the caller that has to be deallocated, so the same request and
+/// response buffer can be reused in a polling loop.
+///
+/// This is not allocation free. The server still reads the response into its own buffer,
+/// which is copied into `resp_buf` and freed before this returns.
+///
+/// ## Parameters
+/// * payload - Payload to send to the ECU
+/// * response_require - If set to false, no response will be read from the ECU, and `resp_len` is set to 0.
+/// * resp_buf - Buffer to write the ECUs response into. The response will begin with SID + 0x40
+/// * resp_buf_len - Capacity of `resp_buf` in bytes
+/// * resp_len - Set to the length of the ECUs response
+///
+/// ## Returns
+/// [DiagServerResult::BufferTooSmall] if the response does not fit in `resp_buf`. In this case,
+/// `resp_len` is set to the length of the response, and nothing is written to `resp_buf`.
+#[no_mangle]
+pub extern "C" fn send_payload_uds_into(
+    payload: &UdsPayload,
+    response_require: bool,
+    resp_buf: *mut u8,
+    resp_buf_len: u32,
+    resp_len: &mut u32,
+) -> DiagServerResult {
+    *resp_len = 0;
+    match unsafe { UDS_SERVER.as_mut() } {
+        Some(h) => match h.run_payload(payload, response_require) {
+            Ok(resp) => copy_response_to_buffer(&resp, resp_buf, resp_buf_len, resp_len),
+            Err(e) => e,
+        },
+        None => DiagServerResult::NoDiagnosticServer,
+    }
+}
+
+/// Copies the metrics of the UDS server into `metrics`. See [read_uds_metrics]
+#[no_mangle]
+pub extern "C" fn get_uds_metrics(metrics: &mut ServerMetricsSnapshot) -> DiagServerResult {
+    match unsafe { UDS_SERVER.as_ref() } {
+        Some(h) => {
+            *metrics = h.server.get_metrics().snapshot();
+            DiagServerResult::OK
+        }
+        None => DiagServerResult::NoDiagnosticServer,
+    }
+}
+
+/// Destroys an existing UDS server
+#[no_mangle]
+pub extern "C" fn destroy_uds_server() {
+    unsafe { UDS_SERVER = None }
+}
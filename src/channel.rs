@@ -186,11 +186,25 @@ pub trait PacketChannel<T: Packet>: Send + Sync {
     /// can be polled or written to the channel.
     fn close(&mut self) -> ChannelResult<()>;
 
-    /// Writes a list of packets to the raw interface
-    fn write_packets(&mut self, packets: Vec<T>, timeout_ms: u32) -> ChannelResult<()>;
+    /// Writes packets to the raw interface, in order
+    fn write_packets(&mut self, packets: &[T], timeout_ms: u32) -> ChannelResult<()>;
     /// Reads a list of packets from the raw interface
     fn read_packets(&mut self, max: usize, timeout_ms: u32) -> ChannelResult<Vec<T>>;
 
+    /// Reads packets from the raw interface into a caller owned buffer, returning how many
+    /// were read. This reads up to `packets.len()` packets, in the same way as [PacketChannel::read_packets].
+    ///
+    /// Channels should override this where they can read without allocating,
+    /// by default this is implemented with [PacketChannel::read_packets]
+    fn read_packets_into(&mut self, packets: &mut [T], timeout_ms: u32) -> ChannelResult<usize> {
+        let read = self.read_packets(packets.len(), timeout_ms)?;
+        let count = read.len().min(packets.len());
+        for (dst, src) in packets.iter_mut().zip(read) {
+            *dst = src
+        }
+        Ok(count)
+    }
+
     /// Tells the channel to clear its Rx buffer.
     /// This means all pending messages to be read should be wiped from the devices queue,
     /// such that [PayloadChannel::read_bytes] does not read them
@@ -207,6 +221,13 @@ pub trait CanChannel: PacketChannel<CanFrame> {
     fn set_can_cfg(&mut self, baud: u32, use_extended: bool) -> ChannelResult<()>;
 }
 
+/// Packet channel for sending and receiving individual CAN-FD Frames.
+/// Classic CAN frames can also be sent and received over this channel
+pub trait CanFdChannel: PacketChannel<CanFdFrame> {
+    /// Sets the CAN network configuration. `baud` is the nominal (arbitration) bit rate
+    fn set_can_fd_cfg(&mut self, baud: u32, use_extended: bool) -> ChannelResult<()>;
+}
+
 impl<T: PayloadChannel + ?Sized> PayloadChannel for Box<T> {
     fn open(&mut self) -> ChannelResult<()> {
         T::open(self)
@@ -252,7 +273,7 @@ impl<X: Packet, T: PacketChannel<X> + ?Sized> PacketChannel<X> for Box<T> {
         T::close(self)
     }
 
-    fn write_packets(&mut self, packets: Vec<X>, timeout_ms: u32) -> ChannelResult<()> {
+    fn write_packets(&mut self, packets: &[X], timeout_ms: u32) -> ChannelResult<()> {
         T::write_packets(self, packets, timeout_ms)
     }
 
@@ -260,6 +281,10 @@ impl<X: Packet, T: PacketChannel<X> + ?Sized> PacketChannel<X> for Box<T> {
         T::read_packets(self, max, timeout_ms)
     }
 
+    fn read_packets_into(&mut self, packets: &mut [X], timeout_ms: u32) -> ChannelResult<usize> {
+        T::read_packets_into(self, packets, timeout_ms)
+    }
+
     fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
         T::clear_rx_buffer(self)
     }
@@ -275,6 +300,12 @@ impl<T: CanChannel + ?Sized> CanChannel for Box<T> {
     }
 }
 
+impl<T: CanFdChannel + ?Sized> CanFdChannel for Box<T> {
+    fn set_can_fd_cfg(&mut self, baud: u32, use_extended: bool) -> ChannelResult<()> {
+        T::set_can_fd_cfg(self, baud, use_extended)
+    }
+}
+
 impl<T: PayloadChannel + ?Sized> PayloadChannel for Arc<Mutex<T>> {
     fn open(&mut self) -> ChannelResult<()> {
         T::open(self.lock()?.borrow_mut())
@@ -320,7 +351,7 @@ impl<X: Packet, T: PacketChannel<X> + ?Sized> PacketChannel<X> for Arc<Mutex<T>>
         T::close(self.lock()?.borrow_mut())
     }
 
-    fn write_packets(&mut self, packets: Vec<X>, timeout_ms: u32) -> ChannelResult<()> {
+    fn write_packets(&mut self, packets: &[X], timeout_ms: u32) -> ChannelResult<()> {
         T::write_packets(self.lock()?.borrow_mut(), packets, timeout_ms)
     }
 
@@ -328,6 +359,10 @@ impl<X: Packet, T: PacketChannel<X> + ?Sized> PacketChannel<X> for Arc<Mutex<T>>
         T::read_packets(self.lock()?.borrow_mut(), max, timeout_ms)
     }
 
+    fn read_packets_into(&mut self, packets: &mut [X], timeout_ms: u32) -> ChannelResult<usize> {
+        T::read_packets_into(self.lock()?.borrow_mut(), packets, timeout_ms)
+    }
+
     fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
         T::clear_rx_buffer(self.lock()?.borrow_mut())
     }
@@ -343,6 +378,12 @@ impl<T: CanChannel + ?Sized> CanChannel for Arc<Mutex<T>> {
     }
 }
 
+impl<T: CanFdChannel + ?Sized> CanFdChannel for Arc<Mutex<T>> {
+    fn set_can_fd_cfg(&mut self, baud: u32, use_extended: bool) -> ChannelResult<()> {
+        T::set_can_fd_cfg(self.lock()?.borrow_mut(), baud, use_extended)
+    }
+}
+
 /// This trait is for packets that are used by [PacketChannel]
 pub trait Packet: Send + Sync + Sized {
     /// Returns the address of the packet
@@ -355,13 +396,22 @@ pub trait Packet: Send + Sync + Sized {
     fn set_data(&mut self, data: &[u8]);
 }
 
-#[derive(Debug, Copy, Clone)]
+#[derive(Debug, Copy, Clone, Default)]
+#[repr(C)]
 /// CAN Frame
+///
+/// This is also the layout frames are exchanged with over the FFI, so every field is an
+/// integer. Frames written by foreign code cannot hold an invalid `bool`, and a `dlc`
+/// above 8 is treated as 8
 pub struct CanFrame {
+    /// CAN ID
     id: u32,
+    /// Number of valid bytes in `data`
     dlc: u8,
+    /// Frame data
     data: [u8; 8],
-    ext: bool,
+    /// Non zero if the frame uses extended (29bit) addressing
+    ext: u8,
 }
 
 impl CanFrame {
@@ -383,13 +433,13 @@ impl CanFrame {
             id,
             dlc: max as u8,
             data: tmp,
-            ext: is_ext,
+            ext: is_ext as u8,
         }
     }
 
     /// Returns true if the CAN Frame uses Extended (29bit) addressing
     pub fn is_extended(&self) -> bool {
-        self.ext
+        self.ext != 0
     }
 }
 
@@ -399,7 +449,7 @@ impl Packet for CanFrame {
     }
 
     fn get_data(&self) -> &[u8] {
-        &self.data[0..self.dlc as usize]
+        &self.data[0..(self.dlc as usize).min(8)]
     }
 
     fn set_address(&mut self, address: u32) {
@@ -412,6 +462,125 @@ impl Packet for CanFrame {
     }
 }
 
+/// Maximum number of data bytes in a CAN-FD frame
+pub const CAN_FD_MAX_DATA_LEN: usize = 64;
+
+#[derive(Debug, Copy, Clone)]
+#[repr(C)]
+/// CAN-FD Frame. This can also hold a classic CAN frame, but is much larger than [CanFrame],
+/// so is only used by channels which can send FD frames
+///
+/// Like [CanFrame], every field is an integer so frames written by foreign code cannot hold
+/// an invalid `bool`. A `len` above the limit of the frame type is treated as that limit
+pub struct CanFdFrame {
+    /// CAN ID
+    id: u32,
+    /// Number of valid bytes in `data`
+    len: u8,
+    /// Non zero if the frame is a CAN-FD frame, zero for a classic CAN frame
+    fd: u8,
+    /// Non zero if the data phase of the frame is sent at the data bit rate (Bit rate switch)
+    brs: u8,
+    /// Non zero if the frame uses extended (29bit) addressing
+    ext: u8,
+    /// Frame data
+    data: [u8; CAN_FD_MAX_DATA_LEN],
+}
+
+impl CanFdFrame {
+    /// Creates a new CAN-FD Frame given data and an ID.
+    /// ## Parameters
+    /// * id - The CAN ID of the packet
+    /// * data - The data of the CAN packet
+    /// * is_ext - Indication if the CAN packet shall use extended addressing
+    /// * brs - Indication if the data phase shall be sent at the data bit rate
+    ///
+    /// NOTE: If `id` is greater than 0x7FF, extended addressing (29bit) will be enabled
+    /// regardless of `is_ext`.
+    ///
+    /// Also, `data` will be limited to 64 bytes. CAN-FD only allows lengths of 0-8, 12, 16, 20,
+    /// 24, 32, 48 and 64 bytes, other lengths are padded by the adapter when sent.
+    pub fn new(id: u32, data: &[u8], is_ext: bool, brs: bool) -> Self {
+        let mut f = Self {
+            id,
+            len: 0,
+            fd: 1,
+            brs: brs as u8,
+            ext: is_ext as u8,
+            data: [0; CAN_FD_MAX_DATA_LEN],
+        };
+        f.set_data(data);
+        f
+    }
+
+    /// Returns true if the CAN Frame uses Extended (29bit) addressing
+    pub fn is_extended(&self) -> bool {
+        self.ext != 0
+    }
+
+    /// Returns true if the frame is a CAN-FD frame, false if it is a classic CAN frame
+    pub fn is_fd(&self) -> bool {
+        self.fd != 0
+    }
+
+    /// Returns true if the data phase of the frame is sent at the data bit rate
+    pub fn is_brs(&self) -> bool {
+        self.is_fd() && self.brs != 0
+    }
+
+    /// Maximum number of data bytes the frame can hold, 64 for FD frames and 8 for classic frames
+    fn max_len(&self) -> usize {
+        if self.is_fd() {
+            CAN_FD_MAX_DATA_LEN
+        } else {
+            8
+        }
+    }
+}
+
+impl Default for CanFdFrame {
+    fn default() -> Self {
+        Self::new(0, &[], false, false)
+    }
+}
+
+impl From<CanFrame> for CanFdFrame {
+    fn from(f: CanFrame) -> Self {
+        let mut data = [0; CAN_FD_MAX_DATA_LEN];
+        data[0..8].copy_from_slice(&f.data);
+        Self {
+            id: f.id,
+            len: f.dlc.min(8),
+            fd: 0,
+            brs: 0,
+            ext: f.ext,
+            data,
+        }
+    }
+}
+
+impl Packet for CanFdFrame {
+    fn get_address(&self) -> u32 {
+        self.id
+    }
+
+    fn get_data(&self) -> &[u8] {
+        &self.data[0..(self.len as usize).min(self.max_len())]
+    }
+
+    fn set_address(&mut self, address: u32) {
+        self.id = address
+    }
+
+    /// Sets the data of the frame. Classic frames are limited to 8 bytes,
+    /// and FD frames to 64 bytes
+    fn set_data(&mut self, data: &[u8]) {
+        let max = std::cmp::min(self.max_len(), data.len());
+        self.data[0..max].copy_from_slice(&data[0..max]);
+        self.len = max as u8;
+    }
+}
+
 /// ISO-TP configuration options (ISO15765-2)
 #[derive(Debug, Copy, Clone)]
 #[repr(C)]
@@ -442,6 +611,23 @@ pub struct IsoTPSettings {
     pub can_speed: u32,
     /// Does the CAN Network support extended addressing (29bit) or standard addressing (11bit)
     pub can_use_ext_addr: bool,
+    /// Send and receive ISO-TP frames as CAN-FD frames of up to 64 bytes, rather than
+    /// classic 8 byte CAN frames. Both the ECU and the adapter must support CAN-FD
+    pub can_fd: bool,
+    /// Send the data phase of CAN-FD frames at the data bit rate (Bit rate switch).
+    /// Only used if `can_fd` is set
+    pub can_fd_brs: bool,
+}
+
+impl IsoTPSettings {
+    /// Returns the largest CAN frame ISO-TP frames are sent in, in bytes
+    pub fn max_frame_len(&self) -> usize {
+        if self.can_fd {
+            CAN_FD_MAX_DATA_LEN
+        } else {
+            8
+        }
+    }
 }
 
 impl Default for IsoTPSettings {
@@ -453,6 +639,8 @@ impl Default for IsoTPSettings {
             pad_frame: true,
             can_speed: 500_000,
             can_use_ext_addr: false,
+            can_fd: false,
+            can_fd_brs: false,
         }
     }
 }
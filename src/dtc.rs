@@ -75,49 +75,118 @@ pub struct DTC {
     pub readiness_flag: bool,
 }
 
+/// Longest name a [DTC] can have (A u32 in decimal)
+pub const DTC_NAME_MAX_LEN: usize = 10;
+
+/// Component prefixes of ISO15031-6 and KWP2000 DTCs
+const DTC_PREFIX: [u8; 4] = *b"PCBU";
+
+const HEX_DIGITS: [u8; 16] = *b"0123456789ABCDEF";
+
+/// Name of a DTC, as created by [DTC::get_name]. This is stored inline, so creating one never allocates
+#[derive(Copy, Clone, PartialEq, Eq)]
+pub struct DtcName {
+    buf: [u8; DTC_NAME_MAX_LEN],
+    len: u8,
+}
+
+impl DtcName {
+    /// Returns the name as a string
+    pub fn as_str(&self) -> &str {
+        // Only ever contains ASCII
+        std::str::from_utf8(&self.buf[..self.len as usize]).unwrap_or_default()
+    }
+}
+
+impl std::fmt::Display for DtcName {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.write_str(self.as_str())
+    }
+}
+
+impl std::fmt::Debug for DtcName {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        std::fmt::Debug::fmt(self.as_str(), f)
+    }
+}
+
 impl DTC {
     /// Returns the error in a string format. EG: raw of 8276 = error P
+    ///
+    /// This allocates a new String, use [DTC::get_name] or [DTC::write_name] when
+    /// formatting many DTCs
     pub fn get_name_as_string(&self) -> String {
+        self.get_name().as_str().to_string()
+    }
+
+    /// Returns the error in a string format, without allocating. See [DTC::get_name_as_string]
+    pub fn get_name(&self) -> DtcName {
+        let mut name = DtcName {
+            buf: [0; DTC_NAME_MAX_LEN],
+            len: 0,
+        };
+        name.len = self.write_name_unchecked(&mut name.buf) as u8;
+        name
+    }
+
+    /// Writes the error in a string format (See [DTC::get_name_as_string]) into `buf`.
+    /// The name is not null terminated.
+    ///
+    /// ## Returns
+    /// The length of the name, or None if `buf` is too small to hold it.
+    /// A buffer of [DTC_NAME_MAX_LEN] bytes can hold any name
+    pub fn write_name(&self, buf: &mut [u8]) -> Option<usize> {
+        let name = self.get_name();
+        let len = name.len as usize;
+        buf.get_mut(..len)?.copy_from_slice(&name.buf[..len]);
+        Some(len)
+    }
+
+    fn write_name_unchecked(&self, buf: &mut [u8; DTC_NAME_MAX_LEN]) -> usize {
         match self.format {
             DTCFormatType::Iso15031_6 => {
                 // 2 bytes
                 let b0 = (self.raw >> 8) as u8;
                 let b1 = self.raw as u8;
-                let component_prefix = match b0 >> 6 {
-                    0 => "P",
-                    1 => "C",
-                    2 => "B",
-                    3 => "U",
-                    _ => "N", // Should never happen
-                };
-                format!(
-                    "{}{:01X}{:01X}{:01X}{:01X}",
-                    component_prefix,
-                    ((b0 & 0x30) >> 4),
-                    b0 & 0x0F,
-                    b1 >> 4,
-                    b1 & 0x0F
-                )
+                buf[0] = DTC_PREFIX[(b0 >> 6) as usize];
+                buf[1] = HEX_DIGITS[((b0 & 0x30) >> 4) as usize];
+                buf[2] = HEX_DIGITS[(b0 & 0x0F) as usize];
+                buf[3] = HEX_DIGITS[(b1 >> 4) as usize];
+                buf[4] = HEX_DIGITS[(b1 & 0x0F) as usize];
+                5
             }
             DTCFormatType::TwoByteHexKwp => {
-                let component_prefix = match (self.raw as u16 & 0b110000000000000) >> 14 {
-                    0b00 => "P",
-                    0b01 => "C",
-                    0b10 => "B",
-                    0b11 => "U",
-                    _ => "", // Should never happen
-                };
-                format!("{}{:04X}", component_prefix, self.raw & 0b11111111111111)
-                // 14 bits
+                buf[0] = DTC_PREFIX[((self.raw as u16 & 0b110000000000000) >> 14) as usize];
+                let code = self.raw & 0b11111111111111; // 14 bits
+                for i in 0..4 {
+                    buf[4 - i] = HEX_DIGITS[((code >> (i * 4)) & 0x0F) as usize];
+                }
+                5
+            }
+            _ => {
+                // Decimal, written from the back
+                let mut tmp = [0u8; DTC_NAME_MAX_LEN];
+                let mut pos = DTC_NAME_MAX_LEN;
+                let mut v = self.raw;
+                loop {
+                    pos -= 1;
+                    tmp[pos] = b'0' + (v % 10) as u8;
+                    v /= 10;
+                    if v == 0 {
+                        break;
+                    }
+                }
+                let len = DTC_NAME_MAX_LEN - pos;
+                buf[..len].copy_from_slice(&tmp[pos..]);
+                len
             }
-            _ => format!("{}", self.raw),
         }
     }
 }
 
 #[cfg(test)]
 pub mod test {
-    use super::DTC;
+    use super::{DTCFormatType, DTCStatus, DTC, DTC_NAME_MAX_LEN};
 
     #[test]
     pub fn test_dtc_parse_raw() {
@@ -131,4 +200,122 @@ pub mod test {
         println!("{:04X}", iso15031_6_dtc.raw);
         println!("{}", iso15031_6_dtc.get_name_as_string());
     }
+
+    #[test]
+    pub fn test_dtc_name_formats() {
+        let mut dtc = DTC {
+            format: super::DTCFormatType::Iso15031_6,
+            raw: 0xC123,
+            status: super::DTCStatus::None,
+            mil_on: false,
+            readiness_flag: false,
+        };
+        assert_eq!(dtc.get_name().as_str(), "U0123");
+        dtc.raw = 0x0301;
+        assert_eq!(dtc.get_name_as_string(), "P0301");
+
+        dtc.format = super::DTCFormatType::TwoByteHexKwp;
+        dtc.raw = 0x4ABC;
+        assert_eq!(dtc.get_name().as_str(), "C0ABC");
+
+        dtc.format = super::DTCFormatType::Iso14229_1;
+        dtc.raw = u32::MAX;
+        assert_eq!(dtc.get_name().as_str(), "4294967295");
+        dtc.raw = 0;
+        assert_eq!(dtc.get_name().as_str(), "0");
+
+        let mut buf = [0u8; 2];
+        assert_eq!(dtc.write_name(&mut buf), Some(1));
+        assert_eq!(buf[0], b'0');
+        dtc.raw = 123;
+        assert_eq!(dtc.write_name(&mut buf), None);
+    }
+
+    /// The format! based formatter [DTC::get_name] replaced
+    fn reference_name(dtc: &DTC) -> String {
+        match dtc.format {
+            DTCFormatType::Iso15031_6 => {
+                let b0 = (dtc.raw >> 8) as u8;
+                let b1 = dtc.raw as u8;
+                let component_prefix = ["P", "C", "B", "U"][(b0 >> 6) as usize];
+                format!(
+                    "{}{:01X}{:01X}{:01X}{:01X}",
+                    component_prefix,
+                    ((b0 & 0x30) >> 4),
+                    b0 & 0x0F,
+                    b1 >> 4,
+                    b1 & 0x0F
+                )
+            }
+            DTCFormatType::TwoByteHexKwp => {
+                let component_prefix =
+                    ["P", "C", "B", "U"][((dtc.raw as u16 & 0b110000000000000) >> 14) as usize];
+                format!("{}{:04X}", component_prefix, dtc.raw & 0b11111111111111)
+            }
+            _ => format!("{}", dtc.raw),
+        }
+    }
+
+    fn assert_names_match(dtc: &DTC) {
+        assert_eq!(dtc.get_name().as_str(), reference_name(dtc), "{:?}", dtc);
+        assert_eq!(dtc.get_name_as_string(), reference_name(dtc), "{:?}", dtc);
+    }
+
+    const FORMATS: [DTCFormatType; 6] = [
+        DTCFormatType::Iso15031_6,
+        DTCFormatType::Iso14229_1,
+        DTCFormatType::SaeJ1939_73,
+        DTCFormatType::Iso11992_4,
+        DTCFormatType::Unknown(0x10),
+        DTCFormatType::TwoByteHexKwp,
+    ];
+
+    #[test]
+    pub fn test_dtc_name_matches_reference() {
+        let mut dtc = DTC {
+            format: DTCFormatType::Iso15031_6,
+            raw: 0,
+            status: DTCStatus::None,
+            mil_on: false,
+            readiness_flag: false,
+        };
+        for format in FORMATS {
+            dtc.format = format;
+            // Every 2 byte code, with and without the upper bytes set
+            for raw in 0..=0xFFFFu32 {
+                dtc.raw = raw;
+                assert_names_match(&dtc);
+                dtc.raw = raw | 0xFFFF_0000;
+                assert_names_match(&dtc);
+            }
+            // Either side of every decimal length
+            for digits in 1..DTC_NAME_MAX_LEN as u32 {
+                let p = 10u32.pow(digits);
+                for raw in [p - 1, p, p + 1] {
+                    dtc.raw = raw;
+                    assert_names_match(&dtc);
+                }
+            }
+        }
+    }
+
+    /// Every raw value of every format. Takes a long time, run with `cargo test -- --ignored`
+    #[test]
+    #[ignore]
+    pub fn test_dtc_name_matches_reference_exhaustive() {
+        let mut dtc = DTC {
+            format: DTCFormatType::Iso15031_6,
+            raw: 0,
+            status: DTCStatus::None,
+            mil_on: false,
+            readiness_flag: false,
+        };
+        for format in FORMATS {
+            dtc.format = format;
+            for raw in 0..=u32::MAX {
+                dtc.raw = raw;
+                assert_names_match(&dtc);
+            }
+        }
+    }
 }
@@ -102,6 +102,8 @@ impl DynamicDiagSession {
                 global_tp_id: 0x00,
                 tester_present_interval_ms: 2000,
                 tester_present_require_response: true,
+                p2_star_timeout_ms: 5000,
+                busy_repeat_delay_ms: 500,
             },
             iso_tp_channel,
             channel_cfg,
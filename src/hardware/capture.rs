@@ -0,0 +1,711 @@
+//! Binary capture and replay of diagnostic sessions
+//!
+//! A [CaptureChannel] wraps any [PayloadChannel] or [CanChannel], and records every request,
+//! response and CAN frame passing through it into a [CaptureLog]. Recording copies the record
+//! into a buffer and hands it to the log's writer thread without waiting, so nothing is formatted
+//! or written to disk on the channel's thread. This still costs a copy of the data and a send on
+//! a bounded [mpsc::sync_channel] per record. The writer thread hands written buffers back to a
+//! free list, so once the log is warmed up, records only allocate if no buffer is free (EG: the
+//! free list is briefly locked by the writer thread) or if their data is unusually long.
+//! If the writer falls behind, records are dropped (and counted) rather than slowing down the channel.
+//!
+//! A [ReplayChannel] feeds a capture back as a [PayloadChannel] and [CanChannel], as fast as
+//! it is read, for regression and performance testing without hardware.
+//!
+//! ## File format
+//! All integers are little endian. A capture starts with [CAPTURE_MAGIC], followed by
+//! [CAPTURE_VERSION] as a u16, followed by records. Each record is a [RECORD_HEADER_LEN] byte
+//! header, followed by its data:
+//!
+//! | Offset | Size | Field |
+//! |--------|------|-------|
+//! | 0 | 8 | Microseconds since the capture started |
+//! | 8 | 1 | [RecordKind] |
+//! | 9 | 1 | Flags (Bit 0 - Extended CAN ID) |
+//! | 10 | 4 | Target address, or CAN ID |
+//! | 14 | 2 | Data length |
+
+use std::{
+    fs::File,
+    io::{BufReader, BufWriter, Read, Write},
+    path::Path,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        mpsc, Arc, Mutex,
+    },
+    thread::JoinHandle,
+    time::Instant,
+};
+
+use crate::channel::{
+    CanChannel, CanFrame, ChannelError, ChannelResult, IsoTPChannel, IsoTPSettings, Packet,
+    PacketChannel, PayloadChannel,
+};
+
+/// Magic bytes at the start of every capture
+pub const CAPTURE_MAGIC: [u8; 6] = *b"ECUCAP";
+
+/// Version of the capture format written by [CaptureLog]
+pub const CAPTURE_VERSION: u16 = 1;
+
+/// Size of the header of each record
+pub const RECORD_HEADER_LEN: usize = 16;
+
+/// Flag set on CAN frames with an extended (29bit) ID
+const FLAG_EXTENDED: u8 = 0x01;
+
+/// Largest record buffer kept for reuse. Longer buffers are freed once written, so that one
+/// long payload does not keep its memory for the rest of the capture
+const MAX_REUSED_RECORD_LEN: usize = 4096;
+
+/// Kind of a [CaptureRecord]
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum RecordKind {
+    /// Payload written to the ECU
+    Request = 0,
+    /// Payload read from the ECU
+    Response = 1,
+    /// CAN frame written to the bus
+    CanTx = 2,
+    /// CAN frame read from the bus
+    CanRx = 3,
+}
+
+impl RecordKind {
+    fn from_byte(b: u8) -> Option<Self> {
+        match b {
+            0 => Some(Self::Request),
+            1 => Some(Self::Response),
+            2 => Some(Self::CanTx),
+            3 => Some(Self::CanRx),
+            _ => None,
+        }
+    }
+}
+
+/// One decoded record of a capture
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct CaptureRecord {
+    /// Microseconds since the capture started
+    pub timestamp_us: u64,
+    /// Kind of record
+    pub kind: RecordKind,
+    /// Target address of a payload, or ID of a CAN frame
+    pub addr: u32,
+    /// True if the record is a CAN frame with an extended (29bit) ID
+    pub extended: bool,
+    /// Payload, or CAN frame data
+    pub data: Vec<u8>,
+}
+
+enum CaptureMsg {
+    Record(Vec<u8>),
+    Stop,
+}
+
+/// Handle for adding records to a [CaptureLog]. Cloning the handle is cheap, and every
+/// clone writes to the same log
+#[derive(Debug, Clone)]
+pub struct CaptureWriter {
+    tx: mpsc::SyncSender<CaptureMsg>,
+    /// Written record buffers, handed back by the writer thread for reuse
+    free: Arc<Mutex<Vec<Vec<u8>>>>,
+    start: Instant,
+    dropped: Arc<AtomicU64>,
+}
+
+impl CaptureWriter {
+    /// Adds a record to the log, without waiting for it to be written. If the log's
+    /// buffer is full, or the log has finished, the record is dropped instead.
+    /// Data longer than [u16::MAX] bytes is truncated
+    pub fn record(&self, kind: RecordKind, addr: u32, extended: bool, data: &[u8]) {
+        let data = &data[..data.len().min(u16::MAX as usize)];
+        // Never waits for the writer thread. If it holds the free list, allocate instead
+        let mut buf = self
+            .free
+            .try_lock()
+            .ok()
+            .and_then(|mut free| free.pop())
+            .unwrap_or_default();
+        buf.clear();
+        buf.reserve(RECORD_HEADER_LEN + data.len());
+        buf.extend_from_slice(&(self.start.elapsed().as_micros() as u64).to_le_bytes());
+        buf.push(kind as u8);
+        buf.push(if extended { FLAG_EXTENDED } else { 0 });
+        buf.extend_from_slice(&addr.to_le_bytes());
+        buf.extend_from_slice(&(data.len() as u16).to_le_bytes());
+        buf.extend_from_slice(data);
+        if self.tx.try_send(CaptureMsg::Record(buf)).is_err() {
+            self.dropped.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// Returns the number of records dropped so far
+    pub fn dropped(&self) -> u64 {
+        self.dropped.load(Ordering::Relaxed)
+    }
+}
+
+/// Binary capture being written by a background thread, see the [module level docs](self).
+///
+/// Dropping the log stops it, after writing every record already added
+#[derive(Debug)]
+pub struct CaptureLog {
+    writer: CaptureWriter,
+    thread: Option<JoinHandle<std::io::Result<()>>>,
+}
+
+impl CaptureLog {
+    /// Creates a new capture file at `path`, replacing any existing file
+    ///
+    /// ## Parameters
+    /// * path - Path of the capture file
+    /// * capacity - Number of records which can be waiting to be written, before
+    ///   further records are dropped
+    pub fn create<P: AsRef<Path>>(path: P, capacity: usize) -> std::io::Result<Self> {
+        Self::new(BufWriter::new(File::create(path)?), capacity)
+    }
+
+    /// Creates a new capture, written to `out`
+    ///
+    /// ## Parameters
+    /// * out - Destination of the capture. This should be buffered, as each record is
+    ///   written to it separately
+    /// * capacity - Number of records which can be waiting to be written, before
+    ///   further records are dropped
+    pub fn new<W: Write + Send + 'static>(mut out: W, capacity: usize) -> std::io::Result<Self> {
+        out.write_all(&CAPTURE_MAGIC)?;
+        out.write_all(&CAPTURE_VERSION.to_le_bytes())?;
+        let (tx, rx) = mpsc::sync_channel(capacity);
+        let free = Arc::new(Mutex::new(Vec::with_capacity(capacity)));
+        let thread_free = free.clone();
+        let thread = std::thread::spawn(move || {
+            for msg in rx {
+                match msg {
+                    CaptureMsg::Record(r) => {
+                        out.write_all(&r)?;
+                        if r.capacity() <= MAX_REUSED_RECORD_LEN {
+                            if let Ok(mut free) = thread_free.lock() {
+                                // No more buffers than can be waiting to be written are ever needed
+                                if free.len() < capacity {
+                                    free.push(r);
+                                }
+                            }
+                        }
+                    }
+                    CaptureMsg::Stop => break,
+                }
+            }
+            out.flush()
+        });
+        Ok(Self {
+            writer: CaptureWriter {
+                tx,
+                free,
+                start: Instant::now(),
+                dropped: Arc::new(AtomicU64::new(0)),
+            },
+            thread: Some(thread),
+        })
+    }
+
+    /// Returns a new handle for adding records to the log
+    pub fn writer(&self) -> CaptureWriter {
+        self.writer.clone()
+    }
+
+    /// Returns the number of records dropped so far
+    pub fn dropped(&self) -> u64 {
+        self.writer.dropped()
+    }
+
+    /// Writes every record already added, and stops the log. Records added after this
+    /// are dropped
+    pub fn finish(mut self) -> std::io::Result<()> {
+        self.stop()
+    }
+
+    fn stop(&mut self) -> std::io::Result<()> {
+        let thread = match self.thread.take() {
+            Some(t) => t,
+            None => return Ok(()),
+        };
+        // Blocks if the buffer is full, so that every record before it is still written
+        let _ = self.writer.tx.send(CaptureMsg::Stop);
+        thread.join().unwrap_or_else(|_| {
+            Err(std::io::Error::new(
+                std::io::ErrorKind::Other,
+                "Capture writer thread panicked",
+            ))
+        })
+    }
+}
+
+impl Drop for CaptureLog {
+    fn drop(&mut self) {
+        if let Err(e) = self.stop() {
+            log::error!("Could not finish capture: {}", e)
+        }
+    }
+}
+
+/// Reads every record of a capture.
+///
+/// A capture which ends part way through a record (EG: The process recording it
+/// was killed) is read up to the last complete record
+pub fn read_capture<R: Read>(mut r: R) -> std::io::Result<Vec<CaptureRecord>> {
+    let invalid = |msg: &str| std::io::Error::new(std::io::ErrorKind::InvalidData, msg);
+    let mut header = [0u8; 8];
+    r.read_exact(&mut header)?;
+    if header[..6] != CAPTURE_MAGIC {
+        return Err(invalid("Not a capture file"));
+    }
+    if u16::from_le_bytes([header[6], header[7]]) != CAPTURE_VERSION {
+        return Err(invalid("Unsupported capture version"));
+    }
+    let mut records = Vec::new();
+    let mut header = [0u8; RECORD_HEADER_LEN];
+    loop {
+        match r.read_exact(&mut header) {
+            Ok(_) => {}
+            Err(e) if e.kind() == std::io::ErrorKind::UnexpectedEof => break,
+            Err(e) => return Err(e),
+        }
+        let kind = RecordKind::from_byte(header[8]).ok_or_else(|| invalid("Bad record kind"))?;
+        let mut data = vec![0u8; u16::from_le_bytes([header[14], header[15]]) as usize];
+        match r.read_exact(&mut data) {
+            Ok(_) => {}
+            Err(e) if e.kind() == std::io::ErrorKind::UnexpectedEof => {
+                log::warn!("Capture ends part way through a record");
+                break;
+            }
+            Err(e) => return Err(e),
+        }
+        records.push(CaptureRecord {
+            timestamp_us: u64::from_le_bytes(header[0..8].try_into().unwrap()),
+            kind,
+            addr: u32::from_le_bytes(header[10..14].try_into().unwrap()),
+            extended: header[9] & FLAG_EXTENDED != 0,
+            data,
+        });
+    }
+    Ok(records)
+}
+
+/// Channel which records everything passing through another channel into a [CaptureLog]
+#[derive(Debug)]
+pub struct CaptureChannel<C> {
+    inner: C,
+    writer: CaptureWriter,
+}
+
+impl<C> CaptureChannel<C> {
+    /// Starts capturing the traffic of `inner`
+    pub fn new(inner: C, writer: CaptureWriter) -> Self {
+        Self { inner, writer }
+    }
+
+    /// Stops capturing, and returns the wrapped channel
+    pub fn into_inner(self) -> C {
+        self.inner
+    }
+}
+
+impl<C: PayloadChannel> PayloadChannel for CaptureChannel<C> {
+    fn open(&mut self) -> ChannelResult<()> {
+        self.inner.open()
+    }
+
+    fn close(&mut self) -> ChannelResult<()> {
+        self.inner.close()
+    }
+
+    fn set_ids(&mut self, send: u32, recv: u32) -> ChannelResult<()> {
+        self.inner.set_ids(send, recv)
+    }
+
+    fn read_bytes(&mut self, timeout_ms: u32) -> ChannelResult<Vec<u8>> {
+        let res = self.inner.read_bytes(timeout_ms)?;
+        self.writer.record(RecordKind::Response, 0, false, &res);
+        Ok(res)
+    }
+
+    fn write_bytes(&mut self, addr: u32, buffer: &[u8], timeout_ms: u32) -> ChannelResult<()> {
+        self.inner.write_bytes(addr, buffer, timeout_ms)?;
+        self.writer.record(RecordKind::Request, addr, false, buffer);
+        Ok(())
+    }
+
+    fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
+        self.inner.clear_rx_buffer()
+    }
+
+    fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
+        self.inner.clear_tx_buffer()
+    }
+}
+
+impl<C: IsoTPChannel> IsoTPChannel for CaptureChannel<C> {
+    fn set_iso_tp_cfg(&mut self, cfg: IsoTPSettings) -> ChannelResult<()> {
+        self.inner.set_iso_tp_cfg(cfg)
+    }
+}
+
+impl<C: CanChannel> PacketChannel<CanFrame> for CaptureChannel<C> {
+    fn open(&mut self) -> ChannelResult<()> {
+        PacketChannel::open(&mut self.inner)
+    }
+
+    fn close(&mut self) -> ChannelResult<()> {
+        PacketChannel::close(&mut self.inner)
+    }
+
+    fn write_packets(&mut self, packets: &[CanFrame], timeout_ms: u32) -> ChannelResult<()> {
+        self.inner.write_packets(packets, timeout_ms)?;
+        for p in packets {
+            self.writer.record(
+                RecordKind::CanTx,
+                p.get_address(),
+                p.is_extended(),
+                p.get_data(),
+            );
+        }
+        Ok(())
+    }
+
+    fn read_packets(&mut self, max: usize, timeout_ms: u32) -> ChannelResult<Vec<CanFrame>> {
+        let packets = self.inner.read_packets(max, timeout_ms)?;
+        for p in &packets {
+            self.writer.record(
+                RecordKind::CanRx,
+                p.get_address(),
+                p.is_extended(),
+                p.get_data(),
+            );
+        }
+        Ok(packets)
+    }
+
+    fn read_packets_into(
+        &mut self,
+        packets: &mut [CanFrame],
+        timeout_ms: u32,
+    ) -> ChannelResult<usize> {
+        let count = self.inner.read_packets_into(packets, timeout_ms)?;
+        for p in &packets[..count] {
+            self.writer.record(
+                RecordKind::CanRx,
+                p.get_address(),
+                p.is_extended(),
+                p.get_data(),
+            );
+        }
+        Ok(count)
+    }
+
+    fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
+        PacketChannel::clear_rx_buffer(&mut self.inner)
+    }
+
+    fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
+        PacketChannel::clear_tx_buffer(&mut self.inner)
+    }
+}
+
+impl<C: CanChannel> CanChannel for CaptureChannel<C> {
+    fn set_can_cfg(&mut self, baud: u32, use_extended: bool) -> ChannelResult<()> {
+        self.inner.set_can_cfg(baud, use_extended)
+    }
+}
+
+/// Channel which plays back a capture, see the [module level docs](self).
+///
+/// Each write is checked against the next recorded request (Or CAN frame written), and the
+/// responses (Or CAN frames read) recorded after it are then returned by reads, in order.
+/// Recorded timestamps are ignored, so the capture is played back as fast as it is read.
+/// Writes which do not match the capture still succeed, but are counted as mismatches
+#[derive(Debug, Clone)]
+pub struct ReplayChannel {
+    payloads: Vec<CaptureRecord>,
+    payload_pos: usize,
+    frames: Vec<CaptureRecord>,
+    frame_pos: usize,
+    mismatches: u64,
+}
+
+impl ReplayChannel {
+    /// Creates a new replay of `records`
+    pub fn new(records: Vec<CaptureRecord>) -> Self {
+        let (payloads, frames) = records
+            .into_iter()
+            .partition(|r| matches!(r.kind, RecordKind::Request | RecordKind::Response));
+        Self {
+            payloads,
+            payload_pos: 0,
+            frames,
+            frame_pos: 0,
+            mismatches: 0,
+        }
+    }
+
+    /// Creates a new replay of the capture file at `path`
+    pub fn from_file<P: AsRef<Path>>(path: P) -> std::io::Result<Self> {
+        Ok(Self::new(read_capture(BufReader::new(File::open(path)?))?))
+    }
+
+    /// Returns the number of writes which did not match the capture
+    pub fn mismatches(&self) -> u64 {
+        self.mismatches
+    }
+
+    /// Returns true once every record of the capture has been played back
+    pub fn is_finished(&self) -> bool {
+        self.payload_pos >= self.payloads.len() && self.frame_pos >= self.frames.len()
+    }
+
+    /// Restarts the replay from the start of the capture
+    pub fn rewind(&mut self) {
+        self.payload_pos = 0;
+        self.frame_pos = 0;
+        self.mismatches = 0;
+    }
+
+    /// Moves past the next record of kind `kind` (Skipping any unread records before it),
+    /// and checks it matches what was written
+    fn expect(
+        records: &[CaptureRecord],
+        pos: &mut usize,
+        mismatches: &mut u64,
+        kind: RecordKind,
+        addr: u32,
+        data: &[u8],
+    ) {
+        while let Some(r) = records.get(*pos) {
+            *pos += 1;
+            if r.kind == kind {
+                if r.addr != addr || r.data != data {
+                    *mismatches += 1;
+                }
+                return;
+            }
+        }
+        // Written past the end of the capture
+        *mismatches += 1;
+    }
+}
+
+impl PayloadChannel for ReplayChannel {
+    fn open(&mut self) -> ChannelResult<()> {
+        Ok(())
+    }
+
+    fn close(&mut self) -> ChannelResult<()> {
+        Ok(())
+    }
+
+    fn set_ids(&mut self, _send: u32, _recv: u32) -> ChannelResult<()> {
+        Ok(())
+    }
+
+    fn read_bytes(&mut self, timeout_ms: u32) -> ChannelResult<Vec<u8>> {
+        match self.payloads.get(self.payload_pos) {
+            Some(r) if r.kind == RecordKind::Response => {
+                self.payload_pos += 1;
+                Ok(r.data.clone())
+            }
+            _ if timeout_ms == 0 => Err(ChannelError::BufferEmpty),
+            _ => Err(ChannelError::ReadTimeout),
+        }
+    }
+
+    fn write_bytes(&mut self, addr: u32, buffer: &[u8], _timeout_ms: u32) -> ChannelResult<()> {
+        Self::expect(
+            &self.payloads,
+            &mut self.payload_pos,
+            &mut self.mismatches,
+            RecordKind::Request,
+            addr,
+            buffer,
+        );
+        Ok(())
+    }
+
+    fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
+        // Skip any responses which have not been read yet
+        while self
+            .payloads
+            .get(self.payload_pos)
+            .map_or(false, |r| r.kind == RecordKind::Response)
+        {
+            self.payload_pos += 1;
+        }
+        Ok(())
+    }
+
+    fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
+        Ok(())
+    }
+}
+
+impl IsoTPChannel for ReplayChannel {
+    fn set_iso_tp_cfg(&mut self, _cfg: IsoTPSettings) -> ChannelResult<()> {
+        Ok(())
+    }
+}
+
+impl PacketChannel<CanFrame> for ReplayChannel {
+    fn open(&mut self) -> ChannelResult<()> {
+        Ok(())
+    }
+
+    fn close(&mut self) -> ChannelResult<()> {
+        Ok(())
+    }
+
+    fn write_packets(&mut self, packets: &[CanFrame], _timeout_ms: u32) -> ChannelResult<()> {
+        for p in packets {
+            Self::expect(
+                &self.frames,
+                &mut self.frame_pos,
+                &mut self.mismatches,
+                RecordKind::CanTx,
+                p.get_address(),
+                p.get_data(),
+            );
+        }
+        Ok(())
+    }
+
+    fn read_packets(&mut self, max: usize, timeout_ms: u32) -> ChannelResult<Vec<CanFrame>> {
+        let mut packets = Vec::new();
+        while packets.len() < max {
+            match self.frames.get(self.frame_pos) {
+                Some(r) if r.kind == RecordKind::CanRx => {
+                    packets.push(CanFrame::new(r.addr, &r.data, r.extended));
+                    self.frame_pos += 1;
+                }
+                _ => break,
+            }
+        }
+        match packets.is_empty() && max != 0 {
+            // Same as a real channel with nothing to read
+            true if timeout_ms == 0 => Err(ChannelError::BufferEmpty),
+            true => Err(ChannelError::ReadTimeout),
+            false => Ok(packets),
+        }
+    }
+
+    fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
+        // Skip any frames which have not been read yet
+        while self
+            .frames
+            .get(self.frame_pos)
+            .map_or(false, |r| r.kind == RecordKind::CanRx)
+        {
+            self.frame_pos += 1;
+        }
+        Ok(())
+    }
+
+    fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
+        Ok(())
+    }
+}
+
+impl CanChannel for ReplayChannel {
+    fn set_can_cfg(&mut self, _baud: u32, _use_extended: bool) -> ChannelResult<()> {
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod capture_test {
+    use super::*;
+
+    fn record(kind: RecordKind, addr: u32, data: &[u8]) -> CaptureRecord {
+        CaptureRecord {
+            timestamp_us: 0,
+            kind,
+            addr,
+            extended: false,
+            data: data.to_vec(),
+        }
+    }
+
+    #[test]
+    fn test_capture_and_replay() {
+        // A session to capture, played back by a replay
+        let session = vec![
+            record(RecordKind::Request, 0x7E0, &[0x22, 0xF1, 0x90]),
+            record(RecordKind::Response, 0, &[0x62, 0xF1, 0x90, b'W']),
+            record(RecordKind::CanRx, 0x100, &[0x01, 0x02]),
+            record(RecordKind::CanTx, 0x101, &[0x03]),
+        ];
+        let path = std::env::temp_dir().join(format!("ecu_capture_{}.bin", std::process::id()));
+        let capture = CaptureLog::create(&path, 16).unwrap();
+        let mut channel =
+            CaptureChannel::new(ReplayChannel::new(session.clone()), capture.writer());
+
+        channel
+            .write_bytes(0x7E0, &[0x22, 0xF1, 0x90], 100)
+            .unwrap();
+        assert_eq!(channel.read_bytes(100).unwrap(), [0x62, 0xF1, 0x90, b'W']);
+        assert!(matches!(
+            channel.read_bytes(100),
+            Err(ChannelError::ReadTimeout)
+        ));
+        let frames = channel.read_packets(8, 100).unwrap();
+        assert_eq!(frames.len(), 1);
+        // The next frame was written, so there is nothing left to read until it is
+        assert!(matches!(
+            channel.read_packets(8, 0),
+            Err(ChannelError::BufferEmpty)
+        ));
+        channel
+            .write_packets(&[CanFrame::new(0x101, &[0x03], false)], 100)
+            .unwrap();
+        let replay = channel.into_inner();
+        assert!(replay.is_finished());
+        assert_eq!(replay.mismatches(), 0);
+        capture.finish().unwrap();
+
+        // Captured records are in the order they passed through the channel
+        let mut captured = ReplayChannel::from_file(&path).unwrap();
+        std::fs::remove_file(&path).unwrap();
+        captured
+            .write_bytes(0x7E0, &[0x22, 0xF1, 0x91], 100)
+            .unwrap();
+        assert_eq!(captured.mismatches(), 1);
+        assert_eq!(captured.read_bytes(0).unwrap(), [0x62, 0xF1, 0x90, b'W']);
+        assert_eq!(
+            captured.read_packets(8, 0).unwrap()[0].get_data(),
+            &[0x01, 0x02]
+        );
+    }
+
+    #[test]
+    fn test_truncated_capture() {
+        let mut bytes = Vec::new();
+        bytes.extend_from_slice(&CAPTURE_MAGIC);
+        bytes.extend_from_slice(&CAPTURE_VERSION.to_le_bytes());
+        // One complete record, then one cut short
+        for _ in 0..2 {
+            bytes.extend_from_slice(&5u64.to_le_bytes());
+            bytes.extend_from_slice(&[RecordKind::Request as u8, 0]);
+            bytes.extend_from_slice(&0x7E0u32.to_le_bytes());
+            bytes.extend_from_slice(&2u16.to_le_bytes());
+            bytes.extend_from_slice(&[0x3E, 0x00]);
+        }
+        bytes.pop();
+        let records = read_capture(bytes.as_slice()).unwrap();
+        assert_eq!(
+            records,
+            vec![{
+                let mut r = record(RecordKind::Request, 0x7E0, &[0x3E, 0x00]);
+                r.timestamp_us = 5;
+                r
+            }]
+        );
+        assert!(read_capture(&b"NOTCAP\x01\x00"[..]).is_err());
+    }
+}
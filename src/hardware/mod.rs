@@ -10,9 +10,15 @@ pub mod passthru; // Not finished at all yet, hide from the crate
 #[cfg(all(feature = "socketcan", unix))]
 pub mod socketcan;
 
+#[cfg(feature = "simulation")]
+pub mod simulation;
+
+pub mod capture;
+pub mod scheduler;
+
 use std::sync::{Arc, Mutex};
 
-use crate::channel::{CanChannel, IsoTPChannel};
+use crate::channel::{CanChannel, CanFdChannel, IsoTPChannel};
 
 /// Hardware API result
 pub type HardwareResult<T> = Result<T, HardwareError>;
@@ -31,6 +37,13 @@ pub trait Hardware {
     /// the channel will automatically be closed, if it has been opened.
     fn create_can_channel(this: Arc<Mutex<Self>>) -> HardwareResult<Box<dyn CanChannel>>;
 
+    /// Creates a CAN-FD Channel on the devices. This behaves like [Hardware::create_can_channel],
+    /// but the channel can also send and receive CAN-FD frames.
+    /// Devices which do not support CAN-FD return [HardwareError::ChannelNotSupported]
+    fn create_can_fd_channel(_this: Arc<Mutex<Self>>) -> HardwareResult<Box<dyn CanFdChannel>> {
+        Err(HardwareError::ChannelNotSupported)
+    }
+
     /// Returns true if the ISO-TP channel is current open and in use
     fn is_iso_tp_channel_open(&self) -> bool;
 
@@ -1,8 +1,9 @@
 use j2534_rust::FilterType::FLOW_CONTROL_FILTER;
 use j2534_rust::*;
 use libloading::Library;
+use std::collections::HashMap;
 use std::os::raw::c_char;
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
 use std::{ffi::*, fmt};
 
 /// Result which contains a PASSTHRU_ERROR in it's Err() variant
@@ -129,7 +130,25 @@ fn ret_res<T>(res: i32, ret: T) -> PassthruResult<T> {
     }
 }
 
+/// Function libraries loaded by this process, by path
+static LOADED_LIBS: Mutex<Option<HashMap<String, PassthruDrv>>> = Mutex::new(None);
+
 impl PassthruDrv {
+    /// Loads a function library, or reuses it if this process has already loaded it.
+    /// Libraries stay loaded until the process exits, so reopening a device does not have
+    /// to load and link its library again
+    pub fn load_cached(path: String) -> Result<PassthruDrv, libloading::Error> {
+        let mut libs = LOADED_LIBS.lock().unwrap_or_else(|e| e.into_inner());
+        let libs = libs.get_or_insert_with(HashMap::new);
+        if let Some(drv) = libs.get(&path) {
+            log::debug!("Reusing function library {}", path);
+            return Ok(drv.clone());
+        }
+        let drv = Self::load_lib(path.clone())?;
+        libs.insert(path, drv.clone());
+        Ok(drv)
+    }
+
     pub fn load_lib(path: String) -> Result<PassthruDrv, libloading::Error> {
         log::debug!("Opening function library {}", path);
         let lib = unsafe { Library::new(path)? };
@@ -219,6 +238,10 @@ impl PassthruDrv {
     }
 
     // type PassThruWriteMsgsFn = unsafe extern "stdcall" fn(channel_id: u32, msgs: *mut PASSTHRU_MSG, num_msgs: *mut u32, timeout: u32) -> i32;
+    /// Writes messages, returning how many the adapter accepted.
+    ///
+    /// A full Tx queue or a timeout is not an error, as the adapter may still have accepted
+    /// some of the messages. Only those are counted, so the rest can be written again later.
     #[allow(trivial_casts)]
     pub fn write_messages(
         &self,
@@ -240,18 +263,22 @@ impl PassthruDrv {
                 timeout,
             )
         };
-        ret_res(res, msg_count as usize)
+        // Never trust the adapter to report more messages than we gave it
+        let msg_count = std::cmp::min(msg_count, msgs.len() as u32) as usize;
+        if res == PassthruError::ERR_BUFFER_FULL as i32 || res == PassthruError::ERR_TIMEOUT as i32 {
+            return ret_res(0x00, msg_count);
+        }
+        ret_res(res, msg_count)
     }
 
     //type PassThruReadMsgsFn = unsafe extern "stdcall" fn(channel_id: u32, msgs: *mut PASSTHRU_MSG, num_msgs: *mut u32, timeout: u32) -> i32;
+    #[allow(dead_code)]
     pub fn read_messages(
         &self,
         channel_id: u32,
         max_msgs: u32,
         timeout: u32,
     ) -> PassthruResult<Vec<PASSTHRU_MSG>> {
-        log::debug!("PT_READ_MSGS called. Channel ID: {}, {} msgs, Timeout {}", channel_id, max_msgs, timeout);
-        let mut msg_count: u32 = max_msgs;
         // Create a blank array of empty passthru messages according to the max we should read
         let mut write_array: Vec<PASSTHRU_MSG> = vec![
             PASSTHRU_MSG {
@@ -265,28 +292,43 @@ impl PassthruDrv {
             };
             max_msgs as usize
         ];
+        let count = self.read_messages_into(channel_id, &mut write_array, timeout)?;
+        // Trim the output vector to size
+        write_array.truncate(count);
+        Ok(write_array)
+    }
 
+    /// Reads up to `msgs.len()` messages into a caller owned buffer, returning how many
+    /// were read. Unlike [PassthruDrv::read_messages], this does not allocate, so the buffer
+    /// can be reused across calls.
+    ///
+    /// An empty buffer or a timeout is not an error, it simply reads 0 messages.
+    pub fn read_messages_into(
+        &self,
+        channel_id: u32,
+        msgs: &mut [PASSTHRU_MSG],
+        timeout: u32,
+    ) -> PassthruResult<usize> {
+        log::debug!("PT_READ_MSGS called. Channel ID: {}, {} msgs, Timeout {}", channel_id, msgs.len(), timeout);
+        if msgs.is_empty() {
+            return Ok(0);
+        }
+        let max_msgs = msgs.len() as u32;
+        let mut msg_count: u32 = max_msgs;
         let res = unsafe {
             (&self.read_msg_fn)(
                 channel_id,
-                write_array.as_mut_ptr(),
+                msgs.as_mut_ptr(),
                 &mut msg_count,
                 timeout,
             )
         };
-        if res == PassthruError::ERR_BUFFER_EMPTY as i32 {
-            write_array.truncate(msg_count as usize);
-            return ret_res(0x00, write_array);
-        }
-        if res == PassthruError::ERR_TIMEOUT as i32 {
-            write_array.truncate(msg_count as usize);
-            return ret_res(0x00, write_array);
-        }
-        if msg_count != max_msgs {
-            // Trim the output vector to size
-            write_array.truncate(msg_count as usize);
+        // Never trust the adapter to report more messages than we gave it room for
+        let msg_count = std::cmp::min(msg_count, max_msgs) as usize;
+        if res == PassthruError::ERR_BUFFER_EMPTY as i32 || res == PassthruError::ERR_TIMEOUT as i32 {
+            return ret_res(0x00, msg_count);
         }
-        ret_res(res, write_array)
+        ret_res(res, msg_count)
     }
 
     //type PassThruReadVersionFn = unsafe extern "stdcall" fn(device_id: u32, firmware_version: *mut libc::c_char, dll_version: *mut libc::c_char, api_version: *mut libc::c_char) -> i32;
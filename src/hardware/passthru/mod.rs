@@ -18,9 +18,10 @@
 //! are supported
 
 use std::{
+    collections::{HashMap, VecDeque},
     ffi::c_void,
     sync::{Arc, Mutex},
-    time::Instant,
+    time::{Duration, Instant},
 };
 
 #[cfg(windows)]
@@ -30,11 +31,13 @@ use winreg::enums::*;
 use winreg::RegKey;
 
 #[cfg(unix)]
-use std::path::Path;
+use std::{
+    path::{Path, PathBuf},
+    time::UNIX_EPOCH,
+};
 
 use j2534_rust::{
-    ConnectFlags, FilterType, IoctlID, PassthruError, Protocol, RxFlag, TxFlag,
-    PASSTHRU_MSG,
+    ConnectFlags, FilterType, IoctlID, PassthruError, Protocol, RxFlag, TxFlag, PASSTHRU_MSG,
 };
 
 use crate::channel::{
@@ -44,10 +47,26 @@ use crate::channel::{
 
 use self::lib_funcs::PassthruDrv;
 
-use super::{HardwareCapabilities, HardwareError, HardwareInfo, HardwareResult};
+use super::{
+    scheduler::{IoHandle, IoPriority, IoScheduler},
+    HardwareCapabilities, HardwareError, HardwareInfo, HardwareResult,
+};
 
 mod lib_funcs;
 
+/// Maximum number of messages drained from the adapter by a single
+/// ISO-TP read call
+const ISO_TP_READ_BATCH: usize = 8;
+
+/// Returns the first `n` messages of a channel's reusable message buffer,
+/// only growing the buffer if it is too small
+fn msg_buffer(buf: &mut Vec<PASSTHRU_MSG>, n: usize) -> &mut [PASSTHRU_MSG] {
+    if buf.len() < n {
+        buf.resize(n, PASSTHRU_MSG::default());
+    }
+    &mut buf[..n]
+}
+
 /// Device scanner for Passthru supported devices
 #[derive(Debug, Clone, PartialEq, Eq, PartialOrd, Ord)]
 pub struct PassthruScanner {
@@ -60,58 +79,130 @@ impl Default for PassthruScanner {
     }
 }
 
+/// Identifies one version of a scanned entry (JSON file or registry key). Once it changes,
+/// the entry is read again
+type EntryStamp = (u128, u64);
+
+/// Entries read by a scan, by file path or registry key name, along with their stamp
+type ScanCache = HashMap<String, (EntryStamp, Option<PassthruInfo>)>;
+
+/// Entries read by previous scans, so that a scan only reads entries which are new
+/// or have changed since the last scan
+static SCAN_CACHE: Mutex<Option<ScanCache>> = Mutex::new(None);
+
+/// Returns the device of every entry found by a scan, reusing the devices of entries whose
+/// stamp has not changed since the last scan. Entries without a stamp are always read
+fn scan_entries<E>(
+    entries: Vec<(String, Option<EntryStamp>, E)>,
+    read: impl Fn(&E) -> HardwareResult<PassthruInfo>,
+) -> Vec<PassthruInfo> {
+    let mut cache = SCAN_CACHE.lock().unwrap_or_else(|e| e.into_inner());
+    scan_entries_with(cache.get_or_insert_with(HashMap::new), entries, read)
+}
+
+/// [scan_entries], using and updating `cache` instead of the cache shared by every scan
+fn scan_entries_with<E>(
+    cache: &mut ScanCache,
+    entries: Vec<(String, Option<EntryStamp>, E)>,
+    read: impl Fn(&E) -> HardwareResult<PassthruInfo>,
+) -> Vec<PassthruInfo> {
+    let mut scanned = HashMap::with_capacity(entries.len());
+    let mut devices = Vec::with_capacity(entries.len());
+    for (key, stamp, entry) in entries {
+        let info = match (cache.remove(&key), stamp) {
+            (Some((cached, info)), Some(stamp)) if cached == stamp => info,
+            _ => read(&entry).ok(),
+        };
+        if let Some(info) = &info {
+            devices.push(info.clone());
+        }
+        if let Some(stamp) = stamp {
+            scanned.insert(key, (stamp, info));
+        }
+    }
+    // Entries which were not found again have been uninstalled
+    *cache = scanned;
+    devices
+}
+
 impl PassthruScanner {
     #[cfg(unix)]
     /// Creates a passthru scanner. Scanning is done
     /// by scanning the ~/.passthru folder on the users PC for supported passthru
     /// JSON entries. This is UNOFFICIAL and should be considered experimental
     /// as Passthru API does not out of the box support UNIX Operating systems.
+    ///
+    /// JSON files which have not been modified since the last scan in this process
+    /// are not read again, see [PassthruScanner::rescan]
     pub fn new() -> Self {
-        match std::fs::read_dir(shellexpand::tilde("~/.passthru").to_string()) {
-            Ok(list) => {
-                Self {
-                    devices: list
-                        .into_iter()
-                        // Remove files that cannot be read
-                        .filter_map(|p| p.ok())
-                        // Filter any files that are not json files
-                        .filter(|p| p.file_name().to_str().unwrap().ends_with(".json"))
-                        // Attempt to read a PassthruDevice from each json file found
-                        .map(|p| PassthruInfo::new(&p.path()))
-                        // Keep Oks that were found, any entries that ended with errors are discarded
-                        .filter_map(|s| s.ok())
-                        // Convert result into vector
-                        .collect(),
-                }
-            }
-            Err(_) => Self {
-                devices: Vec::new(),
-            },
+        let entries = match std::fs::read_dir(shellexpand::tilde("~/.passthru").to_string()) {
+            Ok(list) => list
+                .into_iter()
+                // Remove files that cannot be read
+                .filter_map(|p| p.ok())
+                // Filter any files that are not json files
+                .filter(|p| {
+                    p.file_name()
+                        .to_str()
+                        .map_or(false, |n| n.ends_with(".json"))
+                })
+                .map(|p| {
+                    let stamp = p.metadata().ok().and_then(|m| {
+                        let modified = m.modified().ok()?.duration_since(UNIX_EPOCH).ok()?;
+                        Some((modified.as_nanos(), m.len()))
+                    });
+                    (p.path().to_string_lossy().into_owned(), stamp, p.path())
+                })
+                .collect(),
+            Err(_) => Vec::new(),
+        };
+        // Attempt to read a PassthruDevice from each json file found, discarding any with errors
+        Self {
+            devices: scan_entries(entries, |p: &PathBuf| PassthruInfo::new(p)),
         }
     }
 
     #[cfg(windows)]
     /// Creates a passthru scanner. This scanner scans for devices by checking
     /// the windows registry entry `HKEY_LOCAL_MACHINE\\SOFTWARE\\WOW6432Node\\PassthruSupport.04.04`
+    ///
+    /// Registry keys which have not been written to since the last scan in this process
+    /// are not read again, see [PassthruScanner::rescan]
     pub fn new() -> Self {
-        match RegKey::predef(HKEY_LOCAL_MACHINE)
+        let entries = match RegKey::predef(HKEY_LOCAL_MACHINE)
             .open_subkey("SOFTWARE\\WOW6432Node\\PassThruSupport.04.04")
         {
-            Ok(r) => Self {
-                devices: r
-                    .enum_keys()
-                    .into_iter()
-                    .filter_map(|e| e.ok())
-                    .map(|key| r.open_subkey(key))
-                    .map(|x| PassthruInfo::new(&x.unwrap()))
-                    .filter_map(|d| d.ok())
-                    .collect(),
-            },
-            Err(_) => Self {
-                devices: Vec::new(),
-            },
+            Ok(r) => r
+                .enum_keys()
+                .into_iter()
+                .filter_map(|e| e.ok())
+                .filter_map(|name| {
+                    let key = r.open_subkey(&name).ok()?;
+                    let stamp = key.query_info().ok().map(|i| {
+                        let t = i.last_write_time;
+                        (
+                            (t.dwHighDateTime as u128) << 32 | t.dwLowDateTime as u128,
+                            0,
+                        )
+                    });
+                    Some((name, stamp, key))
+                })
+                .collect(),
+            Err(_) => Vec::new(),
+        };
+        Self {
+            devices: scan_entries(entries, |k: &RegKey| PassthruInfo::new(k)),
         }
     }
+
+    /// Creates a passthru scanner, reading every entry again rather than reusing
+    /// the entries read by previous scans
+    pub fn rescan() -> Self {
+        if let Ok(mut cache) = SCAN_CACHE.lock() {
+            *cache = None;
+        }
+        Self::new()
+    }
 }
 
 impl super::HardwareScanner<PassthruDevice> for PassthruScanner {
@@ -259,7 +350,16 @@ impl From<&PassthruInfo> for HardwareInfo {
     }
 }
 
+/// Longest time a driver call may block a device's I/O thread for, whilst every queued job is
+/// waiting on the adapter. See [IoScheduler::new]
+const IO_MAX_BLOCK: Duration = Duration::from_millis(5);
+
 /// Passthru device
+///
+/// Every call into the device's driver runs on the device's own I/O thread (See [IoScheduler]),
+/// so channels on the same device do not hold each other up. ISO-TP channels submit their
+/// calls at [IoPriority::Diagnostic], and CAN channels at [IoPriority::Bulk], unless changed
+/// with [PassthruDevice::set_io_priority]
 #[derive(Debug)]
 pub struct PassthruDevice {
     info: HardwareInfo,
@@ -267,23 +367,42 @@ pub struct PassthruDevice {
     device_idx: Option<u32>,
     can_channel: bool,
     isotp_channel: bool,
+    /// Priority of the I/O of ISO-TP and CAN channels created on this device
+    priorities: (IoPriority, IoPriority),
+    /// Handle for device level calls, which always run at diagnostic priority
+    io_handle: IoHandle,
+    io: IoScheduler,
 }
 
 impl PassthruDevice {
     /// Opens the passthru device
     fn open_device(info: &PassthruInfo) -> HardwareResult<Self> {
-        log::debug!("Opening device {}. Function library is at {}", info.name, info.function_lib);
+        log::debug!(
+            "Opening device {}. Function library is at {}",
+            info.name,
+            info.function_lib
+        );
         let lib = info.function_lib.clone();
-        let mut drv = lib_funcs::PassthruDrv::load_lib(lib)?;
-        let idx = drv.open()?;
+        let mut drv = lib_funcs::PassthruDrv::load_cached(lib)?;
+        let io = IoScheduler::new(IO_MAX_BLOCK);
+        let io_handle = io.handle(IoPriority::Diagnostic);
+        // Like every other driver call, the device is opened on its I/O thread
+        let (drv, idx) = io_handle.run(move || {
+            let res = drv.open();
+            (drv, res)
+        })?;
+        let idx = idx?;
         let mut ret = Self {
             info: info.into(),
             drv,
             device_idx: Some(idx),
             can_channel: false,
             isotp_channel: false,
+            priorities: (IoPriority::Diagnostic, IoPriority::Bulk),
+            io_handle,
+            io,
         };
-        if let Ok(version) = ret.drv.get_version(idx) {
+        if let Ok(version) = ret.safe_passthru_op(|idx, drv| drv.get_version(idx)) {
             // Set new version information from the device!
             ret.info.api_version = Some(version.api_version.clone());
             ret.info.device_fw_version = Some(version.fw_version.clone());
@@ -292,37 +411,61 @@ impl PassthruDevice {
         Ok(ret)
     }
 
-    pub(crate) fn safe_passthru_op<
-        X,
-        T: FnOnce(u32, PassthruDrv) -> lib_funcs::PassthruResult<X>,
-    >(
-        &self,
-        f: T,
-    ) -> HardwareResult<X> {
-        match self.device_idx {
-            Some(idx) => match f(idx, self.drv.clone()) {
-                Ok(res) => Ok(res),
-                Err(e) => {
-                    log::warn!("Function failed with status {:?}, status 0x{:02X}", e, e as u32);
-                    if e == PassthruError::ERR_FAILED {
-                        // Err failed, query the adapter for error!
-                        if let Ok(reason) = self.drv.get_last_error() {
-                            log::warn!("Function generic failure reason: {}", reason);
-                            Err(HardwareError::APIError {
-                                code: e as u32,
-                                desc: reason,
-                            })
-                        } else {
-                            log::warn!("Function generic failure with no reason");
-                            // No reason, just ERR_FAILED
-                            Err(e.into())
-                        }
-                    } else {
-                        Err(e.into())
-                    }
+    /// Sets the priority of the I/O of ISO-TP and CAN channels created after this call.
+    /// By default, ISO-TP channels use [IoPriority::Diagnostic] and CAN channels use [IoPriority::Bulk],
+    /// so diagnostic requests are never held up by sniffing the CAN network
+    pub fn set_io_priority(&mut self, iso_tp: IoPriority, can: IoPriority) {
+        self.priorities = (iso_tp, can);
+    }
+
+    /// Returns the I/O handle a new channel uses
+    fn channel_io(&self, priority: IoPriority) -> PassthruIo {
+        PassthruIo {
+            drv: self.drv.clone(),
+            handle: self.io.handle(priority),
+        }
+    }
+
+    /// Runs a driver call on the device's I/O thread, at diagnostic priority
+    pub(crate) fn safe_passthru_op<X, T>(&self, f: T) -> HardwareResult<X>
+    where
+        X: Send + 'static,
+        T: FnOnce(u32, PassthruDrv) -> lib_funcs::PassthruResult<X> + Send + 'static,
+    {
+        let idx = self.device_idx.ok_or(HardwareError::DeviceNotOpen)?;
+        let drv = self.drv.clone();
+        self.io_handle
+            .run(move || check_result(&drv, f(idx, drv.clone())))?
+    }
+}
+
+/// Converts the result of a driver call, querying the driver for the reason of generic failures.
+/// This must run on the device's I/O thread, straight after the failed call
+fn check_result<X>(drv: &PassthruDrv, res: lib_funcs::PassthruResult<X>) -> HardwareResult<X> {
+    match res {
+        Ok(res) => Ok(res),
+        Err(e) => {
+            log::warn!(
+                "Function failed with status {:?}, status 0x{:02X}",
+                e,
+                e as u32
+            );
+            if e == PassthruError::ERR_FAILED {
+                // Err failed, query the adapter for error!
+                if let Ok(reason) = drv.get_last_error() {
+                    log::warn!("Function generic failure reason: {}", reason);
+                    Err(HardwareError::APIError {
+                        code: e as u32,
+                        desc: reason,
+                    })
+                } else {
+                    log::warn!("Function generic failure with no reason");
+                    // No reason, just ERR_FAILED
+                    Err(e.into())
                 }
-            },
-            None => Err(HardwareError::DeviceNotOpen),
+            } else {
+                Err(e.into())
+            }
         }
     }
 }
@@ -331,16 +474,16 @@ impl Drop for PassthruDevice {
     #[allow(unused_must_use)] // If this function fails, then device is already closed, so don't care!
     fn drop(&mut self) {
         log::debug!("Drop called for device");
-        if let Some(idx) = self.device_idx {
-            self.drv.close(idx);
-            self.device_idx = None;
+        if let Some(idx) = self.device_idx.take() {
+            let mut drv = self.drv.clone();
+            self.io_handle.run(move || drv.close(idx));
         }
     }
 }
 
 impl super::Hardware for PassthruDevice {
     fn create_iso_tp_channel(this: Arc<Mutex<Self>>) -> HardwareResult<Box<dyn IsoTPChannel>> {
-        {
+        let io = {
             let this = this.lock()?;
             if !this.info.capabilities.iso_tp {
                 return Err(HardwareError::ChannelNotSupported);
@@ -348,19 +491,24 @@ impl super::Hardware for PassthruDevice {
             if this.can_channel {
                 return Err(HardwareError::ConflictingChannel);
             }
-        }
+            this.channel_io(this.priorities.0)
+        };
         let iso_tp_channel = PassthruIsoTpChannel {
             device: this,
+            io,
             channel_id: None,
             cfg: IsoTPSettings::default(),
             ids: (0, 0),
             cfg_complete: false,
+            tx_msgs: Vec::new(),
+            rx_msgs: Vec::new(),
+            rx_queue: VecDeque::new(),
         };
         Ok(Box::new(iso_tp_channel))
     }
 
     fn create_can_channel(this: Arc<Mutex<Self>>) -> HardwareResult<Box<dyn CanChannel>> {
-        {
+        let io = {
             let this = this.lock()?;
             if !this.info.capabilities.can {
                 return Err(HardwareError::ChannelNotSupported);
@@ -368,12 +516,16 @@ impl super::Hardware for PassthruDevice {
             if this.can_channel {
                 return Err(HardwareError::ConflictingChannel);
             }
-        }
+            this.channel_io(this.priorities.1)
+        };
         let can_channel = PassthruCanChannel {
             device: this,
+            io,
             channel_id: None,
             baud: 0,
             use_ext: false,
+            tx_msgs: Vec::new(),
+            rx_msgs: Vec::new(),
         };
         Ok(Box::new(can_channel))
     }
@@ -388,32 +540,34 @@ impl super::Hardware for PassthruDevice {
 
     #[allow(trivial_casts)]
     fn read_battery_voltage(&mut self) -> Option<f32> {
-        let mut output: u32 = 0;
         match self.safe_passthru_op(|idx, drv: PassthruDrv| {
+            let mut output: u32 = 0;
             drv.ioctl(
                 idx,
                 IoctlID::READ_VBATT,
                 std::ptr::null_mut(),
                 (&mut output) as *mut _ as *mut c_void,
             )
+            .map(|_| output)
         }) {
-            Ok(_) => Some(output as f32 / 1000.0),
+            Ok(output) => Some(output as f32 / 1000.0),
             Err(_) => None,
         }
     }
 
     #[allow(trivial_casts)]
     fn read_ignition_voltage(&mut self) -> Option<f32> {
-        let mut output: u32 = 0;
         match self.safe_passthru_op(|idx, drv: PassthruDrv| {
+            let mut output: u32 = 0;
             drv.ioctl(
                 idx,
                 IoctlID::READ_PROG_VOLTAGE,
                 std::ptr::null_mut(),
                 (&mut output) as *mut _ as *mut c_void,
             )
+            .map(|_| output)
         }) {
-            Ok(_) => Some(output as f32 / 1000.0),
+            Ok(output) => Some(output as f32 / 1000.0),
             Err(_) => None,
         }
     }
@@ -423,13 +577,119 @@ impl super::Hardware for PassthruDevice {
     }
 }
 
+/// A device's driver, and a channel's handle to the device's I/O thread.
+/// Channels do their I/O through this, rather than locking the device
+#[derive(Debug, Clone)]
+struct PassthruIo {
+    drv: PassthruDrv,
+    handle: IoHandle,
+}
+
+impl PassthruIo {
+    /// Polls a driver call on the device's I/O thread until it returns a result, see [IoHandle::poll].
+    /// `f` must not call the driver with a timeout longer than the time it is given to block for
+    fn poll<X, F>(&self, mut f: F) -> HardwareResult<X>
+    where
+        X: Send,
+        F: FnMut(&PassthruDrv, Duration) -> Option<lib_funcs::PassthruResult<X>> + Send,
+    {
+        let drv = self.drv.clone();
+        self.handle
+            .poll(move |block| f(&drv, block).map(|res| check_result(&drv, res)))?
+    }
+
+    /// Runs an IOCTL without parameters on a channel
+    fn ioctl(&self, channel_id: u32, ioctl: IoctlID) -> HardwareResult<()> {
+        self.poll(move |drv, _| {
+            Some(drv.ioctl(
+                channel_id,
+                ioctl,
+                std::ptr::null_mut(),
+                std::ptr::null_mut(),
+            ))
+        })
+    }
+}
+
+/// Writes messages without blocking the I/O thread. Each poll queues as many of the
+/// remaining messages as the adapter accepts, until all are queued or `deadline` passes.
+/// If the adapter's Tx queue fills part way through, only the messages it did not accept
+/// are written again.
+///
+/// Unlike reads, writes never block, as the adapter only has to queue the messages
+fn poll_write(
+    drv: &PassthruDrv,
+    channel_id: u32,
+    msgs: &mut [PASSTHRU_MSG],
+    sent: &mut usize,
+    deadline: Instant,
+) -> Option<lib_funcs::PassthruResult<()>> {
+    match drv.write_messages(channel_id, &mut msgs[*sent..], 0) {
+        Ok(count) => *sent += count,
+        Err(e) => return Some(Err(e)),
+    }
+    if *sent >= msgs.len() {
+        Some(Ok(()))
+    } else if Instant::now() >= deadline {
+        Some(Err(PassthruError::ERR_TIMEOUT))
+    } else {
+        None
+    }
+}
+
+/// Reads messages without holding up the I/O thread. Each poll reads whatever the adapter
+/// has buffered into the rest of `msgs`, until `wanted` messages are read or `deadline` passes.
+///
+/// When allowed to `block`, the adapter is instead asked to wait for the messages still wanted,
+/// so they are returned as soon as they arrive, and anything else already buffered is read after
+fn poll_read(
+    drv: &PassthruDrv,
+    channel_id: u32,
+    msgs: &mut [PASSTHRU_MSG],
+    read: &mut usize,
+    wanted: usize,
+    deadline: Instant,
+    block: Duration,
+) -> Option<lib_funcs::PassthruResult<()>> {
+    let timeout = block_timeout(block, deadline);
+    if timeout != 0 && *read < wanted {
+        match drv.read_messages_into(channel_id, &mut msgs[*read..wanted], timeout) {
+            Ok(count) => *read += count,
+            Err(e) => return Some(Err(e)),
+        }
+    }
+    if timeout == 0 || (*read != 0 && *read < msgs.len()) {
+        match drv.read_messages_into(channel_id, &mut msgs[*read..], 0) {
+            Ok(count) => *read += count,
+            Err(e) => return Some(Err(e)),
+        }
+    }
+    if *read >= wanted || Instant::now() >= deadline {
+        Some(Ok(()))
+    } else {
+        None
+    }
+}
+
+/// Returns the timeout of a driver call which may block for up to `block`, without passing `deadline`
+fn block_timeout(block: Duration, deadline: Instant) -> u32 {
+    let wait = block.min(deadline.saturating_duration_since(Instant::now()));
+    // Rounded up, as a driver given a timeout of 0 would not wait at all
+    ((wait.as_micros() + 999) / 1000) as u32
+}
+
 /// Passthru device CAN Channel
 #[derive(Debug)]
 pub struct PassthruCanChannel {
     pub(crate) device: Arc<Mutex<PassthruDevice>>,
+    io: PassthruIo,
     pub(crate) channel_id: Option<u32>,
     pub(crate) baud: u32,
     pub(crate) use_ext: bool,
+    /// Reusable buffer frames are converted into before being written
+    tx_msgs: Vec<PASSTHRU_MSG>,
+    /// Reusable buffer the adapter reads frames into
+    rx_msgs: Vec<PASSTHRU_MSG>,
 }
 
 impl PassthruCanChannel {
@@ -461,10 +721,11 @@ impl PacketChannel<CanFrame> for PassthruCanChannel {
         if self.use_ext {
             flags |= ConnectFlags::CAN_29BIT_ID;
         }
+        let (flags, baud) = (flags.bits(), self.baud);
         // Initialize the interface
         let channel_id = device
-            .safe_passthru_op(|device_id, device| {
-                device.connect(device_id, Protocol::CAN, flags.bits(), self.baud)
+            .safe_passthru_op(move |device_id, device| {
+                device.connect(device_id, Protocol::CAN, flags, baud)
             })
             .map_err(ChannelError::HardwareError)?;
         device.can_channel = true; // Acknowledge CAN is open now
@@ -490,7 +751,7 @@ impl PacketChannel<CanFrame> for PassthruCanChannel {
         mask.data[0..4].copy_from_slice(&[0x00, 0x00, 0x00, 0x00]);
         pattern.data[0..4].copy_from_slice(&[0x00, 0x00, 0x00, 0x00]);
 
-        match device.safe_passthru_op(|_, device| {
+        match device.safe_passthru_op(move |_, device| {
             device.start_msg_filter(channel_id, FilterType::PASS_FILTER, &mask, &pattern, None)
         }) {
             Ok(_) => Ok(()), // Channel setup complete
@@ -512,62 +773,63 @@ impl PacketChannel<CanFrame> for PassthruCanChannel {
         }
         let id = self.get_channel_id().unwrap(); // Unwrap as we checked previously if none
         device
-            .safe_passthru_op(|_, device| device.disconnect(id))
+            .safe_passthru_op(move |_, device| device.disconnect(id))
             .map_err(ChannelError::HardwareError)?;
         device.can_channel = false;
         self.channel_id = None;
         Ok(())
     }
 
-    fn write_packets(&mut self, packets: Vec<CanFrame>, timeout_ms: u32) -> ChannelResult<()> {
+    fn write_packets(&mut self, packets: &[CanFrame], timeout_ms: u32) -> ChannelResult<()> {
         let channel_id = self.get_channel_id()?;
-        let mut msgs: Vec<PASSTHRU_MSG> = packets.iter().map(|f| f.into()).collect();
-        self.device
-            .lock()?
-            .safe_passthru_op(|_, device| device.write_messages(channel_id, &mut msgs, timeout_ms))
-            .map_err(|e| e.into())
-            .map(|_| ())
+        let count = packets.len();
+        let msgs = msg_buffer(&mut self.tx_msgs, count);
+        for (msg, frame) in msgs.iter_mut().zip(packets) {
+            fill_msg_from_frame(msg, frame);
+        }
+        let deadline = Instant::now() + Duration::from_millis(timeout_ms as u64);
+        let mut sent = 0;
+        self.io
+            .poll(|drv, _| poll_write(drv, channel_id, msgs, &mut sent, deadline))?;
+        Ok(())
     }
 
     fn read_packets(&mut self, max: usize, timeout_ms: u32) -> ChannelResult<Vec<CanFrame>> {
+        let mut result = vec![CanFrame::default(); max];
+        let count = self.read_packets_into(&mut result, timeout_ms)?;
+        result.truncate(count);
+        Ok(result)
+    }
+
+    fn read_packets_into(
+        &mut self,
+        packets: &mut [CanFrame],
+        timeout_ms: u32,
+    ) -> ChannelResult<usize> {
         let channel_id = self.get_channel_id()?;
-        match self
-            .device
-            .lock()?
-            .safe_passthru_op(|_, device| device.read_messages(channel_id, max as u32, timeout_ms))
-        {
-            Ok(res) => Ok(res.iter().map(CanFrame::from).collect()),
-            Err(e) => Err(e.into()),
+        let max = packets.len();
+        let msgs = msg_buffer(&mut self.rx_msgs, max);
+        let deadline = Instant::now() + Duration::from_millis(timeout_ms as u64);
+        let mut read = 0;
+        self.io
+            .poll(|drv, block| poll_read(drv, channel_id, msgs, &mut read, max, deadline, block))?;
+        for (frame, msg) in packets.iter_mut().zip(&msgs[..read]) {
+            *frame = CanFrame::from(msg);
         }
+        Ok(read)
     }
 
     fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
         let channel_id = self.get_channel_id()?;
-        self.device
-            .lock()?
-            .safe_passthru_op(|_, device| {
-                device.ioctl(
-                    channel_id,
-                    IoctlID::CLEAR_RX_BUFFER,
-                    std::ptr::null_mut(),
-                    std::ptr::null_mut(),
-                )
-            })
+        self.io
+            .ioctl(channel_id, IoctlID::CLEAR_RX_BUFFER)
             .map_err(|e| e.into())
     }
 
     fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
         let channel_id = self.get_channel_id()?;
-        self.device
-            .lock()?
-            .safe_passthru_op(|_, device| {
-                device.ioctl(
-                    channel_id,
-                    IoctlID::CLEAR_TX_BUFFER,
-                    std::ptr::null_mut(),
-                    std::ptr::null_mut(),
-                )
-            })
+        self.io
+            .ioctl(channel_id, IoctlID::CLEAR_TX_BUFFER)
             .map_err(|e| e.into())
     }
 }
@@ -585,10 +847,17 @@ impl Drop for PassthruCanChannel {
 #[derive(Debug)]
 pub struct PassthruIsoTpChannel {
     device: Arc<Mutex<PassthruDevice>>,
+    io: PassthruIo,
     channel_id: Option<u32>,
     cfg: IsoTPSettings,
     ids: (u32, u32),
     cfg_complete: bool,
+    /// Reusable buffer payloads are written from
+    tx_msgs: Vec<PASSTHRU_MSG>,
+    /// Reusable buffer the adapter reads messages into
+    rx_msgs: Vec<PASSTHRU_MSG>,
+    /// Completed payloads read from the adapter but not yet returned by [PayloadChannel::read_bytes]
+    rx_queue: VecDeque<Vec<u8>>,
 }
 
 impl PassthruIsoTpChannel {
@@ -598,6 +867,37 @@ impl PassthruIsoTpChannel {
             Some(x) => Ok(x),
         }
     }
+
+    /// Reads a batch of messages from the adapter, waiting until `deadline` for at least one,
+    /// and queues every completed payload in `rx_queue`
+    fn fill_rx_queue(&mut self, channel_id: u32, deadline: Instant) -> ChannelResult<()> {
+        let msgs = msg_buffer(&mut self.rx_msgs, ISO_TP_READ_BATCH);
+        let mut read = 0;
+        self.io
+            .poll(|drv, block| poll_read(drv, channel_id, msgs, &mut read, 1, deadline, block))
+            .map_err(ChannelError::HardwareError)?;
+        let count = read;
+
+        // Messages with these RxStatus bits sets are considered
+        // to be either echo messages or indication of more data to be received
+        // therefore, we ignore them
+        //
+        // This is a quirk fix specifically for some *cough* crappy *cough* VCI adapters
+        // Normally, ISO15765_FIRST_FRAME are ALWAYS 4 bytes in length, but some of these adapters
+        // don't do that, instead returning a message with an arbitrary number
+        // of bytes, all set to 0x00. This breaks the specification!
+        // but instead they use these 2 flags to denote echo messages!
+        let ignore_mask = RxFlag::ISO15765_FIRST_FRAME.bits() | RxFlag::TX_MSG_TYPE.bits();
+        for msg in self.rx_msgs[..count]
+            .iter()
+            .filter(|msg| msg.rx_status & ignore_mask == 0 && msg.data_size >= 4)
+        {
+            // First 4 bytes are CAN ID, so ignore those
+            self.rx_queue
+                .push_back(msg.data[4..msg.data_size as usize].to_vec());
+        }
+        Ok(())
+    }
 }
 
 impl PayloadChannel for PassthruIsoTpChannel {
@@ -612,13 +912,14 @@ impl PayloadChannel for PassthruIsoTpChannel {
         if self.cfg.extended_addressing {
             flags |= ConnectFlags::ISO15765_ADDR_TYPE;
         }
+        let (flags, baud) = (flags.bits(), self.cfg.can_speed);
 
         let mut device = self.device.lock()?;
 
         // Initialize the interface
         let channel_id = device
-            .safe_passthru_op(|device_id, device| {
-                device.connect(device_id, Protocol::ISO15765, flags.bits(), self.cfg.can_speed)
+            .safe_passthru_op(move |device_id, device| {
+                device.connect(device_id, Protocol::ISO15765, flags, baud)
             })
             .map_err(ChannelError::HardwareError)?;
         device.isotp_channel = true; // Acknowledge CAN is open now
@@ -651,7 +952,7 @@ impl PayloadChannel for PassthruIsoTpChannel {
         pattern.data[0..4].copy_from_slice(&self.ids.1.to_be_bytes());
         flow_control.data[0..4].copy_from_slice(&self.ids.0.to_be_bytes());
 
-        match device.safe_passthru_op(|_, device| {
+        match device.safe_passthru_op(move |_, device| {
             device.start_msg_filter(
                 channel_id,
                 FilterType::FLOW_CONTROL_FILTER,
@@ -681,11 +982,12 @@ impl PayloadChannel for PassthruIsoTpChannel {
             let mut device = self.device.lock()?;
             let id = self.get_channel_id().unwrap(); // Unwrap as we checked previously if none
             device
-                .safe_passthru_op(|_, device| device.disconnect(id))
+                .safe_passthru_op(move |_, device| device.disconnect(id))
                 .map_err(ChannelError::HardwareError)?;
             device.isotp_channel = false;
             self.channel_id = None;
         }
+        self.rx_queue.clear();
         Ok(())
     }
 
@@ -696,32 +998,19 @@ impl PayloadChannel for PassthruIsoTpChannel {
 
     fn read_bytes(&mut self, timeout_ms: u32) -> ChannelResult<Vec<u8>> {
         let channel_id = self.get_channel_id()?;
-        let start = Instant::now();
+        // Payloads left over from a previous batch read are returned first
+        if let Some(payload) = self.rx_queue.pop_front() {
+            return Ok(payload);
+        }
         let timeout = std::cmp::max(1, timeout_ms); // Need 1ms minimum
-        while start.elapsed().as_millis() <= timeout as u128 {
-            let read = self
-                .device
-                .lock()?
-                .safe_passthru_op(|_, device| device.read_messages(channel_id, 1, timeout_ms))
-                .map_err(ChannelError::HardwareError)?;
-            if let Some(msg) = read.get(0) {
-                // Messages with these RxStatus bits sets are considered
-                // to be either echo messages or indication of more data to be received
-                // therefore, we ignore them
-                //
-                // This is a quirk fix specifically for some *cough* crappy *cough* VCI adapters
-                // Normally, ISO15765_FIRST_FRAME are ALWAYS 4 bytes in length, but some of these adapters
-                // don't do that, instead returning a message with an arbitrary number
-                // of bytes, all set to 0x00. This breaks the specification!
-                // but instead they use these 2 flags to denote echo messages!
-                if (msg.rx_status & RxFlag::ISO15765_FIRST_FRAME.bits() == 0) // Not a first frame indication
-                    && (msg.rx_status & RxFlag::TX_MSG_TYPE.bits() == 0) // Not an echo message
-                {
-                    // Normal way of checking for ISO15765_FIRST_FRAME indication
-                    // Read complete!
-                    // First 4 bytes are CAN ID, so ignore those
-                    return Ok(msg.data[4..msg.data_size as usize].to_vec());
-                }
+        let deadline = Instant::now() + Duration::from_millis(timeout as u64);
+        loop {
+            self.fill_rx_queue(channel_id, deadline)?;
+            if let Some(payload) = self.rx_queue.pop_front() {
+                return Ok(payload);
+            }
+            if Instant::now() >= deadline {
+                break;
             }
         }
         if timeout_ms == 0 {
@@ -733,12 +1022,6 @@ impl PayloadChannel for PassthruIsoTpChannel {
 
     fn write_bytes(&mut self, addr: u32, buffer: &[u8], timeout_ms: u32) -> ChannelResult<()> {
         let channel_id = self.get_channel_id()?;
-        let mut write_msg = PASSTHRU_MSG {
-            protocol_id: Protocol::ISO15765 as u32,
-            data_size: 4 + buffer.len() as u32, // First 4 bytes are CAN ID
-            ..Default::default()
-        };
-
         let mut tx_flags = 0u32;
         if self.cfg.can_use_ext_addr {
             tx_flags |= TxFlag::CAN_29BIT_ID.bits();
@@ -750,57 +1033,50 @@ impl PayloadChannel for PassthruIsoTpChannel {
             tx_flags |= TxFlag::ISO15765_EXT_ADDR.bits();
         }
 
+        // Only the header and the bytes covered by data_size are rewritten,
+        // the rest of the reused message is never read by the adapter
+        let msgs = msg_buffer(&mut self.tx_msgs, 1);
+        let write_msg = &mut msgs[0];
+        write_msg.protocol_id = Protocol::ISO15765 as u32;
+        write_msg.rx_status = 0;
         write_msg.tx_flags = tx_flags;
-        write_msg.data[0] = (addr >> 24) as u8;
-        write_msg.data[1] = (addr >> 16) as u8;
-        write_msg.data[2] = (addr >> 8) as u8;
-        write_msg.data[3] = addr as u8;
+        write_msg.data_size = 4 + buffer.len() as u32; // First 4 bytes are CAN ID
+        write_msg.extra_data_size = 0;
+        write_msg.data[0..4].copy_from_slice(&addr.to_be_bytes());
         write_msg.data[4..4 + buffer.len()].copy_from_slice(buffer);
 
         // Now transmit our message!
-
-        self.device
-            .lock()?
-            .safe_passthru_op(|_, device| {
-                device.write_messages(channel_id, &mut [write_msg], timeout_ms)
-            })
-            .map_err(ChannelError::HardwareError)
-            .map(|_| ())
+        let deadline = Instant::now() + Duration::from_millis(timeout_ms as u64);
+        let mut sent = 0;
+        self.io
+            .poll(|drv, _| poll_write(drv, channel_id, msgs, &mut sent, deadline))
+            .map_err(ChannelError::HardwareError)?;
+        Ok(())
     }
 
     fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
         let channel_id = self.get_channel_id()?;
-        self.device
-            .lock()?
-            .safe_passthru_op(|_, device| {
-                device.ioctl(
-                    channel_id,
-                    IoctlID::CLEAR_RX_BUFFER,
-                    std::ptr::null_mut(),
-                    std::ptr::null_mut(),
-                )
-            })
+        self.rx_queue.clear();
+        self.io
+            .ioctl(channel_id, IoctlID::CLEAR_RX_BUFFER)
             .map_err(|e| e.into())
     }
 
     fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
         let channel_id = self.get_channel_id()?;
-        self.device
-            .lock()?
-            .safe_passthru_op(|_, device| {
-                device.ioctl(
-                    channel_id,
-                    IoctlID::CLEAR_TX_BUFFER,
-                    std::ptr::null_mut(),
-                    std::ptr::null_mut(),
-                )
-            })
+        self.io
+            .ioctl(channel_id, IoctlID::CLEAR_TX_BUFFER)
             .map_err(|e| e.into())
     }
 }
 
 impl<'a> IsoTPChannel for PassthruIsoTpChannel {
+    /// NOTE: The J2534 API has no CAN-FD ISO-TP protocol, so settings requesting CAN-FD
+    /// fail with [ChannelError::UnsupportedRequest]
     fn set_iso_tp_cfg(&mut self, cfg: IsoTPSettings) -> ChannelResult<()> {
+        if cfg.can_fd {
+            return Err(ChannelError::UnsupportedRequest);
+        }
         self.cfg_complete = true;
         self.cfg = cfg;
         Ok(())
@@ -816,19 +1092,24 @@ impl<'a> Drop for PassthruIsoTpChannel {
     }
 }
 
+/// Writes a CAN Frame into an existing (possibly reused) Passthru message
+fn fill_msg_from_frame(msg: &mut PASSTHRU_MSG, frame: &CanFrame) {
+    msg.protocol_id = Protocol::CAN as u32;
+    msg.rx_status = 0;
+    msg.tx_flags = 0;
+    if frame.is_extended() {
+        msg.tx_flags |= TxFlag::CAN_29BIT_ID.bits();
+    }
+    msg.extra_data_size = 0;
+    msg.data_size = (frame.get_data().len() + 4) as u32;
+    msg.data[0..4].copy_from_slice(&frame.get_address().to_be_bytes());
+    msg.data[4..4 + frame.get_data().len()].copy_from_slice(frame.get_data());
+}
+
 impl From<&CanFrame> for PASSTHRU_MSG {
     fn from(frame: &CanFrame) -> Self {
         let mut f = PASSTHRU_MSG::default();
-        if frame.is_extended() {
-            f.tx_flags |= TxFlag::CAN_29BIT_ID.bits();
-        }
-        f.protocol_id = Protocol::CAN as u32;
-        f.data_size = (frame.get_data().len() + 4) as u32;
-        f.data[0] = (frame.get_address() >> 24) as u8;
-        f.data[1] = (frame.get_address() >> 16) as u8;
-        f.data[2] = (frame.get_address() >> 8) as u8;
-        f.data[3] = frame.get_address() as u8;
-        f.data[4..4 + frame.get_data().len()].copy_from_slice(frame.get_data());
+        fill_msg_from_frame(&mut f, frame);
         f
     }
 }
@@ -853,3 +1134,59 @@ impl From<PassthruError> for HardwareError {
         }
     }
 }
+
+#[cfg(test)]
+mod passthru_test {
+    use super::*;
+    use std::cell::Cell;
+
+    fn info(name: &str) -> HardwareResult<PassthruInfo> {
+        Ok(PassthruInfo {
+            name: name.into(),
+            vendor: String::new(),
+            function_lib: String::new(),
+            can: true,
+            iso15765: true,
+            iso14230: false,
+            iso9141: false,
+            j1850pwm: false,
+            j1850vpw: false,
+            sci_a_engine: false,
+            sci_b_engine: false,
+            sci_a_trans: false,
+            sci_b_trans: false,
+        })
+    }
+
+    #[test]
+    fn test_scan_only_reads_changed_entries() {
+        let reads = Cell::new(0);
+        let read = |name: &&str| {
+            reads.set(reads.get() + 1);
+            info(name)
+        };
+        // Not the shared cache, which scans by other tests would also change
+        let mut cache = ScanCache::new();
+        let mut scan = |entries: &[(&'static str, Option<EntryStamp>)]| {
+            let entries = entries
+                .iter()
+                .map(|(n, s)| (n.to_string(), *s, *n))
+                .collect();
+            scan_entries_with(&mut cache, entries, read)
+        };
+
+        assert_eq!(scan(&[("a", Some((1, 1))), ("b", Some((1, 1)))]).len(), 2);
+        assert_eq!(reads.get(), 2);
+        // Nothing changed
+        assert_eq!(scan(&[("a", Some((1, 1))), ("b", Some((1, 1)))]).len(), 2);
+        assert_eq!(reads.get(), 2);
+        // b was modified, a could not be stamped, and c is new
+        let devices = scan(&[("a", None), ("b", Some((2, 1))), ("c", Some((1, 1)))]);
+        assert_eq!(devices.len(), 3);
+        assert_eq!(reads.get(), 5);
+        // b was removed
+        let devices = scan(&[("c", Some((1, 1)))]);
+        assert_eq!(devices[0].name, "c");
+        assert_eq!(reads.get(), 5);
+    }
+}
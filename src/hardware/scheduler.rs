@@ -0,0 +1,482 @@
+//! Device level I/O scheduler
+//!
+//! When several channels share one adapter, putting the adapter behind a single `Arc<Mutex<_>>`
+//! makes every channel wait for whichever call holds the lock longest, which is usually a
+//! CAN read sitting out its timeout. An [IoScheduler] instead runs every driver call of one adapter
+//! on a single owner thread. Channels submit jobs through their own [IoHandle], and jobs do not
+//! hold up the owner thread: a job which cannot complete yet (EG: A read with nothing to read)
+//! returns [JobState::Pending] and is polled again later.
+//!
+//! Jobs of [IoPriority::Diagnostic] handles are always polled before [IoPriority::Bulk] jobs,
+//! so diagnostic requests are never held up by bulk CAN traffic on the same adapter.
+//!
+//! When every queued job is pending, rather than polling them all again after a fixed interval,
+//! the next job is allowed to block in the driver for a short time (See [IoScheduler::new]),
+//! so a read completes as soon as its data arrives.
+//!
+//! Submitting a job does not allocate. Each handle owns the slot its job completes through,
+//! and the job itself stays on the submitting thread's stack until it has completed.
+
+use std::{
+    collections::VecDeque,
+    sync::{mpsc, Arc, Condvar, Mutex, MutexGuard},
+    thread::JoinHandle,
+    time::{Duration, Instant},
+};
+
+use super::{HardwareError, HardwareResult};
+
+/// Number of jobs which can be submitted to a scheduler before it has collected them.
+/// Submitting to a full queue waits for the scheduler thread to catch up
+const SUBMIT_QUEUE_LEN: usize = 64;
+
+/// Priority of the jobs submitted through an [IoHandle]
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum IoPriority {
+    /// Diagnostic requests and responses, and other short requests a user is waiting on
+    Diagnostic = 0,
+    /// Bulk traffic, such as sniffing a CAN network. Only polled once no diagnostic job can progress
+    Bulk = 1,
+}
+
+/// Result of polling a job once
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum JobState {
+    /// The job has completed, and will not be polled again
+    Done,
+    /// The job cannot complete yet, and should be polled again later
+    Pending,
+}
+
+type PollFn = dyn FnMut(Duration) -> JobState + Send;
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+enum SlotState {
+    /// No job submitted
+    Idle,
+    /// Job is queued on the scheduler thread
+    Queued,
+    /// Job has completed
+    Done,
+    /// Scheduler stopped before the job completed
+    Abandoned,
+}
+
+/// Completion slot of an [IoHandle]'s job, shared with the scheduler thread
+#[derive(Debug)]
+struct Slot {
+    state: Mutex<SlotState>,
+    changed: Condvar,
+    /// Held whilst a job is submitted, so callers sharing a handle take turns using the slot
+    submit: Mutex<()>,
+}
+
+impl Slot {
+    fn new() -> Arc<Self> {
+        Arc::new(Self {
+            state: Mutex::new(SlotState::Idle),
+            changed: Condvar::new(),
+            submit: Mutex::new(()),
+        })
+    }
+
+    fn state(&self) -> MutexGuard<'_, SlotState> {
+        // Nothing can be left half written in the state, so a poisoned lock is still usable
+        self.state.lock().unwrap_or_else(|e| e.into_inner())
+    }
+
+    fn set(&self, state: SlotState) {
+        *self.state() = state;
+        self.changed.notify_one();
+    }
+}
+
+struct Job {
+    priority: IoPriority,
+    /// Points to the submitter's poll function. The submitter waits for `slot` to leave
+    /// [SlotState::Queued] before the function goes out of scope, which only happens when the
+    /// job is dropped, so the pointer is valid for as long as the job exists
+    poll: *mut PollFn,
+    slot: Arc<Slot>,
+    done: bool,
+}
+
+// SAFETY: The poll function is Send, and only the scheduler thread calls it whilst the job exists
+unsafe impl Send for Job {}
+
+impl Job {
+    fn poll(&mut self, block: Duration) -> JobState {
+        // SAFETY: See [Job::poll]. The submitter does not touch the function until the job is dropped
+        let state = unsafe { (*self.poll)(block) };
+        self.done = state == JobState::Done;
+        state
+    }
+}
+
+impl Drop for Job {
+    fn drop(&mut self) {
+        // Releases the submitter, after which the poll function must not be used again
+        self.slot.set(if self.done {
+            SlotState::Done
+        } else {
+            SlotState::Abandoned
+        });
+    }
+}
+
+enum SchedulerMsg {
+    Job(Job),
+    Stop,
+}
+
+/// Owner thread of one adapter, which runs the jobs submitted by [IoHandle]s
+#[derive(Debug)]
+pub struct IoScheduler {
+    tx: mpsc::SyncSender<SchedulerMsg>,
+    thread: Option<JoinHandle<()>>,
+}
+
+impl IoScheduler {
+    /// Starts a new scheduler thread.
+    ///
+    /// ## Parameters
+    /// * max_block - Longest time a job may block in the driver for, when every queued job is
+    ///   pending. This is also how long a newly submitted job may have to wait for a blocked
+    ///   job to return, so should be kept short
+    pub fn new(max_block: Duration) -> Self {
+        let (tx, rx) = mpsc::sync_channel(SUBMIT_QUEUE_LEN);
+        let thread = std::thread::spawn(move || {
+            SchedulerState {
+                rx,
+                queues: [VecDeque::new(), VecDeque::new()],
+                running: true,
+            }
+            .run(max_block)
+        });
+        Self {
+            tx,
+            thread: Some(thread),
+        }
+    }
+
+    /// Creates a new handle to submit jobs to this scheduler with
+    pub fn handle(&self, priority: IoPriority) -> IoHandle {
+        IoHandle {
+            tx: self.tx.clone(),
+            priority,
+            slot: Slot::new(),
+        }
+    }
+}
+
+impl Drop for IoScheduler {
+    fn drop(&mut self) {
+        // Handles can outlive the scheduler, so tell the thread to stop rather than waiting for them
+        let _ = self.tx.send(SchedulerMsg::Stop);
+        if let Some(thread) = self.thread.take() {
+            let _ = thread.join();
+        }
+    }
+}
+
+/// Handle for submitting jobs to an [IoScheduler]. Each channel on an adapter owns its own handle,
+/// so channels never wait for each other to submit jobs. Cloning a handle gives the clone
+/// its own completion slot, so clones do not wait for each other either.
+///
+/// Once the scheduler is dropped, jobs fail with [HardwareError::DeviceNotOpen]
+#[derive(Debug)]
+pub struct IoHandle {
+    tx: mpsc::SyncSender<SchedulerMsg>,
+    priority: IoPriority,
+    slot: Arc<Slot>,
+}
+
+impl Clone for IoHandle {
+    fn clone(&self) -> Self {
+        Self {
+            tx: self.tx.clone(),
+            priority: self.priority,
+            slot: Slot::new(),
+        }
+    }
+}
+
+impl IoHandle {
+    /// Returns the priority of jobs submitted through this handle
+    pub fn priority(&self) -> IoPriority {
+        self.priority
+    }
+
+    /// Sets the priority of jobs submitted through this handle
+    pub fn set_priority(&mut self, priority: IoPriority) {
+        self.priority = priority
+    }
+
+    /// Runs `f` once on the scheduler thread, and waits for its result
+    pub fn run<T, F>(&self, f: F) -> HardwareResult<T>
+    where
+        T: Send,
+        F: FnOnce() -> T + Send,
+    {
+        let mut f = Some(f);
+        self.poll(move |_| f.take().map(|f| f()))
+    }
+
+    /// Polls `f` on the scheduler thread until it returns a value, and waits for that value.
+    ///
+    /// `f` is given how long it may block for, which is zero unless every other queued job is
+    /// pending too. It should return `None` if it cannot complete yet
+    pub fn poll<T, F>(&self, mut f: F) -> HardwareResult<T>
+    where
+        T: Send,
+        F: FnMut(Duration) -> Option<T> + Send,
+    {
+        let _submit = self.slot.submit.lock().unwrap_or_else(|e| e.into_inner());
+        let mut result = None;
+        let mut job_fn = |block| match f(block) {
+            Some(res) => {
+                result = Some(res);
+                JobState::Done
+            }
+            None => JobState::Pending,
+        };
+        let job_fn: *mut (dyn FnMut(Duration) -> JobState + Send + '_) = &mut job_fn;
+        // SAFETY: Only the lifetime is erased. The job is dropped, releasing the pointer,
+        // before the slot leaves the queued state, and this waits for that below
+        let job_fn: *mut PollFn = unsafe { std::mem::transmute(job_fn) };
+
+        *self.slot.state() = SlotState::Queued;
+        // If the scheduler has stopped, the returned job is dropped here, abandoning it
+        let _ = self.tx.send(SchedulerMsg::Job(Job {
+            priority: self.priority,
+            poll: job_fn,
+            slot: self.slot.clone(),
+            done: false,
+        }));
+        let mut state = self.slot.state();
+        while *state == SlotState::Queued {
+            state = self
+                .slot
+                .changed
+                .wait(state)
+                .unwrap_or_else(|e| e.into_inner());
+        }
+        *state = SlotState::Idle;
+        drop(state);
+        // If the scheduler stops before the job completes, the job is dropped without a result
+        result.ok_or(HardwareError::DeviceNotOpen)
+    }
+}
+
+struct SchedulerState {
+    rx: mpsc::Receiver<SchedulerMsg>,
+    /// Queued jobs, indexed by [IoPriority]
+    queues: [VecDeque<Job>; 2],
+    running: bool,
+}
+
+impl SchedulerState {
+    fn run(mut self, max_block: Duration) {
+        while self.running {
+            self.collect();
+            if self.poll_all() || !self.running {
+                continue;
+            }
+            if self.queues.iter().all(|q| q.is_empty()) {
+                // Nothing to do until a new job arrives
+                match self.rx.recv() {
+                    Ok(msg) => self.push(msg),
+                    Err(_) => self.running = false,
+                }
+                continue;
+            }
+            // Every job is pending, so let the next one block in the driver
+            let start = Instant::now();
+            if self.poll_blocking(max_block) {
+                continue;
+            }
+            // The job returned early (Or could not block at all), so wait out the rest of its
+            // time for new jobs, rather than spinning
+            if let Some(rest) = max_block.checked_sub(start.elapsed()) {
+                match self.rx.recv_timeout(rest) {
+                    Ok(msg) => self.push(msg),
+                    Err(mpsc::RecvTimeoutError::Timeout) => {}
+                    Err(mpsc::RecvTimeoutError::Disconnected) => self.running = false,
+                }
+            }
+        }
+        // Remaining jobs are dropped here, telling their submitters the scheduler has stopped
+        self.queues.iter_mut().for_each(|q| q.clear());
+        while self.rx.try_recv().is_ok() {}
+    }
+
+    fn push(&mut self, msg: SchedulerMsg) {
+        match msg {
+            SchedulerMsg::Job(job) => self.queues[job.priority as usize].push_back(job),
+            SchedulerMsg::Stop => self.running = false,
+        }
+    }
+
+    /// Queues every job submitted since the last call, returning the number of new diagnostic jobs
+    fn collect(&mut self) -> usize {
+        let before = self.queues[IoPriority::Diagnostic as usize].len();
+        loop {
+            match self.rx.try_recv() {
+                Ok(msg) => self.push(msg),
+                Err(mpsc::TryRecvError::Empty) => break,
+                Err(mpsc::TryRecvError::Disconnected) => {
+                    // Every handle is gone, so nobody is waiting on the queued jobs either
+                    self.running = false;
+                    break;
+                }
+            }
+        }
+        self.queues[IoPriority::Diagnostic as usize].len() - before
+    }
+
+    /// Polls every queued job once, without blocking. Before each bulk job, any newly submitted
+    /// diagnostic jobs are polled first. Returns true if any job completed
+    fn poll_all(&mut self) -> bool {
+        let mut progress = self.poll_queue(IoPriority::Diagnostic, usize::MAX);
+        for _ in 0..self.queues[IoPriority::Bulk as usize].len() {
+            if self.collect() != 0 {
+                progress |= self.poll_queue(IoPriority::Diagnostic, usize::MAX);
+            }
+            if !self.running {
+                break;
+            }
+            progress |= self.poll_queue(IoPriority::Bulk, 1);
+        }
+        progress
+    }
+
+    /// Polls up to `max` jobs from the front of a queue once each. Returns true if any completed
+    fn poll_queue(&mut self, priority: IoPriority, max: usize) -> bool {
+        let queue = &mut self.queues[priority as usize];
+        let mut progress = false;
+        for _ in 0..queue.len().min(max) {
+            let mut job = match queue.pop_front() {
+                Some(j) => j,
+                None => break,
+            };
+            match job.poll(Duration::ZERO) {
+                JobState::Done => progress = true,
+                JobState::Pending => queue.push_back(job),
+            }
+        }
+        progress
+    }
+
+    /// Polls the first job of the highest priority, letting it block for up to `max_block`.
+    /// Jobs take turns being the one to block. Returns true if it completed
+    fn poll_blocking(&mut self, max_block: Duration) -> bool {
+        let queue = match self.queues.iter_mut().find(|q| !q.is_empty()) {
+            Some(q) => q,
+            None => return false,
+        };
+        let mut job = queue.pop_front().unwrap();
+        match job.poll(max_block) {
+            JobState::Done => true,
+            JobState::Pending => {
+                queue.push_back(job);
+                false
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod scheduler_test {
+    use super::*;
+    use std::sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc,
+    };
+
+    #[test]
+    fn test_run() {
+        let scheduler = IoScheduler::new(Duration::from_millis(1));
+        let handle = scheduler.handle(IoPriority::Diagnostic);
+        assert_eq!(handle.run(|| 1 + 1).unwrap(), 2);
+        let mut polls = 0;
+        assert_eq!(
+            handle
+                .poll(move |_| {
+                    polls += 1;
+                    if polls == 3 {
+                        Some(polls)
+                    } else {
+                        None
+                    }
+                })
+                .unwrap(),
+            3
+        );
+        drop(scheduler);
+        assert!(matches!(
+            handle.run(|| ()),
+            Err(HardwareError::DeviceNotOpen)
+        ));
+    }
+
+    #[test]
+    fn test_pending_bulk_does_not_block_diagnostic() {
+        let scheduler = IoScheduler::new(Duration::from_millis(1));
+        let bulk = scheduler.handle(IoPriority::Bulk);
+        let diag = scheduler.handle(IoPriority::Diagnostic);
+        let released = Arc::new(AtomicBool::new(false));
+
+        // Bulk read which only completes once the diagnostic request has run
+        let r = released.clone();
+        let bulk_thread =
+            std::thread::spawn(move || bulk.poll(move |_| r.load(Ordering::SeqCst).then(|| ())));
+        std::thread::sleep(Duration::from_millis(10));
+        let r = released.clone();
+        diag.run(move || r.store(true, Ordering::SeqCst)).unwrap();
+        bulk_thread.join().unwrap().unwrap();
+    }
+
+    #[test]
+    fn test_stop_fails_pending_jobs() {
+        let scheduler = IoScheduler::new(Duration::from_millis(1));
+        let handle = scheduler.handle(IoPriority::Bulk);
+        let waiter = std::thread::spawn(move || handle.poll(|_| None::<()>));
+        std::thread::sleep(Duration::from_millis(10));
+        drop(scheduler);
+        assert!(matches!(
+            waiter.join().unwrap(),
+            Err(HardwareError::DeviceNotOpen)
+        ));
+    }
+
+    #[test]
+    fn test_poll_borrows_caller_data() {
+        let scheduler = IoScheduler::new(Duration::from_millis(1));
+        let handle = scheduler.handle(IoPriority::Diagnostic);
+        // Jobs run on the caller's data in place, nothing is moved to the scheduler thread
+        let mut buf = [0u8; 4];
+        handle
+            .run(|| buf.iter_mut().for_each(|b| *b = 0xAA))
+            .unwrap();
+        assert_eq!(buf, [0xAA; 4]);
+        let cloned = handle.clone();
+        assert_eq!(cloned.run(|| buf[0]).unwrap(), 0xAA);
+    }
+
+    #[test]
+    fn test_lone_pending_job_may_block() {
+        let max_block = Duration::from_millis(5);
+        let scheduler = IoScheduler::new(max_block);
+        let handle = scheduler.handle(IoPriority::Bulk);
+        let mut blocks = Vec::new();
+        handle
+            .poll(|block| {
+                blocks.push(block);
+                (blocks.len() == 3).then(|| ())
+            })
+            .unwrap();
+        // Polled without blocking first, then allowed to block as nothing else is queued
+        assert_eq!(blocks[0], Duration::ZERO);
+        assert!(blocks[1..].contains(&max_block));
+    }
+}
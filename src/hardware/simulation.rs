@@ -1,16 +1,39 @@
-//! Simulation hardware for unit testing diagnostic servers
+//! Simulation hardware for unit testing and benchmarking diagnostic servers
+//!
+//! [SimulationIsoTpChannel] answers instantly from an exact request/response table.
+//! [SimulatedEcu] models a real ECU's timing instead (Response time, response pending
+//! sequences and ISO-TP transfer times), for load testing many servers without hardware.
+//!
+//! This is only available with the `simulation` feature enabled.
 
-use std::{collections::{HashMap, VecDeque}, sync::{Arc, RwLock}};
+use std::{
+    collections::{HashMap, VecDeque},
+    sync::{Arc, Mutex, RwLock},
+    time::{Duration, Instant},
+};
 
-use crate::ChannelError;
+use crate::channel::{ChannelError, ChannelResult, IsoTPChannel, IsoTPSettings, PayloadChannel};
 
+/// Simulated ISO-TP channel, which responds to requests from a fixed
+/// request/response table. Responses are available to read as soon as
+/// the matching request is written.
+///
+/// Clones of the channel share the same table, so responses can be
+/// changed after the channel has been handed to a diagnostic server.
 #[derive(Debug, Clone)]
 pub struct SimulationIsoTpChannel {
     req_resp_map: Arc<RwLock<HashMap<Vec<u8>, Vec<u8>>>>,
     rx_queue: Arc<RwLock<VecDeque<Vec<u8>>>>,
 }
 
+impl Default for SimulationIsoTpChannel {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
 impl SimulationIsoTpChannel {
+    /// Creates a new simulation channel, with an empty request/response table
     pub fn new() -> Self {
         Self {
             req_resp_map: Arc::new(RwLock::new(HashMap::new())),
@@ -18,56 +41,481 @@ impl SimulationIsoTpChannel {
         }
     }
 
+    /// Adds (Or replaces) the response the channel gives to a request
     pub fn add_response(&mut self, req: &[u8], resp: &[u8]) {
-        self.req_resp_map.write().unwrap().insert(req.to_vec(), resp.to_vec());
+        self.req_resp_map
+            .write()
+            .unwrap()
+            .insert(req.to_vec(), resp.to_vec());
     }
 
+    /// Removes all responses, including any that have not been read yet
     pub fn clear_map(&mut self) {
         self.req_resp_map.write().unwrap().clear();
         self.rx_queue.write().unwrap().clear();
     }
 }
 
-impl crate::channel::PayloadChannel for SimulationIsoTpChannel {
-    fn open(&mut self) -> crate::channel::ChannelResult<()> {
+impl PayloadChannel for SimulationIsoTpChannel {
+    fn open(&mut self) -> ChannelResult<()> {
         Ok(())
     }
 
-    fn close(&mut self) -> crate::channel::ChannelResult<()> {
+    fn close(&mut self) -> ChannelResult<()> {
         Ok(())
     }
 
-    fn set_ids(&mut self, send: u32, recv: u32) -> crate::channel::ChannelResult<()> {
+    fn set_ids(&mut self, _send: u32, _recv: u32) -> ChannelResult<()> {
         Ok(())
     }
 
-    fn read_bytes(&mut self, timeout_ms: u32) -> crate::channel::ChannelResult<Vec<u8>> {
+    fn read_bytes(&mut self, _timeout_ms: u32) -> ChannelResult<Vec<u8>> {
         if let Some(r) = self.rx_queue.write().unwrap().pop_front() {
-            return Ok(r)
+            return Ok(r);
         }
         Err(ChannelError::BufferEmpty)
     }
 
-    fn write_bytes(&mut self, addr: u32, buffer: &[u8], timeout_ms: u32) -> crate::channel::ChannelResult<()> {
+    fn write_bytes(&mut self, _addr: u32, buffer: &[u8], _timeout_ms: u32) -> ChannelResult<()> {
         if let Some(expected_response) = self.req_resp_map.read().unwrap().get(buffer) {
-            self.rx_queue.write().unwrap().push_back(expected_response.to_vec());
+            self.rx_queue
+                .write()
+                .unwrap()
+                .push_back(expected_response.to_vec());
         }
         Ok(())
     }
 
-    fn clear_rx_buffer(&mut self) -> crate::channel::ChannelResult<()> {
+    fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
         self.rx_queue.write().unwrap().clear();
         Ok(())
     }
 
-    fn clear_tx_buffer(&mut self) -> crate::channel::ChannelResult<()> {
+    fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
+        Ok(())
+    }
+}
+
+impl IsoTPChannel for SimulationIsoTpChannel {
+    fn set_iso_tp_cfg(&mut self, _cfg: IsoTPSettings) -> ChannelResult<()> {
+        Ok(())
+    }
+}
+
+/// Distribution the response times of a [SimulatedEcu] are drawn from.
+/// This is the time the ECU takes to process a request, not including ISO-TP transfer times
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum ResponseTime {
+    /// Always respond after the same time
+    Fixed(Duration),
+    /// Respond after a time evenly distributed between `min` and `max`
+    Uniform {
+        /// Shortest response time
+        min: Duration,
+        /// Longest response time
+        max: Duration,
+    },
+    /// Respond after at least `min`, plus an exponentially distributed extra time with
+    /// an average of `mean_extra`. This gives the long tail real ECUs have under load
+    LongTail {
+        /// Shortest response time
+        min: Duration,
+        /// Average time added to `min`
+        mean_extra: Duration,
+    },
+}
+
+/// How a [SimulatedEcu] responds to requests starting with a given prefix
+#[derive(Debug, Clone)]
+pub struct SimulatedRule {
+    prefix: Vec<u8>,
+    response: Arc<[u8]>,
+    pending_count: u32,
+    pending_interval: Duration,
+    timing: Option<ResponseTime>,
+    before: Arc<[u8]>,
+    after: Arc<[u8]>,
+}
+
+impl SimulatedRule {
+    /// Creates a rule which answers every request starting with `prefix` with `response`.
+    /// An empty response means the ECU does not respond
+    pub fn new(prefix: &[u8], response: &[u8]) -> Self {
+        Self {
+            prefix: prefix.to_vec(),
+            response: response.into(),
+            pending_count: 0,
+            pending_interval: Duration::ZERO,
+            timing: None,
+            before: Arc::from(&[][..]),
+            after: Arc::from(&[][..]),
+        }
+    }
+
+    /// Sends `count` response pending (0x78) responses, `interval` apart, before the response
+    pub fn with_pending(mut self, count: u32, interval: Duration) -> Self {
+        self.pending_count = count;
+        self.pending_interval = interval;
+        self
+    }
+
+    /// Uses a different response time for this rule than the rest of the ECU
+    pub fn with_timing(mut self, timing: ResponseTime) -> Self {
+        self.timing = Some(timing);
+        self
+    }
+
+    /// Sends `before` just before the response, and `after` straight after it, as an ECU
+    /// also streaming periodic data would. Empty messages are not sent
+    pub fn with_unsolicited(mut self, before: &[u8], after: &[u8]) -> Self {
+        self.before = before.into();
+        self.after = after.into();
+        self
+    }
+}
+
+#[derive(Debug)]
+struct SimulatedEcuState {
+    /// Sorted by prefix length, longest first, so the most specific rule wins
+    rules: Vec<SimulatedRule>,
+    timing: ResponseTime,
+    unsupported_nrc: Option<u8>,
+    cfg: IsoTPSettings,
+    rng: u64,
+    rx_queue: VecDeque<(Instant, Arc<[u8]>)>,
+    requests: u64,
+}
+
+impl SimulatedEcuState {
+    /// xorshift64*, cheap enough to not show up next to the rest of the simulation
+    fn next_random(&mut self) -> u64 {
+        self.rng ^= self.rng >> 12;
+        self.rng ^= self.rng << 25;
+        self.rng ^= self.rng >> 27;
+        self.rng.wrapping_mul(0x2545_F491_4F6C_DD1D)
+    }
+
+    fn sample(&mut self, timing: ResponseTime) -> Duration {
+        match timing {
+            ResponseTime::Fixed(t) => t,
+            ResponseTime::Uniform { min, max } => {
+                let range = max.saturating_sub(min).as_nanos() as u64;
+                if range == 0 {
+                    min
+                } else {
+                    min + Duration::from_nanos(self.next_random() % (range + 1))
+                }
+            }
+            ResponseTime::LongTail { min, mean_extra } => {
+                // Uniform in (0, 1], so ln never sees 0
+                let u = ((self.next_random() >> 11) + 1) as f64 / (1u64 << 53) as f64;
+                min + mean_extra.mul_f64(-u.ln())
+            }
+        }
+    }
+}
+
+/// Time taken to send one full ISO-TP frame at the configured baud rate.
+/// With CAN-FD, the data phase is assumed to run at the nominal rate, so bit rate switching
+/// is not modelled and FD frames take the longest time they could
+fn frame_time(cfg: &IsoTPSettings, fd: bool) -> Duration {
+    // Bits in a full 8 (or 64) byte frame, including an average amount of bit stuffing
+    let bits: u64 = match (fd, cfg.can_use_ext_addr) {
+        (false, false) => 111,
+        (false, true) => 131,
+        (true, false) => 614,
+        (true, true) => 634,
+    };
+    match cfg.can_speed {
+        0 => Duration::ZERO,
+        speed => Duration::from_nanos(bits * 1_000_000_000 / speed as u64),
+    }
+}
+
+/// Minimum separation time between consecutive frames, as encoded by ISO 15765-2
+fn st_min_time(st_min: u8) -> Duration {
+    match st_min {
+        0x00..=0x7F => Duration::from_millis(st_min as u64),
+        0xF1..=0xF9 => Duration::from_micros((st_min - 0xF0) as u64 * 100),
+        _ => Duration::from_millis(0x7F), // Reserved values must be treated as the maximum
+    }
+}
+
+/// Time taken to transfer a payload of `len` bytes over ISO-TP, including flow control
+fn transfer_time(len: usize, cfg: &IsoTPSettings) -> Duration {
+    let frame = frame_time(cfg, cfg.can_fd);
+    // Flow control frames only carry 3 bytes, so never need a full FD frame
+    let flow_control = frame_time(cfg, false);
+    let payload = cfg.max_frame_len() - cfg.extended_addressing as usize;
+    // FD single frames longer than 7 bytes need an escape byte for their length
+    let sf_max = if cfg.can_fd { payload - 2 } else { payload - 1 };
+    if len <= sf_max {
+        return frame;
+    }
+    let (ff_len, cf_len) = (payload - 2, payload - 1);
+    let consecutive = (len - ff_len + cf_len - 1) / cf_len;
+    let flow_controls = match cfg.block_size {
+        0 => 1,
+        bs => (consecutive + bs as usize - 1) / bs as usize,
+    };
+    let cf_time = frame.max(st_min_time(cfg.st_min));
+    frame + flow_control * flow_controls as u32 + cf_time * consecutive as u32
+}
+
+/// Simulated ECU, which answers requests by prefix matching rules, and models how long
+/// a real ECU and the ISO-TP transfers to and from it take.
+///
+/// A response only becomes readable once its simulated time has passed, and reads
+/// block for up to their timeout like real hardware. Clones of the ECU share the same
+/// rules and state, so it can be changed after it has been handed to a diagnostic server.
+#[derive(Debug, Clone)]
+pub struct SimulatedEcu {
+    state: Arc<Mutex<SimulatedEcuState>>,
+}
+
+impl SimulatedEcu {
+    /// Creates a new simulated ECU with no rules
+    ///
+    /// ## Parameters
+    /// * timing - Response time of the ECU, unless a rule overrides it
+    /// * seed - Seed for the response time distribution. ECUs with the same seed and rules
+    /// behave identically
+    pub fn new(timing: ResponseTime, seed: u64) -> Self {
+        Self {
+            state: Arc::new(Mutex::new(SimulatedEcuState {
+                rules: Vec::new(),
+                timing,
+                unsupported_nrc: None,
+                cfg: IsoTPSettings::default(),
+                rng: seed | 1, // xorshift state cannot be 0
+                rx_queue: VecDeque::new(),
+                requests: 0,
+            })),
+        }
+    }
+
+    /// Adds a rule. When several rules match a request, the one with the longest prefix is used
+    pub fn add_rule(&mut self, rule: SimulatedRule) {
+        let mut state = self.state.lock().unwrap();
+        let pos = state
+            .rules
+            .iter()
+            .position(|r| r.prefix.len() < rule.prefix.len())
+            .unwrap_or(state.rules.len());
+        state.rules.insert(pos, rule);
+    }
+
+    /// Sets the response time of the rule whose prefix is exactly `prefix`, as
+    /// [SimulatedRule::with_timing] does. If `timing` is None, the rule uses the ECU's response time
+    ///
+    /// ## Returns
+    /// False if the ECU has no rule with this prefix
+    pub fn set_rule_timing(&mut self, prefix: &[u8], timing: Option<ResponseTime>) -> bool {
+        let mut state = self.state.lock().unwrap();
+        match state.rules.iter_mut().find(|r| r.prefix == prefix) {
+            Some(rule) => {
+                rule.timing = timing;
+                true
+            }
+            None => false,
+        }
+    }
+
+    /// Sets the negative response code the ECU responds with to requests that match no rule.
+    /// If None (The default), the ECU does not respond to them
+    pub fn set_unsupported_nrc(&mut self, nrc: Option<u8>) {
+        self.state.lock().unwrap().unsupported_nrc = nrc;
+    }
+
+    /// Returns the number of requests the ECU has received
+    pub fn request_count(&self) -> u64 {
+        self.state.lock().unwrap().requests
+    }
+}
+
+impl PayloadChannel for SimulatedEcu {
+    fn open(&mut self) -> ChannelResult<()> {
+        Ok(())
+    }
+
+    fn close(&mut self) -> ChannelResult<()> {
+        Ok(())
+    }
+
+    fn set_ids(&mut self, _send: u32, _recv: u32) -> ChannelResult<()> {
+        Ok(())
+    }
+
+    fn read_bytes(&mut self, timeout_ms: u32) -> ChannelResult<Vec<u8>> {
+        let deadline = Instant::now() + Duration::from_millis(timeout_ms as u64);
+        loop {
+            let now = Instant::now();
+            let mut state = self.state.lock().unwrap();
+            let wake = match state.rx_queue.front() {
+                Some((ready, _)) if *ready <= now => {
+                    let (_, resp) = state.rx_queue.pop_front().unwrap();
+                    return Ok(resp.to_vec());
+                }
+                Some((ready, _)) if *ready <= deadline => *ready,
+                _ if timeout_ms == 0 => return Err(ChannelError::BufferEmpty),
+                _ if now >= deadline => return Err(ChannelError::ReadTimeout),
+                _ => deadline,
+            };
+            drop(state);
+            std::thread::sleep(wake - now);
+        }
+    }
+
+    fn write_bytes(&mut self, _addr: u32, buffer: &[u8], _timeout_ms: u32) -> ChannelResult<()> {
+        let now = Instant::now();
+        let mut state = self.state.lock().unwrap();
+        state.requests += 1;
+        let cfg = state.cfg;
+        let rule = state
+            .rules
+            .iter()
+            .find(|r| buffer.starts_with(&r.prefix))
+            .map(|r| {
+                (
+                    r.response.clone(),
+                    r.pending_count,
+                    r.pending_interval,
+                    r.timing,
+                    (r.before.clone(), r.after.clone()),
+                )
+            });
+        let (response, pending_count, pending_interval, timing, unsolicited) =
+            match (rule, state.unsupported_nrc) {
+                (Some(r), _) => r,
+                (None, Some(nrc)) if !buffer.is_empty() => (
+                    Arc::from(&[0x7F, buffer[0], nrc][..]),
+                    0,
+                    Duration::ZERO,
+                    None,
+                    (Arc::from(&[][..]), Arc::from(&[][..])),
+                ),
+                _ => return Ok(()),
+            };
+        if response.is_empty() {
+            return Ok(());
+        }
+        let timing = timing.unwrap_or(state.timing);
+        let mut t = now + transfer_time(buffer.len(), &cfg) + state.sample(timing);
+        if pending_count > 0 {
+            let pending: Arc<[u8]> = Arc::from(&[0x7F, buffer[0], 0x78][..]);
+            for _ in 0..pending_count {
+                state
+                    .rx_queue
+                    .push_back((t + frame_time(&cfg, false), pending.clone()));
+                t += pending_interval;
+            }
+        }
+        let ready = t + transfer_time(response.len(), &cfg);
+        let (before, after) = unsolicited;
+        for msg in [before, response, after] {
+            if !msg.is_empty() {
+                state.rx_queue.push_back((ready, msg));
+            }
+        }
+        Ok(())
+    }
+
+    fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
+        self.state.lock().unwrap().rx_queue.clear();
+        Ok(())
+    }
+
+    fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
         Ok(())
     }
 }
 
-impl super::IsoTPChannel for SimulationIsoTpChannel {
-    fn set_iso_tp_cfg(&mut self, cfg: crate::channel::IsoTPSettings) -> crate::channel::ChannelResult<()> {
+impl IsoTPChannel for SimulatedEcu {
+    fn set_iso_tp_cfg(&mut self, cfg: IsoTPSettings) -> ChannelResult<()> {
+        self.state.lock().unwrap().cfg = cfg;
         Ok(())
     }
 }
 
+#[cfg(test)]
+mod simulation_test {
+    use super::*;
+
+    #[test]
+    fn test_transfer_time() {
+        let cfg = IsoTPSettings {
+            block_size: 0,
+            st_min: 0,
+            can_speed: 500_000,
+            ..Default::default()
+        };
+        // 111 bits at 500kbps
+        let frame = frame_time(&cfg, false);
+        assert_eq!(frame, Duration::from_nanos(222_000));
+        assert_eq!(transfer_time(7, &cfg), frame);
+        // First frame, flow control, 2 consecutive frames
+        assert_eq!(transfer_time(20, &cfg), frame * 4);
+        let cfg = IsoTPSettings {
+            block_size: 1,
+            st_min: 10,
+            ..cfg
+        };
+        // First frame, 2 flow controls, 2 consecutive frames limited by st_min
+        assert_eq!(
+            transfer_time(20, &cfg),
+            frame * 3 + Duration::from_millis(20)
+        );
+    }
+
+    #[test]
+    fn test_transfer_time_fd() {
+        let cfg = IsoTPSettings {
+            block_size: 0,
+            st_min: 0,
+            can_speed: 500_000,
+            can_fd: true,
+            ..Default::default()
+        };
+        let (frame, fc) = (frame_time(&cfg, true), frame_time(&cfg, false));
+        assert_eq!(transfer_time(62, &cfg), frame);
+        // First frame (62 bytes), flow control, 2 consecutive frames (63 bytes each)
+        assert_eq!(transfer_time(188, &cfg), frame * 3 + fc);
+        assert_eq!(transfer_time(189, &cfg), frame * 4 + fc);
+    }
+
+    #[test]
+    fn test_rules_and_pending() {
+        let mut ecu = SimulatedEcu::new(ResponseTime::Fixed(Duration::from_millis(2)), 1);
+        ecu.add_rule(SimulatedRule::new(&[0x22], &[0x7F, 0x22, 0x31]));
+        ecu.add_rule(
+            SimulatedRule::new(&[0x22, 0xF1, 0x90], &[0x62, 0xF1, 0x90, 0x01])
+                .with_pending(2, Duration::from_millis(1)),
+        );
+        ecu.set_unsupported_nrc(Some(0x11));
+
+        let start = Instant::now();
+        ecu.write_bytes(0, &[0x22, 0xF1, 0x90], 0).unwrap();
+        assert!(matches!(ecu.read_bytes(0), Err(ChannelError::BufferEmpty)));
+        assert_eq!(ecu.read_bytes(100).unwrap(), &[0x7F, 0x22, 0x78]);
+        assert!(start.elapsed() >= Duration::from_millis(2));
+        assert_eq!(ecu.read_bytes(100).unwrap(), &[0x7F, 0x22, 0x78]);
+        assert_eq!(ecu.read_bytes(100).unwrap(), &[0x62, 0xF1, 0x90, 0x01]);
+        assert!(start.elapsed() >= Duration::from_millis(4));
+
+        ecu.write_bytes(0, &[0x22, 0x12, 0x34], 0).unwrap();
+        assert_eq!(ecu.read_bytes(100).unwrap(), &[0x7F, 0x22, 0x31]);
+        ecu.write_bytes(0, &[0x31, 0x01], 0).unwrap();
+        assert_eq!(ecu.read_bytes(100).unwrap(), &[0x7F, 0x31, 0x11]);
+        assert!(matches!(ecu.read_bytes(5), Err(ChannelError::ReadTimeout)));
+        assert_eq!(ecu.request_count(), 3);
+
+        // Rules can be slowed down after they were added
+        assert!(!ecu.set_rule_timing(&[0x22, 0xF1], None));
+        let slow = ResponseTime::Fixed(Duration::from_millis(20));
+        assert!(ecu.set_rule_timing(&[0x22], Some(slow)));
+        let start = Instant::now();
+        ecu.write_bytes(0, &[0x22, 0x12, 0x34], 0).unwrap();
+        assert_eq!(ecu.read_bytes(100).unwrap(), &[0x7F, 0x22, 0x31]);
+        assert!(start.elapsed() >= Duration::from_millis(20));
+    }
+}
@@ -1,15 +1,19 @@
 //! SocketCAN module
 
 use std::{
+    io::ErrorKind,
+    mem,
+    os::unix::io::{AsRawFd, RawFd},
+    ptr,
     sync::{Arc, Mutex},
-    time::Instant,
+    time::{Duration, Instant},
 };
 
 use socketcan_isotp::{ExtendedId, Id, IsoTpBehaviour, IsoTpOptions, LinkLayerOptions, StandardId, FlowControlOptions};
 
 use crate::channel::{
-    CanChannel, CanFrame, ChannelError, ChannelResult, IsoTPChannel, IsoTPSettings, Packet,
-    PacketChannel, PayloadChannel,
+    CanChannel, CanFdChannel, CanFdFrame, CanFrame, ChannelError, ChannelResult, IsoTPChannel,
+    IsoTPSettings, Packet, PacketChannel, PayloadChannel, CAN_FD_MAX_DATA_LEN,
 };
 
 use super::{Hardware, HardwareCapabilities, HardwareError, HardwareInfo, HardwareScanner};
@@ -24,6 +28,331 @@ const SOCKET_CAN_CAPABILITIES: HardwareCapabilities = HardwareCapabilities {
     sci: false,
 };
 
+/// Sleeps until a socket is ready for `events` (POLLIN / POLLOUT), or `deadline` passes.
+///
+/// Returns true if the socket is ready
+fn wait_for_fd(fd: RawFd, events: libc::c_short, deadline: Instant) -> ChannelResult<bool> {
+    let mut pfd = libc::pollfd {
+        fd,
+        events,
+        revents: 0,
+    };
+    loop {
+        let timeout = deadline
+            .saturating_duration_since(Instant::now())
+            .as_millis()
+            .min(libc::c_int::MAX as u128) as libc::c_int;
+        match unsafe { libc::poll(&mut pfd, 1, timeout) } {
+            x if x > 0 => return Ok(true),
+            0 => return Ok(false),
+            _ => {
+                let err = std::io::Error::last_os_error();
+                if err.kind() != ErrorKind::Interrupted {
+                    return Err(err.into());
+                }
+                // Interrupted by a signal, wait for the remaining time
+            }
+        }
+    }
+}
+
+/// Most frames moved by one sendmmsg() / recvmmsg() call
+const MMSG_BATCH: usize = 32;
+
+/// Linux's `struct canfd_frame`, as read from and written to a raw CAN socket.
+/// Classic CAN frames (`struct can_frame`) share its layout, but are only [CAN_MTU] bytes long
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+struct RawCanFrame {
+    can_id: u32,
+    len: u8,
+    flags: u8,
+    res0: u8,
+    res1: u8,
+    data: [u8; CAN_FD_MAX_DATA_LEN],
+}
+
+/// Size of a classic `struct can_frame`
+const CAN_MTU: usize = 16;
+/// Size of [RawCanFrame]
+const CANFD_MTU: usize = 72;
+
+const CAN_EFF_FLAG: u32 = 0x8000_0000;
+const CAN_SFF_MASK: u32 = 0x0000_07FF;
+const CAN_EFF_MASK: u32 = 0x1FFF_FFFF;
+/// Bit rate switch flag of `canfd_frame.flags`
+const CANFD_BRS: u8 = 0x01;
+
+/// Socket option level and option to enable CAN-FD frames on a raw CAN socket.
+/// Not every libc version defines these
+const SOL_CAN_RAW: libc::c_int = 101;
+const CAN_RAW_FILTER: libc::c_int = 1;
+const CAN_RAW_FD_FRAMES: libc::c_int = 5;
+
+impl RawCanFrame {
+    const EMPTY: Self = Self {
+        can_id: 0,
+        len: 0,
+        flags: 0,
+        res0: 0,
+        res1: 0,
+        data: [0; CAN_FD_MAX_DATA_LEN],
+    };
+
+    fn new(id: u32, ext: bool, data: &[u8]) -> ChannelResult<Self> {
+        let can_id = match id {
+            x if x > CAN_EFF_MASK => return Err(ChannelError::UnsupportedRequest),
+            x if ext || x > CAN_SFF_MASK => x | CAN_EFF_FLAG,
+            x => x,
+        };
+        let mut raw = Self {
+            can_id,
+            len: data.len() as u8,
+            ..Self::EMPTY
+        };
+        raw.data[..data.len()].copy_from_slice(data);
+        Ok(raw)
+    }
+
+    /// Returns the frame's ID, and if it is extended (29bit)
+    fn id(&self) -> (u32, bool) {
+        match self.can_id & CAN_EFF_FLAG != 0 {
+            true => (self.can_id & CAN_EFF_MASK, true),
+            false => (self.can_id & CAN_SFF_MASK, false),
+        }
+    }
+}
+
+/// Frame types which can be sent and received over a raw CAN socket
+trait SocketFrame: Packet + Copy {
+    /// Converts the frame to a raw frame, and the number of bytes of it to write
+    fn to_raw(&self) -> ChannelResult<(RawCanFrame, usize)>;
+    /// Converts a raw frame of `mtu` bytes to a frame, or None if this type cannot hold it
+    fn from_raw(raw: &RawCanFrame, mtu: usize) -> Option<Self>;
+}
+
+impl SocketFrame for CanFrame {
+    fn to_raw(&self) -> ChannelResult<(RawCanFrame, usize)> {
+        let raw = RawCanFrame::new(self.get_address(), self.is_extended(), self.get_data())?;
+        Ok((raw, CAN_MTU))
+    }
+
+    fn from_raw(raw: &RawCanFrame, mtu: usize) -> Option<Self> {
+        if mtu != CAN_MTU {
+            return None;
+        }
+        let (id, ext) = raw.id();
+        Some(CanFrame::new(
+            id,
+            &raw.data[..(raw.len as usize).min(8)],
+            ext,
+        ))
+    }
+}
+
+impl SocketFrame for CanFdFrame {
+    fn to_raw(&self) -> ChannelResult<(RawCanFrame, usize)> {
+        let mut raw = RawCanFrame::new(self.get_address(), self.is_extended(), self.get_data())?;
+        if !self.is_fd() {
+            return Ok((raw, CAN_MTU));
+        }
+        if self.is_brs() {
+            raw.flags |= CANFD_BRS;
+        }
+        Ok((raw, CANFD_MTU))
+    }
+
+    fn from_raw(raw: &RawCanFrame, mtu: usize) -> Option<Self> {
+        let (id, ext) = raw.id();
+        match mtu {
+            CAN_MTU => Some(CanFrame::new(id, &raw.data[..(raw.len as usize).min(8)], ext).into()),
+            CANFD_MTU => Some(CanFdFrame::new(
+                id,
+                &raw.data[..(raw.len as usize).min(CAN_FD_MAX_DATA_LEN)],
+                ext,
+                raw.flags & CANFD_BRS != 0,
+            )),
+            _ => None,
+        }
+    }
+}
+
+/// Builds the message headers for a batch of frames. `lens` is the number of bytes of each frame
+/// to send or receive. `lens`, `iov` and `msgs` must be as long as `raw`
+fn batch_headers(
+    raw: &mut [RawCanFrame],
+    lens: &[usize],
+    iov: &mut [libc::iovec],
+    msgs: &mut [libc::mmsghdr],
+) {
+    debug_assert!(lens.len() == raw.len() && iov.len() == raw.len() && msgs.len() == raw.len());
+    let base = raw.as_mut_ptr();
+    for (idx, (iov, msg)) in iov.iter_mut().zip(msgs.iter_mut()).enumerate() {
+        *iov = libc::iovec {
+            iov_base: base.wrapping_add(idx).cast(),
+            iov_len: lens[idx],
+        };
+        // Safety: mmsghdr is plain old data, for which all zeros is valid
+        *msg = unsafe { mem::zeroed() };
+        msg.msg_hdr.msg_iov = iov;
+        msg.msg_hdr.msg_iovlen = 1;
+    }
+}
+
+/// Writes as many frames as the socket's Tx queue accepts with a single sendmmsg() call,
+/// returning how many were written. Returns 0 if the queue is full
+fn send_frames<F: SocketFrame>(fd: RawFd, frames: &[F]) -> ChannelResult<usize> {
+    let len = frames.len().min(MMSG_BATCH);
+    let mut raw = [RawCanFrame::EMPTY; MMSG_BATCH];
+    let mut lens = [CAN_MTU; MMSG_BATCH];
+    for ((r, l), f) in raw.iter_mut().zip(lens.iter_mut()).zip(&frames[..len]) {
+        let (frame, mtu) = f.to_raw()?;
+        *r = frame;
+        *l = mtu;
+    }
+    // Safety: Both are plain old data, and are filled in by batch_headers
+    let mut iov: [libc::iovec; MMSG_BATCH] = unsafe { mem::zeroed() };
+    let mut msgs: [libc::mmsghdr; MMSG_BATCH] = unsafe { mem::zeroed() };
+    batch_headers(
+        &mut raw[..len],
+        &lens[..len],
+        &mut iov[..len],
+        &mut msgs[..len],
+    );
+    loop {
+        match unsafe { libc::sendmmsg(fd, msgs.as_mut_ptr(), len as libc::c_uint, 0) } {
+            x if x >= 0 => return Ok(x as usize),
+            _ => {
+                let err = std::io::Error::last_os_error();
+                match err.kind() {
+                    // ENOBUFS is how SocketCAN reports a full Tx queue
+                    ErrorKind::WouldBlock => return Ok(0),
+                    _ if err.raw_os_error() == Some(libc::ENOBUFS) => return Ok(0),
+                    ErrorKind::Interrupted => {}
+                    _ => return Err(err.into()),
+                }
+            }
+        }
+    }
+}
+
+/// Reads as many frames as are waiting in the socket's Rx queue (Up to `frames.len()`)
+/// with a single recvmmsg() call, returning how many were read. Returns 0 if the queue is empty
+fn recv_frames<F: SocketFrame>(fd: RawFd, frames: &mut [F]) -> ChannelResult<usize> {
+    let len = frames.len().min(MMSG_BATCH);
+    let mut raw = [RawCanFrame::EMPTY; MMSG_BATCH];
+    // Sockets without CAN-FD enabled only ever return classic frames, so this fits both
+    let lens = [CANFD_MTU; MMSG_BATCH];
+    // Safety: Both are plain old data, and are filled in by batch_headers
+    let mut iov: [libc::iovec; MMSG_BATCH] = unsafe { mem::zeroed() };
+    let mut msgs: [libc::mmsghdr; MMSG_BATCH] = unsafe { mem::zeroed() };
+    batch_headers(
+        &mut raw[..len],
+        &lens[..len],
+        &mut iov[..len],
+        &mut msgs[..len],
+    );
+    let read = loop {
+        let res = unsafe {
+            libc::recvmmsg(
+                fd,
+                msgs.as_mut_ptr(),
+                len as libc::c_uint,
+                libc::MSG_DONTWAIT,
+                ptr::null_mut(),
+            )
+        };
+        if res >= 0 {
+            break res as usize;
+        }
+        let err = std::io::Error::last_os_error();
+        match err.kind() {
+            ErrorKind::WouldBlock => return Ok(0),
+            ErrorKind::Interrupted => {}
+            _ => return Err(err.into()),
+        }
+    };
+    let mut count = 0;
+    for (r, msg) in raw[..read].iter().zip(&msgs[..read]) {
+        // Skip anything the frame type cannot hold
+        if let Some(f) = F::from_raw(r, msg.msg_len as usize) {
+            frames[count] = f;
+            count += 1;
+        }
+    }
+    Ok(count)
+}
+
+/// Writes all of `packets` to a raw CAN socket, waiting up to `timeout_ms` for space in its Tx queue
+fn write_all<F: SocketFrame>(fd: RawFd, packets: &[F], timeout_ms: u32) -> ChannelResult<()> {
+    let deadline = Instant::now() + Duration::from_millis(timeout_ms as u64);
+    let mut sent = 0;
+    while sent < packets.len() {
+        match send_frames(fd, &packets[sent..])? {
+            // Tx queue is full, wait for space
+            0 => {
+                if !wait_for_fd(fd, libc::POLLOUT, deadline)? {
+                    return Err(ChannelError::WriteTimeout);
+                }
+            }
+            count => sent += count,
+        }
+    }
+    Ok(())
+}
+
+/// Fills `packets` from a raw CAN socket, waiting up to `timeout_ms` for frames to arrive.
+/// Returns the number of frames read
+fn read_into<F: SocketFrame>(
+    fd: RawFd,
+    packets: &mut [F],
+    timeout_ms: u32,
+) -> ChannelResult<usize> {
+    let deadline = Instant::now() + Duration::from_millis(timeout_ms as u64);
+    let mut count = 0;
+    while count < packets.len() {
+        match recv_frames(fd, &mut packets[count..])? {
+            // Nothing in the Rx queue, sleep until there is
+            0 => {
+                if !wait_for_fd(fd, libc::POLLIN, deadline)? {
+                    break;
+                }
+            }
+            read => count += read,
+        }
+    }
+    Ok(count)
+}
+
+/// Opens a non blocking raw CAN socket which receives every frame on the interface
+fn open_raw_socket(if_name: &str) -> ChannelResult<socketcan::CANSocket> {
+    let channel = socketcan::CANSocket::open(if_name)?;
+    channel.filter_accept_all()?;
+    // Non blocking, reads and writes wait for the socket with poll() instead
+    channel.set_nonblocking(true)?;
+    Ok(channel)
+}
+
+/// Opens a non blocking raw CAN socket which only sends frames. An empty filter list
+/// stops the kernel from queueing every frame on the interface for a socket that is never read
+fn open_send_only_socket(if_name: &str) -> ChannelResult<socketcan::CANSocket> {
+    let channel = socketcan::CANSocket::open(if_name)?;
+    let res = unsafe {
+        libc::setsockopt(
+            channel.as_raw_fd(),
+            SOL_CAN_RAW,
+            CAN_RAW_FILTER,
+            ptr::null(),
+            0,
+        )
+    };
+    if res != 0 {
+        return Err(std::io::Error::last_os_error().into());
+    }
+    channel.set_nonblocking(true)?;
+    Ok(channel)
+}
+
 /// SocketCAN device
 #[derive(Debug)]
 pub struct SocketCanDevice {
@@ -60,6 +389,7 @@ impl Hardware for SocketCanDevice {
             ids: (0, 0),
             cfg: IsoTPSettings::default(),
             cfg_complete: false,
+            oob_channel: None,
         }))
     }
 
@@ -70,6 +400,15 @@ impl Hardware for SocketCanDevice {
         }))
     }
 
+    fn create_can_fd_channel(
+        this: Arc<Mutex<Self>>,
+    ) -> super::HardwareResult<Box<dyn CanFdChannel>> {
+        Ok(Box::new(SocketCanCanFdChannel {
+            device: this,
+            channel: None,
+        }))
+    }
+
     fn read_battery_voltage(&mut self) -> Option<f32> {
         None
     }
@@ -116,10 +455,7 @@ impl PacketChannel<CanFrame> for SocketCanCanChannel {
             return Ok(()); // Already open!
         }
         let mut device = self.device.lock()?;
-        let channel = socketcan::CANSocket::open(&device.info.name)?;
-        channel.filter_accept_all()?;
-        channel.set_nonblocking(false)?;
-        self.channel = Some(channel);
+        self.channel = Some(open_raw_socket(&device.info.name)?);
         device.canbus_active = true;
         Ok(())
     }
@@ -134,38 +470,25 @@ impl PacketChannel<CanFrame> for SocketCanCanChannel {
         Ok(())
     }
 
-    fn write_packets(&mut self, packets: Vec<CanFrame>, timeout_ms: u32) -> ChannelResult<()> {
-        self.safe_with_iface(|iface| {
-            iface.set_write_timeout(std::time::Duration::from_millis(timeout_ms as u64))?;
-            let mut cf: socketcan::CANFrame;
-            for p in &packets {
-                cf = socketcan::CANFrame::new(p.get_address(), p.get_data(), false, false).unwrap();
-                iface.write_frame(&cf)?;
-            }
-            Ok(())
-        })
+    fn write_packets(&mut self, packets: &[CanFrame], timeout_ms: u32) -> ChannelResult<()> {
+        self.safe_with_iface(|iface| write_all(iface.as_raw_fd(), packets, timeout_ms))
     }
 
     fn read_packets(&mut self, max: usize, timeout_ms: u32) -> ChannelResult<Vec<CanFrame>> {
-        let timeout = std::cmp::max(1, timeout_ms) as u128;
-        let mut result: Vec<CanFrame> = Vec::with_capacity(max);
-        self.safe_with_iface(|iface| {
-            let start = Instant::now();
-            let mut read: socketcan::CANFrame;
-            while start.elapsed().as_millis() <= timeout {
-                read = iface.read_frame()?;
-                result.push(CanFrame::new(read.id(), read.data(), read.is_extended()));
-                // Read complete
-                if result.len() == max {
-                    return Ok(());
-                }
-            }
-            Ok(())
-        })?;
-        result.shrink_to_fit(); // Deallocate unneeded memory
+        let mut result = vec![CanFrame::default(); max];
+        let count = self.read_packets_into(&mut result, timeout_ms)?;
+        result.truncate(count);
         Ok(result)
     }
 
+    fn read_packets_into(
+        &mut self,
+        packets: &mut [CanFrame],
+        timeout_ms: u32,
+    ) -> ChannelResult<usize> {
+        self.safe_with_iface(|iface| read_into(iface.as_raw_fd(), packets, timeout_ms))
+    }
+
     fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
         self.safe_with_iface(|iface| {
             while iface.read_frame().is_ok() {} // Keep reading until we drain the buffer
@@ -193,6 +516,111 @@ impl Drop for SocketCanCanChannel {
     }
 }
 
+#[derive(Debug)]
+/// SocketCAN CAN-FD channel. The interface must be configured for CAN-FD by the OS,
+/// EG: `ip link set can0 type can bitrate 500000 dbitrate 2000000 fd on`
+pub struct SocketCanCanFdChannel {
+    device: Arc<Mutex<SocketCanDevice>>,
+    channel: Option<socketcan::CANSocket>,
+}
+
+impl SocketCanCanFdChannel {
+    fn safe_with_iface<X, T: FnOnce(&socketcan::CANSocket) -> ChannelResult<X>>(
+        &mut self,
+        function: T,
+    ) -> ChannelResult<X> {
+        match self.channel {
+            Some(ref channel) => function(channel),
+            None => Err(ChannelError::InterfaceNotOpen),
+        }
+    }
+}
+
+impl PacketChannel<CanFdFrame> for SocketCanCanFdChannel {
+    fn open(&mut self) -> ChannelResult<()> {
+        if self.channel.is_some() {
+            return Ok(()); // Already open!
+        }
+        let mut device = self.device.lock()?;
+        let channel = open_raw_socket(&device.info.name)?;
+        // An int, set to 1
+        let enable = libc::c_int::to_ne_bytes(1);
+        let res = unsafe {
+            libc::setsockopt(
+                channel.as_raw_fd(),
+                SOL_CAN_RAW,
+                CAN_RAW_FD_FRAMES,
+                enable.as_ptr().cast(),
+                enable.len() as libc::socklen_t,
+            )
+        };
+        if res != 0 {
+            // Kernel without CAN-FD support
+            return Err(std::io::Error::last_os_error().into());
+        }
+        self.channel = Some(channel);
+        device.canbus_active = true;
+        Ok(())
+    }
+
+    fn close(&mut self) -> ChannelResult<()> {
+        if self.channel.is_none() {
+            return Ok(());
+        }
+        let mut device = self.device.lock()?;
+        self.channel = None;
+        device.canbus_active = false;
+        Ok(())
+    }
+
+    fn write_packets(&mut self, packets: &[CanFdFrame], timeout_ms: u32) -> ChannelResult<()> {
+        self.safe_with_iface(|iface| write_all(iface.as_raw_fd(), packets, timeout_ms))
+    }
+
+    fn read_packets(&mut self, max: usize, timeout_ms: u32) -> ChannelResult<Vec<CanFdFrame>> {
+        let mut result = vec![CanFdFrame::default(); max];
+        let count = self.read_packets_into(&mut result, timeout_ms)?;
+        result.truncate(count);
+        Ok(result)
+    }
+
+    fn read_packets_into(
+        &mut self,
+        packets: &mut [CanFdFrame],
+        timeout_ms: u32,
+    ) -> ChannelResult<usize> {
+        self.safe_with_iface(|iface| read_into(iface.as_raw_fd(), packets, timeout_ms))
+    }
+
+    fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
+        self.safe_with_iface(|iface| {
+            let mut frames = [CanFdFrame::default(); MMSG_BATCH];
+            // Keep reading until we drain the buffer
+            while recv_frames(iface.as_raw_fd(), &mut frames)? != 0 {}
+            Ok(())
+        })
+    }
+
+    fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
+        Ok(())
+    }
+}
+
+impl CanFdChannel for SocketCanCanFdChannel {
+    /// SocketCAN ignores this function as the channel is pre-configured
+    /// by the OS' kernel.
+    fn set_can_fd_cfg(&mut self, _baud: u32, _use_extended: bool) -> ChannelResult<()> {
+        Ok(())
+    }
+}
+
+impl Drop for SocketCanCanFdChannel {
+    #[allow(unused_must_use)]
+    fn drop(&mut self) {
+        self.close();
+    }
+}
+
 /// SocketCAN CAN channel
 pub struct SocketCanIsoTPChannel {
     device: Arc<Mutex<SocketCanDevice>>,
@@ -201,6 +629,9 @@ pub struct SocketCanIsoTPChannel {
     ids: (u32, u32),
     cfg: IsoTPSettings,
     cfg_complete: bool,
+    /// Send only raw CAN socket for single frames to addresses other than the Tx ID
+    /// (EG: Global tester present). Opened on first use, and kept until the channel is closed
+    oob_channel: Option<socketcan::CANSocket>,
 }
 
 impl SocketCanIsoTPChannel {
@@ -213,6 +644,15 @@ impl SocketCanIsoTPChannel {
             None => Err(ChannelError::InterfaceNotOpen),
         }
     }
+
+    /// Returns the raw CAN socket used for out of band frames, opening it if this is its first use
+    fn get_oob_channel(&mut self) -> ChannelResult<&socketcan::CANSocket> {
+        if self.oob_channel.is_none() {
+            let device = self.device.lock()?;
+            self.oob_channel = Some(open_send_only_socket(&device.info.name)?);
+        }
+        Ok(self.oob_channel.as_ref().unwrap())
+    }
 }
 
 impl std::fmt::Debug for SocketCanIsoTPChannel {
@@ -249,7 +689,7 @@ impl PayloadChannel for SocketCanIsoTPChannel {
 
         let opts: IsoTpOptions = IsoTpOptions::new(
             flags,
-            std::time::Duration::from_millis(0),
+            Duration::from_millis(0),
             ext_address,
             0x00,
             0x00,
@@ -257,7 +697,14 @@ impl PayloadChannel for SocketCanIsoTPChannel {
         )
         .unwrap();
 
-        let link_opts: LinkLayerOptions = LinkLayerOptions::default();
+        let link_opts: LinkLayerOptions = match self.cfg.can_fd {
+            true => LinkLayerOptions::new(
+                CANFD_MTU as u8,
+                CAN_FD_MAX_DATA_LEN as u8,
+                if self.cfg.can_fd_brs { CANFD_BRS } else { 0 },
+            ),
+            false => LinkLayerOptions::default(),
+        };
 
         let (tx_id, rx_id) = match self.cfg.can_use_ext_addr {
             true => (
@@ -287,6 +734,7 @@ impl PayloadChannel for SocketCanIsoTPChannel {
     }
 
     fn close(&mut self) -> ChannelResult<()> {
+        self.oob_channel = None;
         let mut device = self.device.lock()?;
         if self.channel.is_none() {
             // Already shut
@@ -303,13 +751,16 @@ impl PayloadChannel for SocketCanIsoTPChannel {
     }
 
     fn read_bytes(&mut self, timeout_ms: u32) -> ChannelResult<Vec<u8>> {
-        let start = Instant::now();
-        let timeout = std::cmp::max(1, timeout_ms);
+        let deadline = Instant::now() + Duration::from_millis(timeout_ms as u64);
         self.safe_with_iface(|socket| {
-            while start.elapsed().as_millis() <= timeout as u128 {
+            loop {
                 if let Ok(data) = socket.read() {
                     return Ok(data.to_vec());
                 }
+                // Nothing to read yet, sleep until the kernel has a full payload for us
+                if !wait_for_fd(socket.as_raw_fd(), libc::POLLIN, deadline)? {
+                    break;
+                }
             }
             // Timeout
             if timeout_ms == 0 {
@@ -327,42 +778,42 @@ impl PayloadChannel for SocketCanIsoTPChannel {
     /// but longer messages will fail.
     ///
     /// If `buffer` is less than 7 bytes (With Standard ISO-TP addressing), or less than 6 bytes (With Extended ISO-TP addressing),
-    /// this function will attempt to open a parallel socketCAN channel in order to send an ISO-TP single frame request on the alternate requested
-    /// address.
+    /// this function will send an ISO-TP single frame request on the alternate requested address, using a parallel socketCAN channel.
+    /// That channel is opened on first use, and reused until this channel is closed.
     ///
     /// If `buffer` is more than 7 bytes and you request on an alternate address, then this function will fail with [ChannelError::UnsupportedRequest]
     fn write_bytes(&mut self, addr: u32, buffer: &[u8], timeout_ms: u32) -> ChannelResult<()> {
         // Work around for issue #1
         // If the buffer is less than 7/6 bytes, we can send it as 1 frame (Usually for global tester present msg)
-        // If this is the case, we can simply open a socketCAN channel to send that frame in parallel to the ISO-TP channel already open!
+        // If this is the case, we can simply use a socketCAN channel to send that frame in parallel to the ISO-TP channel already open!
         if addr != self.ids.0 {
             if (buffer.len() <= 7 && !self.cfg.extended_addressing)
                 || (buffer.len() <= 6 && self.cfg.extended_addressing)
             {
-                let mut data = Vec::new();
-                let can_id = if self.cfg.extended_addressing {
-                    // Std ISO-TP addr
-                    data.push((addr & 0xFF) as u8);
-                    data.push(buffer.len() as u8);
-                    (addr >> 8) & 0xFFFF
-                } else {
+                let mut data = [0u8; 8];
+                let (can_id, pci_len) = if self.cfg.extended_addressing {
                     // Ext ISO-TP addr
-                    data.push(buffer.len() as u8);
-                    addr
+                    data[0] = (addr & 0xFF) as u8;
+                    data[1] = buffer.len() as u8;
+                    ((addr >> 8) & 0xFFFF, 2)
+                } else {
+                    // Std ISO-TP addr
+                    data[0] = buffer.len() as u8;
+                    (addr, 1)
                 };
-                data.extend_from_slice(buffer); // Push Tx Data
-
-                if self.cfg.pad_frame {
-                    // Pad to 8 bytes
-                    data.resize(8, 0x00);
-                }
+                data[pci_len..pci_len + buffer.len()].copy_from_slice(buffer); // Push Tx Data
 
-                let can_frame = CanFrame::new(can_id, &data, self.cfg.can_use_ext_addr);
+                // Pad to 8 bytes if required
+                let frame_len = if self.cfg.pad_frame {
+                    8
+                } else {
+                    pci_len + buffer.len()
+                };
 
-                let mut channel = Hardware::create_can_channel(self.device.clone())?;
-                channel.open()?;
-                channel.write_packets(vec![can_frame], timeout_ms)?;
-                drop(channel);
+                let can_frame =
+                    CanFrame::new(can_id, &data[..frame_len], self.cfg.can_use_ext_addr);
+                let oob = self.get_oob_channel()?;
+                write_all(oob.as_raw_fd(), &[can_frame], timeout_ms)?;
                 return Ok(());
             } else {
                 return Err(ChannelError::UnsupportedRequest);
@@ -494,3 +945,45 @@ impl From<std::io::Error> for ChannelError {
         Self::IOError(e)
     }
 }
+
+#[cfg(test)]
+mod socketcan_test {
+    use super::*;
+
+    #[test]
+    fn test_raw_frame_ids() {
+        let (std, mtu) = CanFrame::new(0x7E0, &[0x02, 0x10, 0x03], false)
+            .to_raw()
+            .unwrap();
+        assert_eq!(std.can_id, 0x7E0);
+        assert_eq!(std.len, 3);
+        assert_eq!(mtu, CAN_MTU);
+        // Large IDs are always extended
+        let (ext, _) = CanFrame::new(0x18DA10F1, &[0x01], false).to_raw().unwrap();
+        assert_eq!(ext.can_id, 0x18DA10F1 | CAN_EFF_FLAG);
+        let (small_ext, _) = CanFrame::new(0x10, &[], true).to_raw().unwrap();
+        assert_eq!(small_ext.can_id, 0x10 | CAN_EFF_FLAG);
+        assert!(CanFrame::new(0x2000_0000, &[], true).to_raw().is_err());
+
+        let back = CanFrame::from_raw(&ext, CAN_MTU).unwrap();
+        assert_eq!(back.get_address(), 0x18DA10F1);
+        assert!(back.is_extended());
+        assert_eq!(back.get_data(), &[0x01]);
+        assert!(!CanFrame::from_raw(&std, CAN_MTU).unwrap().is_extended());
+    }
+
+    #[test]
+    fn test_raw_fd_frames() {
+        assert_eq!(mem::size_of::<RawCanFrame>(), CANFD_MTU);
+        let data = [0xAA; 48];
+        let (raw, mtu) = CanFdFrame::new(0x7E0, &data, false, true).to_raw().unwrap();
+        assert_eq!((mtu, raw.len, raw.flags), (CANFD_MTU, 48, CANFD_BRS));
+        let back = CanFdFrame::from_raw(&raw, mtu).unwrap();
+        assert!(back.is_fd() && back.is_brs());
+        assert_eq!(back.get_data(), &data[..]);
+        // Classic frames are never sent as FD frames, and FD frames do not fit a CanFrame
+        let classic = CanFdFrame::from(CanFrame::new(0x7E0, &[0x01], false));
+        assert_eq!(classic.to_raw().unwrap().1, CAN_MTU);
+        assert!(CanFrame::from_raw(&raw, CANFD_MTU).is_none());
+    }
+}
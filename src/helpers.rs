@@ -1,9 +1,14 @@
 //! When parsing ECU response data from raw bytes,
 //! Some functions in here can be useful with data transformation
-use std::time::{Duration, Instant};
+use std::{
+    sync::mpsc,
+    time::{Duration, Instant},
+};
 
 use crate::{
-    channel::PayloadChannel, BaseServerPayload, BaseServerSettings, DiagError, DiagServerResult,
+    channel::{ChannelError, ChannelResult, PayloadChannel},
+    metrics::ServerMetrics,
+    BaseServerPayload, BaseServerSettings, DiagError, DiagServerResult,
 };
 
 /// Checks if the response payload matches the request ServiceID.
@@ -26,11 +31,114 @@ pub(crate) fn check_pos_response_id(sid: u8, resp: Vec<u8>) -> DiagServerResult<
     }
 }
 
+/// Waits for the next command to arrive on a diagnostic server's command channel.
+///
+/// ## Parameters
+/// * rx - Command channel of the server thread
+/// * deadline - If set, give up waiting at this point in time (For example, when the next
+/// tester present message is due). If not set, block until a command arrives.
+///
+/// ## Returns
+/// `Ok(None)` if the deadline passed without a command. `Err` if the client side of
+/// the channel has been dropped, meaning the server should exit
+pub(crate) fn wait_for_cmd<T>(
+    rx: &mpsc::Receiver<T>,
+    deadline: Option<Instant>,
+) -> Result<Option<T>, mpsc::RecvTimeoutError> {
+    match deadline {
+        Some(d) => match rx.recv_timeout(d.saturating_duration_since(Instant::now())) {
+            Ok(cmd) => Ok(Some(cmd)),
+            Err(mpsc::RecvTimeoutError::Timeout) => Ok(None),
+            Err(e) => Err(e),
+        },
+        None => rx
+            .recv()
+            .map(Some)
+            .map_err(|_| mpsc::RecvTimeoutError::Disconnected),
+    }
+}
+
+/// Returns the point in time the next tester present message is due, if tester present
+/// is currently being sent
+pub(crate) fn tester_present_deadline(
+    send_tester_present: bool,
+    last_tester_present_time: Instant,
+    interval_ms: u32,
+) -> Option<Instant> {
+    if send_tester_present {
+        Some(last_tester_present_time + Duration::from_millis(interval_ms as u64))
+    } else {
+        None
+    }
+}
+
+/// How long to wait on an ECU that has asked the tester to wait (Response pending), or
+/// to try again later (Busy repeat request)
+#[derive(Debug, Copy, Clone)]
+pub(crate) struct ResponseTiming {
+    /// Maximum time to wait for the next response after the ECU responded with
+    /// response pending (P2*)
+    pub p2_star_ms: u32,
+    /// Time to wait before repeating a request the ECU was too busy to handle
+    pub busy_repeat_ms: u32,
+}
+
+impl Default for ResponseTiming {
+    fn default() -> Self {
+        Self {
+            p2_star_ms: 2000,
+            busy_repeat_ms: 500,
+        }
+    }
+}
+
+/// State of a request that is being processed by [perform_cmd_with_timing]
+#[derive(Debug, Copy, Clone)]
+enum CmdState {
+    /// Request needs to be (re)sent to the ECU
+    Send,
+    /// Waiting for the ECU to respond. `pending` is set once the ECU
+    /// has responded with response pending
+    AwaitResponse { deadline: Instant, pending: bool },
+    /// ECU was busy, the request is repeated at this point in time
+    Repeat { at: Instant },
+}
+
+/// Hooks allowing a diagnostic server to do other work whilst [perform_cmd_with_timing]
+/// is waiting on the ECU
+pub(crate) trait WaitHooks<C> {
+    /// Called with the channel every time the wait wakes up, once the ECU has asked the
+    /// tester to wait. Returns when it next wants to be called, if at all.
+    fn on_idle(&mut self, _channel: &mut C) -> Option<Instant> {
+        None
+    }
+
+    /// Called with every payload read from the channel, before it is treated as the ECU's
+    /// response to the request with SID `target`. Returns true if the payload is not a
+    /// response and has been consumed, in which case it is otherwise ignored.
+    fn on_unsolicited(&mut self, _target: u8, _payload: &[u8]) -> bool {
+        false
+    }
+
+    /// Called before every transmission of the request, to throw away stale responses
+    /// waiting on the channel. Hooks which expect messages other than responses can
+    /// instead read and keep them here.
+    fn clear_rx(&mut self, channel: &mut C) -> ChannelResult<()>
+    where
+        C: PayloadChannel,
+    {
+        channel.clear_rx_buffer()
+    }
+}
+
+/// No hooks
+impl<C> WaitHooks<C> for () {}
+
 pub(crate) fn perform_cmd<
     P: BaseServerPayload,
     T: BaseServerSettings,
     C: PayloadChannel,
-    L: FnOnce(u8) -> String,
+    L: Fn(u8) -> String,
 >(
     addr: u32,
     cmd: &P,
@@ -39,71 +147,176 @@ pub(crate) fn perform_cmd<
     busy_repeat_byte: u8,
     lookup_func: L,
 ) -> DiagServerResult<Vec<u8>> {
-    // Clear IO buffers
-    channel.clear_tx_buffer()?;
-    channel.clear_rx_buffer()?;
-    let target = cmd.get_sid_byte();
-    if !cmd.requires_response() {
-        // Just send the data and return an empty response
-        log::debug!("Request doesn't require response. Just sending");
-        channel.write_bytes(addr, cmd.to_bytes(), settings.get_write_timeout_ms())?;
-        return Ok(Vec::new());
-    }
-    let res = channel.read_write_bytes(
+    perform_cmd_with_timing(
         addr,
-        cmd.to_bytes(),
-        settings.get_write_timeout_ms(),
-        settings.get_read_timeout_ms(),
-    )?;
-    log::debug!("ECU response: {:02X?}", res);
-    if res.is_empty() {
-        return Err(DiagError::EmptyResponse);
-    }
-    if res[0] == 0x7F {
-        if res[2] == busy_repeat_byte {
-            log::warn!("ECU Responded with busy_repeat_request! Retrying in 500ms");
-            std::thread::sleep(std::time::Duration::from_millis(500));
-            return perform_cmd(addr, cmd, settings, channel, busy_repeat_byte, lookup_func);
-        }
-        if res[2] == 0x78 {
-            // Always busy wait for response
-            log::warn!("ECU Responded with await_response! Waiting for real response");
-            // For both UDS or
-            // Wait a bit longer for the ECU response
-            let mut timestamp = Instant::now();
-            while timestamp.elapsed() <= Duration::from_millis(2000) {
-                if let Ok(res2) = channel.read_bytes(settings.get_read_timeout_ms()) {
-                    log::debug!("ECU next response: {:02X?}", res2);
-                    if res2.is_empty() {
-                        log::error!("ECU Response was empty after await_response!?");
-                        return Err(DiagError::EmptyResponse);
-                    }
-                    if res2[0] == 0x7F {
-                        if res2[2] == 0x78 {
-                            log::warn!("ECU Still asking for tester to wait for its response");
-                            timestamp = Instant::now();
+        cmd,
+        settings,
+        channel,
+        busy_repeat_byte,
+        lookup_func,
+        ResponseTiming::default(),
+        None,
+        &mut (),
+    )
+}
+
+/// Sends a command to the ECU, and waits for its response.
+///
+/// If the ECU asks the tester to wait (`0x78`), or to repeat the request (`busy_repeat_byte`),
+/// then this keeps waiting according to `timing`. Whilst waiting, [WaitHooks::on_idle] is called with the
+/// channel every time this wakes up, allowing the caller to do other work (Such as sending tester present).
+/// It returns when it next wants to be called, so that reads from the channel never block
+/// past that point. Reads still return as soon as the ECU's response arrives.
+///
+/// If `metrics` is set, write and response times as well as retries and timeouts are recorded to it.
+#[allow(clippy::too_many_arguments)]
+pub(crate) fn perform_cmd_with_timing<
+    P: BaseServerPayload,
+    T: BaseServerSettings,
+    C: PayloadChannel,
+    L: Fn(u8) -> String,
+    H: WaitHooks<C>,
+>(
+    addr: u32,
+    cmd: &P,
+    settings: &T,
+    channel: &mut C,
+    busy_repeat_byte: u8,
+    lookup_func: L,
+    timing: ResponseTiming,
+    metrics: Option<&ServerMetrics>,
+    hooks: &mut H,
+) -> DiagServerResult<Vec<u8>> {
+    let target = cmd.get_sid_byte();
+    let mut state = CmdState::Send;
+    // Set whilst waiting for the first response to the latest transmission of the request
+    let mut sent_at: Option<Instant> = None;
+    loop {
+        state = match state {
+            CmdState::Send => {
+                // Clear IO buffers
+                channel.clear_tx_buffer()?;
+                hooks.clear_rx(channel)?;
+                if !cmd.requires_response() {
+                    // Just send the data and return an empty response
+                    log::debug!("Request doesn't require response. Just sending");
+                    channel.write_bytes(addr, cmd.to_bytes(), settings.get_write_timeout_ms())?;
+                    return Ok(Vec::new());
+                }
+                let write_start = Instant::now();
+                channel.write_bytes(addr, cmd.to_bytes(), settings.get_write_timeout_ms())?;
+                let now = Instant::now();
+                if let Some(m) = metrics {
+                    m.record_write(now - write_start);
+                }
+                sent_at = Some(now);
+                CmdState::AwaitResponse {
+                    deadline: Instant::now()
+                        + Duration::from_millis(settings.get_read_timeout_ms() as u64),
+                    pending: false,
+                }
+            }
+            CmdState::Repeat { at } => {
+                let now = Instant::now();
+                if now >= at {
+                    CmdState::Send
+                } else {
+                    let wake = hooks.on_idle(channel).map_or(at, |w| w.min(at));
+                    std::thread::sleep(wake.saturating_duration_since(now));
+                    state
+                }
+            }
+            CmdState::AwaitResponse { deadline, pending } => {
+                let wake = match pending {
+                    // Only do other work once the ECU has asked us to wait
+                    true => hooks.on_idle(channel).map_or(deadline, |w| w.min(deadline)),
+                    false => deadline,
+                };
+                // Rounded up, so a wake less than 1ms away is not turned into a non-blocking read
+                let timeout_ms =
+                    ((wake.saturating_duration_since(Instant::now()).as_micros() + 999) / 1000)
+                        .clamp(1, u32::MAX as u128) as u32;
+                match channel.read_bytes(timeout_ms) {
+                    Ok(res) => {
+                        if hooks.on_unsolicited(target, &res) {
+                            // Not for us, keep waiting
+                            continue;
+                        }
+                        log::debug!("ECU response: {:02X?}", res);
+                        if let (Some(m), Some(t)) = (metrics, sent_at.take()) {
+                            m.record_first_response(t.elapsed());
+                        }
+                        if res.is_empty() {
+                            return Err(DiagError::EmptyResponse);
+                        }
+                        if res[0] != 0x7F {
+                            return check_pos_response_id(target, res); // ECU Response OK!
+                        }
+                        if res.len() < 3 {
+                            return Err(DiagError::InvalidResponseLength);
+                        }
+                        if res[2] == busy_repeat_byte {
+                            if let Some(m) = metrics {
+                                m.record_busy_repeat();
+                            }
+                            log::warn!(
+                                "ECU Responded with busy_repeat_request! Retrying in {}ms",
+                                timing.busy_repeat_ms
+                            );
+                            CmdState::Repeat {
+                                at: Instant::now()
+                                    + Duration::from_millis(timing.busy_repeat_ms as u64),
+                            }
+                        } else if res[2] == 0x78 {
+                            if let Some(m) = metrics {
+                                m.record_response_pending();
+                            }
+                            log::warn!(
+                                "ECU Responded with await_response! Waiting for real response"
+                            );
+                            CmdState::AwaitResponse {
+                                deadline: Instant::now()
+                                    + Duration::from_millis(timing.p2_star_ms as u64),
+                                pending: true,
+                            }
                         } else {
-                            // Still an error but not busy. Give up
-                            log::error!("ECU Still responded negatively (0x{:02X?}) after await_response. Giving up.", res2[2]);
-                            return Err(super::DiagError::ECUError {
-                                code: res2[2],
-                                def: Some(lookup_func(res2[2])),
-                            })
+                            log::error!("ECU Negative response 0x{:02X?}", res[2]);
+                            return Err(DiagError::ECUError {
+                                code: res[2],
+                                def: Some(lookup_func(res[2])),
+                            });
+                        }
+                    }
+                    Err(ChannelError::ReadTimeout) | Err(ChannelError::BufferEmpty)
+                        if Instant::now() < deadline =>
+                    {
+                        // Woke up early to do other work, keep waiting. Some channels return
+                        // straight away when there is nothing to read, so sleep out the rest
+                        // of the wait rather than spinning on them
+                        let now = Instant::now();
+                        let wake = wake.min(deadline);
+                        if now < wake {
+                            std::thread::sleep(wake - now);
                         }
-                    } else {
-                        // Response OK!
-                        log::debug!("ECU Responded positively after await.");
-                        return check_pos_response_id(target, res2)
-                    };
+                        state
+                    }
+                    Err(e) => {
+                        if let (Some(m), ChannelError::ReadTimeout | ChannelError::BufferEmpty) =
+                            (metrics, &e)
+                        {
+                            m.record_timeout();
+                        }
+                        if pending {
+                            log::error!("ECU did not respond within P2* after await_response");
+                            return Err(DiagError::ECUError {
+                                code: 0x78,
+                                def: Some(lookup_func(0x78)),
+                            });
+                        }
+                        return Err(e.into());
+                    }
                 }
-                std::thread::sleep(std::time::Duration::from_millis(50));
             }
         }
-        log::error!("ECU Negative response 0x{:02X?}", res[2]);
-        return Err(super::DiagError::ECUError {
-            code: res[2],
-            def: Some(lookup_func(res[2])),
-        });
     }
-    check_pos_response_id(target, res) // ECU Response OK!
 }
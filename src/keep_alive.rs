@@ -0,0 +1,224 @@
+//! Bus wide keep-alive (Tester present) scheduling
+//!
+//! Every diagnostic server normally keeps its own ECU's session alive, by sending tester present
+//! on a fixed interval. With many servers on one bus, that is one message per ECU per interval,
+//! and servers waiting on a tester present response hold up their queued requests.
+//!
+//! A [KeepAliveScheduler] is shared by every server on a bus. Instead of each server sending its
+//! own tester present, one functional tester present which suppresses the positive response
+//! (`0x3E 0x80`) is sent on behalf of every session on the bus, by whichever server is idle
+//! when it is due. Any real request a server sends to its ECU also restarts that ECU's
+//! session timer (S3), so the keep-alive is skipped entirely whilst every session has seen
+//! traffic recently. Servers with a request queued never send the keep-alive.
+
+use std::{
+    collections::HashMap,
+    sync::{Arc, Mutex},
+    time::{Duration, Instant},
+};
+
+/// Request sent to keep every session on the bus alive
+/// (Tester present, suppressing the positive response)
+pub const KEEP_ALIVE_PAYLOAD: [u8; 2] = [0x3E, 0x80];
+
+#[derive(Debug)]
+struct BusState {
+    next_id: u64,
+    /// Time each session in a non-default session last saw traffic, keyed by member ID
+    sessions: HashMap<u64, Instant>,
+    sent: u64,
+}
+
+/// Keep-alive scheduler shared by every diagnostic server on one bus,
+/// see the [module level docs](self).
+///
+/// Cloning the scheduler returns another handle to the same bus
+#[derive(Debug, Clone)]
+pub struct KeepAliveScheduler {
+    functional_id: u32,
+    interval: Duration,
+    bus: Arc<Mutex<BusState>>,
+}
+
+impl KeepAliveScheduler {
+    /// Creates a new scheduler for a bus
+    ///
+    /// ## Parameters
+    /// * functional_id - Functional (Broadcast) address every ECU on the bus listens to
+    /// * interval_ms - Longest time a session may go without traffic. This should be
+    ///   comfortably shorter than the ECUs' session timeout (S3)
+    pub fn new(functional_id: u32, interval_ms: u32) -> Self {
+        Self {
+            functional_id,
+            interval: Duration::from_millis(interval_ms as u64),
+            bus: Arc::new(Mutex::new(BusState {
+                next_id: 0,
+                sessions: HashMap::new(),
+                sent: 0,
+            })),
+        }
+    }
+
+    /// Returns the functional address keep-alives are sent to
+    pub fn functional_id(&self) -> u32 {
+        self.functional_id
+    }
+
+    /// Returns the keep-alive interval
+    pub fn interval(&self) -> Duration {
+        self.interval
+    }
+
+    /// Returns the number of sessions which are currently being kept alive
+    pub fn active_sessions(&self) -> usize {
+        self.bus.lock().unwrap().sessions.len()
+    }
+
+    /// Returns the number of keep-alives sent on the bus so far
+    pub fn keep_alives_sent(&self) -> u64 {
+        self.bus.lock().unwrap().sent
+    }
+
+    /// Adds a new (Inactive) session to the bus. The session leaves the bus once the
+    /// returned member is dropped
+    pub(crate) fn join(&self) -> KeepAliveMember {
+        let mut bus = self.bus.lock().unwrap();
+        let id = bus.next_id;
+        bus.next_id += 1;
+        KeepAliveMember {
+            scheduler: self.clone(),
+            id,
+        }
+    }
+}
+
+/// One server's session on a [KeepAliveScheduler]'s bus
+#[derive(Debug)]
+pub(crate) struct KeepAliveMember {
+    scheduler: KeepAliveScheduler,
+    id: u64,
+}
+
+impl KeepAliveMember {
+    /// Returns the functional address keep-alives are sent to
+    pub fn functional_id(&self) -> u32 {
+        self.scheduler.functional_id
+    }
+
+    /// Sets whether the session needs keeping alive (EG: The ECU is in a non-default session)
+    pub fn set_active(&self, active: bool) {
+        self.set_active_at(active, Instant::now())
+    }
+
+    /// [KeepAliveMember::set_active], at a given time
+    pub(crate) fn set_active_at(&self, active: bool, now: Instant) {
+        let mut bus = self.scheduler.bus.lock().unwrap();
+        if active {
+            bus.sessions.insert(self.id, now);
+        } else {
+            bus.sessions.remove(&self.id);
+        }
+    }
+
+    /// Records that a request has just been sent to the session's ECU, restarting its S3 timer
+    pub fn record_traffic(&self) {
+        self.record_traffic_at(Instant::now())
+    }
+
+    /// [KeepAliveMember::record_traffic], at a given time
+    pub(crate) fn record_traffic_at(&self, now: Instant) {
+        let mut bus = self.scheduler.bus.lock().unwrap();
+        if let Some(t) = bus.sessions.get_mut(&self.id) {
+            *t = now;
+        }
+    }
+
+    /// Returns when the next keep-alive is due on the bus, if any session needs keeping alive
+    pub fn deadline(&self) -> Option<Instant> {
+        let bus = self.scheduler.bus.lock().unwrap();
+        bus.sessions
+            .values()
+            .min()
+            .map(|t| *t + self.scheduler.interval)
+    }
+
+    /// Returns true if a keep-alive is due, in which case the caller must send
+    /// [KEEP_ALIVE_PAYLOAD] to [KeepAliveMember::functional_id]. Every other member is then
+    /// told the keep-alive has been sent, so only one member sends it
+    pub fn claim(&self) -> bool {
+        self.claim_at(Instant::now())
+    }
+
+    /// [KeepAliveMember::claim], at a given time
+    pub(crate) fn claim_at(&self, now: Instant) -> bool {
+        let mut bus = self.scheduler.bus.lock().unwrap();
+        match bus.sessions.values().min() {
+            Some(t) if *t + self.scheduler.interval <= now => {
+                // The functional request restarts the S3 timer of every ECU on the bus
+                bus.sessions.values_mut().for_each(|t| *t = now);
+                bus.sent += 1;
+                true
+            }
+            _ => false,
+        }
+    }
+}
+
+impl Drop for KeepAliveMember {
+    fn drop(&mut self) {
+        if let Ok(mut bus) = self.scheduler.bus.lock() {
+            bus.sessions.remove(&self.id);
+        }
+    }
+}
+
+#[cfg(test)]
+mod keep_alive_test {
+    use super::*;
+
+    fn ms(start: Instant, ms: u64) -> Instant {
+        start + Duration::from_millis(ms)
+    }
+
+    #[test]
+    fn test_one_keep_alive_per_bus() {
+        let scheduler = KeepAliveScheduler::new(0x7DF, 20);
+        let a = scheduler.join();
+        let b = scheduler.join();
+        // Nothing to keep alive yet
+        assert!(a.deadline().is_none());
+        let start = Instant::now();
+        a.set_active_at(true, start);
+        b.set_active_at(true, ms(start, 5));
+        assert_eq!(scheduler.active_sessions(), 2);
+        assert_eq!(a.deadline(), Some(ms(start, 20)));
+        assert!(!a.claim_at(ms(start, 19)));
+
+        assert!(a.claim_at(ms(start, 20)));
+        // Already sent on behalf of b
+        assert!(!b.claim_at(ms(start, 25)));
+        assert_eq!(b.deadline(), Some(ms(start, 40)));
+        assert_eq!(scheduler.keep_alives_sent(), 1);
+
+        drop(a);
+        assert_eq!(scheduler.active_sessions(), 1);
+    }
+
+    #[test]
+    fn test_traffic_skips_keep_alive() {
+        let scheduler = KeepAliveScheduler::new(0x7DF, 40);
+        let a = scheduler.join();
+        let start = Instant::now();
+        a.set_active_at(true, start);
+        a.record_traffic_at(ms(start, 25));
+        // 50ms since the session started, but only 25ms since the last request
+        assert!(!a.claim_at(ms(start, 50)));
+        assert!(a.claim_at(ms(start, 65)));
+        a.set_active(false);
+        assert!(a.deadline().is_none());
+        // Traffic outside of a session does not start one
+        a.record_traffic_at(ms(start, 70));
+        assert!(!a.claim_at(ms(start, 200)));
+        assert_eq!(scheduler.keep_alives_sent(), 1);
+    }
+}
@@ -22,7 +22,9 @@ use std::{
 
 use crate::{
     channel::{IsoTPChannel, IsoTPSettings},
-    helpers, BaseServerPayload, BaseServerSettings, DiagError, DiagServerResult, DiagnosticServer,
+    helpers,
+    response_cache::{CacheLookup, CachePolicy, ResponseCache},
+    BaseServerPayload, BaseServerSettings, DiagError, DiagServerResult, DiagnosticServer,
     ServerEvent, ServerEventHandler,
 };
 
@@ -393,6 +395,33 @@ pub struct Kwp2000DiagnosticServer {
     rx: mpsc::Receiver<DiagServerResult<Vec<u8>>>,
     repeat_count: u32,
     repeat_interval: std::time::Duration,
+    response_cache: ResponseCache,
+}
+
+/// Default [ResponseCache] policy of [Kwp2000DiagnosticServer].
+///
+/// Caches ECU identification (ReadECUIdentification). The cache is cleared by session changes,
+/// ECU resets, writes to identifiers and downloads
+pub const KWP2000_CACHE_POLICY: CachePolicy = CachePolicy {
+    cacheable: kwp_cacheable,
+    invalidates: kwp_invalidates,
+};
+
+fn kwp_cacheable(req: &[u8]) -> bool {
+    req.first().copied().map(KWP2000Command::from) == Some(KWP2000Command::ReadECUIdentification)
+}
+
+fn kwp_invalidates(req: &[u8]) -> bool {
+    matches!(
+        req.first().copied().map(KWP2000Command::from),
+        Some(
+            KWP2000Command::StartDiagnosticSession
+                | KWP2000Command::ECUReset
+                | KWP2000Command::WriteDataByIdentifier
+                | KWP2000Command::WriteDataByLocalIdentifier
+                | KWP2000Command::RequestDownload
+        )
+    )
 }
 
 impl Kwp2000DiagnosticServer {
@@ -439,7 +468,22 @@ impl Kwp2000DiagnosticServer {
                     break;
                 }
 
-                if let Ok(mut cmd) = rx_cmd.try_recv() {
+                // Sleep until either a command arrives, or tester present is due
+                let deadline = helpers::tester_present_deadline(
+                    send_tester_present,
+                    last_tester_present_time,
+                    settings.tester_present_interval_ms,
+                );
+                let next_cmd = match helpers::wait_for_cmd(&rx_cmd, deadline) {
+                    Ok(c) => c,
+                    Err(_) => {
+                        // Client side of the server has been dropped
+                        log::debug!("server exit");
+                        break;
+                    }
+                };
+
+                if let Some(mut cmd) = next_cmd {
                     event_handler.on_event(ServerEvent::Request(cmd.to_bytes()));
                     // We have an incoming command
                     log::debug!("Sending {:02X?} to ECU", cmd.to_bytes());
@@ -582,8 +626,6 @@ impl Kwp2000DiagnosticServer {
                     }
                     last_tester_present_time = Instant::now();
                 }
-
-                std::thread::sleep(std::time::Duration::from_millis(10));
             }
             // Goodbye server
             event_handler.on_event(ServerEvent::ServerExit);
@@ -600,6 +642,7 @@ impl Kwp2000DiagnosticServer {
             settings,
             repeat_count: 3,
             repeat_interval: std::time::Duration::from_millis(1000),
+            response_cache: ResponseCache::new(KWP2000_CACHE_POLICY),
         })
     }
 
@@ -608,12 +651,32 @@ impl Kwp2000DiagnosticServer {
         self.settings
     }
 
+    /// Returns the server's cache of ECU identification responses
+    pub fn response_cache(&self) -> &ResponseCache {
+        &self.response_cache
+    }
+
+    /// Returns the server's cache of ECU identification responses, for enabling or clearing it.
+    /// The cache is disabled by default
+    pub fn response_cache_mut(&mut self) -> &mut ResponseCache {
+        &mut self.response_cache
+    }
+
     /// Internal command for sending KWP2000 payload to the ECU
     fn exec_command(&mut self, cmd: Kwp2000Cmd) -> DiagServerResult<Vec<u8>> {
-        match self.tx.send(cmd) {
+        let key = match self.response_cache.lookup(&cmd) {
+            CacheLookup::Hit(resp) => return Ok(resp),
+            CacheLookup::Miss(key) => Some(key),
+            CacheLookup::Uncached => None,
+        };
+        let res = match self.tx.send(cmd) {
             Ok(_) => self.rx.recv().unwrap_or(Err(DiagError::ServerNotRunning)),
             Err(_) => Err(DiagError::ServerNotRunning), // Server must have crashed!
+        };
+        if let (Some(key), Ok(resp)) = (key, &res) {
+            self.response_cache.insert(key, resp);
         }
+        res
     }
 }
 
@@ -66,8 +66,11 @@ pub mod channel;
 pub mod dtc;
 pub mod dynamic_diag;
 pub mod hardware;
+pub mod keep_alive;
 pub mod kwp2000;
+pub mod metrics;
 pub mod obd2;
+pub mod response_cache;
 pub mod uds;
 
 mod helpers;
@@ -107,6 +110,9 @@ pub enum DiagError {
     HardwareError(HardwareError),
     /// ECU Param ID did not match the request, but the Service ID was correct
     MismatchedResponse(String),
+    /// A request carrying many parameters at once failed. The error of the request itself
+    /// is returned for its first parameter, and this for the others
+    BatchedRequestFailed,
 }
 
 impl std::fmt::Display for DiagError {
@@ -133,6 +139,9 @@ impl std::fmt::Display for DiagError {
             }
             DiagError::HardwareError(e) => write!(f, "Hardware error: {}", e),
             DiagError::MismatchedResponse(e) => write!(f, "Param mismatched response: {}", e),
+            DiagError::BatchedRequestFailed => {
+                write!(f, "request carrying this parameter failed")
+            }
         }
     }
 }
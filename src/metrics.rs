@@ -0,0 +1,117 @@
+//! Lightweight timing and retry counters for diagnostic servers
+//!
+//! Every counter is a relaxed atomic which is only ever added to by the server's
+//! background thread, so leaving metrics enabled costs next to nothing. Use
+//! [ServerMetrics::snapshot] to read a consistent-enough copy of all counters at once.
+
+use std::{
+    sync::atomic::{AtomicU64, Ordering},
+    time::Duration,
+};
+
+/// Counters updated by a diagnostic server as it processes requests
+#[derive(Debug, Default)]
+pub struct ServerMetrics {
+    requests: AtomicU64,
+    queue_wait_us: AtomicU64,
+    write_time_us: AtomicU64,
+    first_response_us: AtomicU64,
+    max_first_response_us: AtomicU64,
+    responses: AtomicU64,
+    response_pending: AtomicU64,
+    busy_repeat: AtomicU64,
+    timeouts: AtomicU64,
+}
+
+/// Copy of [ServerMetrics] at a point in time.
+///
+/// All times are totals over every request since the server started (or
+/// since the last [ServerMetrics::reset]), divide by the matching count to get averages.
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+#[repr(C)]
+pub struct ServerMetricsSnapshot {
+    /// Number of requests executed by the server
+    pub requests: u64,
+    /// Total time in microseconds requests spent queued, before the server started executing them
+    pub queue_wait_us: u64,
+    /// Total time in microseconds spent writing requests to the channel
+    pub write_time_us: u64,
+    /// Total time in microseconds between a request being written, and the ECU's first
+    /// response to it (Including response pending replies)
+    pub first_response_us: u64,
+    /// Longest time in microseconds the ECU took to give its first response to a request
+    pub max_first_response_us: u64,
+    /// Number of requests that received a first response. This is the count for `first_response_us`
+    pub responses: u64,
+    /// Number of response pending (0x78) replies received
+    pub response_pending: u64,
+    /// Number of busy repeat request (0x21) replies received, each of which caused the request to be sent again
+    pub busy_repeat: u64,
+    /// Number of requests the ECU did not respond to in time
+    pub timeouts: u64,
+}
+
+#[inline]
+fn as_us(d: Duration) -> u64 {
+    d.as_micros() as u64
+}
+
+impl ServerMetrics {
+    /// Returns a copy of all counters
+    pub fn snapshot(&self) -> ServerMetricsSnapshot {
+        ServerMetricsSnapshot {
+            requests: self.requests.load(Ordering::Relaxed),
+            queue_wait_us: self.queue_wait_us.load(Ordering::Relaxed),
+            write_time_us: self.write_time_us.load(Ordering::Relaxed),
+            first_response_us: self.first_response_us.load(Ordering::Relaxed),
+            max_first_response_us: self.max_first_response_us.load(Ordering::Relaxed),
+            responses: self.responses.load(Ordering::Relaxed),
+            response_pending: self.response_pending.load(Ordering::Relaxed),
+            busy_repeat: self.busy_repeat.load(Ordering::Relaxed),
+            timeouts: self.timeouts.load(Ordering::Relaxed),
+        }
+    }
+
+    /// Resets all counters back to 0
+    pub fn reset(&self) {
+        self.requests.store(0, Ordering::Relaxed);
+        self.queue_wait_us.store(0, Ordering::Relaxed);
+        self.write_time_us.store(0, Ordering::Relaxed);
+        self.first_response_us.store(0, Ordering::Relaxed);
+        self.max_first_response_us.store(0, Ordering::Relaxed);
+        self.responses.store(0, Ordering::Relaxed);
+        self.response_pending.store(0, Ordering::Relaxed);
+        self.busy_repeat.store(0, Ordering::Relaxed);
+        self.timeouts.store(0, Ordering::Relaxed);
+    }
+
+    pub(crate) fn record_request(&self, queue_wait: Duration) {
+        self.requests.fetch_add(1, Ordering::Relaxed);
+        self.queue_wait_us
+            .fetch_add(as_us(queue_wait), Ordering::Relaxed);
+    }
+
+    pub(crate) fn record_write(&self, write_time: Duration) {
+        self.write_time_us
+            .fetch_add(as_us(write_time), Ordering::Relaxed);
+    }
+
+    pub(crate) fn record_first_response(&self, response_time: Duration) {
+        let us = as_us(response_time);
+        self.responses.fetch_add(1, Ordering::Relaxed);
+        self.first_response_us.fetch_add(us, Ordering::Relaxed);
+        self.max_first_response_us.fetch_max(us, Ordering::Relaxed);
+    }
+
+    pub(crate) fn record_response_pending(&self) {
+        self.response_pending.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub(crate) fn record_busy_repeat(&self) {
+        self.busy_repeat.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub(crate) fn record_timeout(&self) {
+        self.timeouts.fetch_add(1, Ordering::Relaxed);
+    }
+}
@@ -343,54 +343,483 @@ impl From<DataPid> for u8 {
     }
 }
 
+/// Where the data of a PID comes from
+pub(crate) enum PidSource<'a> {
+    /// Request the PID from the ECU. If a freeze frame is given, Service 02 is used,
+    /// otherwise Service 01
+    Ecu(&'a mut OBD2DiagnosticServer, Option<u16>),
+    /// Data of the PID, already taken from a multi PID response
+    Data(&'a [u8]),
+}
+
+/// Number of data bytes the ECU responds with to each Service 01 PID (SAE J1979),
+/// or 0 where it is not known
+const PID_DATA_LEN: [u8; 0x68] = [
+    4, 4, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1, // 0x00
+    2, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, // 0x10
+    4, 2, 2, 2, 4, 4, 4, 4, 4, 4, 4, 4, 1, 1, 1, 1, // 0x20
+    1, 2, 2, 1, 4, 4, 4, 4, 4, 4, 4, 4, 2, 2, 2, 2, // 0x30
+    4, 4, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 4, // 0x40
+    4, 1, 1, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2, 1, // 0x50
+    4, 1, 1, 2, 5, 2, 5, 3, // 0x60
+];
+
+/// Maximum number of values a single PID decodes to with [DataPid::decode_scaled]
+pub const SCALED_PID_MAX_VALUES: usize = 4;
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+/// Unit of a value decoded with [DataPid::decode_scaled]
+pub enum PidUnit {
+    /// Raw number
+    Raw,
+    /// Speed in km/h
+    Speed,
+    /// Percentage
+    Percent,
+    /// Temperature in celsius
+    Temperature,
+    /// RPM
+    Rpm,
+    /// Volts
+    Volts,
+    /// Time in seconds
+    Time,
+    /// Distance in kilometers
+    Distance,
+    /// Pressure in kPa
+    Pressure,
+}
+
+impl PidUnit {
+    /// Converts a value in this unit to its [ObdUnitType]
+    pub fn to_unit_type(self, value: f32) -> ObdUnitType {
+        match self {
+            PidUnit::Raw => ObdUnitType::Raw(value),
+            PidUnit::Speed => ObdUnitType::Speed(Speed::from_kmh(value)),
+            PidUnit::Percent => ObdUnitType::Percent(value),
+            PidUnit::Temperature => ObdUnitType::Temperature(Temperature::from_celsius(value)),
+            PidUnit::Rpm => ObdUnitType::Rpm(value as u32),
+            PidUnit::Volts => ObdUnitType::Volts(value),
+            PidUnit::Time => ObdUnitType::Time(Time::from_seconds(value)),
+            PidUnit::Distance => ObdUnitType::Distance(Distance::from_kilometers(value)),
+            PidUnit::Pressure => ObdUnitType::Pressure(Pressure::from_kilo_pascal(value)),
+        }
+    }
+}
+
+/// Formula for one value of a PID. The value is `raw * mul / div + bias`, where
+/// raw is the big endian number formed from `width` bytes starting at `offset`
+#[derive(Debug, Copy, Clone)]
+struct PidChannel {
+    offset: u8,
+    width: u8,
+    mul: f32,
+    div: f32,
+    bias: f32,
+    unit: PidUnit,
+    name: &'static str,
+}
+
+const fn ch(
+    offset: u8,
+    width: u8,
+    mul: f32,
+    div: f32,
+    bias: f32,
+    unit: PidUnit,
+    name: &'static str,
+) -> PidChannel {
+    PidChannel {
+        offset,
+        width,
+        mul,
+        div,
+        bias,
+        unit,
+        name,
+    }
+}
+
+/// Decode formulas of every Service 01 PID that is a plain scaled number, indexed by PID.
+/// PIDs which decode to enumerations or bit fields are empty, and are decoded by [DataPid::get_value]
+#[rustfmt::skip]
+const PID_CHANNELS: [&[PidChannel]; 0x68] = [
+    &[], // 0x00
+    &[], // 0x01
+    &[], // 0x02
+    &[], // 0x03
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Calculated engine load")], // 0x04
+    &[ch(0, 1, 1.0, 1.0, -40.0, PidUnit::Temperature, "Engine coolant temperature")], // 0x05
+    &[ch(0, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Short term fuel trim - Bank 1")], // 0x06
+    &[ch(0, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Long term fuel trim - Bank 1")], // 0x07
+    &[ch(0, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Short term fuel trim - Bank 2")], // 0x08
+    &[ch(0, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Long term fuel trim - Bank 2")], // 0x09
+    &[ch(0, 1, 3.0, 1.0, 0.0, PidUnit::Pressure, "Fuel pressure (gauge pressure)")], // 0x0A
+    &[ch(0, 1, 1.0, 1.0, 0.0, PidUnit::Pressure, "Intake manifold absolute pressure")], // 0x0B
+    &[ch(0, 2, 1.0, 1.0, 0.0, PidUnit::Rpm, "Engine speed")], // 0x0C
+    &[ch(0, 1, 1.0, 1.0, 0.0, PidUnit::Speed, "Vehicle speed")], // 0x0D
+    &[ch(0, 1, 1.0, 1.0, -64.0, PidUnit::Raw, "Timing advance before TDC (degrees)")], // 0x0E
+    &[ch(0, 1, 1.0, 1.0, -40.0, PidUnit::Temperature, "Intake air temperature")], // 0x0F
+    &[ch(0, 2, 1.0, 100.0, 0.0, PidUnit::Raw, "Mass air flow sensor rate (Grames/sec)")], // 0x10
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Throttle position")], // 0x11
+    &[], // 0x12
+    &[], // 0x13
+    // 0x14
+    &[
+        ch(0, 1, 1.0, 200.0, 0.0, PidUnit::Volts, "Oxygen sensor 1 voltage"),
+        ch(1, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Oxygen sensor 1 short term fuel trim"),
+    ],
+    // 0x15
+    &[
+        ch(0, 1, 1.0, 200.0, 0.0, PidUnit::Volts, "Oxygen sensor 2 voltage"),
+        ch(1, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Oxygen sensor 2 short term fuel trim"),
+    ],
+    // 0x16
+    &[
+        ch(0, 1, 1.0, 200.0, 0.0, PidUnit::Volts, "Oxygen sensor 3 voltage"),
+        ch(1, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Oxygen sensor 3 short term fuel trim"),
+    ],
+    // 0x17
+    &[
+        ch(0, 1, 1.0, 200.0, 0.0, PidUnit::Volts, "Oxygen sensor 4 voltage"),
+        ch(1, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Oxygen sensor 4 short term fuel trim"),
+    ],
+    // 0x18
+    &[
+        ch(0, 1, 1.0, 200.0, 0.0, PidUnit::Volts, "Oxygen sensor 5 voltage"),
+        ch(1, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Oxygen sensor 5 short term fuel trim"),
+    ],
+    // 0x19
+    &[
+        ch(0, 1, 1.0, 200.0, 0.0, PidUnit::Volts, "Oxygen sensor 6 voltage"),
+        ch(1, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Oxygen sensor 6 short term fuel trim"),
+    ],
+    // 0x1A
+    &[
+        ch(0, 1, 1.0, 200.0, 0.0, PidUnit::Volts, "Oxygen sensor 7 voltage"),
+        ch(1, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Oxygen sensor 7 short term fuel trim"),
+    ],
+    // 0x1B
+    &[
+        ch(0, 1, 1.0, 200.0, 0.0, PidUnit::Volts, "Oxygen sensor 8 voltage"),
+        ch(1, 1, 1.0, 1.28, -100.0, PidUnit::Percent, "Oxygen sensor 8 short term fuel trim"),
+    ],
+    &[], // 0x1C
+    &[], // 0x1D
+    &[], // 0x1E
+    &[ch(0, 2, 1.0, 1.0, 0.0, PidUnit::Time, "Runtime since engine start")], // 0x1F
+    &[], // 0x20
+    &[ch(0, 2, 1.0, 1.0, 0.0, PidUnit::Distance, "Distance travelled with MIL on")], // 0x21
+    &[ch(0, 2, 0.079, 1.0, 0.0, PidUnit::Pressure, "Fuel rail pressure (Relative to manifold vacuum)")], // 0x22
+    &[ch(0, 2, 10.0, 1.0, 0.0, PidUnit::Pressure, "Fuel rail gauge pressure")], // 0x23
+    // 0x24
+    &[
+        ch(0, 2, 0.000030517578125, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 1 Lambda"),
+        ch(2, 2, 0.0001220703125, 1.0, 0.0, PidUnit::Volts, "Oxygen sensor 1 voltage"),
+    ],
+    // 0x25
+    &[
+        ch(0, 2, 0.000030517578125, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 2 Lambda"),
+        ch(2, 2, 0.0001220703125, 1.0, 0.0, PidUnit::Volts, "Oxygen sensor 2 voltage"),
+    ],
+    // 0x26
+    &[
+        ch(0, 2, 0.000030517578125, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 3 Lambda"),
+        ch(2, 2, 0.0001220703125, 1.0, 0.0, PidUnit::Volts, "Oxygen sensor 3 voltage"),
+    ],
+    // 0x27
+    &[
+        ch(0, 2, 0.000030517578125, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 4 Lambda"),
+        ch(2, 2, 0.0001220703125, 1.0, 0.0, PidUnit::Volts, "Oxygen sensor 4 voltage"),
+    ],
+    // 0x28
+    &[
+        ch(0, 2, 0.000030517578125, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 5 Lambda"),
+        ch(2, 2, 0.0001220703125, 1.0, 0.0, PidUnit::Volts, "Oxygen sensor 5 voltage"),
+    ],
+    // 0x29
+    &[
+        ch(0, 2, 0.000030517578125, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 6 Lambda"),
+        ch(2, 2, 0.0001220703125, 1.0, 0.0, PidUnit::Volts, "Oxygen sensor 6 voltage"),
+    ],
+    // 0x2A
+    &[
+        ch(0, 2, 0.000030517578125, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 7 Lambda"),
+        ch(2, 2, 0.0001220703125, 1.0, 0.0, PidUnit::Volts, "Oxygen sensor 7 voltage"),
+    ],
+    // 0x2B
+    &[
+        ch(0, 2, 0.000030517578125, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 8 Lambda"),
+        ch(2, 2, 0.0001220703125, 1.0, 0.0, PidUnit::Volts, "Oxygen sensor 8 voltage"),
+    ],
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Commanded EGR")], // 0x2C
+    &[ch(0, 1, 100.0 / 128.0, 1.0, -100.0, PidUnit::Percent, "EGR Error")], // 0x2D
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Commanded evaporative purge")], // 0x2E
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Fuel tank level input")], // 0x2F
+    &[ch(0, 1, 1.0, 1.0, 0.0, PidUnit::Raw, "Warm-ups since codes cleared")], // 0x30
+    &[ch(0, 2, 1.0, 1.0, 0.0, PidUnit::Distance, "Distance traveled since codes cleared")], // 0x31
+    &[ch(0, 2, 1.0, 4000.0, 0.0, PidUnit::Pressure, "Evaporative System Vapor Pressure")], // 0x32
+    &[ch(0, 1, 1.0, 1.0, 0.0, PidUnit::Pressure, "Absolute Barometric Pressure")], // 0x33
+    // 0x34
+    &[
+        ch(0, 2, 2.0 / 65536.0, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 1 Lambda"),
+        ch(2, 2, 1.0, 256.0, -128.0, PidUnit::Raw, "Oxygen sensor 1 Current"),
+    ],
+    // 0x35
+    &[
+        ch(0, 2, 2.0 / 65536.0, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 2 Lambda"),
+        ch(2, 2, 1.0, 256.0, -128.0, PidUnit::Raw, "Oxygen sensor 2 Current"),
+    ],
+    // 0x36
+    &[
+        ch(0, 2, 2.0 / 65536.0, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 3 Lambda"),
+        ch(2, 2, 1.0, 256.0, -128.0, PidUnit::Raw, "Oxygen sensor 3 Current"),
+    ],
+    // 0x37
+    &[
+        ch(0, 2, 2.0 / 65536.0, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 4 Lambda"),
+        ch(2, 2, 1.0, 256.0, -128.0, PidUnit::Raw, "Oxygen sensor 4 Current"),
+    ],
+    // 0x38
+    &[
+        ch(0, 2, 2.0 / 65536.0, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 5 Lambda"),
+        ch(2, 2, 1.0, 256.0, -128.0, PidUnit::Raw, "Oxygen sensor 5 Current"),
+    ],
+    // 0x39
+    &[
+        ch(0, 2, 2.0 / 65536.0, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 6 Lambda"),
+        ch(2, 2, 1.0, 256.0, -128.0, PidUnit::Raw, "Oxygen sensor 6 Current"),
+    ],
+    // 0x3A
+    &[
+        ch(0, 2, 2.0 / 65536.0, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 7 Lambda"),
+        ch(2, 2, 1.0, 256.0, -128.0, PidUnit::Raw, "Oxygen sensor 7 Current"),
+    ],
+    // 0x3B
+    &[
+        ch(0, 2, 2.0 / 65536.0, 1.0, 0.0, PidUnit::Raw, "Oxygen sensor 8 Lambda"),
+        ch(2, 2, 1.0, 256.0, -128.0, PidUnit::Raw, "Oxygen sensor 8 Current"),
+    ],
+    &[ch(0, 2, 1.0, 10.0, -40.0, PidUnit::Temperature, "Catalyst Temperature bank 1, sensor 1")], // 0x3C
+    &[ch(0, 2, 1.0, 10.0, -40.0, PidUnit::Temperature, "Catalyst Temperature bank 2, sensor 1")], // 0x3D
+    &[ch(0, 2, 1.0, 10.0, -40.0, PidUnit::Temperature, "Catalyst Temperature bank 1, sensor 2")], // 0x3E
+    &[ch(0, 2, 1.0, 10.0, -40.0, PidUnit::Temperature, "Catalyst Temperature bank 2, sensor 2")], // 0x3F
+    &[], // 0x40
+    &[], // 0x41
+    &[ch(0, 2, 1.0, 1000.0, 0.0, PidUnit::Volts, "Control module voltage")], // 0x42
+    &[ch(0, 2, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Absolute load value")], // 0x43
+    &[ch(0, 2, 2.0 / 65536.0, 1.0, 0.0, PidUnit::Raw, "Commanded Lambda")], // 0x44
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Relative throttle position")], // 0x45
+    &[ch(0, 1, 1.0, 1.0, -40.0, PidUnit::Temperature, "Ambient air temperature")], // 0x46
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Absolute throttle position B")], // 0x47
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Absolute throttle position C")], // 0x48
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Absolute throttle position D")], // 0x49
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Absolute throttle position E")], // 0x4A
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Absolute throttle position F")], // 0x4B
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Commanded throttle actuator")], // 0x4C
+    &[ch(0, 2, 60.0, 1.0, 0.0, PidUnit::Time, "Time run with MIL on")], // 0x4D
+    &[ch(0, 2, 60.0, 1.0, 0.0, PidUnit::Time, "Time since trouble codes cleared")], // 0x4E
+    // 0x4F
+    &[
+        ch(0, 1, 1.0, 1.0, 0.0, PidUnit::Raw, "Maximum value for Lambda"),
+        ch(1, 1, 1.0, 1.0, 0.0, PidUnit::Volts, "Maximum value for oxygen sensor voltage"),
+        ch(2, 1, 1.0, 1.0, 0.0, PidUnit::Raw, "Maximum value oxygen sensor current"),
+        ch(3, 1, 10.0, 1.0, 0.0, PidUnit::Pressure, "Maximum value for intake manifold absolute pressure"),
+    ],
+    &[ch(0, 1, 10.0, 1.0, 0.0, PidUnit::Raw, "Maximum value for air flow rate from mass air flow sensor")], // 0x50
+    &[], // 0x51
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Ethanol fuel")], // 0x52
+    &[ch(0, 2, 1.0, 200.0, 0.0, PidUnit::Pressure, "Absolute evaporative system vapor pressure")], // 0x53
+    &[ch(0, 2, 1.0, 1000.0, 0.0, PidUnit::Pressure, "Evaporative system vapor pressure")], // 0x54
+    // 0x55
+    &[
+        ch(0, 1, 100.0 / 128.0, 1.0, -100.0, PidUnit::Percent, "Short term secondary oxygen sensor trim bank 1"),
+        ch(1, 1, 100.0 / 128.0, 1.0, -100.0, PidUnit::Percent, "Short term secondary oxygen sensor trim bank 3"),
+    ],
+    // 0x56
+    &[
+        ch(0, 1, 100.0 / 128.0, 1.0, -100.0, PidUnit::Percent, "Long term secondary oxygen sensor trim bank 1"),
+        ch(1, 1, 100.0 / 128.0, 1.0, -100.0, PidUnit::Percent, "Long term secondary oxygen sensor trim bank 3"),
+    ],
+    // 0x57
+    &[
+        ch(0, 1, 100.0 / 128.0, 1.0, -100.0, PidUnit::Percent, "Short term secondary oxygen sensor trim bank 2"),
+        ch(1, 1, 100.0 / 128.0, 1.0, -100.0, PidUnit::Percent, "Short term secondary oxygen sensor trim bank 4"),
+    ],
+    // 0x58
+    &[
+        ch(0, 1, 100.0 / 128.0, 1.0, -100.0, PidUnit::Percent, "Long term secondary oxygen sensor trim bank 2"),
+        ch(1, 1, 100.0 / 128.0, 1.0, -100.0, PidUnit::Percent, "Long term secondary oxygen sensor trim bank 4"),
+    ],
+    &[ch(0, 2, 10.0, 1.0, 0.0, PidUnit::Pressure, "Fuel rail absolute pressure")], // 0x59
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Relative accelerator pedal position")], // 0x5A
+    &[ch(0, 1, 100.0 / 255.0, 1.0, 0.0, PidUnit::Percent, "Hybrid battery pack remaining life")], // 0x5B
+    &[], // 0x5C
+    &[], // 0x5D
+    &[], // 0x5E
+    &[], // 0x5F
+    &[], // 0x60
+    &[], // 0x61
+    &[], // 0x62
+    &[], // 0x63
+    &[], // 0x64
+    &[], // 0x65
+    &[], // 0x66
+    &[], // 0x67
+];
+
+/// Values of a PID decoded with [DataPid::decode_scaled].
+///
+/// This only holds the numbers, the names and units of the values come from a static table,
+/// so decoding does not allocate
+#[derive(Debug, Copy, Clone, PartialEq)]
+pub struct ScaledPidValues {
+    pid: DataPid,
+    len: u8,
+    values: [f32; SCALED_PID_MAX_VALUES],
+}
+
+impl ScaledPidValues {
+    /// Returns the PID the values belong to
+    pub fn get_pid(&self) -> DataPid {
+        self.pid
+    }
+
+    /// Returns the decoded values, in the units given by [ScaledPidValues::get_unit]
+    pub fn get_values(&self) -> &[f32] {
+        &self.values[..self.len as usize]
+    }
+
+    /// Returns the name of the value at `idx`
+    pub fn get_name(&self, idx: usize) -> Option<&'static str> {
+        self.pid.get_scaled_name(idx)
+    }
+
+    /// Returns the unit of the value at `idx`
+    pub fn get_unit(&self, idx: usize) -> Option<PidUnit> {
+        self.pid.get_scaled_unit(idx)
+    }
+
+    /// Converts the values to [ObdValue]s, for displaying them
+    pub fn to_obd_values(&self) -> Vec<ObdValue> {
+        self.pid
+            .channels()
+            .iter()
+            .zip(self.get_values())
+            .map(|(c, v)| ObdValue::new(c.name, c.unit.to_unit_type(*v)))
+            .collect()
+    }
+}
+
 impl DataPid {
-    fn request_ecu(
-        &self,
-        server: &mut OBD2DiagnosticServer,
-        ff: Option<u16>,
-        min_length: usize,
-    ) -> DiagServerResult<Vec<u8>> {
-        let req = match ff {
-            None => vec![0x01, u8::from(*self)],
-            Some(ff_id) => vec![0x02, u8::from(*self), (ff_id >> 8) as u8, ff_id as u8],
+    fn channels(&self) -> &'static [PidChannel] {
+        PID_CHANNELS
+            .get(u8::from(*self) as usize)
+            .copied()
+            .unwrap_or(&[])
+    }
+
+    /// Returns true if the PID is a scaled number, which can be decoded with [DataPid::decode_scaled]
+    pub fn is_scaled(&self) -> bool {
+        !self.channels().is_empty()
+    }
+
+    /// Returns the name of value `idx` of the PID when decoded with [DataPid::decode_scaled]
+    pub fn get_scaled_name(&self, idx: usize) -> Option<&'static str> {
+        self.channels().get(idx).map(|c| c.name)
+    }
+
+    /// Returns the unit of value `idx` of the PID when decoded with [DataPid::decode_scaled]
+    pub fn get_scaled_unit(&self, idx: usize) -> Option<PidUnit> {
+        self.channels().get(idx).map(|c| c.unit)
+    }
+
+    /// Decodes the PID's data (Not including the service ID and PID) without allocating.
+    ///
+    /// Only PIDs which are scaled numbers can be decoded this way, other PIDs return
+    /// [DiagError::ParameterInvalid] and must be read with [crate::obd2::Service01::query_pid]
+    pub fn decode_scaled(&self, data: &[u8]) -> DiagServerResult<ScaledPidValues> {
+        let channels = self.channels();
+        if channels.is_empty() {
+            return Err(DiagError::ParameterInvalid);
+        }
+        let mut res = ScaledPidValues {
+            pid: *self,
+            len: channels.len() as u8,
+            values: [0.0; SCALED_PID_MAX_VALUES],
+        };
+        for (c, v) in channels.iter().zip(res.values.iter_mut()) {
+            let bytes = data
+                .get(c.offset as usize..(c.offset + c.width) as usize)
+                .ok_or(DiagError::InvalidResponseLength)?;
+            let raw = bytes.iter().fold(0u32, |acc, b| acc << 8 | *b as u32);
+            *v = raw as f32 * c.mul / c.div + c.bias;
+        }
+        Ok(res)
+    }
+}
+
+impl DataPid {
+    /// Returns the number of data bytes the ECU responds to this PID with, if known.
+    /// This is needed to split up the response to a request for multiple PIDs
+    pub(crate) fn data_len(&self) -> Option<usize> {
+        match PID_DATA_LEN.get(u8::from(*self) as usize) {
+            Some(&0) | None => None,
+            Some(&len) => Some(len as usize),
+        }
+    }
+
+    fn request_ecu(&self, src: &mut PidSource<'_>, min_length: usize) -> DiagServerResult<Vec<u8>> {
+        let r = match src {
+            PidSource::Ecu(server, ff) => {
+                let req = match ff {
+                    None => vec![0x01, u8::from(*self)],
+                    Some(ff_id) => vec![0x02, u8::from(*self), (*ff_id >> 8) as u8, *ff_id as u8],
+                };
+                let mut r = server.send_byte_array_with_response(&req)?;
+                r.drain(0..2);
+                r
+            }
+            PidSource::Data(data) => data.to_vec(),
         };
-        let mut r = server.send_byte_array_with_response(&req)?;
-        r.drain(0..2);
         if r.len() < min_length {
             return Err(DiagError::InvalidResponseLength);
         }
         return Ok(r);
     }
 
-    /// For value = A*100/255
-    fn get_percentage_1_byte(&self, server: &mut OBD2DiagnosticServer, ff: Option<u16>, name: &str) -> DiagServerResult<Vec<ObdValue>> {
-        Ok(vec![
-            ObdValue::new(
-                name,
-                ObdUnitType::Percent(
-                    self.request_ecu(server, ff, 1)?[0] as f32 * (100.0/255.0)
-                )
-            )
-        ])
-    }
-
     /// Returns parsed value after request the ECU for the PID
     pub(crate) fn get_value(
         &self,
         server: &mut OBD2DiagnosticServer,
         ff: Option<u16>,
     ) -> DiagServerResult<Vec<ObdValue>> {
+        self.decode(&mut PidSource::Ecu(server, ff))
+    }
+
+    /// Returns parsed value of the PID's data (Not including the service ID and PID)
+    pub(crate) fn decode_data(&self, data: &[u8]) -> DiagServerResult<Vec<ObdValue>> {
+        self.decode(&mut PidSource::Data(data))
+    }
+
+    fn decode(&self, src: &mut PidSource<'_>) -> DiagServerResult<Vec<ObdValue>> {
+        let channels = self.channels();
+        if let Some(len) = channels.iter().map(|c| (c.offset + c.width) as usize).max() {
+            return Ok(self
+                .decode_scaled(&self.request_ecu(src, len)?)?
+                .to_obd_values());
+        }
         match self {
             DataPid::PidSupport0120 => Ok(vec![ObdValue::new(
                 "PID support 01-20",
-                ObdUnitType::ByteArray(self.request_ecu(server, ff, 4)?),
+                ObdUnitType::ByteArray(self.request_ecu(src, 4)?),
             )]),
             DataPid::StatusSinceDTCCleared => Err(DiagError::NotImplemented(
                 "Status since DTC Cleared unimplemented".into(),
             )),
             DataPid::FreezeDTC => Err(DiagError::NotImplemented("Freeze DTC unimplemented".into())),
             DataPid::FuelSystemStatus => Ok(self
-                .request_ecu(server, ff, 1)?
+                .request_ecu(src, 1)?
                 .iter()
                 .enumerate()
                 .map(|(idx, byte)| {
@@ -402,825 +831,52 @@ impl DataPid {
                     )
                 })
                 .collect()),
-            DataPid::CalculatedEngineLoad => self.get_percentage_1_byte(server, ff, "Calculated engine load"),
-            DataPid::EngineCoolantTemp => Ok(self
-                .request_ecu(server, ff, 1)?
-                .iter()
-                .map(|x| {
-                    ObdValue::new(
-                        "Engine coolant temperature",
-                        ObdUnitType::Temperature(Temperature::from_celsius(*x as f32 - 40.0)),
-                    )
-                })
-                .collect()),
-            DataPid::ShortTermFuelTrimBank1 => Ok(vec![ObdValue::new(
-                "Short term fuel trim - Bank 1",
-                ObdUnitType::Percent((self.request_ecu(server, ff, 1)?[0] as f32 / 1.28) - 100.0),
-            )]),
-            DataPid::LongTermFuelTrimBank1 => Ok(vec![ObdValue::new(
-                "Long term fuel trim - Bank 1",
-                ObdUnitType::Percent((self.request_ecu(server, ff, 1)?[0] as f32 / 1.28) - 100.0),
-            )]),
-            DataPid::ShortTermFuelTrimBank2 => Ok(vec![ObdValue::new(
-                "Short term fuel trim - Bank 2",
-                ObdUnitType::Percent((self.request_ecu(server, ff, 1)?[0] as f32 / 1.28) - 100.0),
-            )]),
-            DataPid::LongTermFuelTrimBank2 => Ok(vec![ObdValue::new(
-                "Long term fuel trim - Bank 2",
-                ObdUnitType::Percent((self.request_ecu(server, ff, 1)?[0] as f32 / 1.28) - 100.0),
-            )]),
-            DataPid::FuelPressureGauge => Ok(vec![ObdValue::new(
-                "Fuel pressure (gauge pressure)",
-                ObdUnitType::Pressure(Pressure::from_kilo_pascal(
-                    self.request_ecu(server, ff, 1)?[0] as f32 * 3.0,
-                )),
-            )]),
-            DataPid::IntakeManifoldAbsPressure => Ok(vec![ObdValue::new(
-                "Intake manifold absolute pressure",
-                ObdUnitType::Pressure(Pressure::from_kilo_pascal(
-                    self.request_ecu(server, ff, 1)?[0] as f32,
-                )),
-            )]),
-            DataPid::EngineSpeed => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![ObdValue::new(
-                    "Engine speed",
-                    ObdUnitType::Rpm(((r[0] as u32) << 8) | r[1] as u32),
-                )])
-            }
-            DataPid::VehicleSpeed => Ok(vec![ObdValue::new(
-                "Vehicle speed",
-                ObdUnitType::Speed(Speed::from_kmh(self.request_ecu(server, ff, 1)?[0] as f32)),
-            )]),
-            DataPid::TimingAdvance => Ok(vec![ObdValue::new(
-                "Timing advance before TDC (degrees)",
-                ObdUnitType::Raw(self.request_ecu(server, ff, 1)?[0] as f32 - 64.0),
-            )]),
-            DataPid::IntakeAirTemperature => Ok(vec![ObdValue::new(
-                "Intake air temperature",
-                ObdUnitType::Temperature(Temperature::from_celsius(
-                    self.request_ecu(server, ff, 1)?[0] as f32 - 40.0,
-                )),
-            )]),
-            DataPid::MassAirFlow => {
-                let s = self.request_ecu(server, ff, 2)?;
-                Ok(vec![ObdValue::new(
-                    "Mass air flow sensor rate (Grames/sec)",
-                    ObdUnitType::Raw(((s[0] as u32) << 8 | s[1] as u32) as f32 / 100.0),
-                )])
-            }
-            DataPid::ThrottlePosition => self.get_percentage_1_byte(server, ff, "Throttle position"),
             DataPid::CommandedSecondaryAirStatus => Ok(vec![ObdValue::new(
                 "Commanded secondary air status",
                 ObdUnitType::Encoded(ObdEnumValue::CommandedAirStatus(
-                    CommandedSecondaryAirStatus::from(self.request_ecu(server, ff, 1)?[0]),
+                    CommandedSecondaryAirStatus::from(self.request_ecu(src, 1)?[0]),
                 )),
             )]),
             DataPid::O2SensorsPresent2Banks => Ok(vec![ObdValue::new(
                 "Oxygen sensors present in 2 banks",
-                ObdUnitType::ByteArray(self.request_ecu(server, ff, 1)?),
+                ObdUnitType::ByteArray(self.request_ecu(src, 1)?),
             )]),
-            DataPid::OxygenSensor1 => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 1 voltage",
-                        ObdUnitType::Volts(r[0] as f32 / 200.0),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 1 short term fuel trim",
-                        ObdUnitType::Percent((r[1] as f32 / 1.28) - 100.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor2 => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 2 voltage",
-                        ObdUnitType::Volts(r[0] as f32 / 200.0),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 2 short term fuel trim",
-                        ObdUnitType::Percent((r[1] as f32 / 1.28) - 100.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor3 => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 3 voltage",
-                        ObdUnitType::Volts(r[0] as f32 / 200.0),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 3 short term fuel trim",
-                        ObdUnitType::Percent((r[1] as f32 / 1.28) - 100.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor4 => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 4 voltage",
-                        ObdUnitType::Volts(r[0] as f32 / 200.0),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 4 short term fuel trim",
-                        ObdUnitType::Percent((r[1] as f32 / 1.28) - 100.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor5 => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 5 voltage",
-                        ObdUnitType::Volts(r[0] as f32 / 200.0),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 5 short term fuel trim",
-                        ObdUnitType::Percent((r[1] as f32 / 1.28) - 100.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor6 => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 6 voltage",
-                        ObdUnitType::Volts(r[0] as f32 / 200.0),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 6 short term fuel trim",
-                        ObdUnitType::Percent((r[1] as f32 / 1.28) - 100.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor7 => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 7 voltage",
-                        ObdUnitType::Volts(r[0] as f32 / 200.0),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 7 short term fuel trim",
-                        ObdUnitType::Percent((r[1] as f32 / 1.28) - 100.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor8 => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 8 voltage",
-                        ObdUnitType::Volts(r[0] as f32 / 200.0),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 8 short term fuel trim",
-                        ObdUnitType::Percent((r[1] as f32 / 1.28) - 100.0),
-                    ),
-                ])
-            }
             DataPid::ObdStandard => Ok(vec![ObdValue::new(
                 "OBD Standard",
                 ObdUnitType::Encoded(ObdEnumValue::ObdStandard(OBDStandard::from(
-                    self.request_ecu(server, ff, 1)?[0],
+                    self.request_ecu(src, 1)?[0],
                 ))),
             )]),
             DataPid::O2SensorsPresent4Banks => Ok(vec![ObdValue::new(
                 "Oxygen sensors present in 4 banks",
-                ObdUnitType::ByteArray(self.request_ecu(server, ff, 1)?),
+                ObdUnitType::ByteArray(self.request_ecu(src, 1)?),
             )]),
 
             //DataPid::AuxInputStatus => {}
-            DataPid::RuntimeSinceStart => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![ObdValue::new(
-                    "Runtime since engine start",
-                    ObdUnitType::Time(Time::from_seconds(
-                        ((r[0] as u32) << 8 | r[1] as u32) as f32,
-                    )),
-                )])
-            }
             DataPid::PidSupport2140 => Ok(vec![ObdValue::new(
                 "PID support 21-40",
-                ObdUnitType::ByteArray(self.request_ecu(server, ff, 4)?),
+                ObdUnitType::ByteArray(self.request_ecu(src, 4)?),
             )]),
-            DataPid::MILRuntime => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![ObdValue::new(
-                    "Distance travelled with MIL on",
-                    ObdUnitType::Distance(Distance::from_kilometers(
-                        ((r[0] as u32) << 8 | r[1] as u32) as f32,
-                    )),
-                )])
-            }
-            DataPid::FuelRailPressure => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![ObdValue::new(
-                    "Fuel rail pressure (Relative to manifold vacuum)",
-                    ObdUnitType::Pressure(Pressure::from_kilo_pascal(
-                        ((r[0] as u32) << 8 | r[1] as u32) as f32 * 0.079,
-                    )),
-                )])
-            }
-            DataPid::FuelRailGaugePressure => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![ObdValue::new(
-                    "Fuel rail gauge pressure",
-                    ObdUnitType::Pressure(Pressure::from_kilo_pascal(
-                        ((r[0] as u32) << 8 | r[1] as u32) as f32 * 10.0,
-                    )),
-                )])
-            }
-            DataPid::OxygenSensor1LambdaVoltage => {
-                let r = self.request_ecu(server, ff, 4)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 1 Lambda",
-                        ObdUnitType::Raw(
-                            ((r[0] as u32) << 8 | r[1] as u32) as f32 * 0.000030517578125,
-                        ),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 1 voltage",
-                        ObdUnitType::Volts(
-                            ((r[2] as u32) << 8 | r[3] as u32) as f32 * 0.0001220703125,
-                        ),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor2LambdaVoltage => {
-                let r = self.request_ecu(server, ff, 4)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 2 Lambda",
-                        ObdUnitType::Raw(
-                            ((r[0] as u32) << 8 | r[1] as u32) as f32 * 0.000030517578125,
-                        ),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 2 voltage",
-                        ObdUnitType::Volts(
-                            ((r[2] as u32) << 8 | r[3] as u32) as f32 * 0.0001220703125,
-                        ),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor3LambdaVoltage => {
-                let r = self.request_ecu(server, ff, 4)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 3 Lambda",
-                        ObdUnitType::Raw(
-                            ((r[0] as u32) << 8 | r[1] as u32) as f32 * 0.000030517578125,
-                        ),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 3 voltage",
-                        ObdUnitType::Volts(
-                            ((r[2] as u32) << 8 | r[3] as u32) as f32 * 0.0001220703125,
-                        ),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor4LambdaVoltage => {
-                let r = self.request_ecu(server, ff, 4)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 4 Lambda",
-                        ObdUnitType::Raw(
-                            ((r[0] as u32) << 8 | r[1] as u32) as f32 * 0.000030517578125,
-                        ),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 4 voltage",
-                        ObdUnitType::Volts(
-                            ((r[2] as u32) << 8 | r[3] as u32) as f32 * 0.0001220703125,
-                        ),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor5LambdaVoltage => {
-                let r = self.request_ecu(server, ff, 4)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 5 Lambda",
-                        ObdUnitType::Raw(
-                            ((r[0] as u32) << 8 | r[1] as u32) as f32 * 0.000030517578125,
-                        ),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 5 voltage",
-                        ObdUnitType::Volts(
-                            ((r[2] as u32) << 8 | r[3] as u32) as f32 * 0.0001220703125,
-                        ),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor6LambdaVoltage => {
-                let r = self.request_ecu(server, ff, 4)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 6 Lambda",
-                        ObdUnitType::Raw(
-                            ((r[0] as u32) << 8 | r[1] as u32) as f32 * 0.000030517578125,
-                        ),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 6 voltage",
-                        ObdUnitType::Volts(
-                            ((r[2] as u32) << 8 | r[3] as u32) as f32 * 0.0001220703125,
-                        ),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor7LambdaVoltage => {
-                let r = self.request_ecu(server, ff, 4)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 7 Lambda",
-                        ObdUnitType::Raw(
-                            ((r[0] as u32) << 8 | r[1] as u32) as f32 * 0.000030517578125,
-                        ),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 7 voltage",
-                        ObdUnitType::Volts(
-                            ((r[2] as u32) << 8 | r[3] as u32) as f32 * 0.0001220703125,
-                        ),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor8LambdaVoltage => {
-                let r = self.request_ecu(server, ff, 4)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 8 Lambda",
-                        ObdUnitType::Raw(
-                            ((r[0] as u32) << 8 | r[1] as u32) as f32 * 0.000030517578125,
-                        ),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 8 voltage",
-                        ObdUnitType::Volts(
-                            ((r[2] as u32) << 8 | r[3] as u32) as f32 * 0.0001220703125,
-                        ),
-                    ),
-                ])
-            }
-            DataPid::CommandedEGR => self.get_percentage_1_byte(server, ff, "Commanded EGR"),
-            DataPid::EGRError => Ok(vec![
-                ObdValue::new(
-                    "EGR Error",
-                    ObdUnitType::Percent(
-                        self.request_ecu(server, ff, 1)?[0] as f32 * (100.0/128.0) - 100.0,
-                    ),
-                )
-            ]),
-            DataPid::CommandedEvapPurge => self.get_percentage_1_byte(server, ff, "Commanded evaporative purge"),
-            DataPid::FuelTankLevelInput => self.get_percentage_1_byte(server, ff, "Fuel tank level input"),
-            DataPid::WarmupsSinceCodesCleared => Ok(vec![
-                ObdValue::new(
-                    "Warm-ups since codes cleared",
-                    ObdUnitType::Raw(
-                        self.request_ecu(server, ff, 1)?[0] as f32,
-                    ),
-                )
-            ]),
-            DataPid::DistanceTraveledSinceCodesCleared => {
-                let r = self.request_ecu(server, ff, 2)?;
-                Ok(vec![
-                    ObdValue::new(
-                        "Distance traveled since codes cleared",
-                        ObdUnitType::Distance(
-                            Distance::from_kilometers(
-                                (((r[0] as u32) << 8) | r[1] as u32) as f32
-                            )
-                        ),
-                    )
-                ])
-            }
-            DataPid::EvapSystemVaporPressure => {
-                let r: Vec<i32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as i32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Evaporative System Vapor Pressure",
-                        ObdUnitType::Pressure(
-                            Pressure::from_kilo_pascal(
-                                (r[0] << 8 | r[1]) as f32 / 4000.0
-                            )
-                        ),
-                    )
-                ])
-            }
-            DataPid::AbsBarometricPressure => Ok(vec![
-                ObdValue::new(
-                    "Absolute Barometric Pressure",
-                    ObdUnitType::Pressure(
-                        Pressure::from_kilo_pascal(
-                            self.request_ecu(server, ff, 1)?[0] as f32
-                        )
-                    ),
-                )
-            ]),
-            DataPid::OxygenSensor1LambdaCurrent => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 4)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 1 Lambda",
-                        ObdUnitType::Raw((r[0] << 8 | r[1]) as f32 * (2.0/65536.0)),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 1 Current",
-                        ObdUnitType::Raw(((r[2] << 8 | r[3]) as f32 / 256.0) - 128.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor2LambdaCurrent => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 4)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 2 Lambda",
-                        ObdUnitType::Raw((r[0] << 8 | r[1]) as f32 * (2.0/65536.0)),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 2 Current",
-                        ObdUnitType::Raw(((r[2] << 8 | r[3]) as f32 / 256.0) - 128.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor3LambdaCurrent => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 4)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 3 Lambda",
-                        ObdUnitType::Raw((r[0] << 8 | r[1]) as f32 * (2.0/65536.0)),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 3 Current",
-                        ObdUnitType::Raw(((r[2] << 8 | r[3]) as f32 / 256.0) - 128.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor4LambdaCurrent => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 4)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 4 Lambda",
-                        ObdUnitType::Raw((r[0] << 8 | r[1]) as f32 * (2.0/65536.0)),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 4 Current",
-                        ObdUnitType::Raw(((r[2] << 8 | r[3]) as f32 / 256.0) - 128.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor5LambdaCurrent => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 4)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 5 Lambda",
-                        ObdUnitType::Raw((r[0] << 8 | r[1]) as f32 * (2.0/65536.0)),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 5 Current",
-                        ObdUnitType::Raw(((r[2] << 8 | r[3]) as f32 / 256.0) - 128.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor6LambdaCurrent => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 4)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 6 Lambda",
-                        ObdUnitType::Raw((r[0] << 8 | r[1]) as f32 * (2.0/65536.0)),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 6 Current",
-                        ObdUnitType::Raw(((r[2] << 8 | r[3]) as f32 / 256.0) - 128.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor7LambdaCurrent => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 4)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 7 Lambda",
-                        ObdUnitType::Raw((r[0] << 8 | r[1]) as f32 * (2.0/65536.0)),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 7 Current",
-                        ObdUnitType::Raw(((r[2] << 8 | r[3]) as f32 / 256.0) - 128.0),
-                    ),
-                ])
-            }
-            DataPid::OxygenSensor8LambdaCurrent => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 4)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Oxygen sensor 8 Lambda",
-                        ObdUnitType::Raw((r[0] << 8 | r[1]) as f32 * (2.0/65536.0)),
-                    ),
-                    ObdValue::new(
-                        "Oxygen sensor 8 Current",
-                        ObdUnitType::Raw(((r[2] << 8 | r[3]) as f32 / 256.0) - 128.0),
-                    ),
-                ])
-            }
-            DataPid::CatTempBank1Sensor1 => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Catalyst Temperature bank 1, sensor 1",
-                        ObdUnitType::Temperature(
-                            Temperature::from_celsius(
-                                ((r[0] << 8 | r[1]) as f32 / 10.0) - 40.0
-                            )
-                        ),
-                    )
-                ])
-            }
-            DataPid::CatTempBank2Sensor1 => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Catalyst Temperature bank 2, sensor 1",
-                        ObdUnitType::Temperature(
-                            Temperature::from_celsius(
-                                ((r[0] << 8 | r[1]) as f32 / 10.0) - 40.0
-                            )
-                        ),
-                    )
-                ])
-            }
-            DataPid::CatTempBank1Sensor2 => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Catalyst Temperature bank 1, sensor 2",
-                        ObdUnitType::Temperature(
-                            Temperature::from_celsius(
-                                ((r[0] << 8 | r[1]) as f32 / 10.0) - 40.0
-                            )
-                        ),
-                    )
-                ])
-            }
-            DataPid::CatTempBank2Sensor2 => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Catalyst Temperature bank 2, sensor 2",
-                        ObdUnitType::Temperature(
-                            Temperature::from_celsius(
-                                ((r[0] << 8 | r[1]) as f32 / 10.0) - 40.0
-                            )
-                        ),
-                    )
-                ])
-            }
             DataPid::PidSupport4160 => Ok(vec![ObdValue::new(
                 "PID support 41-60",
-                ObdUnitType::ByteArray(self.request_ecu(server, ff, 4)?),
+                ObdUnitType::ByteArray(self.request_ecu(src, 4)?),
             )]),
             DataPid::MonitorStatusDriveCycle => Ok(vec![ObdValue::new(
                 "Monitor status this drive cycle",
-                ObdUnitType::ByteArray(self.request_ecu(server, ff, 4)?),
+                ObdUnitType::ByteArray(self.request_ecu(src, 4)?),
             )]),
-            DataPid::ControlModuleVoltage => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Control module voltage",
-                        ObdUnitType::Volts((r[0] << 8 | r[1]) as f32 / 1000.0)
-                    )
-                ])
-            }
-            DataPid::AbsLoadValue => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Absolute load value",
-                        ObdUnitType::Percent(
-                            (r[0] << 8 | r[1]) as f32 * (100.0/255.0)
-                        )
-                    )
-                ])
-            }
-            DataPid::CommandedLambda => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Commanded Lambda",
-                        ObdUnitType::Raw(
-                            (r[0] << 8 | r[1]) as f32 * (2.0/65536.0)
-                        )
-                    )
-                ])
-            }
-            DataPid::RelativeThrottlePosition => self.get_percentage_1_byte(server, ff, "Relative throttle position"),
-            DataPid::AmbientAirTemp => Ok(vec![
-                ObdValue::new(
-                    "Ambient air temperature",
-                    ObdUnitType::Temperature(
-                        Temperature::from_celsius(
-                            self.request_ecu(server, ff, 1)?[0] as f32 - 40.0
-                        )
-                    )
-                )
-            ]),
-            DataPid::AbsoluteThrottlePositionB => self.get_percentage_1_byte(server, ff, "Absolute throttle position B"),
-            DataPid::AbsoluteThrottlePositionC => self.get_percentage_1_byte(server, ff, "Absolute throttle position C"),
-            DataPid::AbsoluteThrottlePositionD => self.get_percentage_1_byte(server, ff, "Absolute throttle position D"),
-            DataPid::AbsoluteThrottlePositionE => self.get_percentage_1_byte(server, ff, "Absolute throttle position E"),
-            DataPid::AbsoluteThrottlePositionF => self.get_percentage_1_byte(server, ff, "Absolute throttle position F"),
-            DataPid::CommandedThrottleActuator => self.get_percentage_1_byte(server, ff, "Commanded throttle actuator"),
-            DataPid::TimeRunSinceMILOn => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Time run with MIL on",
-                        ObdUnitType::Time(
-                            Time::from_seconds(
-                                (r[0] << 8 | r[1]) as f32 * 60.0
-                            )
-                        )
-                    )
-                ])
-            }
-            DataPid::TimeSinceCodesCleared => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Time since trouble codes cleared",
-                        ObdUnitType::Time(
-                            Time::from_seconds(
-                                (r[0] << 8 | r[1]) as f32 * 60.0
-                            )
-                        )
-                    )
-                ])
-            }
-            DataPid::MaximumLambdaVoltageCurrentPressure => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 4)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Maximum value for Lambda",
-                        ObdUnitType::Raw(r[0] as f32)
-                    ),
-                    ObdValue::new(
-                        "Maximum value for oxygen sensor voltage",
-                        ObdUnitType::Volts(r[1] as f32)
-                    ),
-                    ObdValue::new(
-                        "Maximum value oxygen sensor current",
-                        ObdUnitType::Raw(r[2] as f32)
-                    ),
-                    ObdValue::new(
-                        "Maximum value for intake manifold absolute pressure",
-                        ObdUnitType::Pressure(
-                            Pressure::from_kilo_pascal(
-                                r[3] as f32 * 10.0
-                            )
-                        )
-                    )
-                ])
-            }
-            DataPid::MaximumAirFlowRate => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 1)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Maximum value for air flow rate from mass air flow sensor",
-                        ObdUnitType::Raw(r[0] as f32 * 10.0)
-                    )
-                ])
-            }
             DataPid::FuelType => {
                 Ok(vec![
                     ObdValue::new(
                         "Fuel type",
                         ObdUnitType::Encoded(
                             ObdEnumValue::FuelType(
-                                FuelTypeCoding::from(self.request_ecu(server, ff, 1)?[0])
-                            )
-                        )
-                    )
-                ])
-            }
-            DataPid::EthanolFuelPercentage => self.get_percentage_1_byte(server, ff, "Ethanol fuel"),
-            DataPid::AbsoluteEvapSystemVaporPressure => {
-                let r: Vec<i32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as i32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Absolute evaporative system vapor pressure",
-                        ObdUnitType::Pressure(
-                            Pressure::from_kilo_pascal(
-                                (r[0] << 8 | r[1]) as f32 / 200.0
-                            )
-                        )
-                    )
-                ])
-            }
-            DataPid::EvapSystemVaporPressure2 => {
-                let r: Vec<i32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as i32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Evaporative system vapor pressure",
-                        ObdUnitType::Pressure(
-                            Pressure::from_kilo_pascal(
-                                (r[0] << 8 | r[1]) as f32 / 1000.0
-                            )
-                        )
-                    )
-                ])
-            }
-            DataPid::ShortTermSecondaryOxygenSensorTrimBank1and3 => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Short term secondary oxygen sensor trim bank 1",
-                        ObdUnitType::Percent(
-                            r[0] as f32 * (100.0/128.0) - 100.0
-                        )
-                    ),
-                    ObdValue::new(
-                        "Short term secondary oxygen sensor trim bank 3",
-                        ObdUnitType::Percent(
-                            r[1] as f32 * (100.0/128.0) - 100.0
-                        )
-                    )
-                ])
-            }
-            DataPid::LongTermSecondaryOxygenSensorTrimBank1and3 => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Long term secondary oxygen sensor trim bank 1",
-                        ObdUnitType::Percent(
-                            r[0] as f32 * (100.0/128.0) - 100.0
-                        )
-                    ),
-                    ObdValue::new(
-                        "Long term secondary oxygen sensor trim bank 3",
-                        ObdUnitType::Percent(
-                            r[1] as f32 * (100.0/128.0) - 100.0
-                        )
-                    )
-                ])
-            }
-            DataPid::ShortTermSecondaryOxygenSensorTrimBank2and4 => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Short term secondary oxygen sensor trim bank 2",
-                        ObdUnitType::Percent(
-                            r[0] as f32 * (100.0/128.0) - 100.0
-                        )
-                    ),
-                    ObdValue::new(
-                        "Short term secondary oxygen sensor trim bank 4",
-                        ObdUnitType::Percent(
-                            r[1] as f32 * (100.0/128.0) - 100.0
-                        )
-                    )
-                ])
-            }
-            DataPid::LongTermSecondaryOxygenSensorTrimBank2and4 => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Long term secondary oxygen sensor trim bank 2",
-                        ObdUnitType::Percent(
-                            r[0] as f32 * (100.0/128.0) - 100.0
-                        )
-                    ),
-                    ObdValue::new(
-                        "Long term secondary oxygen sensor trim bank 4",
-                        ObdUnitType::Percent(
-                            r[1] as f32 * (100.0/128.0) - 100.0
-                        )
-                    )
-                ])
-            }
-            DataPid::FuelRailAbsPressure => {
-                let r: Vec<u32> = self.request_ecu(server, ff, 2)?.iter().map(|x| *x as u32).collect();
-                Ok(vec![
-                    ObdValue::new(
-                        "Fuel rail absolute pressure",
-                        ObdUnitType::Pressure(
-                            Pressure::from_kilo_pascal(
-                                (r[0] << 8 | r[1]) as f32 * 10.0
+                                FuelTypeCoding::from(self.request_ecu(src, 1)?[0])
                             )
                         )
                     )
                 ])
             }
-            DataPid::RelativePedalPosition => self.get_percentage_1_byte(server, ff, "Relative accelerator pedal position"),
-            DataPid::HybridBatteryPackLife => self.get_percentage_1_byte(server, ff, "Hybrid battery pack remaining life"),
             /*
             DataPid::EngineOilTemp => {}
             DataPid::FuelInjectionTiming => {}
@@ -1228,11 +884,11 @@ impl DataPid {
             */
             DataPid::EmissionsStandard => Ok(vec![ObdValue::new(
                 "Emission requirments to which the vehicle is designed",
-                ObdUnitType::ByteArray(self.request_ecu(server, ff, 1)?),
+                ObdUnitType::ByteArray(self.request_ecu(src, 1)?),
             )]),
             DataPid::PidSupport6180 => Ok(vec![ObdValue::new(
                 "PID support 61-80",
-                ObdUnitType::ByteArray(self.request_ecu(server, ff, 4)?),
+                ObdUnitType::ByteArray(self.request_ecu(src, 4)?),
             )]),
             /*
             DataPid::DriverDemandTorquePercent => {}
@@ -1248,3 +904,43 @@ impl DataPid {
         }
     }
 }
+
+#[cfg(test)]
+mod data_pid_test {
+    use super::*;
+
+    #[test]
+    fn test_decode_scaled() {
+        let v = DataPid::EngineSpeed.decode_scaled(&[0x1A, 0xF8]).unwrap();
+        assert_eq!(v.get_values(), &[6904.0]);
+        assert_eq!(v.get_name(0), Some("Engine speed"));
+        assert_eq!(v.get_unit(0), Some(PidUnit::Rpm));
+        assert_eq!(v.to_obd_values()[0].get_value(), ObdUnitType::Rpm(6904));
+
+        let v = DataPid::OxygenSensor2.decode_scaled(&[100, 128]).unwrap();
+        assert_eq!(v.get_values(), &[0.5, 0.0]);
+        assert_eq!(v.get_name(1), Some("Oxygen sensor 2 short term fuel trim"));
+        assert_eq!(v.get_name(2), None);
+
+        assert!(matches!(
+            DataPid::MassAirFlow.decode_scaled(&[0x01]),
+            Err(DiagError::InvalidResponseLength)
+        ));
+        assert!(matches!(
+            DataPid::FuelType.decode_scaled(&[0x01]),
+            Err(DiagError::ParameterInvalid)
+        ));
+
+        // Every table entry must fit the data length J1979 gives for its PID
+        for pid in 0..PID_CHANNELS.len() as u8 {
+            for c in PID_CHANNELS[pid as usize] {
+                assert!(
+                    (c.offset + c.width) as usize <= PID_DATA_LEN[pid as usize] as usize,
+                    "PID {:02X}",
+                    pid
+                );
+            }
+            assert!(PID_CHANNELS[pid as usize].len() <= SCALED_PID_MAX_VALUES);
+        }
+    }
+}
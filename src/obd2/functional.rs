@@ -0,0 +1,516 @@
+//! Functional (broadcast) OBD2 requests, answered by every ECU at once
+//!
+//! [OBD2DiagnosticServer] talks to one ECU over an ISO-TP channel, which only
+//! receives from a single ID and does not report who sent a response. A functional request
+//! to 0x7DF is answered by every emissions related ECU (0x7E8-0x7EF), so [Obd2FunctionalClient]
+//! works on a raw [CanChannel] instead. It sends the request as one ISO-TP single frame, then
+//! collects and reassembles the responses of every ECU that answers within a time window.
+
+use std::{
+    collections::BTreeMap,
+    time::{Duration, Instant},
+};
+
+use crate::{
+    channel::{CanChannel, CanFrame, ChannelError, Packet},
+    obd2::{
+        lookup_obd_nrc, service01::split_pid_response, DataPid, OBD2Command, ObdValue,
+        MAX_PIDS_PER_REQUEST,
+    },
+    DiagError, DiagServerResult,
+};
+
+/// Largest request that fits into an ISO-TP single frame. Functional requests cannot use
+/// multi-frame transfers, as every ECU would answer with flow control
+const MAX_FUNCTIONAL_REQUEST_LEN: usize = 7;
+
+/// Maximum number of frames to read from the channel at once
+const FUNCTIONAL_READ_MAX: usize = 32;
+
+/// How long to block on the channel for at once, so that flow control frames are sent promptly
+const FUNCTIONAL_POLL_MS: u32 = 5;
+
+#[derive(Debug, Copy, Clone)]
+#[repr(C)]
+/// Settings for [Obd2FunctionalClient]
+pub struct Obd2FunctionalOptions {
+    /// Functional request ID. 0x7DF for 11bit CAN, 0x18DB33F1 for 29bit CAN
+    pub request_id: u32,
+    /// Lowest ID an ECU can respond with. 0x7E8 for 11bit CAN, 0x18DAF100 for 29bit CAN
+    pub response_id_min: u32,
+    /// Highest ID an ECU can respond with. 0x7EF for 11bit CAN, 0x18DAF1FF for 29bit CAN
+    pub response_id_max: u32,
+    /// Time in ms to collect responses for after sending the request. ISO 15765-4 allows
+    /// ECUs 50ms (P2) to respond
+    pub window_ms: u32,
+    /// Time in ms to keep waiting for an ECU that responded with response pending (P2*)
+    pub pending_timeout_ms: u32,
+    /// Write timeout in ms
+    pub write_timeout_ms: u32,
+    /// Baud rate of the CAN Network
+    pub can_speed: u32,
+    /// Pad frames to 8 bytes
+    pub pad_frame: bool,
+}
+
+impl Default for Obd2FunctionalOptions {
+    fn default() -> Self {
+        Self {
+            request_id: 0x07DF,
+            response_id_min: 0x07E8,
+            response_id_max: 0x07EF,
+            window_ms: 100,
+            pending_timeout_ms: 5000,
+            write_timeout_ms: 100,
+            can_speed: 500_000,
+            pad_frame: true,
+        }
+    }
+}
+
+impl Obd2FunctionalOptions {
+    fn is_extended(&self) -> bool {
+        self.request_id > 0x7FF
+    }
+
+    /// Returns the ID the tester sends to the ECU which responds with `response_id`
+    fn flow_control_id(&self, response_id: u32) -> u32 {
+        if self.is_extended() {
+            // 0x18DAF1xx -> 0x18DAxxF1
+            (response_id & 0xFFFF_0000) | ((response_id & 0xFF) << 8) | ((response_id >> 8) & 0xFF)
+        } else {
+            response_id - 8
+        }
+    }
+}
+
+#[derive(Debug)]
+/// Response of one ECU to a functional request
+pub struct FunctionalResponse {
+    /// CAN ID the ECU responded with
+    pub responder_id: u32,
+    /// The ECUs full response (Beginning with SID + 0x40), or the error it responded with
+    pub response: DiagServerResult<Vec<u8>>,
+}
+
+impl FunctionalResponse {
+    /// Decodes the response to a Service 01 request for `pids`, sent with
+    /// [Obd2FunctionalClient::query_pids]
+    ///
+    /// ## Returns
+    /// The value of each PID, in the same order as `pids`. PIDs missing from the response
+    /// return [DiagError::NotSupported]
+    pub fn decode_pids(
+        &self,
+        pids: &[DataPid],
+    ) -> DiagServerResult<Vec<DiagServerResult<Vec<ObdValue>>>> {
+        let resp = match &self.response {
+            Ok(r) => r,
+            Err(DiagError::ECUError { code, def }) => {
+                return Err(DiagError::ECUError {
+                    code: *code,
+                    def: def.clone(),
+                })
+            }
+            Err(_) => return Err(DiagError::EmptyResponse),
+        };
+        let mut results: Vec<Option<DiagServerResult<Vec<ObdValue>>>> =
+            pids.iter().map(|_| None).collect();
+        for (pid, data) in split_pid_response(resp) {
+            if let Some(i) = (0..pids.len()).find(|i| pids[*i] == pid && results[*i].is_none()) {
+                results[i] = Some(pid.decode_data(data));
+            }
+        }
+        Ok(results
+            .into_iter()
+            .map(|r| r.unwrap_or(Err(DiagError::NotSupported)))
+            .collect())
+    }
+}
+
+/// Reassembly state of one responding ECU
+#[derive(Debug)]
+struct Responder {
+    data: Vec<u8>,
+    expected_len: usize,
+    next_sn: u8,
+    /// Time to give up on the ECU
+    deadline: Instant,
+    result: Option<DiagServerResult<Vec<u8>>>,
+}
+
+#[derive(Debug)]
+/// Sends functional OBD2 requests, and collects the responses of every ECU
+pub struct Obd2FunctionalClient<C: CanChannel> {
+    channel: C,
+    options: Obd2FunctionalOptions,
+}
+
+impl<C: CanChannel> Obd2FunctionalClient<C> {
+    /// Creates a new functional client, configuring and opening the CAN channel
+    pub fn new(mut channel: C, options: Obd2FunctionalOptions) -> DiagServerResult<Self> {
+        channel.set_can_cfg(options.can_speed, options.is_extended())?;
+        channel.open()?;
+        Ok(Self { channel, options })
+    }
+
+    /// Returns the settings of the client
+    pub fn get_settings(&self) -> Obd2FunctionalOptions {
+        self.options
+    }
+
+    /// Sends a functional request, and collects the response of every ECU that answers
+    /// within [Obd2FunctionalOptions::window_ms]. ECUs which start a multi frame response,
+    /// or respond with response pending, are waited for past the window.
+    ///
+    /// ## Parameters
+    /// * payload - Request to send, starting with the service ID. At most 7 bytes
+    ///
+    /// ## Returns
+    /// The response of each ECU, sorted by responder ID. Errors only stop the whole request
+    /// if the request could not be sent
+    pub fn send_functional(&mut self, payload: &[u8]) -> DiagServerResult<Vec<FunctionalResponse>> {
+        if payload.is_empty() || payload.len() > MAX_FUNCTIONAL_REQUEST_LEN {
+            return Err(DiagError::ParameterInvalid);
+        }
+        let sid = payload[0];
+        let mut sf = [0xCCu8; 8];
+        sf[0] = payload.len() as u8;
+        sf[1..=payload.len()].copy_from_slice(payload);
+        let len = if self.options.pad_frame {
+            8
+        } else {
+            payload.len() + 1
+        };
+
+        self.channel.clear_rx_buffer()?;
+        self.channel.write_packets(
+            &[CanFrame::new(
+                self.options.request_id,
+                &sf[..len],
+                self.options.is_extended(),
+            )],
+            self.options.write_timeout_ms,
+        )?;
+
+        let window = Duration::from_millis(self.options.window_ms as u64);
+        let window_end = Instant::now() + window;
+        let mut responders: BTreeMap<u32, Responder> = BTreeMap::new();
+        let mut frames = [CanFrame::default(); FUNCTIONAL_READ_MAX];
+        loop {
+            let now = Instant::now();
+            // Wait until the window is over, and every ECU that started responding is done
+            let deadline = responders
+                .values()
+                .filter(|r| r.result.is_none())
+                .map(|r| r.deadline)
+                .fold(window_end, |a, b| a.max(b));
+            if now >= deadline {
+                break;
+            }
+            let wait = (deadline - now).as_millis().min(FUNCTIONAL_POLL_MS as u128) as u32;
+            let count = match self.channel.read_packets_into(&mut frames, wait.max(1)) {
+                Ok(c) => c,
+                Err(ChannelError::ReadTimeout) | Err(ChannelError::BufferEmpty) => continue,
+                Err(e) => return Err(e.into()),
+            };
+            for frame in &frames[..count] {
+                let id = frame.get_address();
+                if id < self.options.response_id_min || id > self.options.response_id_max {
+                    continue;
+                }
+                let r = responders.entry(id).or_insert_with(|| Responder {
+                    data: Vec::new(),
+                    expected_len: 0,
+                    next_sn: 0,
+                    deadline: window_end,
+                    result: None,
+                });
+                if r.result.is_none() {
+                    self.on_frame(id, frame.get_data(), r, sid)?;
+                }
+            }
+        }
+
+        Ok(responders
+            .into_iter()
+            .map(|(id, r)| FunctionalResponse {
+                responder_id: id,
+                response: r
+                    .result
+                    .unwrap_or(Err(DiagError::ChannelError(ChannelError::ReadTimeout))),
+            })
+            .collect())
+    }
+
+    /// Handles one ISO-TP frame from a responding ECU
+    fn on_frame(
+        &mut self,
+        id: u32,
+        data: &[u8],
+        r: &mut Responder,
+        sid: u8,
+    ) -> DiagServerResult<()> {
+        let pci = match data.first() {
+            Some(p) => *p,
+            None => return Ok(()),
+        };
+        let window = Duration::from_millis(self.options.window_ms as u64);
+        match pci >> 4 {
+            // Single frame
+            0x0 => {
+                let len = (pci & 0x0F) as usize;
+                if len == 0 || len + 1 > data.len() {
+                    r.result = Some(Err(DiagError::InvalidResponseLength));
+                } else {
+                    self.on_payload(&data[1..=len], r, sid);
+                }
+            }
+            // First frame. Ask the ECU to send the rest without waiting
+            0x1 => {
+                if data.len() < 8 {
+                    r.result = Some(Err(DiagError::InvalidResponseLength));
+                    return Ok(());
+                }
+                let expected_len = ((pci as usize & 0x0F) << 8) | data[1] as usize;
+                if expected_len <= 7 {
+                    // Would have fit in a single frame
+                    r.result = Some(Err(DiagError::InvalidResponseLength));
+                    return Ok(());
+                }
+                r.expected_len = expected_len;
+                r.data.clear();
+                r.data.extend_from_slice(&data[2..8]);
+                r.next_sn = 1;
+                r.deadline = Instant::now() + window;
+                let mut fc = [0u8; 8];
+                fc[0] = 0x30;
+                let len = if self.options.pad_frame { 8 } else { 3 };
+                self.channel.write_packets(
+                    &[CanFrame::new(
+                        self.options.flow_control_id(id),
+                        &fc[..len],
+                        self.options.is_extended(),
+                    )],
+                    self.options.write_timeout_ms,
+                )?;
+            }
+            // Consecutive frame
+            0x2 => {
+                if r.expected_len == 0 {
+                    return Ok(()); // Not in a multi frame transfer
+                }
+                if pci & 0x0F != r.next_sn {
+                    r.result = Some(Err(DiagError::InvalidResponseLength));
+                    return Ok(());
+                }
+                r.next_sn = (r.next_sn + 1) & 0x0F;
+                let take = r
+                    .expected_len
+                    .saturating_sub(r.data.len())
+                    .min(data.len() - 1);
+                r.data.extend_from_slice(&data[1..=take]);
+                r.deadline = Instant::now() + window;
+                if r.data.len() == r.expected_len {
+                    let payload = std::mem::take(&mut r.data);
+                    r.expected_len = 0;
+                    self.on_payload(&payload, r, sid);
+                }
+            }
+            _ => {}
+        }
+        Ok(())
+    }
+
+    /// Handles a complete response from an ECU
+    fn on_payload(&self, payload: &[u8], r: &mut Responder, sid: u8) {
+        if payload[0] == 0x7F && payload.len() >= 3 {
+            if payload[2] == 0x78 {
+                // Response pending, the real response is still to come
+                r.deadline =
+                    Instant::now() + Duration::from_millis(self.options.pending_timeout_ms as u64);
+            } else {
+                r.result = Some(Err(DiagError::ECUError {
+                    code: payload[2],
+                    def: Some(lookup_obd_nrc(payload[2])),
+                }));
+            }
+        } else if payload[0] == sid.wrapping_add(0x40) {
+            r.result = Some(Ok(payload.to_vec()));
+        } else {
+            r.result = Some(Err(DiagError::WrongMessage));
+        }
+    }
+
+    /// Asks every ECU for up to [MAX_PIDS_PER_REQUEST] Service 01 PIDs at once.
+    /// Decode each ECU's response with [FunctionalResponse::decode_pids]
+    pub fn query_pids(&mut self, pids: &[DataPid]) -> DiagServerResult<Vec<FunctionalResponse>> {
+        if pids.is_empty() || pids.len() > MAX_PIDS_PER_REQUEST {
+            return Err(DiagError::ParameterInvalid);
+        }
+        let mut req = Vec::with_capacity(pids.len() + 1);
+        req.push(u8::from(OBD2Command::Service01));
+        req.extend(pids.iter().map(|p| u8::from(*p)));
+        self.send_functional(&req)
+    }
+
+    /// Asks every ECU which of PIDs 01-20 it supports. Every OBD2 ECU must answer this,
+    /// so the responders are every OBD2 ECU on the vehicle
+    pub fn scan(&mut self) -> DiagServerResult<Vec<FunctionalResponse>> {
+        self.send_functional(&[u8::from(OBD2Command::Service01), 0x00])
+    }
+}
+
+#[cfg(test)]
+mod functional_test {
+    use std::collections::VecDeque;
+
+    use super::*;
+    use crate::channel::{ChannelResult, PacketChannel};
+    use crate::obd2::ObdUnitType;
+
+    /// Sends the queued frames once the tester has written `trigger` frames
+    #[derive(Default)]
+    struct MockCan {
+        written: Vec<CanFrame>,
+        script: VecDeque<(usize, CanFrame)>,
+    }
+
+    impl PacketChannel<CanFrame> for MockCan {
+        fn open(&mut self) -> ChannelResult<()> {
+            Ok(())
+        }
+
+        fn close(&mut self) -> ChannelResult<()> {
+            Ok(())
+        }
+
+        fn write_packets(&mut self, packets: &[CanFrame], _timeout_ms: u32) -> ChannelResult<()> {
+            self.written.extend_from_slice(packets);
+            Ok(())
+        }
+
+        fn read_packets(&mut self, max: usize, _timeout_ms: u32) -> ChannelResult<Vec<CanFrame>> {
+            let mut res = Vec::new();
+            while res.len() < max {
+                match self.script.front() {
+                    Some((trigger, _)) if *trigger <= self.written.len() => {
+                        res.push(self.script.pop_front().unwrap().1)
+                    }
+                    _ => break,
+                }
+            }
+            Ok(res)
+        }
+
+        fn clear_rx_buffer(&mut self) -> ChannelResult<()> {
+            Ok(())
+        }
+
+        fn clear_tx_buffer(&mut self) -> ChannelResult<()> {
+            Ok(())
+        }
+    }
+
+    impl CanChannel for MockCan {
+        fn set_can_cfg(&mut self, _baud: u32, _use_extended: bool) -> ChannelResult<()> {
+            Ok(())
+        }
+    }
+
+    #[test]
+    fn test_functional_collects_every_ecu() {
+        let mut can = MockCan::default();
+        let f = |id, d: &[u8]| CanFrame::new(id, d, false);
+        // Engine ECU answers both PIDs in a multi frame response
+        can.script.push_back((
+            1,
+            f(0x7E8, &[0x10, 0x08, 0x41, 0x0C, 0x1A, 0xF8, 0x0D, 0x32]),
+        ));
+        // Transmission ECU only supports vehicle speed
+        can.script.push_back((
+            1,
+            f(0x7E9, &[0x03, 0x41, 0x0D, 0x33, 0xCC, 0xCC, 0xCC, 0xCC]),
+        ));
+        // Unrelated traffic
+        can.script.push_back((1, f(0x123, &[0x01, 0x02])));
+        // Sent after the flow control frame
+        can.script.push_back((
+            2,
+            f(0x7E8, &[0x21, 0x05, 0x5A, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC]),
+        ));
+
+        let mut client = Obd2FunctionalClient::new(
+            can,
+            Obd2FunctionalOptions {
+                window_ms: 20,
+                ..Default::default()
+            },
+        )
+        .unwrap();
+        let pids = [
+            DataPid::EngineSpeed,
+            DataPid::VehicleSpeed,
+            DataPid::EngineCoolantTemp,
+        ];
+        let res = client.query_pids(&pids).unwrap();
+        assert_eq!(res.len(), 2);
+
+        assert_eq!(res[0].responder_id, 0x7E8);
+        let ecm = res[0].decode_pids(&pids).unwrap();
+        assert_eq!(
+            ecm[0].as_ref().unwrap()[0].get_value(),
+            ObdUnitType::Rpm(0x1AF8)
+        );
+        assert_eq!(ecm[2].as_ref().unwrap()[0].get_metric_data(), 50.0);
+
+        assert_eq!(res[1].responder_id, 0x7E9);
+        let tcm = res[1].decode_pids(&pids).unwrap();
+        assert!(matches!(tcm[0], Err(DiagError::NotSupported)));
+        assert_eq!(tcm[1].as_ref().unwrap()[0].get_metric_data().round(), 51.0);
+
+        // Request, then flow control to the engine ECU
+        let written = &client.channel.written;
+        assert_eq!(written[0].get_address(), 0x7DF);
+        assert_eq!(written[0].get_data()[..5], [0x04, 0x01, 0x0C, 0x0D, 0x05]);
+        assert_eq!(written[1].get_address(), 0x7E0);
+        assert_eq!(written[1].get_data()[0], 0x30);
+    }
+
+    #[test]
+    fn test_functional_rejects_short_first_frame() {
+        let mut can = MockCan::default();
+        let f = |id, d: &[u8]| CanFrame::new(id, d, false);
+        // First frame claiming to carry 4 bytes, followed by a consecutive frame
+        can.script.push_back((
+            1,
+            f(0x7E8, &[0x10, 0x04, 0x41, 0x0D, 0x32, 0xCC, 0xCC, 0xCC]),
+        ));
+        can.script.push_back((
+            1,
+            f(0x7E8, &[0x21, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC]),
+        ));
+        can.script.push_back((
+            1,
+            f(0x7E9, &[0x03, 0x41, 0x0D, 0x33, 0xCC, 0xCC, 0xCC, 0xCC]),
+        ));
+
+        let mut client = Obd2FunctionalClient::new(
+            can,
+            Obd2FunctionalOptions {
+                window_ms: 20,
+                ..Default::default()
+            },
+        )
+        .unwrap();
+        let res = client.query_pids(&[DataPid::VehicleSpeed]).unwrap();
+        assert_eq!(res.len(), 2);
+        assert!(matches!(
+            res[0].response,
+            Err(DiagError::InvalidResponseLength)
+        ));
+        assert!(res[1].response.is_ok());
+        // No flow control is sent for the rejected first frame
+        assert_eq!(client.channel.written.len(), 1);
+    }
+}
@@ -10,12 +10,15 @@ use std::{
 
 use crate::{
     channel::{IsoTPChannel, IsoTPSettings},
-    helpers, BaseServerPayload, BaseServerSettings, DiagError, DiagServerResult, DiagnosticServer,
+    helpers,
+    response_cache::{CacheLookup, CachePolicy, ResponseCache},
+    BaseServerPayload, BaseServerSettings, DiagError, DiagServerResult, DiagnosticServer,
     ServerEvent, ServerEventHandler,
 };
 
 mod data_pids;
 mod enumerations;
+mod functional;
 mod service01;
 mod service09;
 mod units;
@@ -24,6 +27,7 @@ mod units;
 use crate::dtc::{DTCFormatType, DTCStatus, DTC};
 pub use data_pids::*;
 pub use enumerations::*;
+pub use functional::*;
 pub use service01::*;
 pub use service09::*;
 pub use units::*;
@@ -247,6 +251,27 @@ pub struct OBD2DiagnosticServer {
     rx: mpsc::Receiver<DiagServerResult<Vec<u8>>>,
     repeat_count: u32,
     repeat_interval: std::time::Duration,
+    response_cache: ResponseCache,
+}
+
+/// Default [ResponseCache] policy of [OBD2DiagnosticServer].
+///
+/// Caches the vehicle information of Service 09 which cannot change whilst the
+/// vehicle is running (Supported PIDs, VIN, calibration IDs, CVNs and ECU name).
+/// In-use performance tracking is never cached. OBD2 requests cannot change any of this
+/// data, so nothing clears the cache
+pub const OBD2_CACHE_POLICY: CachePolicy = CachePolicy {
+    cacheable: obd_cacheable,
+    invalidates: |_| false,
+};
+
+fn obd_cacheable(req: &[u8]) -> bool {
+    match req {
+        [sid, pid] if OBD2Command::from(*sid) == OBD2Command::Service09 => {
+            matches!(pid, 0x00..=0x07 | 0x09 | 0x0A)
+        }
+        _ => false,
+    }
 }
 
 impl OBD2DiagnosticServer {
@@ -285,7 +310,17 @@ impl OBD2DiagnosticServer {
                     break;
                 }
 
-                if let Ok(cmd) = rx_cmd.try_recv() {
+                // OBD2 has no tester present, so just sleep until a command arrives
+                let next_cmd = match helpers::wait_for_cmd(&rx_cmd, None) {
+                    Ok(c) => c,
+                    Err(_) => {
+                        // Client side of the server has been dropped
+                        log::debug!("server exit");
+                        break;
+                    }
+                };
+
+                if let Some(cmd) = next_cmd {
                     // We have an incoming command
                     log::debug!(
                         "Incoming request from tester. Sending {:02X?} to ECU",
@@ -305,7 +340,6 @@ impl OBD2DiagnosticServer {
                         is_running_t.store(false, Ordering::Relaxed);
                     }
                 }
-                std::thread::sleep(std::time::Duration::from_millis(10));
             }
         });
 
@@ -316,6 +350,7 @@ impl OBD2DiagnosticServer {
             settings,
             repeat_count: 3,
             repeat_interval: std::time::Duration::from_millis(1000),
+            response_cache: ResponseCache::new(OBD2_CACHE_POLICY),
         })
     }
 
@@ -324,12 +359,32 @@ impl OBD2DiagnosticServer {
         self.settings
     }
 
+    /// Returns the server's cache of vehicle information responses
+    pub fn response_cache(&self) -> &ResponseCache {
+        &self.response_cache
+    }
+
+    /// Returns the server's cache of vehicle information responses, for enabling or clearing it.
+    /// The cache is disabled by default
+    pub fn response_cache_mut(&mut self) -> &mut ResponseCache {
+        &mut self.response_cache
+    }
+
     /// Internal command for sending KWP2000 payload to the ECU
     fn exec_command(&mut self, cmd: OBD2Cmd) -> DiagServerResult<Vec<u8>> {
-        match self.tx.send(cmd) {
+        let key = match self.response_cache.lookup(&cmd) {
+            CacheLookup::Hit(resp) => return Ok(resp),
+            CacheLookup::Miss(key) => Some(key),
+            CacheLookup::Uncached => None,
+        };
+        let res = match self.tx.send(cmd) {
             Ok(_) => self.rx.recv().unwrap_or(Err(DiagError::ServerNotRunning)),
             Err(_) => Err(DiagError::ServerNotRunning), // Server must have crashed!
+        };
+        if let (Some(key), Ok(resp)) = (key, &res) {
+            self.response_cache.insert(key, resp);
         }
+        res
     }
 
     /// Attempts to clear stored DTCs on the ECU using Service 04
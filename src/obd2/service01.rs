@@ -1,9 +1,26 @@
 //! OBD2 service 01 (Show current data)
 
-use crate::obd2::data_pids::DataPid;
+use crate::obd2::data_pids::{DataPid, ScaledPidValues};
 use crate::obd2::units::ObdValue;
 use crate::obd2::{decode_pid_response, OBD2Cmd, OBD2Command, OBD2DiagnosticServer};
-use crate::{DiagError, DiagServerResult};
+use crate::{DiagError, DiagServerResult, DiagnosticServer};
+
+/// Maximum number of PIDs the ECU can be asked for in one Service 01 request
+pub const MAX_PIDS_PER_REQUEST: usize = 6;
+
+/// Splits a positive Service 01 response (0x41, followed by each PID the ECU supports and its data)
+/// into its PIDs and their data. This stops at the first PID whose data length is not known,
+/// as there is no way to tell where the next PID starts
+pub(crate) fn split_pid_response(resp: &[u8]) -> impl Iterator<Item = (DataPid, &[u8])> + '_ {
+    let mut data = resp.get(1..).unwrap_or(&[]);
+    std::iter::from_fn(move || {
+        let (&pid, rest) = data.split_first()?;
+        let pid = DataPid::from(pid);
+        let len = pid.data_len().filter(|l| *l <= rest.len())?;
+        data = &rest[len..];
+        Some((pid, &rest[..len]))
+    })
+}
 
 #[derive(Debug)]
 /// Service 01 wrapper for OBD
@@ -42,6 +59,104 @@ impl OBD2DiagnosticServer {
             support_list: decode_pid_response(&total_support_list),
         })
     }
+
+    /// Query's many data PIDs from Service 01, packing up to [MAX_PIDS_PER_REQUEST]
+    /// of them into each request. Unlike [Service01::query_pids], this does not check if the ECU
+    /// supports the PIDs first.
+    ///
+    /// PIDs whose response length is not known are requested on their own. If the ECU
+    /// rejects a multi PID request with a negative response, its PIDs are requested again,
+    /// one at a time. Any other error (Such as a timeout) is returned for the first PID of the request,
+    /// and [DiagError::BatchedRequestFailed] for the others.
+    ///
+    /// ## Returns
+    /// The value of each PID, in the same order as `pids`
+    pub fn query_pids(&mut self, pids: &[DataPid]) -> Vec<DiagServerResult<Vec<ObdValue>>> {
+        self.query_pids_with(pids, |_| true, DataPid::decode_data)
+    }
+
+    /// Query's many scaled data PIDs from Service 01, in the same way as [OBD2DiagnosticServer::query_pids].
+    ///
+    /// Values are decoded with [DataPid::decode_scaled], so unlike [OBD2DiagnosticServer::query_pids],
+    /// no names or values are allocated per PID. This is the one to use for sampling PIDs at a high rate.
+    ///
+    /// ## Returns
+    /// The values of each PID, in the same order as `pids`. PIDs which are not scaled numbers
+    /// (See [DataPid::is_scaled]) are not requested, and return [DiagError::ParameterInvalid]
+    pub fn query_pids_scaled(
+        &mut self,
+        pids: &[DataPid],
+    ) -> Vec<DiagServerResult<ScaledPidValues>> {
+        self.query_pids_with(pids, DataPid::is_scaled, DataPid::decode_scaled)
+    }
+
+    /// Requests each PID of `pids` that is `requestable`, and decodes its data with `decode`
+    fn query_pids_with<T>(
+        &mut self,
+        pids: &[DataPid],
+        requestable: fn(&DataPid) -> bool,
+        decode: fn(&DataPid, &[u8]) -> DiagServerResult<T>,
+    ) -> Vec<DiagServerResult<T>> {
+        let mut results: Vec<Option<DiagServerResult<T>>> = pids
+            .iter()
+            .map(|p| match requestable(p) {
+                true => None,
+                false => Some(Err(DiagError::ParameterInvalid)),
+            })
+            .collect();
+        let (packable, single): (Vec<usize>, Vec<usize>) = (0..pids.len())
+            .filter(|i| results[*i].is_none())
+            .partition(|i| pids[*i].data_len().is_some());
+
+        for group in packable.chunks(MAX_PIDS_PER_REQUEST) {
+            let mut req = Vec::with_capacity(group.len() + 1);
+            req.push(0x01);
+            req.extend(group.iter().map(|i| u8::from(pids[*i])));
+            let resp = match self.send_byte_array_with_response(&req) {
+                Ok(r) => r,
+                Err(DiagError::ECUError { .. }) if group.len() > 1 => {
+                    // Some ECUs only accept a single PID per request
+                    for i in group {
+                        results[*i] = Some(self.query_single_pid(pids[*i], decode));
+                    }
+                    continue;
+                }
+                Err(e) => {
+                    // Asking again one PID at a time will not get past a transport error
+                    for i in &group[1..] {
+                        results[*i] = Some(Err(DiagError::BatchedRequestFailed));
+                    }
+                    results[group[0]] = Some(Err(e));
+                    continue;
+                }
+            };
+            for (pid, data) in split_pid_response(&resp) {
+                if let Some(i) = group
+                    .iter()
+                    .find(|i| pids[**i] == pid && results[**i].is_none())
+                {
+                    results[*i] = Some(decode(&pid, data));
+                }
+            }
+        }
+        for i in single {
+            results[i] = Some(self.query_single_pid(pids[i], decode));
+        }
+
+        results
+            .into_iter()
+            .map(|r| r.unwrap_or(Err(DiagError::NotSupported)))
+            .collect()
+    }
+
+    fn query_single_pid<T>(
+        &mut self,
+        pid: DataPid,
+        decode: fn(&DataPid, &[u8]) -> DiagServerResult<T>,
+    ) -> DiagServerResult<T> {
+        let resp = self.send_byte_array_with_response(&[0x01, u8::from(pid)])?;
+        decode(&pid, resp.get(2..).unwrap_or(&[]))
+    }
 }
 
 impl<'a> Service01<'a> {
@@ -63,6 +178,39 @@ impl<'a> Service01<'a> {
     pub fn query_pid(&mut self, pid: DataPid) -> DiagServerResult<Vec<ObdValue>> {
         pid.get_value(self.server, None)
     }
+
+    /// Returns true if the ECU reported that it supports `pid`
+    pub fn is_pid_supported(&self, pid: DataPid) -> bool {
+        match u8::from(pid) {
+            0x00 => true,
+            x => self
+                .support_list
+                .get(x as usize - 1)
+                .copied()
+                .unwrap_or(false),
+        }
+    }
+
+    /// Query's many data PIDs from Service 01, using as few requests as possible.
+    /// See [OBD2DiagnosticServer::query_pids].
+    ///
+    /// ## Returns
+    /// The value of each PID, in the same order as `pids`. PIDs the ECU does not
+    /// support are not requested, and return [DiagError::NotSupported]
+    pub fn query_pids(&mut self, pids: &[DataPid]) -> Vec<DiagServerResult<Vec<ObdValue>>> {
+        let supported: Vec<DataPid> = pids
+            .iter()
+            .copied()
+            .filter(|p| self.is_pid_supported(*p))
+            .collect();
+        let mut values = self.server.query_pids(&supported).into_iter();
+        pids.iter()
+            .map(|p| match self.is_pid_supported(*p) {
+                true => values.next().unwrap_or(Err(DiagError::NotSupported)),
+                false => Err(DiagError::NotSupported),
+            })
+            .collect()
+    }
 }
 
 #[cfg(test)]
@@ -117,6 +265,8 @@ pub mod service_09_test {
                 pad_frame: true,
                 can_speed: 500_000,
                 can_use_ext_addr: false,
+                can_fd: false,
+                can_fd_brs: false,
             },
         )
         .unwrap();
@@ -136,3 +286,119 @@ pub mod service_09_test {
         }
     }
 }
+
+#[cfg(all(test, feature = "simulation"))]
+mod query_pids_test {
+    use crate::channel::IsoTPSettings;
+    use crate::hardware::simulation::SimulationIsoTpChannel;
+    use crate::obd2::data_pids::DataPid;
+    use crate::obd2::units::ObdUnitType;
+    use crate::obd2::{OBD2DiagnosticServer, Obd2ServerOptions};
+    use crate::DiagError;
+
+    #[test]
+    fn test_query_pids_splits_response() {
+        let mut channel = SimulationIsoTpChannel::new();
+        // Engine speed, vehicle speed and coolant temperature in one request.
+        // The ECU answers in a different order
+        channel.add_response(
+            &[0x01, 0x0C, 0x0D, 0x05],
+            &[0x41, 0x0D, 0x32, 0x0C, 0x1A, 0xF8, 0x05, 0x5A],
+        );
+        channel.add_response(&[0x01, 0x0C], &[0x41, 0x0C, 0x1A, 0xF8]);
+        let mut obd = OBD2DiagnosticServer::new_over_iso_tp(
+            Obd2ServerOptions {
+                send_id: 0x07E0,
+                recv_id: 0x07E8,
+                read_timeout_ms: 50,
+                write_timeout_ms: 50,
+            },
+            channel,
+            IsoTPSettings {
+                block_size: 8,
+                st_min: 20,
+                extended_addressing: false,
+                pad_frame: true,
+                can_speed: 500_000,
+                can_use_ext_addr: false,
+                can_fd: false,
+                can_fd_brs: false,
+            },
+        )
+        .unwrap();
+
+        let res = obd.query_pids(&[
+            DataPid::EngineSpeed,
+            DataPid::VehicleSpeed,
+            DataPid::EngineCoolantTemp,
+        ]);
+        assert_eq!(res.len(), 3);
+        let rpm = res[0].as_ref().unwrap();
+        assert_eq!(rpm[0].get_value(), ObdUnitType::Rpm(0x1AF8));
+        let speed = res[1].as_ref().unwrap();
+        assert_eq!(speed[0].get_metric_data().round(), 50.0);
+        let temp = res[2].as_ref().unwrap();
+        assert_eq!(temp[0].get_metric_data(), 50.0);
+
+        // ECU did not answer at all. Engine speed would be answered on its own, but a
+        // transport error is not worth retrying one PID at a time
+        let res = obd.query_pids(&[DataPid::EngineSpeed, DataPid::MassAirFlow]);
+        assert!(matches!(res[0], Err(DiagError::ChannelError(_))));
+        assert!(matches!(res[1], Err(DiagError::BatchedRequestFailed)));
+    }
+
+    #[test]
+    fn test_query_pids_falls_back_on_negative_response() {
+        let mut channel = SimulationIsoTpChannel::new();
+        // This ECU only accepts one PID per request
+        channel.add_response(&[0x01, 0x0C, 0x0D], &[0x7F, 0x01, 0x12]);
+        channel.add_response(&[0x01, 0x0C], &[0x41, 0x0C, 0x1A, 0xF8]);
+        channel.add_response(&[0x01, 0x0D], &[0x41, 0x0D, 0x32]);
+        let mut obd = OBD2DiagnosticServer::new_over_iso_tp(
+            Obd2ServerOptions {
+                send_id: 0x07E0,
+                recv_id: 0x07E8,
+                read_timeout_ms: 50,
+                write_timeout_ms: 50,
+            },
+            channel,
+            IsoTPSettings::default(),
+        )
+        .unwrap();
+
+        let res = obd.query_pids(&[DataPid::EngineSpeed, DataPid::VehicleSpeed]);
+        let rpm = res[0].as_ref().unwrap();
+        assert_eq!(rpm[0].get_value(), ObdUnitType::Rpm(0x1AF8));
+        let speed = res[1].as_ref().unwrap();
+        assert_eq!(speed[0].get_metric_data().round(), 50.0);
+    }
+
+    #[test]
+    fn test_query_pids_scaled() {
+        let mut channel = SimulationIsoTpChannel::new();
+        channel.add_response(&[0x01, 0x0C, 0x0D], &[0x41, 0x0D, 0x32, 0x0C, 0x1A, 0xF8]);
+        let mut obd = OBD2DiagnosticServer::new_over_iso_tp(
+            Obd2ServerOptions {
+                send_id: 0x07E0,
+                recv_id: 0x07E8,
+                read_timeout_ms: 50,
+                write_timeout_ms: 50,
+            },
+            channel,
+            IsoTPSettings::default(),
+        )
+        .unwrap();
+
+        // Fuel type is an enumeration, so is never requested
+        let res = obd.query_pids_scaled(&[
+            DataPid::EngineSpeed,
+            DataPid::FuelType,
+            DataPid::VehicleSpeed,
+        ]);
+        let rpm = res[0].as_ref().unwrap();
+        assert_eq!(rpm.get_pid(), DataPid::EngineSpeed);
+        assert_eq!(rpm.get_values(), &[6904.0]);
+        assert!(matches!(res[1], Err(DiagError::ParameterInvalid)));
+        assert_eq!(res[2].as_ref().unwrap().get_values(), &[50.0]);
+    }
+}
@@ -145,6 +145,8 @@ pub mod service_09_test {
                 pad_frame: true,
                 can_speed: 500_000,
                 can_use_ext_addr: false,
+                can_fd: false,
+                can_fd_brs: false,
             },
         )
         .unwrap();
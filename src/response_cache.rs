@@ -0,0 +1,203 @@
+//! Opt-in cache of ECU responses which never change during a session
+//!
+//! Identification data (Software versions, part numbers, VIN, ...) is often read again and
+//! again, but only changes when the ECU is reset, reflashed or reconfigured. Each diagnostic server
+//! owns a [ResponseCache], which is disabled by default. Once enabled, positive responses to
+//! requests its [CachePolicy] deems static are kept, keyed by the full request (SID + arguments),
+//! and repeat requests are answered from the cache without touching the bus.
+//!
+//! The cache is cleared whenever a request is sent which could change cached data,
+//! such as a session change or ECU reset.
+
+use std::collections::HashMap;
+
+use crate::BaseServerPayload;
+
+/// Decides which requests a [ResponseCache] caches the response of, and which requests clear it.
+/// Each function is given the full request, starting with the SID
+#[derive(Debug, Copy, Clone)]
+pub struct CachePolicy {
+    /// Returns true if the response to a request never changes during a session
+    pub cacheable: fn(&[u8]) -> bool,
+    /// Returns true if a request could change previously cached data (EG: ECU reset or session change)
+    pub invalidates: fn(&[u8]) -> bool,
+}
+
+/// Cache of responses to static requests, see the [module level docs](self)
+#[derive(Debug, Clone)]
+pub struct ResponseCache {
+    enabled: bool,
+    policy: CachePolicy,
+    entries: HashMap<Vec<u8>, Vec<u8>>,
+    hits: u64,
+    misses: u64,
+}
+
+/// Result of looking up a request which is about to be sent
+#[derive(Debug)]
+pub(crate) enum CacheLookup {
+    /// The cached response
+    Hit(Vec<u8>),
+    /// The response is not cached yet, but can be cached with this key once it arrives
+    Miss(Vec<u8>),
+    /// The response is not cached
+    Uncached,
+}
+
+impl ResponseCache {
+    /// Creates a new, disabled, cache using `policy`
+    pub fn new(policy: CachePolicy) -> Self {
+        Self {
+            enabled: false,
+            policy,
+            entries: HashMap::new(),
+            hits: 0,
+            misses: 0,
+        }
+    }
+
+    /// Returns true if the cache is enabled
+    pub fn is_enabled(&self) -> bool {
+        self.enabled
+    }
+
+    /// Enables or disables the cache. Disabling the cache also clears it
+    pub fn set_enabled(&mut self, enabled: bool) {
+        self.enabled = enabled;
+        if !enabled {
+            self.entries.clear();
+        }
+    }
+
+    /// Returns the policy of the cache
+    pub fn policy(&self) -> CachePolicy {
+        self.policy
+    }
+
+    /// Replaces the policy of the cache (EG: To also cache manufacturer specific identifiers).
+    /// This clears the cache
+    pub fn set_policy(&mut self, policy: CachePolicy) {
+        self.policy = policy;
+        self.entries.clear();
+    }
+
+    /// Returns the cached response to `request` (SID + arguments), if there is one.
+    /// This does not count as a cache hit
+    pub fn get(&self, request: &[u8]) -> Option<&[u8]> {
+        self.entries.get(request).map(|r| r.as_slice())
+    }
+
+    /// Returns the number of cached responses
+    pub fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    /// Returns true if no responses are cached
+    pub fn is_empty(&self) -> bool {
+        self.entries.is_empty()
+    }
+
+    /// Removes every cached response
+    pub fn clear(&mut self) {
+        self.entries.clear()
+    }
+
+    /// Returns the number of requests answered from the cache, and the number of
+    /// cacheable requests which had to be sent to the ECU
+    pub fn stats(&self) -> (u64, u64) {
+        (self.hits, self.misses)
+    }
+
+    /// Clears the cache if `request` could change cached data
+    pub(crate) fn invalidate_for(&mut self, request: &[u8]) {
+        if !self.entries.is_empty() && (self.policy.invalidates)(request) {
+            log::debug!("{:02X?} invalidates the response cache", request);
+            self.entries.clear();
+        }
+    }
+
+    /// Looks up a request that is about to be sent to the ECU, clearing the cache first
+    /// if the request could change cached data
+    pub(crate) fn lookup<P: BaseServerPayload>(&mut self, cmd: &P) -> CacheLookup {
+        let request = cmd.to_bytes();
+        self.invalidate_for(request);
+        if !self.enabled || !cmd.requires_response() || !(self.policy.cacheable)(request) {
+            return CacheLookup::Uncached;
+        }
+        match self.entries.get(request) {
+            Some(resp) => {
+                self.hits += 1;
+                CacheLookup::Hit(resp.clone())
+            }
+            None => {
+                self.misses += 1;
+                CacheLookup::Miss(request.to_vec())
+            }
+        }
+    }
+
+    /// Stores the response to a request which missed the cache
+    pub(crate) fn insert(&mut self, key: Vec<u8>, response: &[u8]) {
+        if self.enabled {
+            self.entries.insert(key, response.to_vec());
+        }
+    }
+}
+
+#[cfg(test)]
+mod response_cache_test {
+    use super::*;
+
+    struct Req(Vec<u8>, bool);
+
+    impl BaseServerPayload for Req {
+        fn get_payload(&self) -> &[u8] {
+            &self.0[1..]
+        }
+
+        fn get_sid_byte(&self) -> u8 {
+            self.0[0]
+        }
+
+        fn to_bytes(&self) -> &[u8] {
+            &self.0
+        }
+
+        fn requires_response(&self) -> bool {
+            self.1
+        }
+    }
+
+    const POLICY: CachePolicy = CachePolicy {
+        cacheable: |r| r[0] == 0x1A,
+        invalidates: |r| r[0] == 0x11,
+    };
+
+    #[test]
+    fn test_cache() {
+        let mut cache = ResponseCache::new(POLICY);
+        let ident = Req(vec![0x1A, 0x86], true);
+        // Disabled by default
+        assert!(matches!(cache.lookup(&ident), CacheLookup::Uncached));
+        cache.set_enabled(true);
+        match cache.lookup(&ident) {
+            CacheLookup::Miss(key) => cache.insert(key, &[0x5A, 0x86, 0x01]),
+            res => panic!("Unexpected {:?}", res),
+        }
+        assert!(matches!(cache.lookup(&ident), CacheLookup::Hit(r) if r == [0x5A, 0x86, 0x01]));
+        assert_eq!(cache.stats(), (1, 1));
+        // Not cacheable, or no response
+        assert!(matches!(
+            cache.lookup(&Req(vec![0x21, 0x01], true)),
+            CacheLookup::Uncached
+        ));
+        assert!(matches!(
+            cache.lookup(&Req(vec![0x1A, 0x86], false)),
+            CacheLookup::Uncached
+        ));
+        assert_eq!(cache.len(), 1);
+        // ECU reset clears the cache
+        cache.lookup(&Req(vec![0x11, 0x01], true));
+        assert!(cache.is_empty());
+    }
+}
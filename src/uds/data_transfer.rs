@@ -0,0 +1,392 @@
+//! Provides methods to download data to the ECU, such as when reprogramming it
+//! (RequestDownload, TransferData and RequestTransferExit)
+//!
+//! [UdsDiagnosticServer::download] is a flow-controlled block transfer. It hands the whole image
+//! to the server's background thread, which sends one TransferData block at a time. The blocks
+//! are not pipelined: UDS only allows one request to be outstanding at a time, so the ECU must
+//! acknowledge each block before the next one is sent. What this saves is the round trip to the
+//! client between blocks. Progress is sent back to the client as each block completes, so a slow
+//! progress callback never holds up the transfer.
+
+use std::{
+    sync::{mpsc, Arc},
+    time::{Duration, Instant},
+};
+
+use crate::{
+    channel::IsoTPChannel, DiagError, DiagServerResult, DiagnosticServer, ServerEventHandler,
+};
+
+use super::{
+    UDSCommand, UDSSessionType, UdsCmd, UdsDiagnosticServer, UdsServerRequest, UdsServerState,
+};
+
+/// Image to download to the ECU. Anything that can be borrowed as a byte slice can be used,
+/// such as a `Vec<u8>` or a memory mapped file, and it is never copied as a whole
+pub type TransferImage = Arc<dyn AsRef<[u8]> + Send + Sync>;
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+#[repr(C)]
+/// Settings for [UdsDiagnosticServer::download]
+pub struct DownloadOptions {
+    /// ECU memory address to download the image to
+    pub memory_address: u64,
+    /// Number of bytes to encode the memory address with (1-8)
+    pub address_len: u8,
+    /// Number of bytes to encode the image size with (1-8)
+    pub size_len: u8,
+    /// Data format identifier. The high nibble is the compression method, and the
+    /// low nibble is the encryption method. 0x00 is neither compressed nor encrypted
+    pub data_format: u8,
+    /// Longest TransferData request to send, including the SID and block sequence counter.
+    /// If 0, the ECU's maximum is used, otherwise the smaller of the two is used
+    pub max_block_len: u32,
+}
+
+impl Default for DownloadOptions {
+    fn default() -> Self {
+        Self {
+            memory_address: 0,
+            address_len: 4,
+            size_len: 4,
+            data_format: 0x00,
+            max_block_len: 0,
+        }
+    }
+}
+
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+#[repr(C)]
+/// Progress of a download
+pub struct TransferProgress {
+    /// Number of image bytes the ECU has acknowledged
+    pub bytes_sent: u64,
+    /// Size of the image in bytes
+    pub total_bytes: u64,
+    /// Time since the first block was sent, in microseconds
+    pub elapsed_us: u64,
+    /// Number of TransferData blocks the ECU has acknowledged
+    pub blocks_sent: u32,
+}
+
+impl TransferProgress {
+    /// Returns the average throughput of the download so far, in bytes per second
+    pub fn bytes_per_second(&self) -> f32 {
+        match self.elapsed_us {
+            0 => 0.0,
+            us => self.bytes_sent as f32 * 1_000_000.0 / us as f32,
+        }
+    }
+}
+
+/// Sent from the server thread to the client during a download
+enum TransferEvent {
+    /// A block other than the last has been acknowledged
+    Progress(TransferProgress),
+    /// Every block has been acknowledged, or a block failed
+    Done(DiagServerResult<TransferProgress>),
+}
+
+/// Blocks of an image for the server thread to send
+pub(crate) struct TransferJob {
+    image: TransferImage,
+    /// Number of image bytes in each block
+    block_data_len: usize,
+    events: mpsc::Sender<TransferEvent>,
+}
+
+impl std::fmt::Debug for TransferJob {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("TransferJob")
+            .field("len", &(*self.image).as_ref().len())
+            .field("block_data_len", &self.block_data_len)
+            .finish()
+    }
+}
+
+/// Encodes the lowest `len` bytes of `value` big endian, checking that it fits
+fn encode_be(value: u64, len: u8, out: &mut Vec<u8>) -> DiagServerResult<()> {
+    if len == 0 || len > 8 || (len < 8 && value >> (len as u32 * 8) != 0) {
+        return Err(DiagError::ParameterInvalid);
+    }
+    out.extend_from_slice(&value.to_be_bytes()[8 - len as usize..]);
+    Ok(())
+}
+
+/// Reads maxNumberOfBlockLength from a positive RequestDownload response
+fn parse_max_block_len(resp: &[u8]) -> DiagServerResult<u32> {
+    let len = match resp.get(1) {
+        Some(fmt) => (fmt >> 4) as usize,
+        None => return Err(DiagError::InvalidResponseLength),
+    };
+    match resp.get(2..2 + len) {
+        // Saturates, as no request is ever this long anyway
+        Some(b) if len != 0 => Ok(b.iter().fold(0u32, |v, b| {
+            v.saturating_mul(0x100).saturating_add(*b as u32)
+        })),
+        _ => Err(DiagError::InvalidResponseLength),
+    }
+}
+
+/// Checks that a positive TransferData response is for the block with counter `seq`
+fn check_block_ack(resp: &[u8], seq: u8) -> DiagServerResult<()> {
+    match resp.get(1) {
+        Some(&x) if x == seq => Ok(()),
+        Some(x) => Err(DiagError::MismatchedResponse(format!(
+            "block sequence counter 0x{:02X}, expected 0x{:02X}",
+            x, seq
+        ))),
+        None => Err(DiagError::InvalidResponseLength),
+    }
+}
+
+impl<C, E> UdsServerState<C, E>
+where
+    C: IsoTPChannel,
+    E: ServerEventHandler<UDSSessionType>,
+{
+    /// Sends every block of a download, stopping at the first block which fails.
+    /// `queue_wait` is how long the job was waiting to be executed.
+    pub(super) fn run_transfer(&mut self, job: TransferJob, queue_wait: Duration) {
+        let image = (*job.image).as_ref();
+        let mut progress = TransferProgress {
+            total_bytes: image.len() as u64,
+            ..Default::default()
+        };
+        // Every block is built in the same request
+        let mut cmd = UdsCmd::new(UDSCommand::TransferData, &[], true);
+        cmd.bytes.reserve(job.block_data_len + 1);
+        let mut wait = queue_wait;
+        let start = Instant::now();
+        for (idx, block) in image.chunks(job.block_data_len.max(1)).enumerate() {
+            // Starts at 0x01, and wraps from 0xFF to 0x00
+            let seq = (idx + 1) as u8;
+            cmd.bytes.truncate(1);
+            cmd.bytes.push(seq);
+            cmd.bytes.extend_from_slice(block);
+
+            self.tester_present_if_due();
+            let res = self
+                .run_cmd(&cmd, wait)
+                .and_then(|resp| check_block_ack(&resp, seq));
+            if let Err(e) = res {
+                let _ = job.events.send(TransferEvent::Done(Err(e)));
+                return;
+            }
+            wait = Duration::ZERO;
+            progress.bytes_sent += block.len() as u64;
+            progress.blocks_sent += 1;
+            progress.elapsed_us = start.elapsed().as_micros() as u64;
+            // The last block's progress is sent with the result instead
+            if progress.bytes_sent < progress.total_bytes
+                && job.events.send(TransferEvent::Progress(progress)).is_err()
+            {
+                // Client has gone away, nobody is left to finish the download
+                return;
+            }
+        }
+        let _ = job.events.send(TransferEvent::Done(Ok(progress)));
+    }
+}
+
+impl UdsDiagnosticServer {
+    /// Asks the ECU to accept a download (RequestDownload)
+    ///
+    /// ## Parameters
+    /// * options - Where to download to, and how the data is formatted. [DownloadOptions::max_block_len] is ignored
+    /// * size - Size of the data to download, in bytes
+    ///
+    /// ## Returns
+    /// The longest TransferData request the ECU accepts (maxNumberOfBlockLength),
+    /// including the SID and block sequence counter
+    pub fn request_download(
+        &mut self,
+        options: &DownloadOptions,
+        size: u64,
+    ) -> DiagServerResult<u32> {
+        let mut args = Vec::with_capacity(18);
+        args.push(options.data_format);
+        args.push(options.size_len << 4 | (options.address_len & 0x0F));
+        encode_be(options.memory_address, options.address_len, &mut args)?;
+        encode_be(size, options.size_len, &mut args)?;
+        let resp = self.execute_command_with_response(UDSCommand::RequestDownload, &args)?;
+        parse_max_block_len(&resp)
+    }
+
+    /// Sends one block of a download to the ECU (TransferData)
+    ///
+    /// ## Parameters
+    /// * block_sequence_counter - Counter of the block. The first block is 0x01, and the counter wraps from 0xFF to 0x00
+    /// * data - Data of the block
+    ///
+    /// ## Returns
+    /// The ECU's response, beginning with 0x76 and the block sequence counter
+    pub fn transfer_data(
+        &mut self,
+        block_sequence_counter: u8,
+        data: &[u8],
+    ) -> DiagServerResult<Vec<u8>> {
+        let mut args = Vec::with_capacity(data.len() + 1);
+        args.push(block_sequence_counter);
+        args.extend_from_slice(data);
+        let resp = self.execute_command_with_response(UDSCommand::TransferData, &args)?;
+        check_block_ack(&resp, block_sequence_counter)?;
+        Ok(resp)
+    }
+
+    /// Tells the ECU that a download is complete (RequestTransferExit)
+    ///
+    /// ## Parameters
+    /// * params - Manufacturer specific parameters. These are usually empty
+    ///
+    /// ## Returns
+    /// The ECU's response, beginning with 0x77
+    pub fn request_transfer_exit(&mut self, params: &[u8]) -> DiagServerResult<Vec<u8>> {
+        self.execute_command_with_response(UDSCommand::RequestTransferExit, params)
+    }
+
+    /// Downloads a whole image to the ECU. This sends RequestDownload, the image as
+    /// TransferData blocks of the largest size the ECU accepts, and finally RequestTransferExit.
+    ///
+    /// The blocks are sent one at a time by the server's background thread, each waiting for the
+    /// ECU to acknowledge the previous one, without returning to the client in between them. Unlike the other requests, blocks that fail are not retried, and the
+    /// download stops at the first block which fails. The ECU must already be in a session
+    /// which allows downloads.
+    ///
+    /// ## Parameters
+    /// * image - Image to download. This is shared with the server thread rather than copied
+    /// * options - Settings for the download
+    /// * on_progress - Called on the calling thread as blocks are acknowledged. If it falls behind,
+    /// some blocks are skipped, but it is always called once every block has been acknowledged
+    ///
+    /// ## Returns
+    /// The final progress of the download
+    pub fn download<F>(
+        &mut self,
+        image: TransferImage,
+        options: DownloadOptions,
+        mut on_progress: F,
+    ) -> DiagServerResult<TransferProgress>
+    where
+        F: FnMut(&TransferProgress),
+    {
+        let total = (*image).as_ref().len();
+        if total == 0 || options.max_block_len == 1 || options.max_block_len == 2 {
+            return Err(DiagError::ParameterInvalid);
+        }
+        let ecu_max = self.request_download(&options, total as u64)?;
+        if ecu_max <= 2 {
+            // No room for any data!
+            return Err(DiagError::InvalidResponseLength);
+        }
+        let block_len = match options.max_block_len {
+            0 => ecu_max,
+            x => x.min(ecu_max),
+        };
+
+        let (tx, rx) = mpsc::channel();
+        let job = TransferJob {
+            image,
+            block_data_len: block_len as usize - 2,
+            events: tx,
+        };
+        self.tx
+            .send((Instant::now(), UdsServerRequest::Transfer(job)))
+            .map_err(|_| DiagError::ServerNotRunning)?;
+
+        let progress = loop {
+            let mut event = rx.recv().map_err(|_| DiagError::ServerNotRunning)?;
+            // Only report the latest progress if we have fallen behind
+            let mut latest = None;
+            while let TransferEvent::Progress(p) = event {
+                latest = Some(p);
+                match rx.try_recv() {
+                    Ok(e) => event = e,
+                    Err(_) => break,
+                }
+            }
+            if let Some(p) = latest {
+                on_progress(&p)
+            }
+            if let TransferEvent::Done(res) = event {
+                break res?;
+            }
+        };
+        on_progress(&progress);
+        self.request_transfer_exit(&[])?;
+        Ok(progress)
+    }
+}
+
+#[cfg(test)]
+mod data_transfer_test {
+    use super::*;
+
+    #[test]
+    fn test_encode_and_parse() {
+        let mut out = Vec::new();
+        encode_be(0x0012_3456, 3, &mut out).unwrap();
+        encode_be(0x0100, 4, &mut out).unwrap();
+        assert_eq!(out, [0x12, 0x34, 0x56, 0x00, 0x00, 0x01, 0x00]);
+        assert!(encode_be(0x0100, 1, &mut out).is_err());
+        assert!(encode_be(0x00, 0, &mut out).is_err());
+
+        assert_eq!(
+            parse_max_block_len(&[0x74, 0x20, 0x0F, 0xFF]).unwrap(),
+            0x0FFF
+        );
+        assert_eq!(
+            parse_max_block_len(&[0x74, 0x50, 0x01, 0x00, 0x00, 0x00, 0x00]).unwrap(),
+            u32::MAX
+        );
+        assert!(parse_max_block_len(&[0x74, 0x20, 0x0F]).is_err());
+        assert!(parse_max_block_len(&[0x74, 0x00]).is_err());
+        assert!(check_block_ack(&[0x76, 0x01], 0x02).is_err());
+    }
+
+    #[cfg(feature = "simulation")]
+    #[test]
+    fn test_download_wraps_block_counter() {
+        use crate::hardware::simulation::{ResponseTime, SimulatedEcu, SimulatedRule};
+        use crate::uds::{test_iso_tp_settings, test_server_options, UdsVoidHandler};
+
+        let mut ecu = SimulatedEcu::new(ResponseTime::Fixed(Duration::ZERO), 1);
+        // 34 bytes per request, so 32 bytes of data per block
+        ecu.add_rule(SimulatedRule::new(
+            &[0x34, 0x00, 0x44, 0x00, 0x01, 0x00, 0x00],
+            &[0x74, 0x10, 0x22],
+        ));
+        for seq in 0..=0xFF {
+            ecu.add_rule(SimulatedRule::new(&[0x36, seq], &[0x76, seq]));
+        }
+        ecu.add_rule(SimulatedRule::new(&[0x37], &[0x77]));
+
+        let mut server = UdsDiagnosticServer::new_over_iso_tp(
+            test_server_options(),
+            ecu.clone(),
+            test_iso_tp_settings(),
+            UdsVoidHandler,
+        )
+        .unwrap();
+
+        // 257 blocks, the last of which is short
+        let image: Vec<u8> = (0..32 * 256 + 5).map(|i| i as u8).collect();
+        let mut calls = 0;
+        let progress = server
+            .download(
+                Arc::new(image),
+                DownloadOptions {
+                    memory_address: 0x0001_0000,
+                    ..Default::default()
+                },
+                |_| calls += 1,
+            )
+            .unwrap();
+        assert_eq!(progress.bytes_sent, 32 * 256 + 5);
+        assert_eq!(progress.total_bytes, progress.bytes_sent);
+        assert_eq!(progress.blocks_sent, 257);
+        assert!(calls >= 1);
+        // RequestDownload, every block and RequestTransferExit
+        assert_eq!(ecu.request_count(), 259);
+    }
+}
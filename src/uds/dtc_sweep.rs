@@ -0,0 +1,238 @@
+//! Reads DTCs from many ECUs at once
+//!
+//! Every [UdsDiagnosticServer] already runs its own background thread with its own
+//! ISO-TP channel, so the sweep submits the ReadDTCInformation requests of many servers
+//! asynchronously, and collects the responses as they complete. The ECUs therefore work on
+//! their responses at the same time, rather than one after another.
+
+use std::{
+    collections::{BTreeMap, VecDeque},
+    sync::mpsc,
+};
+
+use crate::{
+    dtc::{self, DTCFormatType, DTC},
+    DiagError, DiagServerResult,
+};
+
+use super::{
+    read_dtc_information::{dtc_records, parse_dtc_records},
+    DtcSubFunction, UDSCommand, UdsDiagnosticServer,
+};
+
+/// One ECU to read DTCs from during a sweep
+#[derive(Debug)]
+pub struct DtcSweepTarget<'a> {
+    /// Adapter the ECU's server communicates through. Only [DtcSweepOptions::max_in_flight_per_adapter]
+    /// targets with the same adapter are queried at any one time. This is only used to group
+    /// targets, so can be any value.
+    pub adapter: u32,
+    /// Server for the ECU
+    pub server: &'a mut UdsDiagnosticServer,
+}
+
+/// Settings for [sweep_dtcs]
+#[derive(Debug, Copy, Clone)]
+pub struct DtcSweepOptions {
+    /// DTC status mask to read DTCs by. 0xFF reads all DTCs
+    pub status_mask: u8,
+    /// Maximum number of ECUs to query at the same time on each adapter. 0 is treated as 1
+    pub max_in_flight_per_adapter: u32,
+}
+
+impl Default for DtcSweepOptions {
+    fn default() -> Self {
+        Self {
+            status_mask: 0xFF,
+            max_in_flight_per_adapter: 8,
+        }
+    }
+}
+
+/// DTC read during a sweep, along with the ECU it came from
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub struct SweepDtc {
+    /// Send ID of the ECU's server
+    pub send_id: u32,
+    /// Receive ID of the ECU's server
+    pub recv_id: u32,
+    /// The DTC
+    pub dtc: DTC,
+}
+
+/// Result of [sweep_dtcs]
+#[derive(Debug)]
+pub struct DtcSweepResult {
+    /// DTCs of every ECU that responded, grouped by ECU, in the order the ECUs responded
+    pub dtcs: Vec<SweepDtc>,
+    /// Result of each target, in the same order as the targets. On success, this is
+    /// the number of DTCs the ECU reported
+    pub ecu_results: Vec<DiagServerResult<usize>>,
+}
+
+/// Stage of a target's sweep that a response belongs to
+#[derive(Debug, Copy, Clone)]
+enum SweepStage {
+    Format,
+    Dtcs,
+}
+
+/// Response to one request of a sweep
+type SweepMsg = (usize, SweepStage, DiagServerResult<Vec<u8>>);
+
+/// Sends the result of a single request back to the sweep. If the server thread stops
+/// before running the request, the sweep is instead told that the server is not running
+struct SweepReply {
+    idx: usize,
+    stage: SweepStage,
+    tx: Option<mpsc::Sender<SweepMsg>>,
+}
+
+impl SweepReply {
+    fn send(mut self, res: DiagServerResult<Vec<u8>>) {
+        if let Some(tx) = self.tx.take() {
+            let _ = tx.send((self.idx, self.stage, res));
+        }
+    }
+}
+
+impl Drop for SweepReply {
+    fn drop(&mut self) {
+        if let Some(tx) = self.tx.take() {
+            let _ = tx.send((self.idx, self.stage, Err(DiagError::ServerNotRunning)));
+        }
+    }
+}
+
+/// Reads the DTCs of every target concurrently.
+///
+/// Each target's DTCs are read as with [UdsDiagnosticServer::get_dtcs_by_status_mask],
+/// except that failed requests are not retried. A failing ECU does not stop the sweep,
+/// its error is reported in [DtcSweepResult::ecu_results] instead.
+/// Targets are started in the order given, up to the adapter's concurrency limit.
+pub fn sweep_dtcs(targets: &mut [DtcSweepTarget<'_>], options: DtcSweepOptions) -> DtcSweepResult {
+    let status_mask = options.status_mask;
+    let limit = options.max_in_flight_per_adapter.max(1);
+
+    let mut ecu_results: Vec<DiagServerResult<usize>> = Vec::with_capacity(targets.len());
+    ecu_results.resize_with(targets.len(), || Ok(0));
+    let mut formats: Vec<Option<DTCFormatType>> =
+        targets.iter().map(|t| t.server.dtc_format).collect();
+    let mut dtcs = Vec::new();
+
+    // Targets which have not been started yet, per adapter
+    let mut queues: BTreeMap<u32, (u32, VecDeque<usize>)> = BTreeMap::new();
+    for (idx, t) in targets.iter().enumerate() {
+        queues.entry(t.adapter).or_default().1.push_back(idx);
+    }
+
+    let (tx, rx) = mpsc::channel();
+    let mut in_flight = 0usize;
+
+    loop {
+        // Top up every adapter to its limit
+        for (running, queue) in queues.values_mut() {
+            while *running < limit {
+                let idx = match queue.pop_front() {
+                    Some(i) => i,
+                    None => break,
+                };
+                match submit(
+                    targets[idx].server,
+                    idx,
+                    status_mask,
+                    formats[idx].is_none(),
+                    &tx,
+                ) {
+                    Ok(_) => {
+                        *running += 1;
+                        in_flight += 1;
+                    }
+                    Err(e) => ecu_results[idx] = Err(e),
+                }
+            }
+        }
+        if in_flight == 0 {
+            break;
+        }
+
+        // Requests of a server complete in order, so the format always arrives before the DTCs
+        let (idx, stage, res) = match rx.recv() {
+            Ok(r) => r,
+            Err(_) => break, // Cannot happen, we hold a sender
+        };
+        match stage {
+            SweepStage::Format => {
+                // Note the ECU might not support this command, in which case return 0 as format specifier
+                let fmt = match res {
+                    Ok(resp) if resp.len() == 6 => Some(dtc::dtc_format_from_uds(resp[3])),
+                    // The ECU answered, it just cannot tell us. Don't ask again
+                    Ok(_) | Err(DiagError::ECUError { .. }) => Some(DTCFormatType::Unknown(0)),
+                    Err(_) => None,
+                };
+                if fmt.is_some() {
+                    targets[idx].server.dtc_format = fmt;
+                    formats[idx] = fmt;
+                }
+            }
+            SweepStage::Dtcs => {
+                in_flight -= 1;
+                if let Some((running, _)) = queues.get_mut(&targets[idx].adapter) {
+                    *running -= 1;
+                }
+                let fmt = formats[idx].unwrap_or(DTCFormatType::Unknown(0));
+                let settings = targets[idx].server.get_settings();
+                ecu_results[idx] = res.and_then(|resp| {
+                    let records = dtc_records(&resp)?;
+                    let found = parse_dtc_records(records, fmt);
+                    let count = found.len();
+                    dtcs.extend(found.into_iter().map(|dtc| SweepDtc {
+                        send_id: settings.send_id,
+                        recv_id: settings.recv_id,
+                        dtc,
+                    }));
+                    Ok(count)
+                });
+            }
+        }
+    }
+
+    DtcSweepResult { dtcs, ecu_results }
+}
+
+/// Queues the requests of one target on its server
+fn submit(
+    server: &mut UdsDiagnosticServer,
+    idx: usize,
+    status_mask: u8,
+    read_format: bool,
+    tx: &mpsc::Sender<SweepMsg>,
+) -> DiagServerResult<()> {
+    if read_format {
+        let reply = SweepReply {
+            idx,
+            stage: SweepStage::Format,
+            tx: Some(tx.clone()),
+        };
+        server.execute_command_async(
+            UDSCommand::ReadDTCInformation,
+            &[
+                DtcSubFunction::ReportNumberOfDTCByStatusMask as u8,
+                status_mask,
+            ],
+            true,
+            move |res| reply.send(res),
+        )?;
+    }
+    let reply = SweepReply {
+        idx,
+        stage: SweepStage::Dtcs,
+        tx: Some(tx.clone()),
+    };
+    server.execute_command_async(
+        UDSCommand::ReadDTCInformation,
+        &[DtcSubFunction::ReportDTCByStatusMask as u8, status_mask],
+        true,
+        move |res| reply.send(res),
+    )
+}
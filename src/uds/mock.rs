@@ -42,6 +42,8 @@ impl MockUdsServer {
             global_tp_id: 0x00,
             tester_present_interval_ms: 2000,
             tester_present_require_response: true,
+            p2_star_timeout_ms: 5000,
+            busy_repeat_delay_ms: 500,
         };
 
         let isotp_settings = IsoTPSettings {
@@ -51,6 +53,8 @@ impl MockUdsServer {
             pad_frame: true,
             can_speed: 500_000,
             can_use_ext_addr: false,
+            can_fd: false,
+            can_fd_brs: false,
         };
 
         let server = UdsDiagnosticServer::new_over_iso_tp(server_options, channel.clone(), isotp_settings, UdsMockLogger{}).unwrap();
@@ -8,11 +8,17 @@ use std::{
         atomic::{AtomicBool, Ordering},
         mpsc, Arc,
     },
-    time::Instant,
+    thread::JoinHandle,
+    time::{Duration, Instant},
 };
 
+use self::data_transfer::TransferJob;
+use self::periodic_data::PeriodicSink;
 use crate::{
-    channel::IsoTPChannel, channel::IsoTPSettings, dtc::DTCFormatType, helpers, BaseServerPayload,
+    channel::ChannelResult, channel::IsoTPChannel, channel::IsoTPSettings, dtc::DTCFormatType,
+    helpers, helpers::ResponseTiming, keep_alive::KeepAliveMember, keep_alive::KeepAliveScheduler,
+    keep_alive::KEEP_ALIVE_PAYLOAD, metrics::ServerMetrics, response_cache::CacheLookup,
+    response_cache::CachePolicy, response_cache::ResponseCache, BaseServerPayload,
     BaseServerSettings, DiagError, DiagServerResult, DiagnosticServer, ServerEvent,
     ServerEventHandler,
 };
@@ -20,8 +26,11 @@ use crate::{
 mod access_timing_parameter;
 mod clear_diagnostic_information;
 mod communication_control;
+mod data_transfer;
 mod diagnostic_session_control;
+mod dtc_sweep;
 mod ecu_reset;
+mod periodic_data;
 mod read_dtc_information;
 mod scaling_data;
 mod security_access;
@@ -29,8 +38,11 @@ mod security_access;
 pub use access_timing_parameter::*;
 pub use clear_diagnostic_information::*;
 pub use communication_control::*;
+pub use data_transfer::*;
 pub use diagnostic_session_control::*;
+pub use dtc_sweep::*;
 pub use ecu_reset::*;
+pub use periodic_data::*;
 pub use read_dtc_information::*;
 pub use scaling_data::*;
 pub use security_access::*;
@@ -193,9 +205,9 @@ pub enum UDSError {
     /// The ECU has detected the reprogramming error as the blockSequenceCounter is incorrect.
     WrongBlockSequenceCounter,
     /// The ECU has accepted the request, but cannot reply right now. If this error occurs,
-    /// the [UdsDiagnosticServer] will automatically stop sending tester present messages and
-    /// will wait for the ECUs response. If after 2000ms, the ECU did not respond, then this error
-    /// will get returned back to the function call.
+    /// the [UdsDiagnosticServer] will keep sending tester present messages and
+    /// will wait for the ECUs response. If the ECU did not respond within [UdsServerOptions::p2_star_timeout_ms],
+    /// then this error will get returned back to the function call.
     RequestCorrectlyReceivedResponsePending,
     /// The sub function is not supported in the current diagnostic session mode
     SubFunctionNotSupportedInActiveSession,
@@ -307,7 +319,8 @@ pub struct UdsServerOptions {
     pub send_id: u32,
     /// ECU Receive ID
     pub recv_id: u32,
-    /// Read timeout in ms
+    /// Read timeout in ms. This is how long the server waits for the ECU's first
+    /// response to a request (P2)
     pub read_timeout_ms: u32,
     /// Write timeout in ms
     pub write_timeout_ms: u32,
@@ -318,6 +331,12 @@ pub struct UdsServerOptions {
     pub tester_present_interval_ms: u32,
     /// Configures if the diagnostic server will poll for a response from tester present.
     pub tester_present_require_response: bool,
+    /// Maximum time in ms to wait for the ECU's next response, after it has responded with
+    /// [UDSError::RequestCorrectlyReceivedResponsePending] (P2*). The UDS default is 5000ms
+    pub p2_star_timeout_ms: u32,
+    /// Time in ms to wait before repeating a request that the ECU rejected with
+    /// [UDSError::BusyRepeatRequest]
+    pub busy_repeat_delay_ms: u32,
 }
 
 impl BaseServerSettings for UdsServerOptions {
@@ -399,16 +418,361 @@ impl ServerEventHandler<UDSSessionType> for UdsVoidHandler {
     fn on_event(&mut self, _e: ServerEvent<UDSSessionType>) {}
 }
 
+/// Request sent from [UdsDiagnosticServer] to its background thread
+enum UdsServerRequest {
+    /// Single command
+    Single(UdsCmd),
+    /// Batch of commands, executed in order without returning to the client in between
+    Batch {
+        cmds: Vec<UdsCmd>,
+        defer_tester_present: bool,
+    },
+    /// Single command, whose result is handed to `on_complete` on the server thread
+    /// rather than being sent back to the client
+    Async {
+        cmd: UdsCmd,
+        on_complete: UdsCompletionFn,
+    },
+    /// ReadDataByPeriodicIdentifier command. If `sink` is set, the server starts capturing
+    /// periodic data into it, otherwise any active capture is stopped
+    Periodic {
+        cmd: UdsCmd,
+        sink: Option<PeriodicSink>,
+    },
+    /// TransferData blocks of a download, whose progress is sent back to the client by the job itself
+    Transfer(TransferJob),
+    /// Joins (Or with `None`, leaves) a bus wide keep-alive scheduler
+    KeepAlive(Option<KeepAliveMember>),
+}
+
+impl UdsServerRequest {
+    /// Fails a request the server thread stopped before running. Only asynchronous
+    /// requests have anybody left to tell, as blocking requests hold the server whilst queued
+    fn abandon(self) {
+        if let UdsServerRequest::Async { on_complete, .. } = self {
+            on_complete(Err(DiagError::ServerNotRunning));
+        }
+    }
+}
+
+/// Longest time the server waits on the channel for periodic data, before checking for new commands
+const PERIODIC_POLL_MS: u32 = 2;
+
+/// Most periodic messages the server reads in one go, before checking for new commands
+const PERIODIC_DRAIN_MAX: usize = 32;
+
+/// Completion function of an asynchronous request
+type UdsCompletionFn = Box<dyn FnOnce(DiagServerResult<Vec<u8>>) + Send>;
+
+/// Response sent from the background thread back to [UdsDiagnosticServer]
+enum UdsServerResponse {
+    /// Result of [UdsServerRequest::Single]
+    Single(DiagServerResult<Vec<u8>>),
+    /// Results of [UdsServerRequest::Batch], in the same order as the commands
+    Batch(Vec<DiagServerResult<Vec<u8>>>),
+}
+
+/// State owned by the UDS server's background thread
+struct UdsServerState<C, E> {
+    settings: UdsServerOptions,
+    channel: C,
+    event_handler: E,
+    send_tester_present: bool,
+    last_tester_present_time: Instant,
+    metrics: Arc<ServerMetrics>,
+    /// Set whilst periodic data identifiers are being streamed
+    periodic: Option<PeriodicSink>,
+    /// Set whilst keep-alives are shared with the other servers on the bus
+    keep_alive: Option<KeepAliveMember>,
+}
+
+/// Work the UDS server does whilst waiting on the ECU
+struct UdsWaitHooks<'a, E> {
+    settings: &'a UdsServerOptions,
+    send_tester_present: bool,
+    last_tester_present_time: &'a mut Instant,
+    event_handler: &'a mut E,
+    periodic: Option<&'a PeriodicSink>,
+    keep_alive: Option<&'a KeepAliveMember>,
+}
+
+impl<'a, C, E> helpers::WaitHooks<C> for UdsWaitHooks<'a, E>
+where
+    C: IsoTPChannel,
+    E: ServerEventHandler<UDSSessionType>,
+{
+    fn on_idle(&mut self, channel: &mut C) -> Option<Instant> {
+        let settings = self.settings;
+        if let Some(member) = self.keep_alive {
+            // Nothing else to do whilst the ECU is making us wait, so keep the whole bus alive
+            if member.claim() {
+                if let Err(e) = channel.write_bytes(
+                    member.functional_id(),
+                    &KEEP_ALIVE_PAYLOAD,
+                    settings.write_timeout_ms,
+                ) {
+                    self.event_handler
+                        .on_event(ServerEvent::TesterPresentError(e.into()))
+                }
+            }
+            return member.deadline();
+        }
+        // Keep the session alive whilst the ECU is making us wait
+        if !self.send_tester_present {
+            return None;
+        }
+        if self.last_tester_present_time.elapsed().as_millis() as u32
+            >= settings.tester_present_interval_ms
+        {
+            let addr = match settings.global_tp_id {
+                0 => settings.send_id,
+                x => x,
+            };
+            // Suppress the positive response, so that it cannot be mistaken for
+            // the response we are waiting on
+            if let Err(e) = channel.write_bytes(addr, &[0x3E, 0x80], settings.write_timeout_ms) {
+                self.event_handler
+                    .on_event(ServerEvent::TesterPresentError(e.into()))
+            }
+            *self.last_tester_present_time = Instant::now();
+        }
+        helpers::tester_present_deadline(
+            true,
+            *self.last_tester_present_time,
+            settings.tester_present_interval_ms,
+        )
+    }
+
+    fn on_unsolicited(&mut self, target: u8, payload: &[u8]) -> bool {
+        match self.periodic {
+            Some(sink) => sink.capture(Some(target), payload),
+            None => false,
+        }
+    }
+
+    fn clear_rx(&mut self, channel: &mut C) -> ChannelResult<()> {
+        let sink = match self.periodic {
+            Some(s) => s,
+            None => return channel.clear_rx_buffer(),
+        };
+        // Clearing the buffer would throw away periodic data, so only discard everything else.
+        // Bounded, so that a chatty ECU cannot hold up the request
+        for _ in 0..PERIODIC_DRAIN_MAX {
+            match channel.read_bytes(0) {
+                Ok(payload) => {
+                    if !sink.capture(None, &payload) {
+                        log::debug!("Discarding stale message from ECU: {:02X?}", payload);
+                    }
+                }
+                Err(_) => break,
+            }
+        }
+        Ok(())
+    }
+}
+
+impl<C, E> UdsServerState<C, E>
+where
+    C: IsoTPChannel,
+    E: ServerEventHandler<UDSSessionType>,
+{
+    /// Executes a command on the ECU, keeping track of any session change it causes.
+    /// `queue_wait` is how long the command was waiting to be executed.
+    fn run_cmd(&mut self, cmd: &UdsCmd, queue_wait: Duration) -> DiagServerResult<Vec<u8>> {
+        self.event_handler
+            .on_event(ServerEvent::Request(cmd.to_bytes()));
+        self.metrics.record_request(queue_wait);
+        let settings = self.settings;
+        let timing = ResponseTiming {
+            p2_star_ms: settings.p2_star_timeout_ms,
+            busy_repeat_ms: settings.busy_repeat_delay_ms,
+        };
+        let metrics = self.metrics.clone();
+        let (channel, mut hooks) = self.channel_and_hooks();
+        let res = helpers::perform_cmd_with_timing(
+            settings.send_id,
+            cmd,
+            &settings,
+            channel,
+            0x21,
+            lookup_uds_nrc,
+            timing,
+            Some(&*metrics),
+            &mut hooks,
+        );
+        if let Some(member) = &self.keep_alive {
+            member.record_traffic();
+        }
+        if cmd.get_uds_sid() == UDSCommand::DiagnosticSessionControl {
+            // Session change! Set server session type
+            if res.is_ok() {
+                if cmd.bytes.get(1) == Some(&u8::from(UDSSessionType::Default)) {
+                    // Default session, disable tester present
+                    self.send_tester_present = false;
+                } else {
+                    // Enable tester present and refresh the delay
+                    self.send_tester_present = true;
+                    self.last_tester_present_time = Instant::now();
+                }
+                if let Some(member) = &self.keep_alive {
+                    member.set_active(self.send_tester_present);
+                }
+            }
+        } else {
+            self.event_handler.on_event(ServerEvent::Response(&res));
+        }
+        res
+    }
+
+    /// Splits the state into the channel, and the hooks to run whilst waiting on the ECU
+    fn channel_and_hooks(&mut self) -> (&mut C, UdsWaitHooks<'_, E>) {
+        (
+            &mut self.channel,
+            UdsWaitHooks {
+                settings: &self.settings,
+                send_tester_present: self.send_tester_present,
+                last_tester_present_time: &mut self.last_tester_present_time,
+                event_handler: &mut self.event_handler,
+                periodic: self.periodic.as_ref(),
+                keep_alive: self.keep_alive.as_ref(),
+            },
+        )
+    }
+
+    /// Reads periodic data identifiers from the channel into the active stream, waiting
+    /// up to `timeout_ms` for the first one, then only taking what has already arrived
+    fn capture_periodic(&mut self, timeout_ms: u32) {
+        let sink = match self.periodic.as_ref() {
+            Some(s) => s,
+            None => return,
+        };
+        let mut timeout_ms = timeout_ms;
+        // Bounded, so that a chatty ECU cannot hold up commands
+        for _ in 0..PERIODIC_DRAIN_MAX {
+            let payload = match self.channel.read_bytes(timeout_ms) {
+                Ok(p) => p,
+                Err(_) => break,
+            };
+            if !sink.capture(None, &payload) {
+                log::warn!("Discarding unexpected message from ECU: {:02X?}", payload);
+            }
+            timeout_ms = 0;
+        }
+    }
+
+    /// Returns when the next tester present message is due, if tester present is active
+    fn tester_present_deadline(&self) -> Option<Instant> {
+        if let Some(member) = &self.keep_alive {
+            return member.deadline();
+        }
+        helpers::tester_present_deadline(
+            self.send_tester_present,
+            self.last_tester_present_time,
+            self.settings.tester_present_interval_ms,
+        )
+    }
+
+    /// Sends a tester present message to the ECU if one is due. Does nothing whilst keep-alives
+    /// are shared with the bus, as those are only sent by idle servers
+    fn tester_present_if_due(&mut self) {
+        if self.keep_alive.is_none()
+            && self.send_tester_present
+            && self.last_tester_present_time.elapsed().as_millis() as u32
+                >= self.settings.tester_present_interval_ms
+        {
+            // Send tester present message
+            let cmd = UdsCmd::new(UDSCommand::TesterPresent, &[0x00], true);
+            let settings = self.settings;
+            let addr = match settings.global_tp_id {
+                0 => settings.send_id,
+                x => x,
+            };
+
+            // Periodic data arriving whilst waiting on the response is still captured
+            let (channel, mut hooks) = self.channel_and_hooks();
+            if let Err(e) = helpers::perform_cmd_with_timing(
+                addr,
+                &cmd,
+                &settings,
+                channel,
+                0x21,
+                lookup_uds_nrc,
+                ResponseTiming::default(),
+                None,
+                &mut hooks,
+            ) {
+                self.event_handler
+                    .on_event(ServerEvent::TesterPresentError(e))
+            }
+            self.last_tester_present_time = Instant::now();
+        }
+    }
+
+    /// Sends the bus wide keep-alive if it is due, and no other server has sent it yet.
+    /// Only called once the server has no queued requests
+    fn keep_alive_if_due(&mut self) {
+        let member = match &self.keep_alive {
+            Some(m) => m,
+            None => return,
+        };
+        if member.claim() {
+            if let Err(e) = self.channel.write_bytes(
+                member.functional_id(),
+                &KEEP_ALIVE_PAYLOAD,
+                self.settings.write_timeout_ms,
+            ) {
+                self.event_handler
+                    .on_event(ServerEvent::TesterPresentError(e.into()))
+            }
+        }
+    }
+}
+
 #[derive(Debug)]
 /// UDS Diagnostic server
 pub struct UdsDiagnosticServer {
     server_running: Arc<AtomicBool>,
     settings: UdsServerOptions,
-    tx: mpsc::Sender<UdsCmd>,
-    rx: mpsc::Receiver<DiagServerResult<Vec<u8>>>,
+    tx: mpsc::Sender<(Instant, UdsServerRequest)>,
+    rx: mpsc::Receiver<UdsServerResponse>,
+    metrics: Arc<ServerMetrics>,
     repeat_count: u32,
-    repeat_interval: std::time::Duration,
+    repeat_interval: Duration,
     dtc_format: Option<DTCFormatType>, // Used as a cache
+    response_cache: ResponseCache,
+    worker: Option<JoinHandle<()>>,
+}
+
+/// Default [ResponseCache] policy of [UdsDiagnosticServer].
+///
+/// Caches reads of a single identification data identifier (0xF180-0xF19F, such as
+/// software versions, part numbers and the VIN). The cache is cleared by session changes,
+/// ECU resets, writes and downloads
+pub const UDS_CACHE_POLICY: CachePolicy = CachePolicy {
+    cacheable: uds_cacheable,
+    invalidates: uds_invalidates,
+};
+
+fn uds_cacheable(req: &[u8]) -> bool {
+    match req {
+        [sid, hi, lo] if UDSCommand::from(*sid) == UDSCommand::ReadDataByIdentifier => {
+            matches!(u16::from_be_bytes([*hi, *lo]), 0xF180..=0xF19F)
+        }
+        _ => false,
+    }
+}
+
+fn uds_invalidates(req: &[u8]) -> bool {
+    matches!(
+        req.first().copied().map(UDSCommand::from),
+        Some(
+            UDSCommand::DiagnosticSessionControl
+                | UDSCommand::ECUReset
+                | UDSCommand::WriteDataByIdentifier
+                | UDSCommand::WriteMemoryByAddress
+                | UDSCommand::RequestDownload
+        )
+    )
 }
 
 impl UdsDiagnosticServer {
@@ -427,7 +791,7 @@ impl UdsDiagnosticServer {
         settings: UdsServerOptions,
         mut server_channel: C,
         channel_cfg: IsoTPSettings,
-        mut event_handler: E,
+        event_handler: E,
     ) -> DiagServerResult<Self>
     where
         C: IsoTPChannel + 'static,
@@ -440,116 +804,147 @@ impl UdsDiagnosticServer {
         let is_running = Arc::new(AtomicBool::new(true));
         let is_running_t = is_running.clone();
 
-        let (tx_cmd, rx_cmd) = mpsc::channel::<UdsCmd>();
-        let (tx_res, rx_res) = mpsc::channel::<DiagServerResult<Vec<u8>>>();
+        let (tx_cmd, rx_cmd) = mpsc::channel::<(Instant, UdsServerRequest)>();
+        let metrics = Arc::new(ServerMetrics::default());
+        let metrics_t = metrics.clone();
+        let (tx_res, rx_res) = mpsc::channel::<UdsServerResponse>();
 
-        std::thread::spawn(move || {
-            let mut send_tester_present = false;
-            let mut last_tester_present_time: Instant = Instant::now();
+        let worker = std::thread::spawn(move || {
+            let mut state = UdsServerState {
+                settings,
+                channel: server_channel,
+                event_handler,
+                send_tester_present: false,
+                last_tester_present_time: Instant::now(),
+                metrics: metrics_t,
+                periodic: None,
+                keep_alive: None,
+            };
 
-            event_handler.on_event(ServerEvent::ServerStart);
+            state.event_handler.on_event(ServerEvent::ServerStart);
 
             loop {
                 if !is_running_t.load(Ordering::Relaxed) {
                     break;
                 }
 
-                if let Ok(cmd) = rx_cmd.try_recv() {
-                    event_handler.on_event(ServerEvent::Request(cmd.to_bytes()));
+                // Sleep until either a command arrives, or tester present is due.
+                // Whilst streaming, only check for commands, and instead wait on the channel
+                let deadline = match state.periodic {
+                    Some(_) => Some(Instant::now()),
+                    None => state.tester_present_deadline(),
+                };
+                let next_cmd = match helpers::wait_for_cmd(&rx_cmd, deadline) {
+                    Ok(c) => c,
+                    Err(_) => {
+                        // Client side of the server has been dropped
+                        break;
+                    }
+                };
+                if !is_running_t.load(Ordering::Relaxed) {
+                    // Stopped whilst waiting, the command is failed along with the rest of the queue
+                    if let Some((_, req)) = next_cmd {
+                        req.abandon();
+                    }
+                    break;
+                }
+
+                if state.periodic.is_some() {
+                    // Take whatever has already arrived before running a command, otherwise
+                    // wait a little while for more periodic data
+                    let timeout = match (&next_cmd, state.tester_present_deadline()) {
+                        (Some(_), _) => 0,
+                        (None, Some(tp)) => {
+                            (tp.saturating_duration_since(Instant::now()).as_millis() as u32)
+                                .min(PERIODIC_POLL_MS)
+                        }
+                        (None, None) => PERIODIC_POLL_MS,
+                    };
+                    state.capture_periodic(timeout);
+                }
+
+                let idle = next_cmd.is_none();
+                if let Some((queued_at, req)) = next_cmd {
                     // We have an incoming command
-                    if cmd.get_uds_sid() == UDSCommand::DiagnosticSessionControl {
-                        // Session change! Handle this differently
-                        match helpers::perform_cmd(
-                            settings.send_id,
-                            &cmd,
-                            &settings,
-                            &mut server_channel,
-                            0x21,
-                            lookup_uds_nrc,
-                        ) {
-                            // 0x78 - Response correctly received, response pending
-                            Ok(res) => {
-                                // Set server session type
-                                if cmd.bytes[1] == u8::from(UDSSessionType::Default) {
-                                    // Default session, disable tester present
-                                    send_tester_present = false;
-                                } else {
-                                    // Enable tester present and refresh the delay
-                                    send_tester_present = true;
-                                    last_tester_present_time = Instant::now();
-                                }
-                                // Send response to client
-                                if tx_res.send(Ok(res)).is_err() {
-                                    // Terminate! Something has gone wrong and data can no longer be sent to client
-                                    is_running_t.store(false, Ordering::Relaxed);
-                                    event_handler.on_event(ServerEvent::CriticalError {
-                                        desc: "Channel Tx SendError occurred".into(),
-                                    })
+                    let queue_wait = queued_at.elapsed();
+                    let resp = match req {
+                        UdsServerRequest::Single(cmd) => {
+                            Some(UdsServerResponse::Single(state.run_cmd(&cmd, queue_wait)))
+                        }
+                        UdsServerRequest::Batch {
+                            cmds,
+                            defer_tester_present,
+                        } => {
+                            let mut results = Vec::with_capacity(cmds.len());
+                            for (idx, cmd) in cmds.iter().enumerate() {
+                                if !defer_tester_present {
+                                    state.tester_present_if_due();
                                 }
+                                // Only the first command of a batch waited in the queue
+                                let wait = if idx == 0 { queue_wait } else { Duration::ZERO };
+                                results.push(state.run_cmd(cmd, wait));
                             }
-                            Err(e) => {
-                                if tx_res.send(Err(e)).is_err() {
-                                    // Terminate! Something has gone wrong and data can no longer be sent to client
-                                    is_running_t.store(false, Ordering::Relaxed);
-                                    event_handler.on_event(ServerEvent::CriticalError {
-                                        desc: "Channel Tx SendError occurred".into(),
-                                    })
-                                }
+                            Some(UdsServerResponse::Batch(results))
+                        }
+                        UdsServerRequest::Periodic { cmd, sink } => {
+                            // Start capturing before the ECU is asked to start sending,
+                            // and stop capturing once it has been asked to stop
+                            let starting = sink.is_some();
+                            if starting {
+                                state.periodic = sink;
                             }
+                            let res = state.run_cmd(&cmd, queue_wait);
+                            if res.is_err() || !starting {
+                                state.periodic = None;
+                            }
+                            Some(UdsServerResponse::Single(res))
+                        }
+                        UdsServerRequest::Async { cmd, on_complete } => {
+                            // Nothing to send back to the client
+                            on_complete(state.run_cmd(&cmd, queue_wait));
+                            None
                         }
-                    } else {
-                        // Generic command just perform it
-                        let res = helpers::perform_cmd(
-                            settings.send_id,
-                            &cmd,
-                            &settings,
-                            &mut server_channel,
-                            0x21,
-                            lookup_uds_nrc,
-                        );
-                        event_handler.on_event(ServerEvent::Response(&res));
-                        //event_handler.on_event(&res);
-                        if tx_res.send(res).is_err() {
+                        UdsServerRequest::Transfer(job) => {
+                            state.run_transfer(job, queue_wait);
+                            None
+                        }
+                        UdsServerRequest::KeepAlive(member) => {
+                            if let Some(m) = &member {
+                                m.set_active(state.send_tester_present);
+                            }
+                            state.keep_alive = member;
+                            Some(UdsServerResponse::Single(Ok(Vec::new())))
+                        }
+                    };
+                    // Send response to client
+                    if let Some(resp) = resp {
+                        if tx_res.send(resp).is_err() {
                             // Terminate! Something has gone wrong and data can no longer be sent to client
                             is_running_t.store(false, Ordering::Relaxed);
-                            event_handler.on_event(ServerEvent::CriticalError {
+                            state.event_handler.on_event(ServerEvent::CriticalError {
                                 desc: "Channel Tx SendError occurred".into(),
                             })
                         }
                     }
                 }
 
-                // Deal with tester present
-                if send_tester_present
-                    && last_tester_present_time.elapsed().as_millis() as u32
-                        >= settings.tester_present_interval_ms
-                {
-                    // Send tester present message
-                    let cmd = UdsCmd::new(UDSCommand::TesterPresent, &[0x00], true);
-                    let addr = match settings.global_tp_id {
-                        0 => settings.send_id,
-                        x => x,
-                    };
-
-                    if let Err(e) = helpers::perform_cmd(
-                        addr,
-                        &cmd,
-                        &settings,
-                        &mut server_channel,
-                        0x21,
-                        lookup_uds_nrc,
-                    ) {
-                        event_handler.on_event(ServerEvent::TesterPresentError(e))
-                    }
-                    last_tester_present_time = Instant::now();
+                // Deal with tester present. The bus wide keep-alive is only sent once no request
+                // is queued, so after a request, the next loop checks for queued requests first
+                if idle {
+                    state.keep_alive_if_due();
                 }
-
-                std::thread::sleep(std::time::Duration::from_millis(10));
+                state.tester_present_if_due();
+            }
+            // Every asynchronous request still queued gets its one completion
+            while let Ok((_, req)) = rx_cmd.try_recv() {
+                req.abandon();
             }
             // Goodbye server
-            event_handler.on_event(ServerEvent::ServerExit);
-            if let Err(e) = server_channel.close() {
-                event_handler.on_event(ServerEvent::InterfaceCloseOnExitError(e))
+            state.event_handler.on_event(ServerEvent::ServerExit);
+            if let Err(e) = state.channel.close() {
+                state
+                    .event_handler
+                    .on_event(ServerEvent::InterfaceCloseOnExitError(e))
             }
         });
 
@@ -557,10 +952,13 @@ impl UdsDiagnosticServer {
             server_running: is_running,
             tx: tx_cmd,
             rx: rx_res,
+            metrics,
             settings,
             repeat_count: 3,
-            repeat_interval: std::time::Duration::from_millis(1000),
+            repeat_interval: Duration::from_millis(1000),
             dtc_format: None,
+            response_cache: ResponseCache::new(UDS_CACHE_POLICY),
+            worker: Some(worker),
         })
     }
 
@@ -569,13 +967,133 @@ impl UdsDiagnosticServer {
         self.settings
     }
 
+    /// Returns the server's metrics. These stay valid (But stop updating) once the server
+    /// has been dropped, so can be handed to a separate monitoring thread.
+    pub fn get_metrics(&self) -> Arc<ServerMetrics> {
+        self.metrics.clone()
+    }
+
+    /// Returns the server's cache of identification responses
+    pub fn response_cache(&self) -> &ResponseCache {
+        &self.response_cache
+    }
+
+    /// Returns the server's cache of identification responses, for enabling or clearing it.
+    /// The cache is disabled by default
+    pub fn response_cache_mut(&mut self) -> &mut ResponseCache {
+        &mut self.response_cache
+    }
+
     /// Internal command for sending UDS payload to the ECU
     fn exec_command(&mut self, cmd: UdsCmd) -> DiagServerResult<Vec<u8>> {
-        match self.tx.send(cmd) {
-            Ok(_) => self.rx.recv().unwrap_or(Err(DiagError::ServerNotRunning)),
+        let key = match self.response_cache.lookup(&cmd) {
+            CacheLookup::Hit(resp) => return Ok(resp),
+            CacheLookup::Miss(key) => Some(key),
+            CacheLookup::Uncached => None,
+        };
+        let res = match self.send_request(UdsServerRequest::Single(cmd))? {
+            UdsServerResponse::Single(res) => res,
+            UdsServerResponse::Batch(_) => Err(DiagError::WrongMessage),
+        };
+        if let (Some(key), Ok(resp)) = (key, &res) {
+            self.response_cache.insert(key, resp);
+        }
+        res
+    }
+
+    /// Sends a request to the server thread, and waits for its response
+    fn send_request(&mut self, req: UdsServerRequest) -> DiagServerResult<UdsServerResponse> {
+        match self.tx.send((Instant::now(), req)) {
+            Ok(_) => self.rx.recv().map_err(|_| DiagError::ServerNotRunning),
             Err(_) => Err(DiagError::ServerNotRunning), // Server must have crashed!
         }
     }
+
+    /// Submits a command to the server, without waiting for the ECU to respond.
+    ///
+    /// Requests are executed in the order they are submitted, together with any blocking
+    /// requests. Once the request has completed, `on_complete` is called
+    /// **on the server's background thread** with the result. It should therefore return
+    /// quickly, as it holds up any other pending requests. Failed requests are not retried.
+    /// If the server is dropped before the request runs, `on_complete` is instead called
+    /// with [DiagError::ServerNotRunning].
+    ///
+    /// ## Parameters
+    /// * sid - The Service ID of the command
+    /// * args - The arguments for the service
+    /// * need_response - If false, no response is read from the ECU, and `on_complete` is
+    /// called with an empty response once the request has been sent
+    /// * on_complete - Function to call with the result of the request
+    pub fn execute_command_async<F>(
+        &mut self,
+        sid: UDSCommand,
+        args: &[u8],
+        need_response: bool,
+        on_complete: F,
+    ) -> DiagServerResult<()>
+    where
+        F: FnOnce(DiagServerResult<Vec<u8>>) + Send + 'static,
+    {
+        let cmd = UdsCmd::new(sid, args, need_response);
+        self.response_cache.invalidate_for(cmd.to_bytes());
+        self.tx
+            .send((
+                Instant::now(),
+                UdsServerRequest::Async {
+                    cmd,
+                    on_complete: Box::new(on_complete),
+                },
+            ))
+            .map_err(|_| DiagError::ServerNotRunning) // Server must have crashed!
+    }
+
+    /// Executes a batch of commands on the ECU, in order.
+    ///
+    /// The whole batch is handed to the server thread at once, so there is only one
+    /// round trip to the server thread, rather than one per command. Unlike
+    /// [DiagnosticServer::execute_command_with_response], failed commands are not retried.
+    ///
+    /// ## Parameters
+    /// * cmds - Commands to execute
+    /// * defer_tester_present - If true, the server will not send tester present messages
+    /// in between commands of the batch, only before or after it. Only use this if the batch
+    /// is known to complete within the ECUs session timeout.
+    ///
+    /// ## Returns
+    /// The result of each command, in the same order as `cmds`. An error is only returned
+    /// if the batch could not be handed to the server.
+    pub fn execute_batch(
+        &mut self,
+        cmds: Vec<UdsCmd>,
+        defer_tester_present: bool,
+    ) -> DiagServerResult<Vec<DiagServerResult<Vec<u8>>>> {
+        // Batches always go to the ECU, but can still change cached data
+        for cmd in &cmds {
+            self.response_cache.invalidate_for(cmd.to_bytes());
+        }
+        match self.send_request(UdsServerRequest::Batch {
+            cmds,
+            defer_tester_present,
+        })? {
+            UdsServerResponse::Batch(res) => Ok(res),
+            UdsServerResponse::Single(_) => Err(DiagError::WrongMessage),
+        }
+    }
+
+    /// Shares keep-alives with every other server on the same bus, see [crate::keep_alive].
+    ///
+    /// Whilst set, the server no longer sends its own tester present messages, so
+    /// `global_tp_id`, `tester_present_interval_ms` and `tester_present_require_response`
+    /// are ignored. Pass `None` to go back to sending tester present on its own
+    pub fn set_keep_alive_scheduler(
+        &mut self,
+        scheduler: Option<&KeepAliveScheduler>,
+    ) -> DiagServerResult<()> {
+        match self.send_request(UdsServerRequest::KeepAlive(scheduler.map(|s| s.join())))? {
+            UdsServerResponse::Single(res) => res.map(|_| ()),
+            UdsServerResponse::Batch(_) => Err(DiagError::WrongMessage),
+        }
+    }
 }
 
 impl DiagnosticServer<UDSCommand> for UdsDiagnosticServer {
@@ -640,7 +1158,7 @@ impl DiagnosticServer<UDSCommand> for UdsDiagnosticServer {
 
     /// Sets the command retry interval
     fn set_repeat_interval_count(&mut self, interval_ms: u32) {
-        self.repeat_interval = std::time::Duration::from_millis(interval_ms as u64)
+        self.repeat_interval = Duration::from_millis(interval_ms as u64)
     }
 
     /// Sends an arbitrary byte array to the ECU, and does not query response from the ECU
@@ -664,6 +1182,267 @@ pub fn get_description_of_ecu_error(error: u8) -> UDSError {
 
 impl Drop for UdsDiagnosticServer {
     fn drop(&mut self) {
-        self.server_running.store(false, Ordering::Relaxed); // Stop server
+        // Stop the server, waking its thread if it is waiting for a command
+        self.server_running.store(false, Ordering::Relaxed);
+        drop(std::mem::replace(&mut self.tx, mpsc::channel().0));
+        if let Some(worker) = self.worker.take() {
+            // A completion function may hold the last reference to the server,
+            // in which case the server is being dropped on its own thread
+            if worker.thread().id() != std::thread::current().id() {
+                let _ = worker.join();
+            }
+        }
+    }
+}
+
+#[cfg(all(test, feature = "simulation"))]
+/// Options of the server the tests run against a simulated ECU with
+fn test_server_options() -> UdsServerOptions {
+    UdsServerOptions {
+        send_id: 0x07E0,
+        recv_id: 0x07E8,
+        read_timeout_ms: 100,
+        write_timeout_ms: 100,
+        global_tp_id: 0x00,
+        tester_present_interval_ms: 2000,
+        tester_present_require_response: true,
+        p2_star_timeout_ms: 5000,
+        busy_repeat_delay_ms: 500,
+    }
+}
+
+#[cfg(all(test, feature = "simulation"))]
+/// ISO-TP settings for tests which send many frames, without any flow control or separation time
+fn test_iso_tp_settings() -> IsoTPSettings {
+    IsoTPSettings {
+        block_size: 0,
+        st_min: 0,
+        extended_addressing: false,
+        pad_frame: true,
+        can_speed: 0,
+        can_use_ext_addr: false,
+        can_fd: false,
+        can_fd_brs: false,
+    }
+}
+
+#[cfg(all(test, feature = "simulation"))]
+mod response_cache_test {
+    use super::*;
+    use crate::hardware::simulation::{ResponseTime, SimulatedEcu, SimulatedRule};
+
+    #[test]
+    fn test_cached_identification() {
+        let mut ecu = SimulatedEcu::new(ResponseTime::Fixed(Duration::ZERO), 1);
+        ecu.add_rule(SimulatedRule::new(
+            &[0x22, 0xF1, 0x90],
+            &[0x62, 0xF1, 0x90, b'W'],
+        ));
+        ecu.add_rule(SimulatedRule::new(&[0x11, 0x01], &[0x51, 0x01]));
+
+        let mut server = UdsDiagnosticServer::new_over_iso_tp(
+            test_server_options(),
+            ecu.clone(),
+            test_iso_tp_settings(),
+            UdsVoidHandler,
+        )
+        .unwrap();
+        server.response_cache_mut().set_enabled(true);
+
+        let vin = [0x62, 0xF1, 0x90, b'W'];
+        for _ in 0..3 {
+            let resp = server
+                .execute_command_with_response(UDSCommand::ReadDataByIdentifier, &[0xF1, 0x90])
+                .unwrap();
+            assert_eq!(resp, vin);
+        }
+        assert_eq!(ecu.request_count(), 1);
+        assert_eq!(server.response_cache().stats(), (2, 1));
+
+        // ECU reset clears the cache, so the next read goes to the ECU again
+        server
+            .execute_command_with_response(UDSCommand::ECUReset, &[0x01])
+            .unwrap();
+        assert!(server.response_cache().is_empty());
+        server
+            .execute_command_with_response(UDSCommand::ReadDataByIdentifier, &[0xF1, 0x90])
+            .unwrap();
+        assert_eq!(ecu.request_count(), 3);
+    }
+}
+
+#[cfg(all(test, feature = "simulation"))]
+mod async_drop_test {
+    use super::*;
+    use crate::hardware::simulation::{ResponseTime, SimulatedEcu, SimulatedRule};
+    use std::sync::atomic::AtomicUsize;
+
+    #[test]
+    fn test_drop_completes_queued_requests() {
+        let mut ecu = SimulatedEcu::new(ResponseTime::Fixed(Duration::from_millis(5)), 1);
+        ecu.add_rule(SimulatedRule::new(&[0x22, 0xF1, 0x90], &[0x62, 0xF1, 0x90]));
+
+        let mut server = UdsDiagnosticServer::new_over_iso_tp(
+            test_server_options(),
+            ecu,
+            IsoTPSettings::default(),
+            UdsVoidHandler,
+        )
+        .unwrap();
+
+        let completed = Arc::new(AtomicUsize::new(0));
+        for _ in 0..10 {
+            let completed = completed.clone();
+            server
+                .execute_command_async(
+                    UDSCommand::ReadDataByIdentifier,
+                    &[0xF1, 0x90],
+                    true,
+                    move |_| {
+                        completed.fetch_add(1, Ordering::Relaxed);
+                    },
+                )
+                .unwrap();
+        }
+        // Whatever the server has not run yet is failed, rather than never completing
+        drop(server);
+        assert_eq!(completed.load(Ordering::Relaxed), 10);
+    }
+}
+
+#[cfg(all(test, feature = "simulation"))]
+mod periodic_stream_test {
+    use super::*;
+    use crate::hardware::simulation::{ResponseTime, SimulatedEcu, SimulatedRule};
+
+    #[test]
+    fn test_periodic_data_around_requests() {
+        let mut ecu = SimulatedEcu::new(ResponseTime::Fixed(Duration::ZERO), 1);
+        ecu.add_rule(SimulatedRule::new(&[0x10, 0x03], &[0x50, 0x03]));
+        ecu.add_rule(SimulatedRule::new(&[0x2A], &[0x6A]));
+        ecu.add_rule(SimulatedRule::new(&[0x22, 0xF1, 0x91], &[0x62, 0xF1, 0x91]));
+        // Periodic data either side of a response, and just before a tester present response
+        ecu.add_rule(
+            SimulatedRule::new(&[0x22, 0xF1, 0x90], &[0x62, 0xF1, 0x90, b'W'])
+                .with_unsolicited(&[0x01, 0xB0], &[0x01, 0xB1]),
+        );
+        ecu.add_rule(
+            SimulatedRule::new(&[0x3E, 0x00], &[0x7E, 0x00]).with_unsolicited(&[0x01, 0xA0], &[]),
+        );
+
+        let mut server = UdsDiagnosticServer::new_over_iso_tp(
+            UdsServerOptions {
+                tester_present_interval_ms: 20,
+                ..test_server_options()
+            },
+            ecu,
+            IsoTPSettings::default(),
+            UdsVoidHandler,
+        )
+        .unwrap();
+        server
+            .execute_command_with_response(UDSCommand::DiagnosticSessionControl, &[0x03])
+            .unwrap();
+        let mut stream = server
+            .start_periodic_stream(PeriodicTransmissionMode::SendAtFastRate, &[0x01], 16)
+            .unwrap();
+
+        // Nothing runs in between the two reads, so the sample after the first response
+        // is still waiting on the channel when the second read is sent
+        let results = server
+            .execute_batch(
+                vec![
+                    UdsCmd::new(UDSCommand::ReadDataByIdentifier, &[0xF1, 0x90], true),
+                    UdsCmd::new(UDSCommand::ReadDataByIdentifier, &[0xF1, 0x91], true),
+                ],
+                true,
+            )
+            .unwrap();
+        assert_eq!(results[0].as_deref().unwrap(), &[0x62, 0xF1, 0x90, b'W']);
+        assert_eq!(results[1].as_deref().unwrap(), &[0x62, 0xF1, 0x91]);
+
+        let mut seen = Vec::new();
+        let mut out = [PeriodicSample::default(); 16];
+        let give_up = Instant::now() + Duration::from_secs(2);
+        while !seen.contains(&0xA0) && Instant::now() < give_up {
+            let count = stream.read(&mut out);
+            seen.extend(out[..count].iter().map(|s| s.get_data()[0]));
+            std::thread::sleep(Duration::from_millis(5));
+        }
+        server.stop_periodic_stream(&[]).unwrap();
+
+        assert_eq!(&seen[..2], &[0xB0, 0xB1]);
+        // Tester present keeps working alongside the stream
+        assert!(seen.contains(&0xA0));
+        assert_eq!(stream.dropped(), 0);
+    }
+}
+
+#[cfg(all(test, feature = "simulation"))]
+mod keep_alive_test {
+    use super::*;
+    use crate::hardware::simulation::{ResponseTime, SimulatedEcu, SimulatedRule};
+
+    #[test]
+    fn test_shared_keep_alive() {
+        let scheduler = KeepAliveScheduler::new(0x07DF, 20);
+        // One ECU per server, so each server's requests are counted separately
+        let ecus: Vec<SimulatedEcu> = (0..2)
+            .map(|_| {
+                let mut ecu = SimulatedEcu::new(ResponseTime::Fixed(Duration::ZERO), 1);
+                ecu.add_rule(SimulatedRule::new(&[0x10, 0x03], &[0x50, 0x03]));
+                ecu.add_rule(SimulatedRule::new(&[0x10, 0x01], &[0x50, 0x01]));
+                ecu
+            })
+            .collect();
+
+        let mut servers: Vec<UdsDiagnosticServer> = ecus
+            .iter()
+            .enumerate()
+            .map(|(i, ecu)| {
+                UdsDiagnosticServer::new_over_iso_tp(
+                    UdsServerOptions {
+                        send_id: 0x07E0 + i as u32,
+                        recv_id: 0x07E8 + i as u32,
+                        // Ignored once the scheduler is set
+                        tester_present_interval_ms: 5,
+                        ..test_server_options()
+                    },
+                    ecu.clone(),
+                    IsoTPSettings::default(),
+                    UdsVoidHandler,
+                )
+                .unwrap()
+            })
+            .collect();
+        for server in servers.iter_mut() {
+            server.set_keep_alive_scheduler(Some(&scheduler)).unwrap();
+            server
+                .execute_command_with_response(UDSCommand::DiagnosticSessionControl, &[0x03])
+                .unwrap();
+        }
+        assert_eq!(scheduler.active_sessions(), 2);
+
+        // Wait for the first keep-alive. The timeout only bounds a broken scheduler,
+        // how many keep-alives are sent before it does not matter
+        let give_up = Instant::now() + Duration::from_secs(10);
+        while scheduler.keep_alives_sent() == 0 {
+            assert!(Instant::now() < give_up, "No keep-alive sent");
+            std::thread::sleep(Duration::from_millis(1));
+        }
+        for server in servers.iter_mut() {
+            server
+                .execute_command_with_response(UDSCommand::DiagnosticSessionControl, &[0x01])
+                .unwrap();
+        }
+        assert_eq!(scheduler.active_sessions(), 0);
+        // Joins the workers, so a keep-alive claimed just before the last session ended has been sent
+        drop(servers);
+
+        // Each keep-alive is sent by one server for the whole bus, rather than one
+        // tester present per server, and servers never send their own tester present
+        let sent = scheduler.keep_alives_sent();
+        let requests: u64 = ecus.iter().map(|e| e.request_count()).sum();
+        assert_eq!(requests, 4 + sent);
     }
 }
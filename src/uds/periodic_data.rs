@@ -0,0 +1,305 @@
+//! Provides methods to stream data identifiers from the ECU periodically
+//! (ReadDataByPeriodicIdentifier)
+//!
+//! Once a stream is started, the ECU sends the requested periodic data identifiers
+//! at a fixed rate without being asked. The UDS server's background thread captures these
+//! into a ring buffer, which the client drains with [PeriodicDataStream::read].
+
+use std::{
+    cell::UnsafeCell,
+    sync::{
+        atomic::{AtomicU64, AtomicUsize, Ordering},
+        Arc,
+    },
+    time::Instant,
+};
+
+use crate::uds::{UDSCommand, UdsCmd, UdsDiagnosticServer, UdsServerRequest, UdsServerResponse};
+use crate::{DiagError, DiagServerResult};
+
+/// Maximum number of data bytes stored per periodic sample (Not including the periodic identifier)
+pub const PERIODIC_SAMPLE_MAX_LEN: usize = 62;
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq, PartialOrd, Ord)]
+#[repr(C)]
+/// Rate at which the ECU sends periodic data identifiers. The actual rates are defined by the ECU
+pub enum PeriodicTransmissionMode {
+    /// Send at the ECU's slow rate
+    SendAtSlowRate,
+    /// Send at the ECU's medium rate
+    SendAtMediumRate,
+    /// Send at the ECU's fast rate
+    SendAtFastRate,
+    /// Stop sending
+    StopSending,
+}
+
+impl From<PeriodicTransmissionMode> for u8 {
+    fn from(mode: PeriodicTransmissionMode) -> Self {
+        match mode {
+            PeriodicTransmissionMode::SendAtSlowRate => 0x01,
+            PeriodicTransmissionMode::SendAtMediumRate => 0x02,
+            PeriodicTransmissionMode::SendAtFastRate => 0x03,
+            PeriodicTransmissionMode::StopSending => 0x04,
+        }
+    }
+}
+
+#[derive(Debug, Copy, Clone)]
+#[repr(C)]
+/// One periodic data identifier sent by the ECU
+pub struct PeriodicSample {
+    /// Time the sample was received, in microseconds since the stream was started
+    pub timestamp_us: u64,
+    /// Periodic data identifier (The low byte of data identifier 0xF2xx)
+    pub periodic_id: u8,
+    /// Number of valid bytes in `data`
+    pub len: u8,
+    /// Sample data. Data longer than [PERIODIC_SAMPLE_MAX_LEN] is truncated
+    pub data: [u8; PERIODIC_SAMPLE_MAX_LEN],
+}
+
+impl Default for PeriodicSample {
+    fn default() -> Self {
+        Self {
+            timestamp_us: 0,
+            periodic_id: 0,
+            len: 0,
+            data: [0; PERIODIC_SAMPLE_MAX_LEN],
+        }
+    }
+}
+
+impl PeriodicSample {
+    /// Returns the valid portion of the sample's data
+    pub fn get_data(&self) -> &[u8] {
+        &self.data[..self.len as usize]
+    }
+}
+
+/// Lock free single producer, single consumer ring buffer of samples.
+///
+/// The server thread is the only producer, and [PeriodicDataStream] (Which cannot be cloned)
+/// is the only consumer.
+pub(crate) struct PeriodicRing {
+    slots: Box<[UnsafeCell<PeriodicSample>]>,
+    mask: usize,
+    /// Next slot to write. Only written by the producer
+    head: AtomicUsize,
+    /// Next slot to read. Only written by the consumer
+    tail: AtomicUsize,
+    dropped: AtomicU64,
+    epoch: Instant,
+}
+
+// Safety: Slots are only written by the producer before publishing them with `head`,
+// and only read by the consumer before releasing them with `tail`
+unsafe impl Sync for PeriodicRing {}
+
+impl std::fmt::Debug for PeriodicRing {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("PeriodicRing")
+            .field("capacity", &self.slots.len())
+            .field("len", &self.len())
+            .field("dropped", &self.dropped.load(Ordering::Relaxed))
+            .finish()
+    }
+}
+
+impl PeriodicRing {
+    /// Creates a ring which can hold at least `capacity` samples
+    pub(crate) fn new(capacity: usize) -> Self {
+        let capacity = capacity.max(2).next_power_of_two();
+        Self {
+            slots: (0..capacity)
+                .map(|_| UnsafeCell::new(PeriodicSample::default()))
+                .collect(),
+            mask: capacity - 1,
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+            dropped: AtomicU64::new(0),
+            epoch: Instant::now(),
+        }
+    }
+
+    fn len(&self) -> usize {
+        self.head
+            .load(Ordering::Acquire)
+            .wrapping_sub(self.tail.load(Ordering::Acquire))
+    }
+
+    /// Stores a periodic payload (Periodic ID followed by its data) received from the ECU.
+    /// If the ring is full, the sample is dropped. Must only be called by the producer
+    pub(crate) fn push(&self, payload: &[u8]) {
+        let head = self.head.load(Ordering::Relaxed);
+        let tail = self.tail.load(Ordering::Acquire);
+        if head.wrapping_sub(tail) == self.slots.len() {
+            self.dropped.fetch_add(1, Ordering::Relaxed);
+            return;
+        }
+        let data = &payload[1..];
+        let len = data.len().min(PERIODIC_SAMPLE_MAX_LEN);
+        // Safety: The consumer will not read this slot until head is published below
+        let slot = unsafe { &mut *self.slots[head & self.mask].get() };
+        slot.timestamp_us = self.epoch.elapsed().as_micros() as u64;
+        slot.periodic_id = payload[0];
+        slot.len = len as u8;
+        slot.data[..len].copy_from_slice(&data[..len]);
+        self.head.store(head.wrapping_add(1), Ordering::Release);
+    }
+
+    /// Moves as many samples as possible into `out`, returning how many were moved.
+    /// Must only be called by the consumer
+    fn pop_into(&self, out: &mut [PeriodicSample]) -> usize {
+        let tail = self.tail.load(Ordering::Relaxed);
+        let head = self.head.load(Ordering::Acquire);
+        let count = head.wrapping_sub(tail).min(out.len());
+        for (i, sample) in out[..count].iter_mut().enumerate() {
+            // Safety: The producer will not write this slot until tail is released below
+            *sample = unsafe { *self.slots[tail.wrapping_add(i) & self.mask].get() };
+        }
+        self.tail.store(tail.wrapping_add(count), Ordering::Release);
+        count
+    }
+}
+
+/// Where the server thread stores periodic data identifiers from the ECU
+#[derive(Debug, Clone)]
+pub(crate) struct PeriodicSink {
+    pub(crate) ring: Arc<PeriodicRing>,
+    pub(crate) ids: Vec<u8>,
+}
+
+impl PeriodicSink {
+    /// Returns true, and stores the payload if it is periodic data from the ECU rather than a
+    /// response to a request with SID `target` (If any)
+    pub(crate) fn capture(&self, target: Option<u8>, payload: &[u8]) -> bool {
+        match payload.first() {
+            // Responses to the request in progress take priority
+            Some(&0x7F) => false,
+            Some(&x) if Some(x.wrapping_sub(0x40)) == target => false,
+            Some(x) if self.ids.contains(x) => {
+                self.ring.push(payload);
+                true
+            }
+            _ => false,
+        }
+    }
+}
+
+#[derive(Debug)]
+/// Consumer of an active periodic data stream, created by [UdsDiagnosticServer::start_periodic_stream]
+pub struct PeriodicDataStream {
+    ring: Arc<PeriodicRing>,
+}
+
+impl PeriodicDataStream {
+    /// Moves as many buffered samples as will fit into `out`, oldest first,
+    /// returning how many were written. This never blocks.
+    pub fn read(&mut self, out: &mut [PeriodicSample]) -> usize {
+        self.ring.pop_into(out)
+    }
+
+    /// Returns the number of samples currently buffered
+    pub fn available(&self) -> usize {
+        self.ring.len()
+    }
+
+    /// Returns the number of samples that were discarded because the buffer was full
+    pub fn dropped(&self) -> u64 {
+        self.ring.dropped.load(Ordering::Relaxed)
+    }
+}
+
+impl UdsDiagnosticServer {
+    /// Asks the ECU to start sending periodic data identifiers, and starts capturing them.
+    ///
+    /// Only one stream can be active at a time. Starting a new stream stops the
+    /// previous stream's [PeriodicDataStream] from receiving samples.
+    ///
+    /// ## Parameters
+    /// * mode - Rate at which the ECU should send the identifiers
+    /// * periodic_ids - Periodic data identifiers to stream (The low byte of data identifier 0xF2xx)
+    /// * capacity - Minimum number of samples to buffer. Once the buffer is full, new samples are dropped
+    /// until the stream is read
+    pub fn start_periodic_stream(
+        &mut self,
+        mode: PeriodicTransmissionMode,
+        periodic_ids: &[u8],
+        capacity: usize,
+    ) -> DiagServerResult<PeriodicDataStream> {
+        if mode == PeriodicTransmissionMode::StopSending || periodic_ids.is_empty() {
+            return Err(DiagError::ParameterInvalid);
+        }
+        let mut args = Vec::with_capacity(periodic_ids.len() + 1);
+        args.push(u8::from(mode));
+        args.extend_from_slice(periodic_ids);
+
+        let sink = PeriodicSink {
+            ring: Arc::new(PeriodicRing::new(capacity)),
+            ids: periodic_ids.to_vec(),
+        };
+        let stream = PeriodicDataStream {
+            ring: sink.ring.clone(),
+        };
+        self.set_periodic_stream(
+            UdsCmd::new(UDSCommand::ReadDataByPeriodicIdentifier, &args, true),
+            Some(sink),
+        )?;
+        Ok(stream)
+    }
+
+    /// Asks the ECU to stop sending periodic data identifiers, and stops capturing them
+    ///
+    /// ## Parameters
+    /// * periodic_ids - Periodic data identifiers to stop. If empty, the ECU stops sending all of them
+    pub fn stop_periodic_stream(&mut self, periodic_ids: &[u8]) -> DiagServerResult<()> {
+        let mut args = Vec::with_capacity(periodic_ids.len() + 1);
+        args.push(u8::from(PeriodicTransmissionMode::StopSending));
+        args.extend_from_slice(periodic_ids);
+        self.set_periodic_stream(
+            UdsCmd::new(UDSCommand::ReadDataByPeriodicIdentifier, &args, true),
+            None,
+        )
+    }
+
+    fn set_periodic_stream(
+        &mut self,
+        cmd: UdsCmd,
+        sink: Option<PeriodicSink>,
+    ) -> DiagServerResult<()> {
+        match self.send_request(UdsServerRequest::Periodic { cmd, sink })? {
+            UdsServerResponse::Single(res) => res.map(|_| ()),
+            UdsServerResponse::Batch(_) => Err(DiagError::WrongMessage),
+        }
+    }
+}
+
+#[cfg(test)]
+mod periodic_test {
+    use super::*;
+
+    #[test]
+    fn test_ring_wraps_and_drops() {
+        let ring = Arc::new(PeriodicRing::new(3)); // Rounded up to 4
+        let mut stream = PeriodicDataStream { ring: ring.clone() };
+        let mut out = [PeriodicSample::default(); 8];
+
+        for i in 0..6u8 {
+            ring.push(&[0x01, i, i]);
+        }
+        assert_eq!(stream.available(), 4);
+        assert_eq!(stream.dropped(), 2);
+        assert_eq!(stream.read(&mut out[..3]), 3);
+        assert_eq!(out[0].get_data(), &[0, 0]);
+        assert_eq!(out[2].get_data(), &[2, 2]);
+
+        // Wrap around the end of the ring
+        ring.push(&[0x02, 0xAA]);
+        assert_eq!(stream.read(&mut out), 2);
+        assert_eq!(out[0].get_data(), &[3, 3]);
+        assert_eq!(out[1].periodic_id, 0x02);
+        assert_eq!(out[1].get_data(), &[0xAA]);
+        assert_eq!(stream.read(&mut out), 0);
+    }
+}
@@ -61,6 +61,59 @@ pub enum DtcSubFunction {
     ReportDTCWithPermanentStatus = 0x15,
 }
 
+/// Returns the 4 byte DTC and status records of a ReportDTCByStatusMask style response,
+/// without the SID, sub function and status availability mask
+pub(crate) fn dtc_records(resp: &[u8]) -> DiagServerResult<&[u8]> {
+    if resp.len() < 7 {
+        return Ok(&[]); // No errors
+    }
+    let records = &resp[3..];
+    if records.len() % 4 != 0 {
+        return Err(DiagError::InvalidResponseLength); // Each DTC should be 4 bytes!
+    }
+    Ok(records)
+}
+
+#[inline]
+fn decode_dtc_record(r: &[u8], fmt: DTCFormatType) -> DTC {
+    let status = r[3];
+    DTC {
+        format: fmt,
+        raw: (r[0] as u32) << 16 | (r[1] as u32) << 8 | r[2] as u32,
+        status: DTCStatus::Unknown(status), // TODO
+        mil_on: status & 0b10000000 != 0,
+        readiness_flag: false,
+    }
+}
+
+/// Decodes 4 byte DTC and status records (As sent by the ECU after the SID, sub function
+/// and status availability mask) straight into `out`, without allocating.
+///
+/// Any trailing incomplete record is ignored. `T` can be [DTC] itself,
+/// or any type that can be built from one.
+///
+/// ## Returns
+/// The number of DTCs written into `out`. This is less than the number of records if `out` is too small
+pub fn decode_dtc_records<T: From<DTC>>(
+    records: &[u8],
+    fmt: DTCFormatType,
+    out: &mut [T],
+) -> usize {
+    let count = (records.len() / 4).min(out.len());
+    for (dtc, r) in out[..count].iter_mut().zip(records.chunks_exact(4)) {
+        *dtc = T::from(decode_dtc_record(r, fmt));
+    }
+    count
+}
+
+/// Decodes 4 byte DTC and status records into a new list
+pub(crate) fn parse_dtc_records(records: &[u8], fmt: DTCFormatType) -> Vec<DTC> {
+    records
+        .chunks_exact(4)
+        .map(|r| decode_dtc_record(r, fmt))
+        .collect()
+}
+
 impl UdsDiagnosticServer {
     /// Returns the number of DTCs stored on the ECU
     /// matching the provided status_mask
@@ -97,45 +150,61 @@ impl UdsDiagnosticServer {
     /// Returns a list of DTCs stored on the ECU
     /// matching the provided status_mask
     pub fn get_dtcs_by_status_mask(&mut self, status_mask: u8) -> DiagServerResult<Vec<DTC>> {
-        let mut resp = self.execute_command_with_response(
+        let resp = self.execute_command_with_response(
             UDSCommand::ReadDTCInformation,
             &[DtcSubFunction::ReportDTCByStatusMask as u8, status_mask],
         )?;
-        if resp.len() < 7 {
+        let records = dtc_records(&resp)?;
+        if records.is_empty() {
             return Ok(vec![]); // No errors
         }
+        let fmt = self.get_cached_dtc_format(status_mask);
+        Ok(parse_dtc_records(records, fmt))
+    }
 
-        resp.drain(0..3);
-        if resp.len() % 4 != 0 {
-            return Err(DiagError::InvalidResponseLength); // Each DTC should be 4 bytes!
+    /// Reads the DTCs stored on the ECU matching the provided status_mask into `out`,
+    /// without building a list of them.
+    ///
+    /// ## Returns
+    /// The number of DTCs the ECU reported. If this is more than `out.len()`,
+    /// only the first `out.len()` DTCs were written
+    pub fn get_dtcs_by_status_mask_into<T: From<DTC>>(
+        &mut self,
+        status_mask: u8,
+        out: &mut [T],
+    ) -> DiagServerResult<usize> {
+        let resp = self.execute_command_with_response(
+            UDSCommand::ReadDTCInformation,
+            &[DtcSubFunction::ReportDTCByStatusMask as u8, status_mask],
+        )?;
+        let records = dtc_records(&resp)?;
+        if records.is_empty() {
+            return Ok(0); // No errors
         }
+        let fmt = self.get_cached_dtc_format(status_mask);
+        decode_dtc_records(records, fmt, out);
+        Ok(records.len() / 4)
+    }
 
-        // Now, see if we can query the ECU's DTC format
+    /// Returns the ECU's DTC format, only asking the ECU for it the first time
+    fn get_cached_dtc_format(&mut self, status_mask: u8) -> DTCFormatType {
+        if let Some(fmt) = self.dtc_format {
+            return fmt;
+        }
         // Note the ECU might not support this command, in which case return 0 as format specifier
-        let fmt = match self.dtc_format {
-            Some(s) => s,
-            None => self
-                .get_number_of_dtcs_by_status_mask(status_mask)
-                .map(|r| r.1)
-                .unwrap_or(DTCFormatType::Unknown(0)),
-        };
-        let mut result: Vec<DTC> = Vec::new();
-
-        for x in (0..resp.len()).step_by(4) {
-            let dtc_code: u32 =
-                (resp[x] as u32) << 16 | (resp[x + 1] as u32) << 8 | resp[x + 2] as u32;
-            let status = resp[x + 3];
-
-            result.push(DTC {
-                format: fmt,
-                raw: dtc_code,
-                status: DTCStatus::Unknown(status), // TODO
-                mil_on: status & 0b10000000 != 0,
-                readiness_flag: false,
-            })
+        match self.get_number_of_dtcs_by_status_mask(status_mask) {
+            Ok(r) => r.1,
+            Err(e) => {
+                // The ECU answered, it just cannot tell us. Don't ask again
+                if matches!(
+                    e,
+                    DiagError::ECUError { .. } | DiagError::InvalidResponseLength
+                ) {
+                    self.dtc_format = Some(DTCFormatType::Unknown(0));
+                }
+                DTCFormatType::Unknown(0)
+            }
         }
-
-        Ok(result)
     }
 
     /// Returns a list of DTCs out of the DTC mirror memory who's status_mask matches
@@ -144,47 +213,19 @@ impl UdsDiagnosticServer {
         &mut self,
         status_mask: u8,
     ) -> DiagServerResult<Vec<DTC>> {
-        let mut resp = self.execute_command_with_response(
+        let resp = self.execute_command_with_response(
             UDSCommand::ReadDTCInformation,
             &[
                 DtcSubFunction::ReportMirrorMemoryDTCByStatusMask as u8,
                 status_mask,
             ],
         )?;
-        if resp.len() < 7 {
+        let records = dtc_records(&resp)?;
+        if records.is_empty() {
             return Ok(vec![]); // No errors
         }
-
-        resp.drain(0..3);
-        if resp.len() % 4 != 0 {
-            return Err(DiagError::InvalidResponseLength); // Each DTC should be 4 bytes!
-        }
-
-        // Now, see if we can query the ECU's DTC format
-        // Note the ECU might not support this command, in which case return 0 as format specifier
-        let fmt = match self.dtc_format {
-            Some(s) => s,
-            None => self
-                .get_number_of_dtcs_by_status_mask(status_mask)
-                .map(|r| r.1)
-                .unwrap_or(DTCFormatType::Unknown(0)),
-        };
-        let mut result: Vec<DTC> = Vec::new();
-
-        for x in (0..resp.len()).step_by(4) {
-            let dtc_code: u32 =
-                (resp[x] as u32) << 16 | (resp[x + 1] as u32) << 8 | resp[x + 2] as u32;
-            let status = resp[x + 3];
-
-            result.push(DTC {
-                format: fmt,
-                raw: dtc_code,
-                status: DTCStatus::Unknown(status), // TODO
-                mil_on: status & 0b10000000 != 0,
-                readiness_flag: false,
-            })
-        }
-        Ok(result)
+        let fmt = self.get_cached_dtc_format(status_mask);
+        Ok(parse_dtc_records(records, fmt))
     }
 
     /// Returns the number of DTCs in DTC mirror memory who's status_mask matches
@@ -255,47 +296,19 @@ impl UdsDiagnosticServer {
         &mut self,
         status_mask: u8,
     ) -> DiagServerResult<Vec<DTC>> {
-        let mut resp = self.execute_command_with_response(
+        let resp = self.execute_command_with_response(
             UDSCommand::ReadDTCInformation,
             &[
                 DtcSubFunction::ReportEmissionsRelatedOBDDTCByStatusMask as u8,
                 status_mask,
             ],
         )?;
-        if resp.len() < 7 {
+        let records = dtc_records(&resp)?;
+        if records.is_empty() {
             return Ok(vec![]); // No errors
         }
-
-        resp.drain(0..3);
-        if resp.len() % 4 != 0 {
-            return Err(DiagError::InvalidResponseLength); // Each DTC should be 4 bytes!
-        }
-
-        // Now, see if we can query the ECU's DTC format
-        // Note the ECU might not support this command, in which case return 0 as format specifier
-        let fmt = match self.dtc_format {
-            Some(s) => s,
-            None => self
-                .get_number_of_dtcs_by_status_mask(status_mask)
-                .map(|r| r.1)
-                .unwrap_or(DTCFormatType::Unknown(0)),
-        };
-        let mut result: Vec<DTC> = Vec::new();
-
-        for x in (0..resp.len()).step_by(4) {
-            let dtc_code: u32 =
-                (resp[x] as u32) << 16 | (resp[x + 1] as u32) << 8 | resp[x + 2] as u32;
-            let status = resp[x + 3];
-
-            result.push(DTC {
-                format: fmt,
-                raw: dtc_code,
-                status: DTCStatus::Unknown(status), // TODO
-                mil_on: status & 0b10000000 != 0,
-                readiness_flag: false,
-            })
-        }
-        Ok(result)
+        let fmt = self.get_cached_dtc_format(status_mask);
+        Ok(parse_dtc_records(records, fmt))
     }
 
     ///
@@ -453,44 +466,16 @@ impl UdsDiagnosticServer {
 
     /// Returns a list of all DTCs that the ECU can return
     pub fn get_supported_dtc(&mut self) -> DiagServerResult<Vec<DTC>> {
-        let mut resp = self.execute_command_with_response(
+        let resp = self.execute_command_with_response(
             UDSCommand::ReadDTCInformation,
             &[DtcSubFunction::ReportSupportedDTC as u8],
         )?;
-        if resp.len() < 7 {
+        let records = dtc_records(&resp)?;
+        if records.is_empty() {
             return Ok(vec![]); // No errors
         }
-
-        resp.drain(0..3);
-        if resp.len() % 4 != 0 {
-            return Err(DiagError::InvalidResponseLength); // Each DTC should be 4 bytes!
-        }
-
-        // Now, see if we can query the ECU's DTC format
-        // Note the ECU might not support this command, in which case return 0 as format specifier
-        let fmt = match self.dtc_format {
-            Some(s) => s,
-            None => self
-                .get_number_of_dtcs_by_status_mask(0xFF)
-                .map(|r| r.1)
-                .unwrap_or(DTCFormatType::Unknown(0)),
-        };
-        let mut result: Vec<DTC> = Vec::new();
-
-        for x in (0..resp.len()).step_by(4) {
-            let dtc_code: u32 =
-                (resp[x] as u32) << 16 | (resp[x + 1] as u32) << 8 | resp[x + 2] as u32;
-            let status = resp[x + 3];
-
-            result.push(DTC {
-                format: fmt,
-                raw: dtc_code,
-                status: DTCStatus::Unknown(status), // TODO
-                mil_on: status & 0b10000000 != 0,
-                readiness_flag: false,
-            })
-        }
-        Ok(result)
+        let fmt = self.get_cached_dtc_format(0xFF);
+        Ok(parse_dtc_records(records, fmt))
     }
 
     /// Returns the first failed DTC to be detected since the last DTC clear operation
@@ -549,7 +534,7 @@ impl UdsDiagnosticServer {
     /// 1. (u32) - DTC Code
     /// 2. (u8) - Fault detection counter
     pub fn get_dtc_fault_detection_counter(&mut self) -> DiagServerResult<Vec<(u32, u8)>> {
-        let mut resp = self.execute_command_with_response(
+        let resp = self.execute_command_with_response(
             UDSCommand::ReadDTCInformation,
             &[DtcSubFunction::ReportDTCFaultDetectionCounter as u8],
         )?;
@@ -557,19 +542,15 @@ impl UdsDiagnosticServer {
             return Ok(vec![]); // No errors
         }
 
-        resp.drain(0..2);
-        if resp.len() % 4 != 0 {
+        let records = &resp[2..];
+        if records.len() % 4 != 0 {
             return Err(DiagError::InvalidResponseLength); // Each DTC should be 4 bytes!
         }
 
-        let mut result: Vec<(u32, u8)> = Vec::new();
-
-        for x in (0..resp.len()).step_by(4) {
-            let dtc_code: u32 =
-                (resp[x] as u32) << 16 | (resp[x + 1] as u32) << 8 | resp[x + 2] as u32;
-            result.push((dtc_code, resp[x + 3]))
-        }
-        Ok(result)
+        Ok(records
+            .chunks_exact(4)
+            .map(|r| ((r[0] as u32) << 16 | (r[1] as u32) << 8 | r[2] as u32, r[3]))
+            .collect())
     }
 
     /// Returns a list of DTCs that have a permanent status
@@ -584,3 +565,42 @@ impl UdsDiagnosticServer {
         )))
     }
 }
+
+#[cfg(test)]
+mod dtc_record_test {
+    use super::*;
+
+    #[test]
+    fn test_decode_dtc_records() {
+        let resp = [
+            0x59, 0x02, 0xFF, 0x12, 0x34, 0x56, 0x88, 0xAB, 0xCD, 0xEF, 0x01,
+        ];
+        let records = dtc_records(&resp).unwrap();
+        let mut out = [DTC {
+            format: DTCFormatType::Unknown(0),
+            raw: 0,
+            status: DTCStatus::None,
+            mil_on: false,
+            readiness_flag: false,
+        }; 4];
+        assert_eq!(
+            decode_dtc_records(records, DTCFormatType::Iso14229_1, &mut out),
+            2
+        );
+        assert_eq!(out[0].raw, 0x123456);
+        assert!(out[0].mil_on);
+        assert_eq!(out[1].raw, 0xABCDEF);
+        assert_eq!(out[1].status, DTCStatus::Unknown(0x01));
+        assert!(!out[1].mil_on);
+        assert_eq!(out[1].format, DTCFormatType::Iso14229_1);
+
+        // Output too small
+        assert_eq!(
+            decode_dtc_records(records, DTCFormatType::Iso14229_1, &mut out[..1]),
+            1
+        );
+        // Incomplete record
+        assert!(dtc_records(&resp[..10]).is_err());
+        assert!(dtc_records(&resp[..3]).unwrap().is_empty());
+    }
+}
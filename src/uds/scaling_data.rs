@@ -1,4 +1,7 @@
-///! Functions and data for ReadScalingDataById UDS Service
+//! Functions and data for ReadScalingDataById UDS Service
+
+use super::{UDSCommand, UdsDiagnosticServer};
+use crate::{DiagError, DiagServerResult, DiagnosticServer};
 
 #[derive(Debug, Copy, Clone, Ord, PartialOrd, Eq, PartialEq)]
 /// Scaling data byte extensions
@@ -233,7 +236,7 @@ pub enum ScalingByteHigh {
 
 impl From<u8> for ScalingByteHigh {
     fn from(x: u8) -> Self {
-        match x & 0xF0 {
+        match x >> 4 {
             0x00 => Self::UnsignedNumeric {
                 num_bytes: x & 0x0F,
             },
@@ -496,22 +499,357 @@ impl ScalingData {
     /// Returns a converted value from raw.
     /// If the conversion formula falls under VMS (Vehicle manufacture specific), then None is returned.
     pub fn get_mapping_from_raw(&self) -> Option<f32> {
-        let c0 = self.c0;
-        let c1 = self.c1;
-        let c2 = self.c2;
-        let x = self.x;
-        match self.mapping_byte {
-            0x00 => Some(c0 * x + c1),
-            0x01 => Some(c0 * (x + c1)),
-            0x02 => Some(c0 / (x + c1) + c2),
-            0x03 => Some(x / (c0 + c1)),
-            0x04 => Some((x + c0) / c1),
-            0x05 => Some((x + c0) / c1 + c2),
-            0x06 => Some(c0 * x),
-            0x07 => Some(x / c0),
-            0x08 => Some(x + c0),
-            0x09 => Some(x * c0 / c1),
-            _ => None, // VMS or reserved
+        ScalingFormula::compile(self.mapping_byte, [self.c0, self.c1, self.c2])
+            .map(|f| f.apply(self.x))
+    }
+}
+
+/// Conversion formula of a [ScalingByteHigh::Formula] scaling byte, reduced to the
+/// cheapest form that evaluates it
+#[derive(Debug, Copy, Clone, PartialEq)]
+pub enum ScalingFormula {
+    /// `y = scale * x + offset`. Every formula apart from 0x02 reduces to this
+    Linear {
+        /// Factor to multiply the raw value by
+        scale: f32,
+        /// Offset to add after scaling
+        offset: f32,
+    },
+    /// `y = c0 / (x + c1) + c2` (Formula 0x02)
+    Reciprocal {
+        /// Constant C0
+        c0: f32,
+        /// Constant C1
+        c1: f32,
+        /// Constant C2
+        c2: f32,
+    },
+}
+
+impl ScalingFormula {
+    /// Formula for values without a conversion formula, which leaves them as they are
+    pub const IDENTITY: Self = Self::Linear {
+        scale: 1.0,
+        offset: 0.0,
+    };
+
+    /// Compiles formula `id` with its constants C0, C1 and C2. Unused constants are ignored.
+    /// If the formula is vehicle manufacturer specific or reserved, then None is returned.
+    pub fn compile(id: u8, constants: [f32; 3]) -> Option<Self> {
+        let [c0, c1, c2] = constants;
+        let linear = |scale, offset| Self::Linear { scale, offset };
+        Some(match id {
+            0x00 => linear(c0, c1),
+            0x01 => linear(c0, c0 * c1),
+            0x02 => Self::Reciprocal { c0, c1, c2 },
+            0x03 => linear(1.0 / (c0 + c1), 0.0),
+            0x04 => linear(1.0 / c1, c0 / c1),
+            0x05 => linear(1.0 / c1, c0 / c1 + c2),
+            0x06 => linear(c0, 0.0),
+            0x07 => linear(1.0 / c0, 0.0),
+            0x08 => linear(1.0, c0),
+            0x09 => linear(c0 / c1, 0.0),
+            _ => return None, // VMS or reserved
+        })
+    }
+
+    /// Applies the formula to one raw value
+    pub fn apply(&self, x: f32) -> f32 {
+        match *self {
+            Self::Linear { scale, offset } => x * scale + offset,
+            Self::Reciprocal { c0, c1, c2 } => c0 / (x + c1) + c2,
+        }
+    }
+
+    /// Applies the formula to every value in `values`, in place
+    pub fn apply_in_place(&self, values: &mut [f32]) {
+        // Matching once keeps the loops branch free, which lets the compiler vectorize them
+        match *self {
+            Self::Linear { scale, offset } => {
+                values.iter_mut().for_each(|x| *x = *x * scale + offset)
+            }
+            Self::Reciprocal { c0, c1, c2 } => {
+                values.iter_mut().for_each(|x| *x = c0 / (*x + c1) + c2)
+            }
         }
     }
 }
+
+/// Decodes a formula constant. The upper 4 bits are a signed exponent, and the lower 12 bits
+/// a signed mantissa, so the constant is `mantissa * 10^exponent`
+fn decode_scaling_constant(hi: u8, lo: u8) -> f32 {
+    let raw = u16::from_be_bytes([hi, lo]);
+    let exponent = ((raw >> 12) as i8) << 4 >> 4;
+    let mantissa = ((raw & 0x0FFF) as i16) << 4 >> 4;
+    mantissa as f32 * 10f32.powi(exponent as i32)
+}
+
+/// Encoding of the raw values a [ScalingConverter] converts
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum ScalingValueType {
+    /// Big endian unsigned integer
+    Unsigned,
+    /// Big endian two's complement signed integer
+    Signed,
+    /// Big endian IEEE 754 floating point (4 or 8 bytes)
+    Float,
+}
+
+/// Converter for the live values of one data identifier, compiled once from its
+/// ReadScalingDataByIdentifier response.
+///
+/// Unlike [ScalingData], the scaling bytes are only parsed once, so whole buffers of
+/// raw samples can be converted in one call
+#[derive(Debug, Clone, PartialEq)]
+pub struct ScalingConverter {
+    did: u16,
+    value_type: ScalingValueType,
+    sample_len: usize,
+    formula: ScalingFormula,
+    units: Vec<ScalingByteExtension>,
+}
+
+impl ScalingConverter {
+    /// Compiles a positive ReadScalingDataByIdentifier response (Beginning with 0x64 and the data identifier).
+    ///
+    /// Only numeric values (Unsigned, signed and floating point) can be converted, any other
+    /// type of data returns [DiagError::NotImplemented], as do vehicle manufacturer specific formulas.
+    pub fn from_response(resp: &[u8]) -> DiagServerResult<Self> {
+        if resp.len() < 4 {
+            return Err(DiagError::InvalidResponseLength);
+        }
+        if resp[0] != u8::from(UDSCommand::ReadScalingDataByIdentifier) + 0x40 {
+            return Err(DiagError::WrongMessage);
+        }
+        let did = u16::from_be_bytes([resp[1], resp[2]]);
+        let mut value = None;
+        let mut formula = ScalingFormula::IDENTITY;
+        let mut units = Vec::new();
+
+        let mut pos = 3;
+        while pos < resp.len() {
+            let scaling_byte = resp[pos];
+            pos += 1;
+            let num_bytes = (scaling_byte & 0x0F) as usize;
+            match ScalingByteHigh::from(scaling_byte) {
+                ScalingByteHigh::UnsignedNumeric { .. } => {
+                    value = Some((ScalingValueType::Unsigned, num_bytes))
+                }
+                ScalingByteHigh::SignedNumeric { .. } => {
+                    value = Some((ScalingValueType::Signed, num_bytes))
+                }
+                ScalingByteHigh::SignedFloatingPoint => {
+                    value = Some((ScalingValueType::Float, num_bytes))
+                }
+                ScalingByteHigh::Formula => {
+                    let ext = resp
+                        .get(pos..pos + num_bytes)
+                        .filter(|e| !e.is_empty())
+                        .ok_or(DiagError::InvalidResponseLength)?;
+                    pos += num_bytes;
+                    let mut constants = [0.0; 3];
+                    for (c, b) in constants.iter_mut().zip(ext[1..].chunks_exact(2)) {
+                        *c = decode_scaling_constant(b[0], b[1]);
+                    }
+                    formula = ScalingFormula::compile(ext[0], constants).ok_or_else(|| {
+                        DiagError::NotImplemented(format!("Scaling formula 0x{:02X}", ext[0]))
+                    })?;
+                }
+                ScalingByteHigh::UnitOrFormat => {
+                    let ext = resp
+                        .get(pos..pos + num_bytes)
+                        .ok_or(DiagError::InvalidResponseLength)?;
+                    pos += num_bytes;
+                    units.extend(ext.iter().map(|b| ScalingByteExtension::from(*b)));
+                }
+                other => {
+                    return Err(DiagError::NotImplemented(format!(
+                        "Scaling of {:?} data",
+                        other
+                    )))
+                }
+            }
+        }
+
+        let (value_type, sample_len) = match value {
+            Some((ScalingValueType::Float, len)) if len != 4 && len != 8 => {
+                return Err(DiagError::NotImplemented(format!(
+                    "{} byte floating point",
+                    len
+                )))
+            }
+            Some((_, len)) if len == 0 || len > 8 => return Err(DiagError::InvalidResponseLength),
+            Some(v) => v,
+            None => {
+                return Err(DiagError::NotImplemented(
+                    "Scaling data without a numeric value".into(),
+                ))
+            }
+        };
+        Ok(Self {
+            did,
+            value_type,
+            sample_len,
+            formula,
+            units,
+        })
+    }
+
+    /// Returns the data identifier the converter was compiled for
+    pub fn data_identifier(&self) -> u16 {
+        self.did
+    }
+
+    /// Returns the encoding of the raw values
+    pub fn value_type(&self) -> ScalingValueType {
+        self.value_type
+    }
+
+    /// Returns the number of bytes of one raw value
+    pub fn sample_len(&self) -> usize {
+        self.sample_len
+    }
+
+    /// Returns the compiled formula
+    pub fn formula(&self) -> ScalingFormula {
+        self.formula
+    }
+
+    /// Returns the units and presentation formats of the converted values
+    pub fn units(&self) -> &[ScalingByteExtension] {
+        &self.units
+    }
+
+    /// Converts one raw value
+    pub fn convert(&self, raw: f32) -> f32 {
+        self.formula.apply(raw)
+    }
+
+    /// Converts raw values which have already been decoded into `out`.
+    ///
+    /// ## Returns
+    /// The number of values converted, which is the shorter of the two lengths
+    pub fn convert_batch(&self, raw: &[f32], out: &mut [f32]) -> usize {
+        let count = raw.len().min(out.len());
+        out[..count].copy_from_slice(&raw[..count]);
+        self.formula.apply_in_place(&mut out[..count]);
+        count
+    }
+
+    /// Decodes back to back raw samples of [ScalingConverter::sample_len] bytes each
+    /// (EG: The data of a periodic data identifier), and converts them into `out`.
+    /// Trailing bytes which do not make up a whole sample are ignored.
+    ///
+    /// ## Returns
+    /// The number of values converted
+    pub fn decode_batch(&self, data: &[u8], out: &mut [f32]) -> usize {
+        let count = (data.len() / self.sample_len).min(out.len());
+        let samples = data.chunks_exact(self.sample_len);
+        for (o, sample) in out[..count].iter_mut().zip(samples) {
+            *o = self.decode_raw(sample);
+        }
+        self.formula.apply_in_place(&mut out[..count]);
+        count
+    }
+
+    fn decode_raw(&self, sample: &[u8]) -> f32 {
+        let unsigned = || sample.iter().fold(0u64, |v, b| v << 8 | u64::from(*b));
+        match self.value_type {
+            ScalingValueType::Unsigned => unsigned() as f32,
+            ScalingValueType::Signed => {
+                let shift = 64 - 8 * sample.len() as u32;
+                ((unsigned() << shift) as i64 >> shift) as f32
+            }
+            ScalingValueType::Float => match sample.len() {
+                4 => f32::from_bits(unsigned() as u32),
+                _ => f64::from_bits(unsigned()) as f32,
+            },
+        }
+    }
+}
+
+impl UdsDiagnosticServer {
+    /// Reads the scaling data of a data identifier from the ECU (ReadScalingDataByIdentifier),
+    /// and compiles it into a [ScalingConverter] for the identifier's live values
+    ///
+    /// ## Parameters
+    /// * did - Data identifier to read the scaling data of
+    pub fn read_scaling_converter(&mut self, did: u16) -> DiagServerResult<ScalingConverter> {
+        let resp = self.execute_command_with_response(
+            UDSCommand::ReadScalingDataByIdentifier,
+            &did.to_be_bytes(),
+        )?;
+        let converter = ScalingConverter::from_response(&resp)?;
+        if converter.data_identifier() != did {
+            return Err(DiagError::MismatchedResponse(format!(
+                "Expected scaling data of 0x{:04X}, got 0x{:04X}",
+                did,
+                converter.data_identifier()
+            )));
+        }
+        Ok(converter)
+    }
+}
+
+#[cfg(test)]
+mod scaling_data_test {
+    use super::*;
+
+    #[test]
+    fn test_decode_constant() {
+        assert_eq!(decode_scaling_constant(0x00, 0x05), 5.0);
+        // Exponent -1, mantissa 25
+        assert_eq!(decode_scaling_constant(0xF0, 0x19), 2.5);
+        // Exponent 2, mantissa -1
+        assert_eq!(decode_scaling_constant(0x2F, 0xFF), -100.0);
+    }
+
+    #[test]
+    fn test_compiled_converter() {
+        // Signed 2 byte value, y = 0.1 * x - 40 in degrees Celsius
+        let resp = [
+            0x64, 0x01, 0x02, 0x12, 0x95, 0x00, 0xF0, 0x01, 0x0F, 0xD8, 0xA1, 0x17,
+        ];
+        let conv = ScalingConverter::from_response(&resp).unwrap();
+        assert_eq!(conv.data_identifier(), 0x0102);
+        assert_eq!(conv.value_type(), ScalingValueType::Signed);
+        assert_eq!(conv.sample_len(), 2);
+        assert_eq!(conv.units(), &[ScalingByteExtension::Celsius]);
+
+        let mut out = [0.0; 3];
+        // 400, 0 and -100
+        assert_eq!(
+            conv.decode_batch(&[0x01, 0x90, 0x00, 0x00, 0xFF, 0x9C, 0xAA], &mut out),
+            3
+        );
+        let expected = [0.0, -40.0, -50.0];
+        for (o, e) in out.iter().zip(expected) {
+            assert!((o - e).abs() < 1e-4, "{} != {}", o, e);
+        }
+        assert_eq!(conv.convert_batch(&[400.0, 0.0], &mut out), 2);
+        assert!(out[0].abs() < 1e-4);
+
+        // Same conversion as the uncompiled formula
+        let data = ScalingData::new(400, 1, 2, 0, 0x00, &[]);
+        assert_eq!(data.get_mapping_from_raw(), Some(402.0));
+    }
+
+    #[test]
+    fn test_unsupported_scaling() {
+        // ASCII value
+        assert!(matches!(
+            ScalingConverter::from_response(&[0x64, 0x01, 0x02, 0x61]),
+            Err(DiagError::NotImplemented(_))
+        ));
+        // VMS formula
+        assert!(matches!(
+            ScalingConverter::from_response(&[0x64, 0x01, 0x02, 0x01, 0x91, 0x80]),
+            Err(DiagError::NotImplemented(_))
+        ));
+        // Truncated formula
+        assert!(matches!(
+            ScalingConverter::from_response(&[0x64, 0x01, 0x02, 0x01, 0x95, 0x00]),
+            Err(DiagError::InvalidResponseLength)
+        ));
+    }
+}